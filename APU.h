@@ -0,0 +1,863 @@
+#ifndef APU_H
+#define APU_H
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#include "Scheduler.h"
+#include "Memory.h"
+#include "Timers.h"
+#include "DMA.h"
+
+/*
+* AUDIO RING:
+*   Single producer single consumer ring of signed 16 bit stereo frames between
+*   the emulator thread (write) and the frontend's audio callback (read). Like
+*   the render ring the head and tail are the only shared state, one writer
+*   each. It never blocks: a full ring drops what does not fit and counts it,
+*   an empty one hands back fewer frames than asked for.
+*/
+class AudioRing {
+    public:
+        //frames must be a power of two
+        AudioRing(uint32_t frames);
+        //frames written, the rest are dropped
+        uint32_t write(const int16_t* samples, uint32_t frames);
+        //frames read, at most what is available
+        uint32_t read(int16_t* samples, uint32_t frames);
+        uint32_t getAvailable();
+        uint64_t getDropped();
+    private:
+        std::vector<uint32_t> buffer;
+        uint32_t mask;
+        alignas(64) std::atomic<uint64_t> writePosition;
+        alignas(64) std::atomic<uint64_t> readPosition;
+        uint64_t dropped;
+};
+/*
+* RESAMPLER:
+*   Linear interpolation between two rates as a polyphase filter. For rates
+*   in:out reduced to inputStep:phases, output k of every group of phases
+*   always starts at the same input offset with the same pair of weights, so
+*   both are tabled once and the inner loop is two frame loads and a multiply
+*   add. A frame is a 32 bit L/R pair: interleaving frames n and n+1 gives
+*   (Ln Ln+1 Rn Rn+1) which pmaddwd against (wa wb wa wb) turns into (L R) in
+*   one instruction, 8 outputs at a time with AVX2 (gathered) or 4 with SSE2.
+*   Weights are 14 bit so the sums stay in 32 bits; the scalar path is the
+*   reference and gives the same result bit for bit.
+*/
+class Resampler {
+    public:
+        Resampler(uint32_t inputRate, uint32_t outputRate);
+        void reset();
+        //interleaved stereo in and out, returns frames written (at most frames * out / in + 2)
+        uint32_t process(const int16_t* in, uint32_t frames, int16_t* out);
+        void setScalar(bool scalar);
+    private:
+        uint32_t phases;
+        uint32_t inputStep;
+        std::vector<int32_t> phaseIndex;
+        std::vector<uint32_t> phaseWeights;
+        //input frames not used up yet, base is where phase 0 of the current group starts
+        std::vector<uint32_t> pending;
+        int32_t base;
+        uint32_t phase;
+        bool scalar;
+        uint32_t interpolate(uint32_t a, uint32_t b, uint32_t weights);
+};
+/*
+* APU:
+*   REGISTERS (offsets from 0x4000000):
+*       0x60 SOUND1CNT_L sweep           0x62 SOUND1CNT_H duty/length/envelope
+*       0x64 SOUND1CNT_X frequency/trigger
+*       0x68 SOUND2CNT_L duty/length/envelope  0x6C SOUND2CNT_H frequency/trigger
+*       0x70 SOUND3CNT_L wave bank/enable  0x72 SOUND3CNT_H length/volume
+*       0x74 SOUND3CNT_X frequency/trigger
+*       0x78 SOUND4CNT_L length/envelope  0x7C SOUND4CNT_H noise/trigger
+*       0x80 SOUNDCNT_L PSG master volume and L/R enables
+*       0x82 SOUNDCNT_H PSG ratio, FIFO volume, L/R enables, timer, reset
+*       0x84 SOUNDCNT_X master enable, channel status  0x88 SOUNDBIAS
+*       0x90 WAVE_RAM (the bank not playing)  0xA0 FIFO_A  0xA4 FIFO_B
+*   BATCHES:
+*       Nothing runs per cycle. Samples are made at the native 32768 Hz (one per
+*       512 cycles, the hardware's default resolution) whenever the APU catches
+*       up: on its AUDIO event every BATCH_SAMPLES samples, before any sound
+*       register write, and on sync(). The APU keeps its own copy of the
+*       registers it has acted on so a catch up draws the past with the old
+*       values. Each PSG channel then fills its whole batch in one tight loop,
+*       split only at the 512 Hz frame sequencer (length, sweep, envelope).
+*       The FIFOs pop on TM0/TM1 overflow (through the Timers overflow hook),
+*       which only logs (cycle, sample) and asks DMA for more below half full;
+*       the batch replays the log so every sample sees the FIFO value of its
+*       own cycle.
+*   MIXING:
+*       a batch is mixed in the hardware's 10 bit domain, PSG * master volume
+*       >> ratio + FIFO * 1 or 2 + bias, clamped to 0 -> 0x3FF and widened to
+*       signed 16 bit. That is all 16 bit multiplies, adds and clamps, 16
+*       samples at a time with AVX2 or 8 with SSE2 (mixScalar is the
+*       reference). The Resampler takes it to OUTPUT_RATE and the result goes
+*       to an AudioRing for the frontend to pull from.
+*/
+class APU {
+    public:
+        enum rates {CYCLES_PER_SAMPLE = 512, NATIVE_RATE = 16777216 / CYCLES_PER_SAMPLE, OUTPUT_RATE = 48000,
+            BATCH_SAMPLES = 64, MAX_BATCH = 256, OUTPUT_FRAMES = 1 << 14};
+        enum fifoAddresses {FIFO_A = 0x40000A0, FIFO_B = 0x40000A4};
+        APU(Scheduler* scheduler, Memory* memory, Timers* timers, DMA* dma);
+        void reset();
+        void mapRegisters();
+        //generate everything up to the current cycle
+        void sync();
+        //OUTPUT_RATE signed 16 bit stereo for the frontend to read
+        AudioRing* getOutput();
+        //native rate samples generated so far
+        uint64_t getSampleCount();
+        //SOUNDCNT_X bits 0 -> 3, which PSG channels are playing
+        uint8_t getChannelStatus();
+        //samples queued in FIFO A (0) or B (1)
+        uint32_t getFifoCount(uint8_t fifo);
+        //the final mix on its own with the current registers, so the SIMD path can be checked against the scalar one
+        void mix(const int16_t* psgLeft, const int16_t* psgRight, const int16_t* fifoA, const int16_t* fifoB,
+            uint32_t count, int16_t* out);
+        void mixScalar(const int16_t* psgLeft, const int16_t* psgRight, const int16_t* fifoA, const int16_t* fifoB,
+            uint32_t count, int16_t* out);
+        //use mixScalar and the scalar resampler
+        void setScalarMixing(bool scalar);
+    private:
+        enum {POP_LOG = 64};
+        struct Channel {
+            bool enabled;
+            uint8_t volume;
+            uint8_t envelopeTimer;
+            uint8_t sweepTimer;
+            uint16_t length;
+            //channel 1's frequency as the sweep moves it
+            uint16_t frequency;
+            uint16_t lfsr;
+            //cycles into the current step and the step (duty position, wave sample)
+            uint32_t timer;
+            uint32_t position;
+        };
+        struct Fifo {
+            int8_t samples[32];
+            uint8_t readIndex;
+            uint8_t count;
+            int8_t current;
+            //pops not yet replayed by a batch
+            uint64_t popCycles[POP_LOG];
+            int8_t popSamples[POP_LOG];
+            uint32_t pops;
+        };
+        Scheduler* scheduler;
+        Memory* memory;
+        DMA* dma;
+        Channel channels[4];
+        Fifo fifos[2];
+        uint8_t waveRam[2][16];
+        //0x4000060 -> 0x40000AF as last acted on
+        uint16_t registers[0x50 / 2];
+        uint8_t sequencerStep;
+        uint64_t samples;
+        bool scalarMixing;
+        int16_t psgLeft[MAX_BATCH];
+        int16_t psgRight[MAX_BATCH];
+        int16_t fifoSamples[2][MAX_BATCH];
+        int16_t mixed[MAX_BATCH * 2];
+        int16_t resampled[(MAX_BATCH * OUTPUT_RATE / NATIVE_RATE + 2) * 2];
+        Resampler resampler;
+        AudioRing output;
+        uint16_t register16(uint32_t offset);
+        void catchUp(uint64_t cycle);
+        void generate(uint32_t count);
+        void renderSquare(uint8_t index, int16_t* left, int16_t* right, uint32_t count);
+        void renderWave(int16_t* left, int16_t* right, uint32_t count);
+        void renderNoise(int16_t* left, int16_t* right, uint32_t count);
+        void replayFifo(uint8_t index, uint32_t count);
+        void clockSequencer();
+        void trigger(uint8_t index);
+        void pushFifo(uint8_t index, uint16_t value);
+        void popFifo(uint8_t index, uint64_t cycle);
+        static void audioEvent(void* context, uint64_t late);
+        static void timerOverflow(void* context, uint8_t index, uint64_t cycle);
+        static uint16_t ioRead(void* context, uint32_t address);
+        static void ioWrite(void* context, uint32_t address, uint16_t value);
+    public:
+        //the sound hardware for save states, saveState syncs first so nothing is left
+        //in the pop logs; the resampler and output ring belong to the frontend side
+        struct State {
+            Channel channels[4];
+            Fifo fifos[2];
+            uint8_t waveRam[2][16];
+            uint16_t registers[0x50 / 2];
+            uint8_t sequencerStep;
+            uint64_t samples;
+        };
+        void saveState(State* state);
+        void loadState(const State* state);
+};
+/*
+* BEGIN AUDIO RING METHODS
+*/
+inline AudioRing::AudioRing(uint32_t frames) : buffer(frames){
+    this->mask = frames - 1;
+    this->dropped = 0;
+    writePosition.store(0);
+    readPosition.store(0);
+}
+inline uint32_t AudioRing::write(const int16_t* samples, uint32_t frames){
+    uint64_t position = writePosition.load(std::memory_order_relaxed);
+    uint64_t used = position - readPosition.load(std::memory_order_acquire);
+    uint32_t room = buffer.size() - used;
+    uint32_t count = frames < room ? frames : room;
+    dropped += frames - count;
+    uint32_t start = position & mask;
+    uint32_t first = count < buffer.size() - start ? count : buffer.size() - start;
+    memcpy(&buffer[start], samples, first * 4);
+    memcpy(&buffer[0], samples + first * 2, (count - first) * 4);
+    writePosition.store(position + count, std::memory_order_release);
+    return count;
+}
+inline uint32_t AudioRing::read(int16_t* samples, uint32_t frames){
+    uint64_t position = readPosition.load(std::memory_order_relaxed);
+    uint64_t available = writePosition.load(std::memory_order_acquire) - position;
+    uint32_t count = frames < available ? frames : available;
+    uint32_t start = position & mask;
+    uint32_t first = count < buffer.size() - start ? count : buffer.size() - start;
+    memcpy(samples, &buffer[start], first * 4);
+    memcpy(samples + first * 2, &buffer[0], (count - first) * 4);
+    readPosition.store(position + count, std::memory_order_release);
+    return count;
+}
+inline uint32_t AudioRing::getAvailable(){
+    return writePosition.load(std::memory_order_acquire) - readPosition.load(std::memory_order_acquire);
+}
+inline uint64_t AudioRing::getDropped(){
+    return dropped;
+}
+/*
+* BEGIN RESAMPLER METHODS
+*/
+inline Resampler::Resampler(uint32_t inputRate, uint32_t outputRate){
+    uint32_t a = inputRate;
+    uint32_t b = outputRate;
+    while (b){
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    this->phases = outputRate / a;
+    this->inputStep = inputRate / a;
+    this->scalar = false;
+    phaseIndex.resize(phases);
+    phaseWeights.resize(phases);
+    for (uint32_t k = 0; k < phases; k++){
+        uint64_t position = (uint64_t)k * inputStep;
+        uint32_t weight = ((position % phases) * 16384 + phases / 2) / phases;
+        phaseIndex[k] = position / phases;
+        phaseWeights[k] = (16384 - weight) | (weight << 16);
+    }
+    reset();
+}
+inline void Resampler::reset(){
+    pending.clear();
+    base = 0;
+    phase = 0;
+}
+inline void Resampler::setScalar(bool scalar){
+    this->scalar = scalar;
+}
+inline uint32_t Resampler::interpolate(uint32_t a, uint32_t b, uint32_t weights){
+    int32_t wa = weights & 0xFFFF;
+    int32_t wb = weights >> 16;
+    int32_t left = ((int16_t)a * wa + (int16_t)b * wb + 8192) >> 14;
+    int32_t right = ((int16_t)(a >> 16) * wa + (int16_t)(b >> 16) * wb + 8192) >> 14;
+    return (uint16_t)left | ((uint32_t)(uint16_t)right << 16);
+}
+inline uint32_t Resampler::process(const int16_t* in, uint32_t frames, int16_t* out){
+    size_t old = pending.size();
+    pending.resize(old + frames);
+    memcpy(&pending[old], in, frames * 4);
+    const uint32_t* source = pending.data();
+    int32_t available = pending.size();
+    uint32_t produced = 0;
+    while (true){
+#ifdef __AVX2__
+        if (!scalar && phase + 8 <= phases && base + phaseIndex[phase + 7] + 1 < available){
+            __m256i index = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)&phaseIndex[phase]), _mm256_set1_epi32(base));
+            __m256i a = _mm256_i32gather_epi32((const int*)source, index, 4);
+            __m256i b = _mm256_i32gather_epi32((const int*)source + 1, index, 4);
+            __m256i w = _mm256_loadu_si256((const __m256i*)&phaseWeights[phase]);
+            const __m256i round = _mm256_set1_epi32(8192);
+            //frames 0 1 | 4 5 and 2 3 | 6 7, the lane wise pack puts them back in order
+            __m256i low = _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), _mm256_unpacklo_epi32(w, w));
+            __m256i high = _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), _mm256_unpackhi_epi32(w, w));
+            low = _mm256_srai_epi32(_mm256_add_epi32(low, round), 14);
+            high = _mm256_srai_epi32(_mm256_add_epi32(high, round), 14);
+            _mm256_storeu_si256((__m256i*)(out + produced * 2), _mm256_packs_epi32(low, high));
+            phase += 8;
+            produced += 8;
+        } else
+#elif defined(__SSE2__)
+        if (!scalar && phase + 4 <= phases && base + phaseIndex[phase + 3] + 1 < available){
+            const int32_t* index = &phaseIndex[phase];
+            __m128i a = _mm_set_epi32(source[base + index[3]], source[base + index[2]], source[base + index[1]], source[base + index[0]]);
+            __m128i b = _mm_set_epi32(source[base + index[3] + 1], source[base + index[2] + 1], source[base + index[1] + 1], source[base + index[0] + 1]);
+            __m128i w = _mm_loadu_si128((const __m128i*)&phaseWeights[phase]);
+            const __m128i round = _mm_set1_epi32(8192);
+            __m128i low = _mm_madd_epi16(_mm_unpacklo_epi16(a, b), _mm_unpacklo_epi32(w, w));
+            __m128i high = _mm_madd_epi16(_mm_unpackhi_epi16(a, b), _mm_unpackhi_epi32(w, w));
+            low = _mm_srai_epi32(_mm_add_epi32(low, round), 14);
+            high = _mm_srai_epi32(_mm_add_epi32(high, round), 14);
+            _mm_storeu_si128((__m128i*)(out + produced * 2), _mm_packs_epi32(low, high));
+            phase += 4;
+            produced += 4;
+        } else
+#endif
+        if (base + phaseIndex[phase] + 1 < available){
+            int32_t index = base + phaseIndex[phase];
+            uint32_t frame = interpolate(source[index], source[index + 1], phaseWeights[phase]);
+            memcpy(out + produced * 2, &frame, 4);
+            phase++;
+            produced++;
+        } else {
+            break;
+        }
+        if (phase == phases){
+            phase = 0;
+            base += inputStep;
+        }
+    }
+    //keep from the next frame needed on
+    int32_t used = base + phaseIndex[phase];
+    pending.erase(pending.begin(), pending.begin() + used);
+    base -= used;
+    return produced;
+}
+/*
+* BEGIN APU METHODS
+*/
+inline APU::APU(Scheduler* scheduler, Memory* memory, Timers* timers, DMA* dma) :
+    resampler(NATIVE_RATE, OUTPUT_RATE), output(OUTPUT_FRAMES){
+    this->scheduler = scheduler;
+    this->memory = memory;
+    this->dma = dma;
+    this->scalarMixing = false;
+    scheduler->setHandler(Scheduler::AUDIO, &APU::audioEvent, this);
+    timers->setOverflowHandler(&APU::timerOverflow, this);
+    reset();
+}
+inline void APU::reset(){
+    memset(channels, 0, sizeof(channels));
+    memset(fifos, 0, sizeof(fifos));
+    memset(waveRam, 0, sizeof(waveRam));
+    memset(registers, 0, sizeof(registers));
+    //SOUNDBIAS comes out of the BIOS at 0x200
+    registers[(0x88 - 0x60) / 2] = 0x200;
+    sequencerStep = 0;
+    samples = (scheduler->getCycles() + CYCLES_PER_SAMPLE - 1) / CYCLES_PER_SAMPLE;
+    resampler.reset();
+    scheduler->schedule(Scheduler::AUDIO, (samples + BATCH_SAMPLES) * CYCLES_PER_SAMPLE);
+}
+inline void APU::mapRegisters(){
+    memory->setIORegister(0x4000088, 0x200);
+    for (uint32_t address = 0x4000060; address < 0x40000A8; address += 2){
+        bool readable = address == 0x4000084 || (address >= 0x4000090 && address < 0x40000A0);
+        memory->setIOHandler(address, readable ? &APU::ioRead : 0, &APU::ioWrite, this);
+    }
+}
+inline uint16_t APU::register16(uint32_t offset){
+    return registers[(offset - 0x60) / 2];
+}
+inline void APU::sync(){
+    catchUp(scheduler->getCycles());
+}
+inline AudioRing* APU::getOutput(){
+    return &output;
+}
+inline uint64_t APU::getSampleCount(){
+    return samples;
+}
+inline uint8_t APU::getChannelStatus(){
+    sync();
+    uint8_t status = 0;
+    for (uint8_t i = 0; i < 4; i++){
+        status |= channels[i].enabled << i;
+    }
+    return status;
+}
+inline void APU::saveState(State* state){
+    sync();
+    memcpy(state->channels, channels, sizeof(channels));
+    memcpy(state->fifos, fifos, sizeof(fifos));
+    memcpy(state->waveRam, waveRam, sizeof(waveRam));
+    memcpy(state->registers, registers, sizeof(registers));
+    state->sequencerStep = sequencerStep;
+    state->samples = samples;
+}
+inline void APU::loadState(const State* state){
+    memcpy(channels, state->channels, sizeof(channels));
+    memcpy(fifos, state->fifos, sizeof(fifos));
+    memcpy(waveRam, state->waveRam, sizeof(waveRam));
+    memcpy(registers, state->registers, sizeof(registers));
+    sequencerStep = state->sequencerStep;
+    samples = state->samples;
+    //the output jumps anyway, start interpolating afresh
+    resampler.reset();
+}
+inline uint32_t APU::getFifoCount(uint8_t fifo){
+    return fifos[fifo].count;
+}
+inline void APU::setScalarMixing(bool scalar){
+    this->scalarMixing = scalar;
+    resampler.setScalar(scalar);
+}
+/*
+* GENERATION
+*/
+inline void APU::catchUp(uint64_t cycle){
+    //every sample before cycle, the ones from cycle on see whatever changes now
+    uint64_t target = (cycle + CYCLES_PER_SAMPLE - 1) / CYCLES_PER_SAMPLE;
+    while (samples < target){
+        uint64_t count = target - samples;
+        generate(count < MAX_BATCH ? count : (uint32_t)MAX_BATCH);
+    }
+}
+inline void APU::generate(uint32_t count){
+    bool master = register16(0x84) & 0x80;
+    memset(psgLeft, 0, count * 2);
+    memset(psgRight, 0, count * 2);
+    uint32_t done = 0;
+    while (master && done < count){
+        //run the channels up to the next frame sequencer tick
+        uint32_t untilTick = BATCH_SAMPLES - (samples + done) % BATCH_SAMPLES;
+        uint32_t segment = count - done < untilTick ? count - done : untilTick;
+        renderSquare(0, psgLeft + done, psgRight + done, segment);
+        renderSquare(1, psgLeft + done, psgRight + done, segment);
+        renderWave(psgLeft + done, psgRight + done, segment);
+        renderNoise(psgLeft + done, psgRight + done, segment);
+        done += segment;
+        if (segment == untilTick){
+            clockSequencer();
+        }
+    }
+    replayFifo(0, count);
+    replayFifo(1, count);
+    if (master){
+        if (scalarMixing){
+            mixScalar(psgLeft, psgRight, fifoSamples[0], fifoSamples[1], count, mixed);
+        } else {
+            mix(psgLeft, psgRight, fifoSamples[0], fifoSamples[1], count, mixed);
+        }
+    } else {
+        memset(mixed, 0, count * 4);
+    }
+    samples += count;
+    uint32_t frames = resampler.process(mixed, count, resampled);
+    output.write(resampled, frames);
+}
+inline void APU::renderSquare(uint8_t index, int16_t* left, int16_t* right, uint32_t count){
+    //duty cycles 12.5%, 25%, 50%, 75% as 8 step patterns
+    static const uint8_t patterns[4] = {0x01, 0x03, 0x0F, 0xFC};
+    Channel* channel = &channels[index];
+    if (!channel->enabled){
+        return;
+    }
+    uint16_t control = register16(index ? 0x68 : 0x62);
+    uint16_t frequency = index ? register16(0x6C) & 0x7FF : channel->frequency;
+    uint8_t pattern = patterns[(control >> 6) & 0b11];
+    uint32_t period = (2048 - frequency) * 16;
+    uint16_t soundcnt = register16(0x80);
+    bool toLeft = soundcnt & (0x1000 << index);
+    bool toRight = soundcnt & (0x100 << index);
+    int16_t volume = channel->volume;
+    uint32_t timer = channel->timer;
+    uint32_t position = channel->position;
+    for (uint32_t i = 0; i < count; i++){
+        timer += CYCLES_PER_SAMPLE;
+        if (timer >= period){
+            position = (position + timer / period) & 7;
+            timer %= period;
+        }
+        int16_t amplitude = (pattern >> position) & 1 ? volume : -volume;
+        left[i] += toLeft ? amplitude : 0;
+        right[i] += toRight ? amplitude : 0;
+    }
+    channel->timer = timer;
+    channel->position = position;
+}
+inline void APU::renderWave(int16_t* left, int16_t* right, uint32_t count){
+    Channel* channel = &channels[2];
+    uint16_t control = register16(0x70);
+    if (!channel->enabled || !(control & 0x80)){
+        return;
+    }
+    uint32_t period = (2048 - (register16(0x74) & 0x7FF)) * 8;
+    uint32_t size = control & 0x20 ? 64 : 32;
+    uint8_t bank = (control >> 6) & 1;
+    uint16_t volume = register16(0x72);
+    uint8_t code = (volume >> 13) & 0b11;
+    bool threeQuarters = volume & 0x8000;
+    uint16_t soundcnt = register16(0x80);
+    bool toLeft = soundcnt & 0x4000;
+    bool toRight = soundcnt & 0x400;
+    uint32_t timer = channel->timer;
+    uint32_t position = channel->position;
+    for (uint32_t i = 0; i < count; i++){
+        timer += CYCLES_PER_SAMPLE;
+        if (timer >= period){
+            position = (position + timer / period) % size;
+            timer %= period;
+        }
+        //high nibble plays first, 64 sample mode runs on into the other bank
+        uint8_t data = waveRam[(bank + (position >> 5)) & 1][(position & 31) >> 1];
+        int16_t amplitude = (position & 1 ? data & 0xF : data >> 4) * 2 - 15;
+        if (threeQuarters){
+            amplitude = amplitude * 3 / 4;
+        } else {
+            amplitude = code ? amplitude >> (code - 1) : 0;
+        }
+        left[i] += toLeft ? amplitude : 0;
+        right[i] += toRight ? amplitude : 0;
+    }
+    channel->timer = timer;
+    channel->position = position;
+}
+inline void APU::renderNoise(int16_t* left, int16_t* right, uint32_t count){
+    Channel* channel = &channels[3];
+    if (!channel->enabled){
+        return;
+    }
+    uint16_t control = register16(0x7C);
+    uint8_t divider = control & 0b111;
+    uint8_t shift = (control >> 4) & 0xF;
+    bool narrow = control & 0x8;
+    //524288 Hz / divider / 2^(shift + 1), divider 0 counts as 0.5; shifts 14 and 15 never clock
+    uint32_t period = shift >= 14 ? 0 : (divider ? divider * 64 : 32) << shift;
+    uint16_t soundcnt = register16(0x80);
+    bool toLeft = soundcnt & 0x8000;
+    bool toRight = soundcnt & 0x800;
+    int16_t volume = channel->volume;
+    uint32_t timer = channel->timer;
+    uint16_t lfsr = channel->lfsr;
+    for (uint32_t i = 0; i < count; i++){
+        if (period){
+            timer += CYCLES_PER_SAMPLE;
+            uint32_t clocks = timer / period;
+            timer %= period;
+            while (clocks--){
+                uint16_t bit = (lfsr ^ (lfsr >> 1)) & 1;
+                lfsr = (lfsr >> 1) | (bit << 14);
+                if (narrow){
+                    lfsr = (lfsr & ~0x40) | (bit << 6);
+                }
+            }
+        }
+        int16_t amplitude = lfsr & 1 ? -volume : volume;
+        left[i] += toLeft ? amplitude : 0;
+        right[i] += toRight ? amplitude : 0;
+    }
+    channel->timer = timer;
+    channel->lfsr = lfsr;
+}
+inline void APU::replayFifo(uint8_t index, uint32_t count){
+    Fifo* fifo = &fifos[index];
+    int16_t* out = fifoSamples[index];
+    uint32_t replayed = 0;
+    uint64_t cycle = samples * CYCLES_PER_SAMPLE;
+    for (uint32_t i = 0; i < count; i++, cycle += CYCLES_PER_SAMPLE){
+        while (replayed < fifo->pops && fifo->popCycles[replayed] <= cycle){
+            fifo->current = fifo->popSamples[replayed++];
+        }
+        out[i] = fifo->current;
+    }
+    //pops after the last sample made wait for the next batch
+    fifo->pops -= replayed;
+    memmove(fifo->popCycles, fifo->popCycles + replayed, fifo->pops * sizeof(uint64_t));
+    memmove(fifo->popSamples, fifo->popSamples + replayed, fifo->pops);
+}
+inline void APU::clockSequencer(){
+    //512 Hz: length every other step, sweep on 2 and 6, envelope on 7
+    uint8_t step = sequencerStep++ & 7;
+    static const uint16_t frequencyRegisters[4] = {0x64, 0x6C, 0x74, 0x7C};
+    static const uint16_t envelopeRegisters[4] = {0x62, 0x68, 0, 0x78};
+    if (!(step & 1)){
+        for (uint8_t i = 0; i < 4; i++){
+            Channel* channel = &channels[i];
+            if (channel->enabled && (register16(frequencyRegisters[i]) & 0x4000) && channel->length){
+                channel->enabled = --channel->length != 0;
+            }
+        }
+    }
+    if (step == 2 || step == 6){
+        Channel* channel = &channels[0];
+        uint16_t sweep = register16(0x60);
+        uint8_t time = (sweep >> 4) & 0b111;
+        if (channel->enabled && time && --channel->sweepTimer == 0){
+            channel->sweepTimer = time;
+            uint16_t delta = channel->frequency >> (sweep & 0b111);
+            uint32_t frequency = sweep & 0x8 ? channel->frequency - delta : channel->frequency + delta;
+            if (frequency > 2047){
+                channel->enabled = false;
+            } else if (sweep & 0b111){
+                channel->frequency = frequency;
+            }
+        }
+    }
+    if (step == 7){
+        for (uint8_t i = 0; i < 4; i++){
+            Channel* channel = &channels[i];
+            if (i == 2 || !channel->enabled){
+                continue;
+            }
+            uint16_t envelope = register16(envelopeRegisters[i]);
+            uint8_t time = (envelope >> 8) & 0b111;
+            if (!time || --channel->envelopeTimer){
+                continue;
+            }
+            channel->envelopeTimer = time;
+            if ((envelope & 0x800) && channel->volume < 15){
+                channel->volume++;
+            } else if (!(envelope & 0x800) && channel->volume > 0){
+                channel->volume--;
+            }
+        }
+    }
+}
+inline void APU::trigger(uint8_t index){
+    static const uint16_t envelopeRegisters[4] = {0x62, 0x68, 0, 0x78};
+    Channel* channel = &channels[index];
+    channel->enabled = true;
+    channel->timer = 0;
+    channel->position = 0;
+    if (!channel->length){
+        channel->length = index == 2 ? 256 : 64;
+    }
+    if (index != 2){
+        uint16_t envelope = register16(envelopeRegisters[index]);
+        channel->volume = envelope >> 12;
+        channel->envelopeTimer = (envelope >> 8) & 0b111;
+    } else if (!(register16(0x70) & 0x80)){
+        //wave channel with its DAC off
+        channel->enabled = false;
+    }
+    if (index == 0){
+        channel->frequency = register16(0x64) & 0x7FF;
+        channel->sweepTimer = (register16(0x60) >> 4) & 0b111;
+    }
+    if (index == 3){
+        channel->lfsr = 0x7FFF;
+    }
+}
+/*
+* FIFOS
+*/
+inline void APU::pushFifo(uint8_t index, uint16_t value){
+    Fifo* fifo = &fifos[index];
+    for (int i = 0; i < 2 && fifo->count < 32; i++){
+        fifo->samples[(fifo->readIndex + fifo->count) & 31] = (int8_t)(value >> (i * 8));
+        fifo->count++;
+    }
+}
+inline void APU::popFifo(uint8_t index, uint64_t cycle){
+    Fifo* fifo = &fifos[index];
+    if (fifo->pops == POP_LOG){
+        catchUp(cycle);
+        if (fifo->pops == POP_LOG){
+            //more than POP_LOG pops inside one sample, only the last one is heard anyway
+            fifo->current = fifo->popSamples[0];
+            fifo->pops--;
+            memmove(fifo->popCycles, fifo->popCycles + 1, fifo->pops * sizeof(uint64_t));
+            memmove(fifo->popSamples, fifo->popSamples + 1, fifo->pops);
+        }
+    }
+    if (fifo->count){
+        fifo->popCycles[fifo->pops] = cycle;
+        fifo->popSamples[fifo->pops] = fifo->samples[fifo->readIndex];
+        fifo->pops++;
+        fifo->readIndex = (fifo->readIndex + 1) & 31;
+        fifo->count--;
+    }
+    if (fifo->count <= 16){
+        dma->onFifoRequest(index ? FIFO_B : FIFO_A);
+    }
+}
+inline void APU::audioEvent(void* context, uint64_t late){
+    APU* self = (APU*)context;
+    uint64_t cycle = self->scheduler->getCycles() - late;
+    self->catchUp(cycle);
+    self->scheduler->schedule(Scheduler::AUDIO, cycle + BATCH_SAMPLES * CYCLES_PER_SAMPLE);
+}
+inline void APU::timerOverflow(void* context, uint8_t index, uint64_t cycle){
+    APU* self = (APU*)context;
+    if (index > 1){
+        return;
+    }
+    uint16_t control = self->register16(0x82);
+    for (uint8_t fifo = 0; fifo < 2; fifo++){
+        if (((control >> (10 + fifo * 4)) & 1) == index){
+            self->popFifo(fifo, cycle);
+        }
+    }
+}
+inline uint16_t APU::ioRead(void* context, uint32_t address){
+    APU* self = (APU*)context;
+    uint32_t offset = address & 0x3FF;
+    if (offset == 0x84){
+        return (self->register16(0x84) & 0x80) | self->getChannelStatus();
+    }
+    //wave RAM reads see the bank that is not playing
+    uint8_t bank = !((self->register16(0x70) >> 6) & 1);
+    uint16_t value;
+    memcpy(&value, &self->waveRam[bank][offset - 0x90], 2);
+    return value;
+}
+inline void APU::ioWrite(void* context, uint32_t address, uint16_t value){
+    APU* self = (APU*)context;
+    uint32_t offset = address & 0x3FF;
+    //the past is made with the registers it had
+    self->sync();
+    if (offset >= 0xA0){
+        self->pushFifo(offset >= 0xA4, value);
+        return;
+    }
+    if (offset >= 0x90){
+        uint8_t bank = !((self->register16(0x70) >> 6) & 1);
+        memcpy(&self->waveRam[bank][offset - 0x90], &value, 2);
+        return;
+    }
+    self->registers[(offset - 0x60) / 2] = value;
+    switch (offset){
+        case 0x62:
+        case 0x68:
+            self->channels[offset == 0x68].length = 64 - (value & 0x3F);
+            break;
+        case 0x72:
+            self->channels[2].length = 256 - (value & 0xFF);
+            break;
+        case 0x78:
+            self->channels[3].length = 64 - (value & 0x3F);
+            break;
+        case 0x70:
+            if (!(value & 0x80)){
+                self->channels[2].enabled = false;
+            }
+            break;
+        case 0x82:
+            //bits 11 and 15 empty the FIFOs and read back as 0
+            for (uint8_t fifo = 0; fifo < 2; fifo++){
+                if (value & (0x800 << (fifo * 4))){
+                    self->fifos[fifo].count = 0;
+                    self->fifos[fifo].readIndex = 0;
+                }
+            }
+            self->registers[(0x82 - 0x60) / 2] &= 0x770F;
+            break;
+        case 0x84:
+            if (!(value & 0x80)){
+                for (uint8_t i = 0; i < 4; i++){
+                    self->channels[i].enabled = false;
+                }
+            }
+            break;
+    }
+    if ((offset == 0x64 || offset == 0x6C || offset == 0x74 || offset == 0x7C) && (value & 0x8000)){
+        self->trigger((offset - 0x64) / 8);
+    }
+}
+/*
+* MIXING
+*/
+inline void APU::mixScalar(const int16_t* psgLeft, const int16_t* psgRight, const int16_t* fifoA, const int16_t* fifoB,
+    uint32_t count, int16_t* out){
+    uint16_t soundcnt = register16(0x80);
+    uint16_t control = register16(0x82);
+    int16_t level = register16(0x88) & 0x3FE;
+    //PSG ratio 25%, 50%, 100% (3 is prohibited, treated as 100%)
+    uint8_t psgShift = (control & 0b11) >= 2 ? 0 : 2 - (control & 0b11);
+    int16_t psgVolume[2] = {(int16_t)(((soundcnt >> 4) & 0b111) + 1), (int16_t)((soundcnt & 0b111) + 1)};
+    int16_t aVolume = control & 0x4 ? 2 : 1;
+    int16_t bVolume = control & 0x8 ? 2 : 1;
+    int16_t aSide[2] = {(int16_t)(control & 0x200 ? aVolume : 0), (int16_t)(control & 0x100 ? aVolume : 0)};
+    int16_t bSide[2] = {(int16_t)(control & 0x2000 ? bVolume : 0), (int16_t)(control & 0x1000 ? bVolume : 0)};
+    for (uint32_t i = 0; i < count; i++){
+        for (int side = 0; side < 2; side++){
+            int32_t psg = side ? psgRight[i] : psgLeft[i];
+            int32_t value = ((psg * psgVolume[side]) >> psgShift) + fifoA[i] * aSide[side] + fifoB[i] * bSide[side] + level;
+            value = value < 0 ? 0 : value > 0x3FF ? 0x3FF : value;
+            out[i * 2 + side] = (value - 0x200) * 64;
+        }
+    }
+}
+inline void APU::mix(const int16_t* psgLeft, const int16_t* psgRight, const int16_t* fifoA, const int16_t* fifoB,
+    uint32_t count, int16_t* out){
+    uint32_t i = 0;
+#if defined(__AVX2__) || defined(__SSE2__)
+    uint16_t soundcnt = register16(0x80);
+    uint16_t control = register16(0x82);
+    int16_t level = register16(0x88) & 0x3FE;
+    uint8_t psgShift = (control & 0b11) >= 2 ? 0 : 2 - (control & 0b11);
+    int16_t aVolume = control & 0x4 ? 2 : 1;
+    int16_t bVolume = control & 0x8 ? 2 : 1;
+    const __m128i shift = _mm_cvtsi32_si128(psgShift);
+#endif
+#ifdef __AVX2__
+    const __m256i psgVolumeLeft = _mm256_set1_epi16(((soundcnt >> 4) & 0b111) + 1);
+    const __m256i psgVolumeRight = _mm256_set1_epi16((soundcnt & 0b111) + 1);
+    const __m256i aLeft = _mm256_set1_epi16(control & 0x200 ? aVolume : 0);
+    const __m256i aRight = _mm256_set1_epi16(control & 0x100 ? aVolume : 0);
+    const __m256i bLeft = _mm256_set1_epi16(control & 0x2000 ? bVolume : 0);
+    const __m256i bRight = _mm256_set1_epi16(control & 0x1000 ? bVolume : 0);
+    const __m256i bias = _mm256_set1_epi16(level);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i top = _mm256_set1_epi16(0x3FF);
+    const __m256i center = _mm256_set1_epi16(0x200);
+    for (; i + 16 <= count; i += 16){
+        __m256i a = _mm256_loadu_si256((const __m256i*)(fifoA + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(fifoB + i));
+        __m256i left = _mm256_sra_epi16(_mm256_mullo_epi16(_mm256_loadu_si256((const __m256i*)(psgLeft + i)), psgVolumeLeft), shift);
+        __m256i right = _mm256_sra_epi16(_mm256_mullo_epi16(_mm256_loadu_si256((const __m256i*)(psgRight + i)), psgVolumeRight), shift);
+        left = _mm256_add_epi16(_mm256_add_epi16(left, bias), _mm256_add_epi16(_mm256_mullo_epi16(a, aLeft), _mm256_mullo_epi16(b, bLeft)));
+        right = _mm256_add_epi16(_mm256_add_epi16(right, bias), _mm256_add_epi16(_mm256_mullo_epi16(a, aRight), _mm256_mullo_epi16(b, bRight)));
+        left = _mm256_slli_epi16(_mm256_sub_epi16(_mm256_min_epi16(_mm256_max_epi16(left, zero), top), center), 6);
+        right = _mm256_slli_epi16(_mm256_sub_epi16(_mm256_min_epi16(_mm256_max_epi16(right, zero), top), center), 6);
+        //unpack works per 128 bit lane, swap the middle quarters back into sample order
+        __m256i low = _mm256_unpacklo_epi16(left, right);
+        __m256i high = _mm256_unpackhi_epi16(left, right);
+        _mm256_storeu_si256((__m256i*)(out + i * 2), _mm256_permute2x128_si256(low, high, 0x20));
+        _mm256_storeu_si256((__m256i*)(out + i * 2 + 16), _mm256_permute2x128_si256(low, high, 0x31));
+    }
+#elif defined(__SSE2__)
+    const __m128i psgVolumeLeft = _mm_set1_epi16(((soundcnt >> 4) & 0b111) + 1);
+    const __m128i psgVolumeRight = _mm_set1_epi16((soundcnt & 0b111) + 1);
+    const __m128i aLeft = _mm_set1_epi16(control & 0x200 ? aVolume : 0);
+    const __m128i aRight = _mm_set1_epi16(control & 0x100 ? aVolume : 0);
+    const __m128i bLeft = _mm_set1_epi16(control & 0x2000 ? bVolume : 0);
+    const __m128i bRight = _mm_set1_epi16(control & 0x1000 ? bVolume : 0);
+    const __m128i bias = _mm_set1_epi16(level);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i top = _mm_set1_epi16(0x3FF);
+    const __m128i center = _mm_set1_epi16(0x200);
+    for (; i + 8 <= count; i += 8){
+        __m128i a = _mm_loadu_si128((const __m128i*)(fifoA + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(fifoB + i));
+        __m128i left = _mm_sra_epi16(_mm_mullo_epi16(_mm_loadu_si128((const __m128i*)(psgLeft + i)), psgVolumeLeft), shift);
+        __m128i right = _mm_sra_epi16(_mm_mullo_epi16(_mm_loadu_si128((const __m128i*)(psgRight + i)), psgVolumeRight), shift);
+        left = _mm_add_epi16(_mm_add_epi16(left, bias), _mm_add_epi16(_mm_mullo_epi16(a, aLeft), _mm_mullo_epi16(b, bLeft)));
+        right = _mm_add_epi16(_mm_add_epi16(right, bias), _mm_add_epi16(_mm_mullo_epi16(a, aRight), _mm_mullo_epi16(b, bRight)));
+        left = _mm_slli_epi16(_mm_sub_epi16(_mm_min_epi16(_mm_max_epi16(left, zero), top), center), 6);
+        right = _mm_slli_epi16(_mm_sub_epi16(_mm_min_epi16(_mm_max_epi16(right, zero), top), center), 6);
+        _mm_storeu_si128((__m128i*)(out + i * 2), _mm_unpacklo_epi16(left, right));
+        _mm_storeu_si128((__m128i*)(out + i * 2 + 8), _mm_unpackhi_epi16(left, right));
+    }
+#endif
+    if (i < count){
+        mixScalar(psgLeft + i, psgRight + i, fifoA + i, fifoB + i, count - i, out + i * 2);
+    }
+}
+#endif
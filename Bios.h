@@ -0,0 +1,611 @@
+#ifndef BIOS_H
+#define BIOS_H
+#include <stdint.h>
+#include <math.h>
+#include <string.h>
+#include <array>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+#include "RegisterFile.h"
+#include "Memory.h"
+
+/*
+* BIOS HIGH LEVEL EMULATION:
+*   SWI numbers handled natively when HLE is on:
+*       0x06 Div          r0 / r1       -> r0 quotient, r1 remainder, r3 |quotient|
+*       0x07 DivArm       r1 / r0       -> same as Div
+*       0x08 Sqrt         r0            -> r0
+*       0x09 ArcTan       r0 (1.14)     -> r0, same polynomial as the BIOS
+*       0x0B CpuSet       r0 src, r1 dst, r2 count/flags
+*       0x0C CpuFastSet   r0 src, r1 dst, r2 count/flags, words in blocks of 8
+*       0x0E BgAffineSet  r0 src, r1 dst, r2 count
+*       0x0F ObjAffineSet r0 src, r1 dst, r2 count, r3 stride
+*       0x11 LZ77UnCompWram / 0x12 LZ77UnCompVram
+*       0x13 HuffUnComp
+*       0x14 RLUnCompWram / 0x15 RLUnCompVram
+*   Each function returns roughly the cycles the real BIOS routine takes so the
+*   rest of the machine still sees time pass. Anything else returns false from
+*   call() and the CPU takes the SWI exception into the real BIOS.
+*   VRAM variants only ever store halfwords (byte stores to VRAM do not work).
+*   DECOMPRESSION FAST PATH:
+*       LZ77 and RL first try to decode straight into the destination buffer the
+*       bus hands out (lz77Decode / rlDecode). Back references and runs are copied
+*       16 bytes at a time with SSE, short displacements (the copy overlaps what
+*       it is producing) replicate the pattern across a register with pshufb.
+*       Copies may run past the current position but never past the end of the
+*       output, later output overwrites the spill. The VRAM variants decode an
+*       even number of bytes, exactly what their halfword stores would leave.
+*       When the range is not plain memory, source and destination overlap, or
+*       the stream does not fit the input window, the byte at a time versions
+*       (lz77UnCompBytewise / rlUnCompBytewise) run instead. Both charge the
+*       same cycles, the host path never changes emulated time.
+*/
+class BiosFunctions {
+    public:
+        enum calls {DIV = 0x06, DIV_ARM = 0x07, SQRT = 0x08, ARC_TAN = 0x09, CPU_SET = 0x0B,
+            CPU_FAST_SET = 0x0C, BG_AFFINE_SET = 0x0E, OBJ_AFFINE_SET = 0x0F,
+            LZ77_UNCOMP_WRAM = 0x11, LZ77_UNCOMP_VRAM = 0x12, HUFF_UNCOMP = 0x13,
+            RL_UNCOMP_WRAM = 0x14, RL_UNCOMP_VRAM = 0x15};
+        //true if the call was handled, cycles gets the approximate cost
+        static bool call(uint8_t number, RegisterFile* registers, Memory* memory, uint32_t* cycles);
+        static uint32_t div(RegisterFile* registers, int32_t numerator, int32_t denominator);
+        static uint32_t sqrt(RegisterFile* registers);
+        static uint32_t arcTan(RegisterFile* registers);
+        static uint32_t cpuSet(RegisterFile* registers, Memory* memory);
+        static uint32_t cpuFastSet(RegisterFile* registers, Memory* memory);
+        static uint32_t bgAffineSet(RegisterFile* registers, Memory* memory);
+        static uint32_t objAffineSet(RegisterFile* registers, Memory* memory);
+        static uint32_t lz77UnComp(RegisterFile* registers, Memory* memory, bool vram);
+        static uint32_t huffUnComp(RegisterFile* registers, Memory* memory);
+        static uint32_t rlUnComp(RegisterFile* registers, Memory* memory, bool vram);
+        static uint32_t lz77UnCompBytewise(RegisterFile* registers, Memory* memory, bool vram);
+        static uint32_t rlUnCompBytewise(RegisterFile* registers, Memory* memory, bool vram);
+        //decode into a host buffer of exactly size bytes, false if the input runs out
+        static bool lz77Decode(const uint8_t* in, const uint8_t* inEnd, uint8_t* out, uint32_t size);
+        static bool rlDecode(const uint8_t* in, const uint8_t* inEnd, uint8_t* out, uint32_t size);
+    private:
+        //sin of angle/256 of a turn in 1.14 fixed point
+        static int16_t sine(uint8_t angle);
+        static bool getBuffers(Memory* memory, uint32_t source, uint32_t* inLength, uint32_t dest, uint32_t size,
+            const uint8_t** in, uint8_t** out);
+        static void copyBackReference(uint8_t* out, uint32_t displacement, uint32_t length, uint8_t* end);
+        static void fillRun(uint8_t* out, uint8_t value, uint32_t length, uint8_t* end);
+};
+//Collects decompressed bytes and stores them as halfwords (VRAM) or bytes (WRAM)
+class BiosOutput {
+    public:
+        BiosOutput(Memory* memory, uint32_t dest, bool vram);
+        void put(uint8_t value);
+        uint8_t get(uint32_t back);
+        uint32_t getWritten();
+    private:
+        Memory* memory;
+        uint32_t dest;
+        bool vram;
+        uint32_t written;
+        uint16_t pending;
+};
+/*
+* BEGIN BIOS FUNCTIONS METHODS
+*/
+inline bool BiosFunctions::call(uint8_t number, RegisterFile* registers, Memory* memory, uint32_t* cycles){
+    switch (number){
+        case DIV:
+            *cycles = div(registers, registers->getRegister(0), registers->getRegister(1));
+            return true;
+        case DIV_ARM:
+            *cycles = div(registers, registers->getRegister(1), registers->getRegister(0));
+            return true;
+        case SQRT:
+            *cycles = sqrt(registers);
+            return true;
+        case ARC_TAN:
+            *cycles = arcTan(registers);
+            return true;
+        case CPU_SET:
+            *cycles = cpuSet(registers, memory);
+            return true;
+        case CPU_FAST_SET:
+            *cycles = cpuFastSet(registers, memory);
+            return true;
+        case BG_AFFINE_SET:
+            *cycles = bgAffineSet(registers, memory);
+            return true;
+        case OBJ_AFFINE_SET:
+            *cycles = objAffineSet(registers, memory);
+            return true;
+        case LZ77_UNCOMP_WRAM:
+        case LZ77_UNCOMP_VRAM:
+            *cycles = lz77UnComp(registers, memory, number == LZ77_UNCOMP_VRAM);
+            return true;
+        case HUFF_UNCOMP:
+            *cycles = huffUnComp(registers, memory);
+            return true;
+        case RL_UNCOMP_WRAM:
+        case RL_UNCOMP_VRAM:
+            *cycles = rlUnComp(registers, memory, number == RL_UNCOMP_VRAM);
+            return true;
+        default:
+            return false;
+    }
+}
+inline uint32_t BiosFunctions::div(RegisterFile* registers, int32_t numerator, int32_t denominator){
+    if (denominator == 0){
+        //the real BIOS never returns here, give the values most emulators settle on
+        registers->setRegister(0, numerator < 0 ? -1 : 1);
+        registers->setRegister(1, numerator);
+        registers->setRegister(3, 1);
+        return 50;
+    }
+    if (numerator == INT32_MIN && denominator == -1){
+        registers->setRegister(0, INT32_MIN);
+        registers->setRegister(1, 0);
+        registers->setRegister(3, INT32_MIN);
+        return 50;
+    }
+    int32_t quotient = numerator / denominator;
+    int32_t remainder = numerator % denominator;
+    registers->setRegister(0, quotient);
+    registers->setRegister(1, remainder);
+    registers->setRegister(3, quotient < 0 ? -(uint32_t)quotient : quotient);
+    //the BIOS loop is a shift and subtract, roughly 3 cycles a quotient bit
+    uint32_t magnitude = quotient < 0 ? -(uint32_t)quotient : quotient;
+    uint32_t bits = 0;
+    while (magnitude){
+        bits++;
+        magnitude >>= 1;
+    }
+    return 40 + bits * 3;
+}
+inline uint32_t BiosFunctions::sqrt(RegisterFile* registers){
+    uint32_t value = registers->getRegister(0);
+    uint32_t root = 0;
+    uint32_t bit = 1u << 30;
+    while (bit > value){
+        bit >>= 2;
+    }
+    while (bit){
+        if (value >= root + bit){
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    registers->setRegister(0, root);
+    return 150;
+}
+inline uint32_t BiosFunctions::arcTan(RegisterFile* registers){
+    //the BIOS multiplies wrap at 32 bits, done unsigned so they wrap here too instead of overflowing
+    auto multiply = [](int32_t x, int32_t y){
+        return (int32_t)((uint32_t)x * (uint32_t)y);
+    };
+    int32_t x = registers->getRegister(0);
+    int32_t a = -(multiply(x, x) >> 14);
+    int32_t b = (multiply(0xA9, a) >> 14) + 0x390;
+    b = (multiply(b, a) >> 14) + 0x91C;
+    b = (multiply(b, a) >> 14) + 0xFB6;
+    b = (multiply(b, a) >> 14) + 0x16AA;
+    b = (multiply(b, a) >> 14) + 0x2081;
+    b = (multiply(b, a) >> 14) + 0x3651;
+    b = (multiply(b, a) >> 14) + 0xA2F9;
+    registers->setRegister(0, multiply(x, b) >> 16);
+    registers->setRegister(1, a);
+    registers->setRegister(3, b);
+    return 100;
+}
+inline uint32_t BiosFunctions::cpuSet(RegisterFile* registers, Memory* memory){
+    uint32_t source = registers->getRegister(0);
+    uint32_t dest = registers->getRegister(1);
+    uint32_t control = registers->getRegister(2);
+    uint32_t count = control & 0x1FFFFF;
+    bool fill = control & (1 << 24);
+    bool word = control & (1 << 26);
+    if (word){
+        source &= ~3;
+        dest &= ~3;
+        uint32_t value = memory->load32(source);
+        for (uint32_t i = 0; i < count; i++){
+            memory->store32(dest + i * 4, fill ? value : memory->load32(source + i * 4));
+        }
+    } else {
+        source &= ~1;
+        dest &= ~1;
+        uint16_t value = memory->load16(source);
+        for (uint32_t i = 0; i < count; i++){
+            memory->store16(dest + i * 2, fill ? value : memory->load16(source + i * 2));
+        }
+    }
+    return 30 + count * (fill ? 6 : 9);
+}
+inline uint32_t BiosFunctions::cpuFastSet(RegisterFile* registers, Memory* memory){
+    uint32_t source = registers->getRegister(0) & ~3;
+    uint32_t dest = registers->getRegister(1) & ~3;
+    uint32_t control = registers->getRegister(2);
+    //always words, and always whole blocks of 8
+    uint32_t count = ((control & 0x1FFFFF) + 7) & ~7;
+    bool fill = control & (1 << 24);
+    uint32_t value = memory->load32(source);
+    for (uint32_t i = 0; i < count; i++){
+        memory->store32(dest + i * 4, fill ? value : memory->load32(source + i * 4));
+    }
+    //LDM/STM of 8 registers, about 2 cycles a word
+    return 30 + count * 2;
+}
+inline int16_t BiosFunctions::sine(uint8_t angle){
+    //a function local static is built once even with several machines calling in at once
+    static const std::array<int16_t, 256> table = [](){
+        std::array<int16_t, 256> values;
+        for (int i = 0; i < 256; i++){
+            values[i] = (int16_t)lround(sin(i * 2 * M_PI / 256) * 0x4000);
+        }
+        return values;
+    }();
+    return table[angle];
+}
+inline uint32_t BiosFunctions::bgAffineSet(RegisterFile* registers, Memory* memory){
+    uint32_t source = registers->getRegister(0);
+    uint32_t dest = registers->getRegister(1);
+    uint32_t count = registers->getRegister(2);
+    for (uint32_t i = 0; i < count; i++){
+        //source: 8.8 texture center, screen center, 8.8 scales, angle in the top byte
+        int32_t originX = memory->load32(source);
+        int32_t originY = memory->load32(source + 4);
+        int32_t centerX = (int16_t)memory->load16(source + 8);
+        int32_t centerY = (int16_t)memory->load16(source + 10);
+        int32_t scaleX = (int16_t)memory->load16(source + 12);
+        int32_t scaleY = (int16_t)memory->load16(source + 14);
+        uint8_t angle = memory->load16(source + 16) >> 8;
+        int32_t sin = sine(angle);
+        int32_t cos = sine(angle + 64);
+        int16_t pa = (cos * scaleX) >> 14;
+        int16_t pb = -((sin * scaleX) >> 14);
+        int16_t pc = (sin * scaleY) >> 14;
+        int16_t pd = (cos * scaleY) >> 14;
+        memory->store16(dest, pa);
+        memory->store16(dest + 2, pb);
+        memory->store16(dest + 4, pc);
+        memory->store16(dest + 6, pd);
+        memory->store32(dest + 8, originX - pa * centerX - pb * centerY);
+        memory->store32(dest + 12, originY - pc * centerX - pd * centerY);
+        source += 20;
+        dest += 16;
+    }
+    return 30 + count * 70;
+}
+inline uint32_t BiosFunctions::objAffineSet(RegisterFile* registers, Memory* memory){
+    uint32_t source = registers->getRegister(0);
+    uint32_t dest = registers->getRegister(1);
+    uint32_t count = registers->getRegister(2);
+    uint32_t stride = registers->getRegister(3);
+    for (uint32_t i = 0; i < count; i++){
+        int32_t scaleX = (int16_t)memory->load16(source);
+        int32_t scaleY = (int16_t)memory->load16(source + 2);
+        uint8_t angle = memory->load16(source + 4) >> 8;
+        int32_t sin = sine(angle);
+        int32_t cos = sine(angle + 64);
+        memory->store16(dest, (cos * scaleX) >> 14);
+        memory->store16(dest + stride, -((sin * scaleX) >> 14));
+        memory->store16(dest + stride * 2, (sin * scaleY) >> 14);
+        memory->store16(dest + stride * 3, (cos * scaleY) >> 14);
+        source += 8;
+        dest += stride * 4;
+    }
+    return 30 + count * 50;
+}
+inline bool BiosFunctions::getBuffers(Memory* memory, uint32_t source, uint32_t* inLength, uint32_t dest, uint32_t size,
+    const uint8_t** in, uint8_t** out){
+    //the stream is usually far shorter than the worst case, only ask for what is mapped
+    uint32_t mapped = memory->getMappedLength(source);
+    if (*inLength > mapped){
+        *inLength = mapped;
+    }
+    if (!size || *inLength <= 4){
+        return false;
+    }
+    *in = memory->getReadPointer(source, *inLength);
+    *out = memory->getWritePointer(dest, size);
+    if (!*in || !*out){
+        return false;
+    }
+    //decoding in place would read back its own output, leave that to the bus version
+    return *in + *inLength <= *out || *out + size <= *in;
+}
+inline uint32_t BiosFunctions::lz77UnComp(RegisterFile* registers, Memory* memory, bool vram){
+    uint32_t source = registers->getRegister(0);
+    uint32_t dest = registers->getRegister(1);
+    uint32_t size = memory->load32(source) >> 8;
+    uint32_t decoded = vram ? size & ~1 : size;
+    //worst case stream is every byte a literal plus one flag byte per 8
+    uint32_t inLength = 4 + size + (size + 7) / 8;
+    const uint8_t* in;
+    uint8_t* out;
+    if ((!vram || !(dest & 1)) && getBuffers(memory, source, &inLength, dest, decoded, &in, &out)){
+        if (lz77Decode(in + 4, in + inLength, out, decoded)){
+            return 50 + size * 10;
+        }
+    }
+    return lz77UnCompBytewise(registers, memory, vram);
+}
+inline uint32_t BiosFunctions::lz77UnCompBytewise(RegisterFile* registers, Memory* memory, bool vram){
+    uint32_t source = registers->getRegister(0);
+    uint32_t header = memory->load32(source);
+    uint32_t size = header >> 8;
+    BiosOutput output(memory, registers->getRegister(1), vram);
+    source += 4;
+    while (output.getWritten() < size){
+        uint8_t flags = memory->load8(source++);
+        for (int block = 0; block < 8 && output.getWritten() < size; block++){
+            if (!(flags & (0x80 >> block))){
+                output.put(memory->load8(source++));
+                continue;
+            }
+            //4 bit length - 3, 12 bit displacement - 1
+            uint8_t first = memory->load8(source++);
+            uint8_t second = memory->load8(source++);
+            uint32_t length = (first >> 4) + 3;
+            uint32_t displacement = (((first & 0xF) << 8) | second) + 1;
+            for (uint32_t i = 0; i < length && output.getWritten() < size; i++){
+                output.put(output.get(displacement));
+            }
+        }
+    }
+    return 50 + size * 10;
+}
+inline uint32_t BiosFunctions::huffUnComp(RegisterFile* registers, Memory* memory){
+    uint32_t source = registers->getRegister(0);
+    uint32_t dest = registers->getRegister(1) & ~3;
+    uint32_t header = memory->load32(source);
+    uint32_t size = header >> 8;
+    uint32_t dataBits = header & 0xF;
+    if (dataBits == 0 || 32 % dataBits){
+        dataBits = 8;
+    }
+    //tree size byte, then the tree starting with the root, then the 32 bit bitstream
+    uint32_t treeSize = (memory->load8(source + 4) + 1) * 2;
+    uint32_t root = source + 5;
+    uint32_t stream = source + 4 + treeSize;
+    uint32_t node = root;
+    uint32_t written = 0;
+    uint32_t word = 0;
+    uint32_t wordBits = 0;
+    while (written < size){
+        uint32_t bits = memory->load32(stream);
+        stream += 4;
+        for (int bit = 31; bit >= 0 && written < size; bit--){
+            uint8_t direction = (bits >> bit) & 1;
+            uint8_t nodeValue = memory->load8(node);
+            uint32_t child = (node & ~1) + (nodeValue & 0x3F) * 2 + 2 + direction;
+            if (!(nodeValue & (direction ? 0x40 : 0x80))){
+                node = child;
+                continue;
+            }
+            word |= (uint32_t)memory->load8(child) << wordBits;
+            wordBits += dataBits;
+            node = root;
+            if (wordBits == 32){
+                memory->store32(dest + written, word);
+                written += 4;
+                word = 0;
+                wordBits = 0;
+            }
+        }
+    }
+    return 50 + size * 25;
+}
+inline uint32_t BiosFunctions::rlUnComp(RegisterFile* registers, Memory* memory, bool vram){
+    uint32_t source = registers->getRegister(0);
+    uint32_t dest = registers->getRegister(1);
+    uint32_t size = memory->load32(source) >> 8;
+    uint32_t decoded = vram ? size & ~1 : size;
+    //worst case stream alternates one literal and a 3 byte run, 2 bytes in per byte out
+    uint32_t inLength = 4 + size * 2;
+    const uint8_t* in;
+    uint8_t* out;
+    if ((!vram || !(dest & 1)) && getBuffers(memory, source, &inLength, dest, decoded, &in, &out)){
+        if (rlDecode(in + 4, in + inLength, out, decoded)){
+            return 50 + size * 6;
+        }
+    }
+    return rlUnCompBytewise(registers, memory, vram);
+}
+inline uint32_t BiosFunctions::rlUnCompBytewise(RegisterFile* registers, Memory* memory, bool vram){
+    uint32_t source = registers->getRegister(0);
+    uint32_t header = memory->load32(source);
+    uint32_t size = header >> 8;
+    BiosOutput output(memory, registers->getRegister(1), vram);
+    source += 4;
+    while (output.getWritten() < size){
+        uint8_t flag = memory->load8(source++);
+        if (flag & 0x80){
+            //run of length + 3 copies of the next byte
+            uint32_t length = (flag & 0x7F) + 3;
+            uint8_t value = memory->load8(source++);
+            for (uint32_t i = 0; i < length && output.getWritten() < size; i++){
+                output.put(value);
+            }
+            continue;
+        }
+        uint32_t length = (flag & 0x7F) + 1;
+        for (uint32_t i = 0; i < length && output.getWritten() < size; i++){
+            output.put(memory->load8(source++));
+        }
+    }
+    return 50 + size * 6;
+}
+inline bool BiosFunctions::lz77Decode(const uint8_t* in, const uint8_t* inEnd, uint8_t* out, uint32_t size){
+    uint8_t* start = out;
+    uint8_t* end = out + size;
+    while (out < end){
+        if (in >= inEnd){
+            return false;
+        }
+        uint8_t flags = *in++;
+        if (!flags && in + 8 <= inEnd && out + 8 <= end){
+            //eight literals in a row
+            memcpy(out, in, 8);
+            in += 8;
+            out += 8;
+            continue;
+        }
+        for (int block = 0; block < 8 && out < end; block++){
+            if (!(flags & (0x80 >> block))){
+                if (in >= inEnd){
+                    return false;
+                }
+                *out++ = *in++;
+                continue;
+            }
+            if (in + 2 > inEnd){
+                return false;
+            }
+            uint32_t length = (in[0] >> 4) + 3;
+            uint32_t displacement = (((in[0] & 0xF) << 8) | in[1]) + 1;
+            in += 2;
+            if (displacement > (uint32_t)(out - start)){
+                //reaches in front of the destination, only the bus knows what is there
+                return false;
+            }
+            if (length > (uint32_t)(end - out)){
+                length = end - out;
+            }
+            copyBackReference(out, displacement, length, end);
+            out += length;
+        }
+    }
+    return true;
+}
+inline void BiosFunctions::copyBackReference(uint8_t* out, uint32_t displacement, uint32_t length, uint8_t* end){
+#ifdef __SSE2__
+    //a back reference is at most 18 bytes, two stores cover it when there is room to spill
+    if (end - out >= 32){
+        if (displacement >= 16){
+            _mm_storeu_si128((__m128i*)out, _mm_loadu_si128((const __m128i*)(out - displacement)));
+            if (length > 16){
+                _mm_storeu_si128((__m128i*)(out + 16), _mm_loadu_si128((const __m128i*)(out + 16 - displacement)));
+            }
+            return;
+        }
+#ifdef __SSSE3__
+        //repeat the last displacement bytes across the register, lane i takes byte i % displacement
+        static const struct PatternTable {
+            uint8_t lanes[16][16];
+            PatternTable(){
+                for (int d = 1; d < 16; d++){
+                    for (int i = 0; i < 16; i++){
+                        lanes[d][i] = i % d;
+                    }
+                }
+            }
+        } patterns;
+        __m128i lanes = _mm_loadu_si128((const __m128i*)patterns.lanes[displacement]);
+        _mm_storeu_si128((__m128i*)out, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(out - displacement)), lanes));
+        if (length > 16){
+            //the output is periodic now, copy from a whole number of periods back (16 -> 30 bytes)
+            uint32_t period = displacement * ((16 + displacement - 1) / displacement);
+            _mm_storeu_si128((__m128i*)(out + 16), _mm_loadu_si128((const __m128i*)(out + 16 - period)));
+        }
+        return;
+#endif
+    }
+#endif
+    //overlapping copy, each memcpy doubles how much of the repeating pattern exists
+    const uint8_t* from = out - displacement;
+    while (length){
+        uint32_t chunk = out - from;
+        if (chunk > length){
+            chunk = length;
+        }
+        memcpy(out, from, chunk);
+        out += chunk;
+        length -= chunk;
+    }
+}
+inline bool BiosFunctions::rlDecode(const uint8_t* in, const uint8_t* inEnd, uint8_t* out, uint32_t size){
+    uint8_t* end = out + size;
+    while (out < end){
+        if (in >= inEnd){
+            return false;
+        }
+        uint8_t flag = *in++;
+        uint32_t length;
+        if (flag & 0x80){
+            length = (flag & 0x7F) + 3;
+            if (in >= inEnd){
+                return false;
+            }
+            uint8_t value = *in++;
+            if (length > (uint32_t)(end - out)){
+                length = end - out;
+            }
+            fillRun(out, value, length, end);
+            out += length;
+            continue;
+        }
+        length = (flag & 0x7F) + 1;
+        if (length > (uint32_t)(end - out)){
+            length = end - out;
+        }
+        if (in + length > inEnd){
+            return false;
+        }
+        memcpy(out, in, length);
+        in += length;
+        out += length;
+    }
+    return true;
+}
+inline void BiosFunctions::fillRun(uint8_t* out, uint8_t value, uint32_t length, uint8_t* end){
+    uint32_t i = 0;
+#ifdef __SSE2__
+    __m128i run = _mm_set1_epi8((char)value);
+    for (; i + 16 <= length; i += 16){
+        _mm_storeu_si128((__m128i*)(out + i), run);
+    }
+    if (i < length && end - (out + i) >= 16){
+        _mm_storeu_si128((__m128i*)(out + i), run);
+        return;
+    }
+#endif
+    memset(out + i, value, length - i);
+}
+/*
+* BEGIN BIOS OUTPUT METHODS
+*/
+inline BiosOutput::BiosOutput(Memory* memory, uint32_t dest, bool vram){
+    this->memory = memory;
+    this->dest = dest;
+    this->vram = vram;
+    this->written = 0;
+    this->pending = 0;
+}
+inline void BiosOutput::put(uint8_t value){
+    if (!vram){
+        memory->store8(dest + written++, value);
+        return;
+    }
+    //hold the low byte until its partner arrives, then store the halfword
+    if (!((dest + written) & 1)){
+        pending = value;
+    } else {
+        memory->store16(dest + written - 1, pending | (value << 8));
+    }
+    written++;
+}
+inline uint8_t BiosOutput::get(uint32_t back){
+    uint32_t address = dest + written - back;
+    if (vram && (address & ~1) == ((dest + written) & ~1)){
+        //still sitting in the pending halfword
+        return pending & 0xFF;
+    }
+    return memory->load8(address);
+}
+inline uint32_t BiosOutput::getWritten(){
+    return written;
+}
+#endif
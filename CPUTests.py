@@ -158,6 +158,51 @@ class ArmCodes:
         #STMIA   r3!, {r0,r4}
         "STMIA": 0xC311
     }
+    #Hardware self checks, run with -s <name> and print Passed <name>
+    SelfTests = [
+        "scheduler",
+        "timers",
+        "dma",
+        "bios",
+        "decompress",
+        "ppu",
+        "tilecache",
+        "affine",
+        "oam",
+        "threaded",
+        "headless",
+        "apu",
+        "savestate",
+        "rewind",
+        "runner",
+        "decodecache",
+        "movie",
+        "waitstates",
+        "irq",
+        "debug",
+        "trace",
+        "profiler",
+        "decoded",
+        "multiply"
+    ]
+    def runSelfTests(tests):
+        print("Beginning Hardware Self Tests")
+        total = len(tests)
+        passed = 0
+        for test in tests:
+            try:
+                spawnStr = "./CPUtest -s " + test
+                print(spawnStr)
+                p = pexpect.spawn(spawnStr)
+                p.expect("Passed " + test, timeout=30)
+                p.close()
+                print("Passed!")
+                passed += 1
+            except:
+                print("Failed!")
+        bar = Progbar(total)
+        bar.update(passed)
+        print(f"we passed {passed/total * 100}% of hardware tests")
     def runDecodeTests(dict, name, thumb = False):
         print(f"Beginning {name} Codes Tests")
         total = len(dict)
@@ -184,4 +229,5 @@ if __name__ == "__main__":
     ArmCodes.runDecodeTests(ArmCodes.ThumbCodes, "Thumb Codes", thumb=True)
     ArmCodes.runDecodeTests(ArmCodes.DataProcessingCodes, "Data Processing")
     ArmCodes.runDecodeTests(ArmCodes.LoadStoreCodes, "Load Store")
-    ArmCodes.runDecodeTests(ArmCodes.BranchLinkCodes, "Branch Link Transfer")
\ No newline at end of file
+    ArmCodes.runDecodeTests(ArmCodes.BranchLinkCodes, "Branch Link Transfer")
+    ArmCodes.runSelfTests(ArmCodes.SelfTests)
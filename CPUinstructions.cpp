@@ -1,5 +1,35 @@
 #include <iostream>
+#include <bitset>
+#include <cstring>
 #include <stdint.h>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <atomic>
+#include <memory>
+#include <map>
+#include <mutex>
+#include <algorithm>
+#include "Scheduler.h"
+#include "Memory.h"
+#include "Interrupts.h"
+#include "Timers.h"
+#include "DMA.h"
+#include "PPU.h"
+#include "APU.h"
+#include "RegisterFile.h"
+#include "Bios.h"
+#include "SaveState.h"
+#include "Rewind.h"
+#include "WorkPool.h"
+#include "Movie.h"
+#include "Debugger.h"
+#include "Trace.h"
+#include "Profiler.h"
+#include "DecodeArena.h"
 
 //placeholder ptr for functions that have not been implemented yet
 void placeholder(uint32_t instruction){
@@ -35,7 +65,8 @@ class Instruction {
 };
 class InstructionProcessingFunctions {
     public: 
-        static Instruction* generateSubClassedInstrct(Instruction* instruction);
+        //decodes through the subclass for the instruction's format, built on the stack
+        static Func decodeSubClassed(Instruction* instruction);
 };
 class InstructionTests {
     public:
@@ -43,6 +74,113 @@ class InstructionTests {
         static void testThumbDecode(char* strInstruction);
         static void runTests(int argc, char** argv);
 };
+class CPU;
+//Self checks for the hardware side, run with -s <name>, print Passed/Failed <name>
+class HardwareTests {
+    public:
+        static bool testScheduler();
+        static bool testTimers();
+        static bool testDMA();
+        static bool testBios();
+        static bool testDecompression();
+        static bool testPPU();
+        static bool testTileCache();
+        static bool testAffine();
+        static bool testOamCache();
+        static bool testThreaded();
+        static bool testHeadless();
+        static bool testAPU();
+        static bool testSaveState();
+        static bool testRewind();
+        static bool testRunner();
+        static bool testDecodeCache();
+        static bool testMovie();
+        static bool testWaitStates();
+        static bool testInterrupts();
+        static bool testDebugger();
+        static bool testTrace();
+        static bool testProfiler();
+        static bool testDecodedInstructions();
+        static bool testMultiply();
+        static void runTest(char* name);
+        //random VRAM/palette/OAM and registers for the given BG mode, every layer and blending on
+        static void makeScene(CPU* cpu, uint8_t mode, uint32_t seed);
+        //makeScene plus timers, sound FIFO and HBlank DMA running, so frames change memory on their own
+        static void makeBusyMachine(CPU* cpu, uint32_t seed);
+        //every memory page plus the timing visible from outside, to compare two machines
+        static std::vector<uint8_t> dumpMachine(CPU* cpu);
+        static std::vector<uint8_t> makeBlob(int kind, uint32_t size, uint32_t seed);
+        static std::vector<uint8_t> compressLZ77(const std::vector<uint8_t>& data);
+        static std::vector<uint8_t> compressRL(const std::vector<uint8_t>& data);
+        //access cycles worked out from WAITCNT on every call, what the table has to agree with
+        static uint32_t referenceAccessCycles(uint16_t waitControl, uint32_t address, uint8_t width, bool sequential);
+        //a multiply worked out the long way, 16 bits at a time, and its m a byte at a time
+        static uint64_t referenceMultiply(uint32_t a, uint32_t b, bool isSigned);
+        static uint32_t referenceMultiplierCycles(uint32_t rs, bool isSigned);
+};
+//Throughput measurements, run with -b <name>
+class HardwareBenchmarks {
+    public:
+        static void benchmarkDecompression();
+        static void benchmarkPPU();
+        static void benchmarkAffine();
+        static void benchmarkThreaded();
+        static void benchmarkHeadless();
+        static void benchmarkAPU();
+        static void benchmarkSaveState();
+        static void benchmarkRewind();
+        static void benchmarkRunner();
+        static void benchmarkDecodeCache();
+        static void benchmarkMovie();
+        static void benchmarkWaitStates();
+        static void benchmarkInterrupts();
+        static void benchmarkDebugger();
+        static void benchmarkTrace();
+        static void benchmarkProfiler();
+        static void benchmarkDecodedInstructions();
+        static void benchmarkMultiply();
+        static void run(char* name);
+};
+//One emulator instance for the headless runner, the first three are the manifest line
+struct RunnerJob {
+    std::string rom;
+    //input script or movie, "-" for none
+    std::string input;
+    uint32_t frames;
+    bool loaded;
+    //FNV-1a over the registers, memory and the last frame
+    uint64_t hash;
+    double seconds;
+    uint32_t worker;
+};
+//Runs a manifest of jobs headless across a work-stealing pool, run with -r <manifest> [threads],
+//or one input movie with -p (see replay). The CPU executes the game, but data processing and
+//most loads and stores are still placeholders, so a run (and its hash) follows the game's branches,
+//calls, SWIs and multiplies and not yet what it computes
+class HeadlessRunner {
+    public:
+        //one job per line: rom path, input script path or -, frame count; # starts a comment
+        static bool parseManifest(std::istream& in, std::vector<RunnerJob>* jobs);
+        //0 threads is one per hardware thread, returns the wall clock seconds
+        static double runJobs(std::vector<RunnerJob>* jobs, uint32_t threads);
+        static void printResults(const std::vector<RunnerJob>& jobs, double seconds, uint32_t threads);
+        static int run(int argc, char** argv);
+        static uint64_t hashMachine(CPU* cpu);
+        //a movie file, or a text script expanded to frames frames, or nothing pressed for "-"
+        static bool loadInput(const std::string& path, uint32_t frames, InputMovie* movie);
+        //runs frames frames of movie on a machine with its ROM loaded, uncapped, returns hashMachine
+        static uint64_t playMovie(CPU* cpu, const InputMovie& movie, uint32_t frames);
+        //-d <trace> <trace>: the first step two execution traces disagree on, exit code 1 if they do
+        static int diffTraces(int argc, char** argv);
+        static void printStep(const TraceStep& step);
+        //-p <rom> <movie> replays a movie and checks it ends the way it did when recorded,
+        //-p <rom> <movie> <script> <frames> records one from a text script first. The game runs,
+        //but nothing reads KEYINPUT until loads are implemented, so a match says the code took the
+        //same path and the last frame's KEYINPUT was the same, not that the input steered it
+        static int replay(int argc, char** argv);
+    private:
+        static void runJob(void* context, uint32_t worker);
+};
 /*
 * BEGIN DATA PROCESSING INSTRUCTIONS:
 *   First: Determine if the instruction is a Multiply or a Regular Data Processing instruction
@@ -127,6 +265,52 @@ class DataProcessingFunctions {
         static void bitwiseNot(uint32_t data);
 };
 /*
+* MULTIPLY FUNCTIONS:
+*   The multiply family, every product formed natively in 64 bits.
+*       MUL MLA                 Rd = Rm * Rs (+ Rn), low 32 bits
+*       UMULL UMLAL SMULL SMLAL RdHi:RdLo = Rm * Rs (+ RdHi:RdLo)
+*       SMULxy SMLAxy           Rd = Rm half x * Rs half y (+ Rn)
+*       SMULWy SMLAWy           Rd = top 32 of Rm * Rs half y (+ Rn)
+*       SMLALxy                 RdHi:RdLo += Rm half x * Rs half y
+*   With S set the 32 bit and long forms put N and Z from the whole result;
+*   C comes out meaningless on the ARM7 and is left alone, V is untouched.
+*   The accumulating halfword forms set Q when the add overflows.
+*   Cycles: the decoded entry carries the fixed part (1S, plus 1I for an
+*   accumulate and 1I for a long), the handler adds m, the multiplier's
+*   internal cycles. The ARM7 eats Rs 8 bits a cycle and stops once the bits
+*   left are all zero, or all one for the signed forms (MUL and MLA count as
+*   signed), so m is 1 to 4 from the leading sign bits of Rs; multiplierCycles
+*   works it out with a count of leading zeros and no branches.
+*   The halfword forms are ARMv5TE, the ARM7TDMI has none of them; they run as
+*   an ARM9E would and take no extra cycles.
+*/
+class MultiplyFunctions {
+    public:
+        static void multiply(uint32_t data);
+        static void multiplyAccumulate(uint32_t data);
+        static void unsignedMultiplyLong(uint32_t data);
+        static void unsignedMultiplyAccumulateLong(uint32_t data);
+        static void signedMultiplyLong(uint32_t data);
+        static void signedMultiplyAccumulateLong(uint32_t data);
+        static void signedMultiplyHalfwords(uint32_t data);
+        static void signedMultiplyAccumulateHalfwords(uint32_t data);
+        static void signedMultiplyWordHalfword(uint32_t data);
+        static void signedMultiplyAccumulateWordHalfword(uint32_t data);
+        static void signedMultiplyAccumulateLongHalfwords(uint32_t data);
+        //m, 1 to 4, for multiplier rs
+        static uint32_t multiplierCycles(uint32_t rs, bool signedMultiplier);
+    private:
+        template <bool accumulate>
+        static void multiplyWord(uint32_t data);
+        template <bool isSigned, bool accumulate>
+        static void multiplyLong(uint32_t data);
+        //SMULxy SMLAxy SMULWy SMLAWy, which differ in how the product is formed and whether Rn is added
+        template <bool wordByHalf, bool accumulate>
+        static void multiplyHalfword(uint32_t data);
+        //bits 16 -> 31 or 0 -> 15 of value, sign extended
+        static int32_t half(uint32_t value, bool top);
+};
+/*
 * LOAD STORE WORD UNSIGNED POSSIBLE INSTRUCTIONS
 *   LDR
 *   LDRB
@@ -174,6 +358,21 @@ class BranchLinkTransferInstrct : public Instruction {
         ~BranchLinkTransferInstrct() override {};
 };
 /*
+* BRANCH FUNCTIONS:
+*   The ARM branches, calls and returns: B, BL, BX (decoded with the data
+*   processing space it sits in) and LDMIA sp! with pc in the list. While
+*   the profiler runs the calls and returns tell it where they went once they
+*   have. SWI (decoded with the coprocessor space) is here too.
+*/
+class BranchFunctions {
+    public:
+        static void softwareInterrupt(uint32_t data);
+        static void branch(uint32_t data);
+        static void branchLink(uint32_t data);
+        static void branchExchange(uint32_t data);
+        static void popPC(uint32_t data);
+};
+/*
 * BEGIN COPROCESSOR INSTRUCTIONS
 * NOT USED
 *   STC
@@ -238,13 +437,230 @@ class ThumbInstruction {
         uint16_t data;
         ThumbFunc Func;
 };
+class ThumbFunctions {
+    public:
+        static void softwareInterrupt(uint16_t data);
+        static void branch(uint16_t data);
+        static void conditionalBranch(uint16_t data);
+        //the BL pair, the first half leaves the high part of the target in LR
+        static void branchLinkHigh(uint16_t data);
+        static void branchLink(uint16_t data);
+        static void branchExchange(uint16_t data);
+        //POP with pc in the list
+        static void popPC(uint16_t data);
+};
+/*
+* DECODE HANDLERS:
+*   The functions the decoders hand out, numbered so a DecodedInstruction (see
+*   DecodeArena.h) names one in two bytes. A function gets its number the first
+*   time a decode returns it and keeps it for the life of the process, ARM and
+*   THUMB number theirs separately. 0 is NULL (not decoded yet) and 1 the
+*   placeholder, which is also what a table that somehow fills up gives out.
+*   Looking a number up is an array read. Handing one out goes through an open
+*   addressed map from function to number, read without a lock and filled
+*   under it, so a bulk decode pays one hash and a probe or two per word and
+*   only takes the lock the first time it meets a function.
+*/
+class DecodeHandlers {
+    public:
+        enum {NONE = 0, PLACEHOLDER = 1, MAX_HANDLERS = 1024};
+        //twice the slots there can be functions, so a probe always finds a free one
+        enum {MAP_BITS = 11, MAP_SLOTS = 1 << MAP_BITS};
+        static uint16_t armIndex(Func func);
+        static uint16_t thumbIndex(ThumbFunc func);
+        static Func arm(uint16_t index);
+        static ThumbFunc thumb(uint16_t index);
+    private:
+        template <typename T>
+        static uint16_t intern(T* table, std::atomic<uint16_t>* count, std::atomic<uintptr_t>* keys, uint16_t* indices, T func);
+        static inline std::mutex lock;
+        static inline Func armTable[MAX_HANDLERS] = {0, placeholder};
+        static inline ThumbFunc thumbTable[MAX_HANDLERS] = {0, placeholder};
+        static inline std::atomic<uint16_t> armCount{2};
+        static inline std::atomic<uint16_t> thumbCount{2};
+        //the map, 0 is a free slot
+        static inline std::atomic<uintptr_t> armKeys[MAP_SLOTS];
+        static inline std::atomic<uintptr_t> thumbKeys[MAP_SLOTS];
+        static inline uint16_t armIndices[MAP_SLOTS];
+        static inline uint16_t thumbIndices[MAP_SLOTS];
+};
+/*
+* ROM DECODE:
+*   The decoded form of one cartridge, words as ARM and halfwords as THUMB,
+*   decoded a 4K page at a time the first time code is looked up there, so a
+*   game pays for the code it runs rather than for its graphics and music.
+*   get() hands out the one for a ROM (keyed by the hash and length of its
+*   bytes) for as long as somebody holds it, so every instance running the same
+*   game shares a single copy and a page one of them has decoded is decoded for
+*   all of them. A page's entries are written once under the decode's lock
+*   and then published by storing the page pointer with release, after which
+*   nothing writes them again; a lookup that finds the pointer set reads the
+*   entries without a lock, one that finds it NULL takes the lock, decodes the
+*   page unless somebody beat it to it, and publishes it. The bytes come with
+*   every lookup rather than being kept, any copy with the same hash decodes
+*   the same, so the decode never points into a cartridge that may be unloaded
+*   before it is. Words with no format decode to the placeholder rather than
+*   through the factory.
+*   A page is a run of DecodedInstructions out of the decode's own arena, 1024
+*   for ARM and 2048 for THUMB, so code running straight through the page walks
+*   consecutive entries.
+*/
+class RomDecode {
+    public:
+        static std::shared_ptr<const RomDecode> get(const uint8_t* rom, uint32_t length);
+        //private, outside the registry; nothing is decoded until it is looked up
+        RomDecode(uint32_t length, uint64_t hash);
+        //offsets are from the start of the cartridge and rom is its bytes, decoding the
+        //page on the first lookup there; past the end gives NULL
+        const DecodedInstruction* getArm(uint32_t offset, const uint8_t* rom) const;
+        const DecodedInstruction* getThumb(uint32_t offset, const uint8_t* rom) const;
+        uint64_t getHash() const;
+        uint32_t getLength() const;
+        //what the pages decoded so far take up
+        uint64_t getBytes() const;
+        //pages decoded so far, ARM and THUMB counted apart
+        uint32_t getPageCount() const;
+        //FNV-1a over the bytes
+        static uint64_t hash(const uint8_t* data, uint32_t length);
+        //decodes built so far, by get() or directly
+        static uint32_t getBuildCount();
+        //one instruction without printing anything, what every table entry is
+        static Func decodeArm(uint32_t data);
+        static ThumbFunc decodeThumb(uint16_t data);
+        //the same with the fields pulled out and the cycles worked out
+        static void decodeArm(uint32_t data, DecodedInstruction* entry);
+        static void decodeThumb(uint16_t data, DecodedInstruction* entry);
+    private:
+        //takes the lock, the entries of page once they are all written
+        const DecodedInstruction* decodePage(uint32_t page, bool thumb, const uint8_t* rom) const;
+        mutable std::mutex lock;
+        mutable DecodeArena arena;
+        //one per page, NULL until decoded
+        std::unique_ptr<std::atomic<DecodedInstruction*>[]> armPages;
+        std::unique_ptr<std::atomic<DecodedInstruction*>[]> thumbPages;
+        mutable std::atomic<uint32_t> pageCount;
+        uint64_t romHash;
+        uint32_t length;
+        static inline std::atomic<uint32_t> builds{0};
+};
+/*
+* DECODE CACHE:
+*   Where one instance looks its decodes up. ROM addresses (all three windows)
+*   go to the shared RomDecode for the loaded cartridge, attached on first use and
+*   again whenever a different one is loaded. Code in EWRAM and IWRAM can be
+*   rewritten at any time so it is cached here, per instance, a 4K page at a
+*   time. Every lookup fetches the word (or halfword) and decodes it again only
+*   when it is not what the entry was decoded from, so a store to a variable or
+*   the stack sharing the page with the code costs nothing and self modifying
+*   code costs one decode per instruction it changes. Entries are decoded the
+*   first time they are asked for. Anything else (BIOS, VRAM, the mirrors past
+*   the end of the cartridge) is decoded on every call.
+*   A RAM page's entries come out of this instance's arena the first time code
+*   runs there, so decoding never allocates once a page has been seen; flush()
+*   drops every RAM decode at once by resetting the arena.
+*/
+class DecodeCache {
+    public:
+        DecodeCache(Memory* memory);
+        //look up the shared decode for the cartridge now in memory
+        void attachRom();
+        //the entry for address, valid until the next lookup there finds a different
+        //opcode; outside ROM and RAM it is decoded into a scratch entry the next call overwrites
+        const DecodedInstruction* getArmEntry(uint32_t address);
+        const DecodedInstruction* getThumbEntry(uint32_t address);
+        //just the handler of the entry
+        Func getArm(uint32_t address);
+        ThumbFunc getThumb(uint32_t address);
+        //forget every RAM decode
+        void flush();
+        const RomDecode* getRomDecode();
+        //what the RAM pages take up, this instance only
+        uint64_t getRamBytes();
+        //RAM entries decoded so far, this instance only
+        uint64_t getRamDecodes();
+    private:
+        struct RamPage {
+            //NULL until code runs in the page
+            DecodedInstruction* arm;
+            DecodedInstruction* thumb;
+        };
+        Memory* memory;
+        DecodeArena arena;
+        DecodedInstruction scratch;
+        std::shared_ptr<const RomDecode> rom;
+        const uint8_t* romData;
+        uint32_t romLength;
+        //one per EWRAM and IWRAM page, empty until something runs there
+        std::vector<RamPage> ramPages;
+        uint64_t ramDecodes;
+        //width is the fetch, 4 for ARM and 2 for THUMB
+        bool romInRange(uint32_t address, uint8_t width, uint32_t* offset);
+        //NULL when address is not in EWRAM or IWRAM
+        RamPage* getRamPage(uint32_t address, uint32_t* offset);
+};
 class CPU {
     public:
         //Move to register file class
         enum instructionState  {ARM, THUMB};
+        CPU();
         void decode(uint32_t instruction, instructionState mode);
         void decodeArm(uint32_t instruction);
         void decodeThumb(uint16_t instruction);
+        //runs for a budget of cycles, dispatching scheduled hardware events on the way
+        void run(uint64_t cycles);
+        void setHalted(bool halted);
+        bool isHalted();
+        Scheduler* getScheduler();
+        Memory* getMemory();
+        Interrupts* getInterrupts();
+        Timers* getTimers();
+        DMA* getDMA();
+        PPU* getPPU();
+        APU* getAPU();
+        RegisterFile* getRegisters();
+        //snapshot the whole machine, memory incrementally (see SaveState.h)
+        void saveState(SaveState* state);
+        void loadState(SaveState* state);
+        //once per frame, snapshots into the buffer when it is due
+        void captureRewind(RewindBuffer* buffer);
+        //load the newest snapshot and drop it, false if there is none
+        bool rewind(RewindBuffer* buffer);
+        //SWI with its comment field, runs the HLE version when enabled
+        void softwareInterrupt(uint8_t comment);
+        void setBiosHLE(bool enabled);
+        DecodeCache* getDecodeCache();
+        Debugger* getDebugger();
+        Profiler* getProfiler();
+        //record every step and store into trace from now on, NULL to stop; the caller closes it
+        void setTrace(TraceWriter* trace);
+        //the CPU currently executing on this thread, for the static instruction functions
+        static CPU* getActive();
+        static void setActive(CPU* cpu);
+    protected:
+        static thread_local CPU* active;
+        Scheduler scheduler;
+        Memory memory;
+        Interrupts interrupts;
+        Timers timers;
+        DMA dma;
+        PPU ppu;
+        APU apu;
+        RegisterFile registers;
+        DecodeCache decodeCache;
+        Debugger debugger;
+        Profiler profiler;
+        TraceWriter* trace;
+        bool halted;
+        bool biosHLE;
+        void runSlice(uint64_t sliceEnd);
+        //runSlice with a breakpoint check in front of every step and the trace after it,
+        //only while there are breakpoints or a trace
+        void runSliceChecked(uint64_t sliceEnd);
+        //the IRQ event: something is requesting, wake up and take it if allowed
+        static void irqEvent(void* context, uint64_t late);
+        static void irqMaskChanged(void* context, bool disabled);
+        //runs the instruction PC is reading ahead of and moves PC on, returns the cycles it took
+        uint32_t step();
 };
 /* CPU CLASS:
 *   getMemory(16 bit address, len)
@@ -255,12 +671,42 @@ class CPU {
 * REGISTER FILE:
 *   getRegister()
 *   
+* TIMING:
+*   run(cycles) splits the budget into slices that end at the next scheduled
+*   event. Inside a slice nothing but the instruction stream is looked at, the
+*   hardware only gets control back through scheduler.dispatch() between slices.
+*   An event scheduled while a slice runs (a timer written by a store etc.)
+*   lowers getNextEventCycle() so the slice ends early on its own. Interrupts
+*   are one of those events (Scheduler::IRQ, see Interrupts.h), so nothing in
+*   the slice ever checks IE, IF or IME.
+*   The debugger (see Debugger.h) works the same way: a breakpoint or
+*   watchpoint hit schedules Scheduler::DEBUG and run() returns after the
+*   dispatch. Only while breakpoints are set does a slice run through
+*   runSliceChecked, so an idle debugger adds nothing per step. The same
+*   loop feeds an execution trace (see Trace.h) when one is set. The
+*   profiler (see Profiler.h) hears from the call and return handlers as
+*   they run and samples through Scheduler::PROFILE events like any other.
+*   
 * Notes:
 *   The device mode can be read from the CPSR (current program status register)
 *   it is the first 5 bits
 *   program counter is 0b1111
 *   stack pointer is 0b1101
 */
+CPU::CPU() : interrupts(&scheduler), timers(&scheduler, &interrupts), dma(&scheduler, &memory, &interrupts),
+    ppu(&scheduler, &memory, &interrupts, &dma), apu(&scheduler, &memory, &timers, &dma),
+    decodeCache(&memory), debugger(&scheduler, &memory), profiler(&scheduler){
+    this->halted = false;
+    this->biosHLE = false;
+    this->trace = 0;
+    scheduler.setHandler(Scheduler::IRQ, &CPU::irqEvent, this);
+    registers.setIrqMaskHook(&CPU::irqMaskChanged, this);
+    interrupts.mapRegisters(&memory);
+    timers.mapRegisters(&memory);
+    dma.mapRegisters();
+    ppu.mapRegisters();
+    apu.mapRegisters();
+}
 void CPU::decode(uint32_t instruction, instructionState mode){
     if (mode == THUMB){
         //decodeThumb(instruction);
@@ -270,6 +716,223 @@ void CPU::decode(uint32_t instruction, instructionState mode){
 }
 void CPU::decodeArm(uint32_t instruction){
 
+}
+thread_local CPU* CPU::active = 0;
+void CPU::run(uint64_t cycles){
+    setActive(this);
+    debugger.resume();
+    uint64_t target = scheduler.getCycles() + cycles;
+    while (scheduler.getCycles() < target){
+        uint64_t sliceEnd = scheduler.getNextEventCycle();
+        if (sliceEnd > target){
+            sliceEnd = target;
+        }
+        runSlice(sliceEnd);
+        scheduler.dispatch();
+        if (debugger.isStopped()){
+            return;
+        }
+    }
+}
+void CPU::runSlice(uint64_t sliceEnd){
+    if (debugger.hasBreakpoints() || trace){
+        runSliceChecked(sliceEnd);
+        return;
+    }
+    //re-read the heap top each step so events added mid slice shorten it
+    while (scheduler.getCycles() < sliceEnd && scheduler.getCycles() < scheduler.getNextEventCycle()){
+        if (halted){
+            //nothing can happen until the next event so skip straight to it
+            scheduler.setCycles(sliceEnd < scheduler.getNextEventCycle() ? sliceEnd : scheduler.getNextEventCycle());
+            return;
+        }
+        scheduler.addCycles(step());
+    }
+}
+void CPU::runSliceChecked(uint64_t sliceEnd){
+    while (scheduler.getCycles() < sliceEnd && scheduler.getCycles() < scheduler.getNextEventCycle()){
+        if (halted){
+            scheduler.setCycles(sliceEnd < scheduler.getNextEventCycle() ? sliceEnd : scheduler.getNextEventCycle());
+            return;
+        }
+        //PC is the instruction about to run plus 8 (ARM) or 4 (THUMB)
+        bool thumb = registers.isThumb();
+        uint32_t address = registers.getRegister(RegisterFile::PC) - (thumb ? 4 : 8);
+        if (debugger.hasBreakpoints() && debugger.checkBreakpoint(address)){
+            return;
+        }
+        scheduler.addCycles(step());
+        if (trace){
+            uint32_t values[TraceStep::REGISTERS];
+            for (uint8_t i = 0; i < TraceStep::CPSR; i++){
+                values[i] = registers.getRegister(i);
+            }
+            values[TraceStep::CPSR] = registers.getCPSR();
+            trace->step(address, memory.peek(address, thumb ? 2 : 4), thumb, values);
+        }
+    }
+}
+uint32_t CPU::step(){
+    //PC is the instruction plus 8 (ARM) or 4 (THUMB), the entry comes from the decode cache
+    bool thumb = registers.isThumb();
+    uint8_t width = thumb ? 2 : 4;
+    uint32_t pc = registers.getRegister(RegisterFile::PC);
+    uint32_t address = pc - width * 2;
+    const DecodedInstruction* entry = thumb ? decodeCache.getThumbEntry(address) : decodeCache.getArmEntry(address);
+    //the entry's cycles count its fetch as one sequential cycle, the bus says what it really took
+    uint32_t cycles = memory.getFetchCycles(address, width) - 1;
+    if (!registers.conditionPassed(entry->condition)){
+        //a failed condition is just the fetch
+        registers.setRegister(RegisterFile::PC, pc + width);
+        return cycles + 1;
+    }
+    cycles += entry->cycles;
+    registers.clearBranched();
+    if (thumb){
+        DecodeHandlers::thumb(entry->handler)((uint16_t)entry->data);
+    } else {
+        DecodeHandlers::arm(entry->handler)(entry->data);
+    }
+    //a handler that jumped (or took an exception) left PC at the target already
+    if (!registers.hasBranched()){
+        registers.setRegister(RegisterFile::PC, pc + width);
+    }
+    return cycles;
+}
+void CPU::irqEvent(void* context, uint64_t late){
+    (void)late;
+    CPU* cpu = (CPU*)context;
+    if (cpu->interrupts.isRequesting()){
+        cpu->halted = false;
+    }
+    if (cpu->interrupts.isPending()){
+        //between instructions PC is the next one plus 8 (ARM) or 4 (THUMB), the handler
+        //returns with SUBS PC, LR, #4 so LR is the next one plus 4 either way
+        RegisterFile* registers = &cpu->registers;
+        uint32_t returnAddress = registers->getRegister(RegisterFile::PC) - (registers->isThumb() ? 0 : 4);
+        registers->enterException(RegisterFile::IRQ, 0x18, returnAddress);
+    }
+}
+void CPU::irqMaskChanged(void* context, bool disabled){
+    ((CPU*)context)->interrupts.setCpuEnabled(!disabled);
+}
+void CPU::setHalted(bool halted){
+    this->halted = halted;
+}
+bool CPU::isHalted(){
+    return this->halted;
+}
+Scheduler* CPU::getScheduler(){
+    return &this->scheduler;
+}
+Memory* CPU::getMemory(){
+    return &this->memory;
+}
+Interrupts* CPU::getInterrupts(){
+    return &this->interrupts;
+}
+Timers* CPU::getTimers(){
+    return &this->timers;
+}
+DMA* CPU::getDMA(){
+    return &this->dma;
+}
+PPU* CPU::getPPU(){
+    return &this->ppu;
+}
+APU* CPU::getAPU(){
+    return &this->apu;
+}
+RegisterFile* CPU::getRegisters(){
+    return &this->registers;
+}
+void CPU::saveState(SaveState* state){
+    //the APU syncs first, generating sound never touches memory
+    apu.saveState(&state->apu);
+    state->registers = registers;
+    scheduler.saveState(&state->scheduler);
+    interrupts.saveState(&state->interrupts);
+    timers.saveState(&state->timers);
+    dma.saveState(&state->dma);
+    ppu.saveState(&state->ppu);
+    state->prefetch = memory.getPrefetch();
+    state->halted = halted;
+    state->captureMemory(&memory);
+}
+void CPU::loadState(SaveState* state){
+    //sound generated so far goes out first, the rest continues from the state
+    apu.sync();
+    state->restoreMemory(&memory);
+    registers = state->registers;
+    registers.setIrqMaskHook(&CPU::irqMaskChanged, this);
+    scheduler.loadState(&state->scheduler);
+    interrupts.loadState(&state->interrupts);
+    timers.loadState(&state->timers);
+    dma.loadState(&state->dma);
+    ppu.loadState(&state->ppu);
+    apu.loadState(&state->apu);
+    //after the pages, putting WAITCNT back empties the buffer
+    memory.setPrefetch(state->prefetch);
+    halted = state->halted;
+}
+void CPU::captureRewind(RewindBuffer* buffer){
+    if (!buffer->nextFrame()){
+        return;
+    }
+    saveState(buffer->getState());
+    buffer->push();
+}
+bool CPU::rewind(RewindBuffer* buffer){
+    if (!buffer->getSnapshotCount()){
+        return false;
+    }
+    loadState(buffer->getState());
+    buffer->pop();
+    return true;
+}
+void CPU::softwareInterrupt(uint8_t comment){
+    uint32_t cycles;
+    if (biosHLE && BiosFunctions::call(comment, &registers, &memory, &cycles)){
+        scheduler.addCycles(cycles);
+        return;
+    }
+    //PC reads two instructions ahead, return to the one after the SWI
+    uint32_t returnAddress = registers.getRegister(RegisterFile::PC) - (registers.isThumb() ? 2 : 4);
+    registers.enterException(RegisterFile::SUPERVISOR, 0x08, returnAddress);
+}
+void CPU::setBiosHLE(bool enabled){
+    this->biosHLE = enabled;
+}
+DecodeCache* CPU::getDecodeCache(){
+    return &this->decodeCache;
+}
+Debugger* CPU::getDebugger(){
+    return &this->debugger;
+}
+Profiler* CPU::getProfiler(){
+    return &this->profiler;
+}
+void CPU::setTrace(TraceWriter* trace){
+    this->trace = trace;
+    debugger.setWriteListener(trace ? &TraceWriter::writeHook : 0, trace);
+}
+CPU* CPU::getActive(){
+    return active;
+}
+void CPU::setActive(CPU* cpu){
+    active = cpu;
+}
+/*
+* DECODE LOG:
+*   The decoders print what they find, which is what the python side checks.
+*   A thread decoding in bulk (the decode caches) sets quietDecode and the same
+*   decoders run without a word, other threads keep printing.
+*/
+static thread_local bool quietDecode = false;
+static std::ostream& decodeLog(){
+    //no buffer, so every write just fails
+    static thread_local std::ostream silent(0);
+    return quietDecode ? silent : std::cout;
 }
 /*
 * BEGIN INSTRUCTION METHODS
@@ -311,12 +974,10 @@ void CPU::decodeArm(uint32_t instruction){
 Instruction::Instruction(uint32_t instruction){
     this->data = instruction;
     this->format = getFormat();
-    std::cout << "Format: " << format << "\n";
+    decodeLog() << "Format: " << format << "\n";
 }
 Func Instruction::decode(){
-    Instruction* subclassedInstrct = InstructionProcessingFunctions::generateSubClassedInstrct(this);
-    std::cout << "Got subclassed instruction" << "\n";
-    return subclassedInstrct->decode();
+    return InstructionProcessingFunctions::decodeSubClassed(this);
 }
 Instruction::instructionFormat Instruction::getSelfFormat(){
     return this->format;
@@ -343,6 +1004,10 @@ uint8_t Instruction::getOp(){
     return op; 
 }
 Instruction::instructionFormat Instruction::getFormat(){
+    //the condition field 0xF is the unconditional space (PLD, BLX on later cores), nothing on the ARM7
+    if (getCondition() == 0xF){
+        return UNDEFINED;
+    }
     uint8_t op = (this->data >> 26) & 0b11;
     switch (op){
         case 0b00:
@@ -352,7 +1017,8 @@ Instruction::instructionFormat Instruction::getFormat(){
         case 0b10:
             return BRANCH_LINK_OR_TRANSFER;
         default:
-            return UNDEFINED;
+            //coprocessor transfers and SWI
+            return COPROCESSOR_INSTRUCTION;
     }
 }
 /*
@@ -360,20 +1026,34 @@ Instruction::instructionFormat Instruction::getFormat(){
 *   A collection of functions used to process instructions into
 *   their subclasses based off their format
 */
-Instruction* InstructionProcessingFunctions::generateSubClassedInstrct(Instruction* instruction){
+Func InstructionProcessingFunctions::decodeSubClassed(Instruction* instruction){
+    //the subclass only lives for the one decode, so it never goes near the heap
     Instruction::instructionFormat format = instruction->getFormat();
     switch (format){
-        case Instruction::DATAPROCESSING_MISC:
-            return new DataProcessingInstrct(instruction->getData());
-        case Instruction::LOAD_STORE_WORD_UNSIGNED:
-            return new LoadStoreWordUnsignedInstrct(instruction->getData());
-        case Instruction::BRANCH_LINK_OR_TRANSFER:
-            return new BranchLinkTransferInstrct(instruction->getData());
-        case Instruction::COPROCESSOR_INSTRUCTION:
-            return new CoprocessorInstrct(instruction->getData());
+        case Instruction::DATAPROCESSING_MISC: {
+            DataProcessingInstrct subclassedInstrct(instruction->getData());
+            decodeLog() << "Got subclassed instruction" << "\n";
+            return subclassedInstrct.decode();
+        }
+        case Instruction::LOAD_STORE_WORD_UNSIGNED: {
+            LoadStoreWordUnsignedInstrct subclassedInstrct(instruction->getData());
+            decodeLog() << "Got subclassed instruction" << "\n";
+            return subclassedInstrct.decode();
+        }
+        case Instruction::BRANCH_LINK_OR_TRANSFER: {
+            BranchLinkTransferInstrct subclassedInstrct(instruction->getData());
+            decodeLog() << "Got subclassed instruction" << "\n";
+            return subclassedInstrct.decode();
+        }
+        case Instruction::COPROCESSOR_INSTRUCTION: {
+            CoprocessorInstrct subclassedInstrct(instruction->getData());
+            decodeLog() << "Got subclassed instruction" << "\n";
+            return subclassedInstrct.decode();
+        }
         default:
-            std::cout << "Throwing" << "\n";
-            throw;
+            //UNDEFINED and the unconditional space, nothing on the ARM7 decodes there
+            decodeLog() << "UNDEFINED" << "\n";
+            return placeholder;
     }
 }
 /*
@@ -400,6 +1080,11 @@ Func DataProcessingInstrct::decode(){
     uint8_t op = this->getOp();
     uint8_t op1 = this->getOp1();
     uint8_t op2 = this->getOp2();
+    //BX sits in the TEQ space with the S bit clear
+    if ((data & 0x0FFFFFF0) == 0x012FFF10){
+        decodeLog() << "BX" << "\n";
+        return &BranchFunctions::branchExchange;
+    }
     if ((op2 == 0b1011 || op2 == 0b1101 || op2 == 0b1111) && !op){
         return getMiscLoadStorePtr();
     }
@@ -452,76 +1137,76 @@ Func DataProcessingInstrct::getGenericFuncPtr(){
     uint8_t rn = (data >> 16) & 0b1111;
     std::bitset<4> opBits(op);
     std::bitset<4> rnBits(rn);
-    std::cout << "op" << opBits << "\n";
-    std::cout << "rn" << rnBits << "\n";  
+    decodeLog() << "op" << opBits << "\n";
+    decodeLog() << "rn" << rnBits << "\n";  
     //switch is faster and somewhat managable here
     switch (op){
         case 0b0000:
             //bitwise AND immeadiate Page 322
-            std::cout << "AND" << "\n";
+            decodeLog() << "AND" << "\n";
             return &DataProcessingFunctions::bitwiseAnd;
         case 0b0001:
             //bitwise Exclusive OR immeadiate page 383
-            std::cout << "EOR" << "\n";
+            decodeLog() << "EOR" << "\n";
             return &DataProcessingFunctions::bitwiseExclusiveOr;
         case 0b0010:
             //Subtract Immeadiate ARM Page 711
-            std::cout << "SUB" << "\n";
+            decodeLog() << "SUB" << "\n";
             return &DataProcessingFunctions::subtract;
         case 0b0011:
             //Reverse Subtract Page 575
-            std::cout << "RSB" << "\n";
+            decodeLog() << "RSB" << "\n";
             return &DataProcessingFunctions::reverseSubtract;
         case 0b0100:
             //ADD immeadiate ARM Page 306
-            std::cout << "ADD" << "\n";
+            decodeLog() << "ADD" << "\n";
             return &DataProcessingFunctions::addImmeadiate;
         case 0b0101:
             //Add with Carry Page 298
-            std::cout << "ADC" << "\n";
+            decodeLog() << "ADC" << "\n";
             return &DataProcessingFunctions::addWithCarry;
         case 0b0110:
             //Subtract with Carry Page 593
-            std::cout << "SBC" << "\n";
+            decodeLog() << "SBC" << "\n";
             return &DataProcessingFunctions::subtractWithCarry;
         case 0b0111:
             //Test Immeadiate Page 745
-            std::cout << "RSC" << "\n";
+            decodeLog() << "RSC" << "\n";
             return &DataProcessingFunctions::reverseSubtract;
         case 0b1000:
             //Test Immeadiate Page 745
-            std::cout << "TST" << "\n";
+            decodeLog() << "TST" << "\n";
             return &DataProcessingFunctions::testImmeadiate;
         case 0b1001:
             //Test Equivalence Page 739
-            std::cout << "TEQ" << "\n";
+            decodeLog() << "TEQ" << "\n";
             return &DataProcessingFunctions::testEquivalence;
         case 0b1010:
             //Compare CMP immediate Page 368
-            std::cout << "CMP" << "\n";
+            decodeLog() << "CMP" << "\n";
             return &DataProcessingFunctions::compare;
         case  0b1011:
             //Compate Negative 
-            std::cout << "CMN" << "\n";
+            decodeLog() << "CMN" << "\n";
             return &DataProcessingFunctions::compareNegative;
         case 0b1100:
             //Bitwise OR immeadiate Page 517
-            std::cout << "ORR" << "\n";
+            decodeLog() << "ORR" << "\n";
             return &DataProcessingFunctions::bitwiseOr;
         case 0b1101:
             //Move Immeadiate Page 485
-            std::cout << "MOV" << "\n";
+            decodeLog() << "MOV" << "\n";
             return &DataProcessingFunctions::move;
         case 0b1110:
             //Bitwise Bit Clear Page 338
-            std::cout << "BIC" << "\n";
+            decodeLog() << "BIC" << "\n";
             return &DataProcessingFunctions::bitwiseBitClear;
         case 0b1111:
             //Bitwise Not Page 505
-            std::cout << "MVN" << "\n";
+            decodeLog() << "MVN" << "\n";
             return &DataProcessingFunctions::bitwiseNot;
     }
-    std::cout << "PLACEHOLDER" << "\n";
+    decodeLog() << "PLACEHOLDER" << "\n";
     return placeholder;
 }
 Func DataProcessingInstrct::getMultiplyFuncPtr(){
@@ -535,55 +1220,55 @@ Func DataProcessingInstrct::getMultiplyFuncPtr(){
     switch (op1){
         case 0b0000:
             //Multiply Page 80
-            std::cout << "MUL" << "\n";
-            return placeholder;
+            decodeLog() << "MUL" << "\n";
+            return &MultiplyFunctions::multiply;
         case 0b0001:
             //Multiply accumulate Page 80
-            std::cout << "MLA" << "\n";
-            return placeholder;
+            decodeLog() << "MLA" << "\n";
+            return &MultiplyFunctions::multiplyAccumulate;
         case 0b0010:
             //Unsigned Multiply Accumulate significant Long Page 247
-            std::cout << "UMAAL" << "\n";
+            decodeLog() << "UMAAL" << "\n";
             return placeholder;
         case 0b0100:
             //Unsigned Multiply Long Page 247
-            std::cout << "UMULL" << "\n";
-            return placeholder;
+            decodeLog() << "UMULL" << "\n";
+            return &MultiplyFunctions::unsignedMultiplyLong;
         case 0b0101:
             //Unsigned Multiply Accumulate Long Page 249
-            std::cout << "UMLAL" << "\n";
-            return placeholder;
+            decodeLog() << "UMLAL" << "\n";
+            return &MultiplyFunctions::unsignedMultiplyAccumulateLong;
         case 0b0110:
             //Signed Mutliply Long Page 168
-            std::cout << "SMULL" << "\n";
-            return placeholder;
+            decodeLog() << "SMULL" << "\n";
+            return &MultiplyFunctions::signedMultiplyLong;
         case 0b0111:
             //Signed Multiply Accumulate Long Page 247
-            std::cout << "SMLAL" << "\n";
-            return placeholder;
+            decodeLog() << "SMLAL" << "\n";
+            return &MultiplyFunctions::signedMultiplyAccumulateLong;
         case 0b1000:
             //Signed Halfword Multiply Accumulate Long Page 148
-            std::cout << "SMLAxy" << "\n";
-            return placeholder;
+            decodeLog() << "SMLAxy" << "\n";
+            return &MultiplyFunctions::signedMultiplyAccumulateHalfwords;
         case 0b1001:
             if (x){
                 //Signed Halfword by Word Multiply Long Page 170
-                std::cout << "SMULWy" << "\n";
-                return placeholder;
+                decodeLog() << "SMULWy" << "\n";
+                return &MultiplyFunctions::signedMultiplyWordHalfword;
             }
             //Signed Halfword by Word Multiply Accumulate Long Page 152
-            std::cout << "SMLAWy" << "\n";
-            return placeholder;
+            decodeLog() << "SMLAWy" << "\n";
+            return &MultiplyFunctions::signedMultiplyAccumulateWordHalfword;
         case 0b1010:
             //Signed halfword Multiply Accumulate Long Page 148.
-            std::cout << "SMLALxy" << "\n";
-            return placeholder;
+            decodeLog() << "SMLALxy" << "\n";
+            return &MultiplyFunctions::signedMultiplyAccumulateLongHalfwords;
         case 0b1011:
             //Signed halfword Multiply Page 166
-            std::cout << "SMULxy" << "\n";
-            return placeholder;
+            decodeLog() << "SMULxy" << "\n";
+            return &MultiplyFunctions::signedMultiplyHalfwords;
         default:
-            std::cout << "could not match pattern" << "\n";
+            decodeLog() << "could not match pattern" << "\n";
             return placeholder;
     }
 }
@@ -594,20 +1279,20 @@ Func DataProcessingInstrct::getMiscLoadStorePtr(){
     switch (op2){
         case 0b01:
             if (op1){
-                std::cout << "LDRH" << "\n";
+                decodeLog() << "LDRH" << "\n";
                 return placeholder;
             } else {
-                std::cout << "STRH" << "\n";
+                decodeLog() << "STRH" << "\n";
                 return placeholder;
             }
         case 0b10:
-            std::cout << "LDRSB" << "\n";
+            decodeLog() << "LDRSB" << "\n";
             return placeholder;
         case 0b11:
-            std::cout << "LDRSH" << "\n";
+            decodeLog() << "LDRSH" << "\n";
             return placeholder;
         default:
-            std::cout << "PLACEHOLDER" << "\n";
+            decodeLog() << "PLACEHOLDER" << "\n";
             return placeholder;
     }
 }
@@ -663,6 +1348,119 @@ void DataProcessingFunctions::bitwiseNot(uint32_t data){
     return;
 }
 /*
+* BEGIN MULTIPLY FUNCTIONS METHODS
+*/
+inline uint32_t MultiplyFunctions::multiplierCycles(uint32_t rs, bool signedMultiplier){
+    //a signed multiplier's leading ones stop it like leading zeros, flip them into zeros
+    uint32_t sign = (uint32_t)((int32_t)rs >> 31) & (0u - signedMultiplier);
+    //each whole byte of leading zeros is a cycle saved, | 1 keeps 0 (one cycle) away from clz(0)
+    return 4 - (__builtin_clz((rs ^ sign) | 1) >> 3);
+}
+inline int32_t MultiplyFunctions::half(uint32_t value, bool top){
+    return (int16_t)(value >> (top ? 16 : 0));
+}
+template <bool accumulate>
+inline void MultiplyFunctions::multiplyWord(uint32_t data){
+    CPU* cpu = CPU::getActive();
+    RegisterFile* registers = cpu->getRegisters();
+    if (!registers->conditionPassed(data >> 28)){
+        return;
+    }
+    uint32_t rs = registers->getRegister((data >> 8) & 0xF);
+    uint32_t result = registers->getRegister(data & 0xF) * rs;
+    if (accumulate){
+        result += registers->getRegister((data >> 12) & 0xF);
+    }
+    registers->setRegister((data >> 16) & 0xF, result);
+    if (data & (1 << 20)){
+        registers->setFlags(RegisterFile::N | RegisterFile::Z, (result & RegisterFile::N) | ((uint32_t)(result == 0) << 30));
+    }
+    cpu->getScheduler()->addCycles(multiplierCycles(rs, true));
+}
+template <bool isSigned, bool accumulate>
+inline void MultiplyFunctions::multiplyLong(uint32_t data){
+    CPU* cpu = CPU::getActive();
+    RegisterFile* registers = cpu->getRegisters();
+    if (!registers->conditionPassed(data >> 28)){
+        return;
+    }
+    uint8_t low = (data >> 12) & 0xF;
+    uint8_t high = (data >> 16) & 0xF;
+    uint32_t rs = registers->getRegister((data >> 8) & 0xF);
+    uint32_t rm = registers->getRegister(data & 0xF);
+    uint64_t result = isSigned ? (uint64_t)((int64_t)(int32_t)rm * (int32_t)rs) : (uint64_t)rm * rs;
+    if (accumulate){
+        result += ((uint64_t)registers->getRegister(high) << 32) | registers->getRegister(low);
+    }
+    registers->setRegister(low, (uint32_t)result);
+    registers->setRegister(high, (uint32_t)(result >> 32));
+    if (data & (1 << 20)){
+        registers->setFlags(RegisterFile::N | RegisterFile::Z, ((uint32_t)(result >> 32) & RegisterFile::N) | ((uint32_t)(result == 0) << 30));
+    }
+    cpu->getScheduler()->addCycles(multiplierCycles(rs, isSigned));
+}
+template <bool wordByHalf, bool accumulate>
+inline void MultiplyFunctions::multiplyHalfword(uint32_t data){
+    RegisterFile* registers = CPU::getActive()->getRegisters();
+    if (!registers->conditionPassed(data >> 28)){
+        return;
+    }
+    uint32_t rm = registers->getRegister(data & 0xF);
+    int32_t y = half(registers->getRegister((data >> 8) & 0xF), (data >> 6) & 1);
+    //SMULW/SMLAW keep the top 32 bits of the 48 bit product
+    int64_t result = wordByHalf ? ((int64_t)(int32_t)rm * y) >> 16 : (int64_t)half(rm, (data >> 5) & 1) * y;
+    if (accumulate){
+        result += (int32_t)registers->getRegister((data >> 12) & 0xF);
+        //Q is sticky, set on overflow and never cleared here
+        uint32_t overflow = (uint32_t)(result != (int32_t)result) << 27;
+        registers->setFlags(overflow, overflow);
+    }
+    registers->setRegister((data >> 16) & 0xF, (uint32_t)result);
+}
+void MultiplyFunctions::multiply(uint32_t data){
+    multiplyWord<false>(data);
+}
+void MultiplyFunctions::multiplyAccumulate(uint32_t data){
+    multiplyWord<true>(data);
+}
+void MultiplyFunctions::unsignedMultiplyLong(uint32_t data){
+    multiplyLong<false, false>(data);
+}
+void MultiplyFunctions::unsignedMultiplyAccumulateLong(uint32_t data){
+    multiplyLong<false, true>(data);
+}
+void MultiplyFunctions::signedMultiplyLong(uint32_t data){
+    multiplyLong<true, false>(data);
+}
+void MultiplyFunctions::signedMultiplyAccumulateLong(uint32_t data){
+    multiplyLong<true, true>(data);
+}
+void MultiplyFunctions::signedMultiplyHalfwords(uint32_t data){
+    multiplyHalfword<false, false>(data);
+}
+void MultiplyFunctions::signedMultiplyAccumulateHalfwords(uint32_t data){
+    multiplyHalfword<false, true>(data);
+}
+void MultiplyFunctions::signedMultiplyWordHalfword(uint32_t data){
+    multiplyHalfword<true, false>(data);
+}
+void MultiplyFunctions::signedMultiplyAccumulateWordHalfword(uint32_t data){
+    multiplyHalfword<true, true>(data);
+}
+void MultiplyFunctions::signedMultiplyAccumulateLongHalfwords(uint32_t data){
+    RegisterFile* registers = CPU::getActive()->getRegisters();
+    if (!registers->conditionPassed(data >> 28)){
+        return;
+    }
+    uint8_t low = (data >> 12) & 0xF;
+    uint8_t high = (data >> 16) & 0xF;
+    int64_t product = (int64_t)half(registers->getRegister(data & 0xF), (data >> 5) & 1) *
+        half(registers->getRegister((data >> 8) & 0xF), (data >> 6) & 1);
+    uint64_t result = (((uint64_t)registers->getRegister(high) << 32) | registers->getRegister(low)) + (uint64_t)product;
+    registers->setRegister(low, (uint32_t)result);
+    registers->setRegister(high, (uint32_t)(result >> 32));
+}
+/*
 * BEGIN LOAD STORE WORD UNSIGNED METHODS
 */
 uint8_t LoadStoreWordUnsignedInstrct::getA(){
@@ -688,11 +1486,11 @@ Func LoadStoreWordUnsignedInstrct::decode(){
         case 0b10010:
         case 0b11000:
         case 0b11010:
-            std::cout << "STR" << "\n";
+            decodeLog() << "STR" << "\n";
             return placeholder;
         case 0b00010:
         case 0b01010:
-            std::cout << "STRT" << "\n";
+            decodeLog() << "STRT" << "\n";
             return placeholder;
         case 0b00001:
         case 0b01001:
@@ -700,11 +1498,11 @@ Func LoadStoreWordUnsignedInstrct::decode(){
         case 0b10011:
         case 0b11001:
         case 0b11011: 
-            std::cout << "LDR" << "\n";
+            decodeLog() << "LDR" << "\n";
             return placeholder;
         case 0b00011:
         case 0b01011:
-            std::cout << "LDRT" << "\n";
+            decodeLog() << "LDRT" << "\n";
             return placeholder;
         case 0b00100:
         case 0b01100:
@@ -712,11 +1510,11 @@ Func LoadStoreWordUnsignedInstrct::decode(){
         case 0b10110:
         case 0b11100:
         case 0b11110:
-            std::cout << "STRB" << "\n";
+            decodeLog() << "STRB" << "\n";
             return placeholder;
         case 0b00110:
         case 0b01110: 
-            std::cout << "STRBT" << "\n";
+            decodeLog() << "STRBT" << "\n";
             return placeholder;
         case 0b00101:
         case 0b01101:
@@ -724,14 +1522,14 @@ Func LoadStoreWordUnsignedInstrct::decode(){
         case 0b10111:
         case 0b11101:
         case 0b11111:
-            std::cout << "LDRB" << "\n";
+            decodeLog() << "LDRB" << "\n";
             return placeholder;
         case 0b00111:
         case 0b01111:
-            std::cout << "LDRBT" << "\n";
+            decodeLog() << "LDRBT" << "\n";
             return placeholder;
         default:
-            std::cout << "PLACEHOLDER" << "\n";
+            decodeLog() << "PLACEHOLDER" << "\n";
             return placeholder;
     }
 }
@@ -769,47 +1567,50 @@ Func BranchLinkTransferInstrct::decode(){
     switch (op){
         case 0b000000:
         case 0b000010:
-            std::cout << "STMDA" << "\n";
+            decodeLog() << "STMDA" << "\n";
             return placeholder;
         case 0b000001:
         case 0b000011:
-            std::cout << "LDMDA" << "\n";
+            decodeLog() << "LDMDA" << "\n";
             return placeholder;
         case 0b001000:
         case 0b001010:
-            std::cout << "STM" << "\n";
+            decodeLog() << "STM" << "\n";
             return placeholder;
         case 0b001001:
-            std::cout << "LDMIA" << "\n";
+            decodeLog() << "LDMIA" << "\n";
             return placeholder;
         case 0b001011:
             if (rn == 0b1101){
-                std::cout << "POP" << "\n";
+                decodeLog() << "POP" << "\n";
+                if (r){
+                    return &BranchFunctions::popPC;
+                }
                 return placeholder;
             }
-            std::cout << "LDMIA" << "\n";
+            decodeLog() << "LDMIA" << "\n";
             return placeholder;
         case 0b010000:
-            std::cout << "STMDB" << "\n";
+            decodeLog() << "STMDB" << "\n";
             return placeholder;
         case 0b010010:
             if (rn == 0b1101){
-                std::cout << "PUSH" << "\n";
+                decodeLog() << "PUSH" << "\n";
                 return placeholder; 
             }
-            std::cout << "STMDB" << "\n";
+            decodeLog() << "STMDB" << "\n";
             return placeholder;
         case 0b010001:
         case 0b010011:
-            std::cout << "LDMDB" << "\n";
+            decodeLog() << "LDMDB" << "\n";
             return placeholder;
         case 0b011000:
         case 0b011010:
-            std::cout << "STMIB" << "\n";
+            decodeLog() << "STMIB" << "\n";
             return placeholder;
         case 0b011001:
         case 0b011011:
-            std::cout << "LDMIB" << "\n";
+            decodeLog() << "LDMIB" << "\n";
             return placeholder;
         //0b0xx1x0
         case 0b000100:
@@ -820,7 +1621,7 @@ Func BranchLinkTransferInstrct::decode(){
         case 0b010110:
         case 0b011100:
         case 0b011110:
-            std::cout << "STM" << "\n";
+            decodeLog() << "STM" << "\n";
             return placeholder;
         //0b0xx1x1
         case 0b000101:
@@ -831,18 +1632,18 @@ Func BranchLinkTransferInstrct::decode(){
         case 0b010111:
         case 0b011101:
         case 0b011111:
-            std::cout << "LDM(user)" << "\n";
+            decodeLog() << "LDM(user)" << "\n";
             return placeholder;
         default:
             if (((op >> 4) & 0b11) == 0b10){
-                std::cout << "B" << "\n";
-                return placeholder;
+                decodeLog() << "B" << "\n";
+                return &BranchFunctions::branch;
             }
             if (((op >> 4) & 0b11) == 0b11){
-                std::cout << "BL" << "\n";
-                return placeholder;
+                decodeLog() << "BL" << "\n";
+                return &BranchFunctions::branchLink;
             }
-            std::cout << "PLACEHOLDER" << "\n";
+            decodeLog() << "PLACEHOLDER" << "\n";
             return placeholder;
     }
 }
@@ -859,16 +1660,20 @@ uint8_t CoprocessorInstrct::getOp1(){
 Func CoprocessorInstrct::decode(){
     uint8_t op = getOp();
     uint8_t op1 = getOp1();
+    if ((this->data >> 24 & 0xF) == 0xF){
+        decodeLog() << "SWI" << "\n";
+        return &BranchFunctions::softwareInterrupt;
+    }
     if (op1 == 0b111){
         if (op){
-            std::cout << "STC" <<  "\n";
+            decodeLog() << "STC" <<  "\n";
             return placeholder;
         }
-        std::cout << "LDC" <<  "\n";
+        decodeLog() << "LDC" <<  "\n";
         return placeholder;
     }
     if (op1 == 0b110){
-        std::cout << "CDP" <<  "\n";
+        decodeLog() << "CDP" <<  "\n";
         return placeholder;
     }
     return placeholder;
@@ -922,36 +1727,36 @@ ThumbFunc ThumbInstruction::decode(){
     switch (op){
         //0b000xx
         case 0b00000:
-            std::cout << "LSL" << "\n";
+            decodeLog() << "LSL" << "\n";
             return placeholder;
         case 0b00001:
-            std::cout << "LSR" << "\n";
+            decodeLog() << "LSR" << "\n";
             return placeholder;
         case 0b00010:
-            std::cout << "ASR" << "\n";
+            decodeLog() << "ASR" << "\n";
             return placeholder;
         case 0b00011:
             op2 = (op1 >> 2) & 1;
             switch (op2){
                 case 0:
-                    std::cout << "ADD" << "\n";
+                    decodeLog() << "ADD" << "\n";
                     return placeholder;
                 case 1:
-                    std::cout << "SUB" << "\n";
+                    decodeLog() << "SUB" << "\n";
                     return placeholder;
             }
         //0b001xx
         case 0b00100:
-            std::cout << "MOV" << "\n";
+            decodeLog() << "MOV" << "\n";
             return placeholder;
         case 0b00101:
-            std::cout << "CMP" << "\n";
+            decodeLog() << "CMP" << "\n";
             return placeholder;
         case 0b00110:
-            std::cout << "ADD" << "\n";
+            decodeLog() << "ADD" << "\n";
             return placeholder;
         case 0b00111:
-            std::cout << "SUB" << "\n";
+            decodeLog() << "SUB" << "\n";
             return placeholder;
         //0b01000
         case 0b01000:
@@ -962,78 +1767,82 @@ ThumbFunc ThumbInstruction::decode(){
                 switch (op1){
                     case 0b000:
                     case 0b100:
-                        std::cout << "ADD" << "\n";
+                        decodeLog() << "ADD" << "\n";
                         return placeholder;
                     case 0b001:
                     case 0b101:
-                        std::cout << "CMP" << "\n";
+                        decodeLog() << "CMP" << "\n";
                         return placeholder;
                     case 0b010:
                     case 0b110:
-                        std::cout << "MOV" << "\n";
-                        std::cout << "NOP" << "\n";
+                        decodeLog() << "MOV" << "\n";
+                        decodeLog() << "NOP" << "\n";
                         return placeholder;
                     case 0b011:
                     case 0b111:
                         //VERY IMPORTANT: WHEN BIT ZERO OF THE RS VALUE THIS SWITCHES INTO ARM MODE
-                        std::cout << "BX" << "\n";
-                        std::cout << "BLX" << "\n";
-                        return placeholder;
+                        decodeLog() << "BX" << "\n";
+                        decodeLog() << "BLX" << "\n";
+                        //bit 7 set is BLX, ARMv5 only
+                        if (this->data & 0x80){
+                            return placeholder;
+                        }
+                        return &ThumbFunctions::branchExchange;
                 }
             }
             switch (op2){
                 //we use hex here, only time
                 case 0x0:
-                    std::cout << "AND" << "\n";
+                    decodeLog() << "AND" << "\n";
                     return placeholder;
                 case 0x1:
-                    std::cout << "EOR" << "\n";
+                    decodeLog() << "EOR" << "\n";
                     return placeholder;
                 case 0x2:
-                    std::cout << "LSL" << "\n";
+                    decodeLog() << "LSL" << "\n";
                     return placeholder;
                 case 0x3:
-                    std::cout << "LSR" << "\n";
+                    decodeLog() << "LSR" << "\n";
                     return placeholder;
                 case 0x4:
-                    std::cout << "ASR" << "\n";
+                    decodeLog() << "ASR" << "\n";
                     return placeholder;
                 case 0x5:
-                    std::cout << "ADC" << "\n";
+                    decodeLog() << "ADC" << "\n";
                     return placeholder;
                 case 0x6:
-                    std::cout << "SBC" << "\n";
+                    decodeLog() << "SBC" << "\n";
                     return placeholder;
                 case 0x7:
-                    std::cout << "ROR" << "\n";
+                    decodeLog() << "ROR" << "\n";
                     return placeholder;
                 case 0x8:
-                    std::cout << "TST" << "\n";
+                    decodeLog() << "TST" << "\n";
                     return placeholder;
                 case 0x9:
-                    std::cout << "NEG" << "\n";
+                    decodeLog() << "NEG" << "\n";
                     return placeholder;
                 case 0xA:
-                    std::cout << "CMP" << "\n";
+                    decodeLog() << "CMP" << "\n";
                     return placeholder;
                 case 0xB:
-                    std::cout << "CMN" << "\n";
+                    decodeLog() << "CMN" << "\n";
                     return placeholder;
                 case 0xC:
-                    std::cout << "ORR" << "\n";
+                    decodeLog() << "ORR" << "\n";
                     return placeholder;
                 case 0xD:
-                    std::cout << "MUL" << "\n";
+                    decodeLog() << "MUL" << "\n";
                     return placeholder;
                 case 0xE:
-                    std::cout << "BIC" << "\n";
+                    decodeLog() << "BIC" << "\n";
                     return placeholder;
                 case 0xF:
-                    std::cout << "BIC" << "\n";
+                    decodeLog() << "BIC" << "\n";
                     return placeholder;
             }
         case 0b01001:
-            std::cout << "LDR" << "\n";
+            decodeLog() << "LDR" << "\n";
             return placeholder;
         case 0b01010:
             op2 = (op1 >> 2) & 1;
@@ -1041,17 +1850,17 @@ ThumbFunc ThumbInstruction::decode(){
             op3 = (op1 >> 1) & 1;
             if (op2){
                 if (op3){
-                    std::cout << "LDSB" << "\n";
+                    decodeLog() << "LDSB" << "\n";
                     return placeholder;
                 }
-                std::cout << "STRB" << "\n";
+                decodeLog() << "STRB" << "\n";
                 return placeholder;
             }
             if (op3){
-                std::cout << "STRH" << "\n";
+                decodeLog() << "STRH" << "\n";
                 return placeholder;
             }
-            std::cout << "STR" << "\n";
+            decodeLog() << "STR" << "\n";
             return placeholder;
         case 0b01011:
             op2 = (op1 >> 2) & 1;
@@ -1059,171 +1868,4457 @@ ThumbFunc ThumbInstruction::decode(){
             op3 = (op1 >> 1) & 1;
             if (op2){
                 if (op3){
-                    std::cout << "LDSH" << "\n";
+                    decodeLog() << "LDSH" << "\n";
                     return placeholder;
                 }
-                std::cout << "LDRB" << "\n";
+                decodeLog() << "LDRB" << "\n";
                 return placeholder;
             }
             if (op3){
-                std::cout << "LDRH" << "\n";
+                decodeLog() << "LDRH" << "\n";
                 return placeholder;
             }
-            std::cout << "LDR" << "\n";
+            decodeLog() << "LDR" << "\n";
             return placeholder;
         case 0b01100:
-            std::cout << "STR" << "\n";
+            decodeLog() << "STR" << "\n";
             return placeholder;
         case 0b01101:
-            std::cout << "LDR" << "\n";
+            decodeLog() << "LDR" << "\n";
             return placeholder;
         case 0b01110:
-            std::cout << "STRB" << "\n";
+            decodeLog() << "STRB" << "\n";
             return placeholder;
         case 0b01111:
-            std::cout << "LDRB" << "\n";
+            decodeLog() << "LDRB" << "\n";
             return placeholder;
         case 0b10000:
-            std::cout << "STRH" << "\n";
+            decodeLog() << "STRH" << "\n";
             return placeholder;
         case 0b10001:
-            std::cout << "LDRH" << "\n";
+            decodeLog() << "LDRH" << "\n";
             return placeholder;
         case 0b10010:
-            std::cout << "STR" << "\n";
+            decodeLog() << "STR" << "\n";
             return placeholder;
         case 0b10011:
-            std::cout << "LDR" << "\n";
+            decodeLog() << "LDR" << "\n";
             return placeholder;
         case 0b10110:
             op2 = (op1 >> 1) & 0b11;
             if (op2 == 0b10){
-                std::cout << "PUSH" << "\n";
+                decodeLog() << "PUSH" << "\n";
                 return placeholder;
             }
             //Add to stack pointer
-            std::cout << "ADD" << "\n";
+            decodeLog() << "ADD" << "\n";
             return placeholder;
         case 0b10111:
             //get relative address
             op2 = (op1 >> 1) & 0b11;
             if (op2 == 0b10){
-                std::cout << "POP" << "\n";
+                decodeLog() << "POP" << "\n";
+                if (op1 & 1){
+                    return &ThumbFunctions::popPC;
+                }
                 return placeholder;
             }
-            std::cout << "ADD" << "\n";
+            decodeLog() << "ADD" << "\n";
             return placeholder;
         case 0b11000:
-            std::cout << "STMIA" << "\n";
+            decodeLog() << "STMIA" << "\n";
             return placeholder;
         case 0b11001:
-            std::cout << "LDMIA" << "\n";
+            decodeLog() << "LDMIA" << "\n";
             return placeholder;
         case 0b11010:
         case 0b11011:
             op2 = (this->data >> 8) & 0b1111;
             switch (op2){
                 case 0x0:
-                    std::cout << "BEQ" << "\n";
-                    return placeholder;
+                    decodeLog() << "BEQ" << "\n";
+                    return &ThumbFunctions::conditionalBranch;
                 case 0x1:
-                    std::cout << "BNE" << "\n";
-                    return placeholder;
+                    decodeLog() << "BNE" << "\n";
+                    return &ThumbFunctions::conditionalBranch;
                 case 0x2:
-                    std::cout << "BCS" << "\n";
-                    std::cout << "BHS" << "\n";
-                    return placeholder;
+                    decodeLog() << "BCS" << "\n";
+                    decodeLog() << "BHS" << "\n";
+                    return &ThumbFunctions::conditionalBranch;
                 case 0x3:
-                    std::cout << "BCC" << "\n";
-                    std::cout << "BLO" << "\n";
-                    return placeholder;
+                    decodeLog() << "BCC" << "\n";
+                    decodeLog() << "BLO" << "\n";
+                    return &ThumbFunctions::conditionalBranch;
                 case 0x4:
-                    std::cout << "BMI" << "\n";
-                    return placeholder;
+                    decodeLog() << "BMI" << "\n";
+                    return &ThumbFunctions::conditionalBranch;
                 case 0x5:
-                    std::cout << "BPL" << "\n";
-                    return placeholder;
+                    decodeLog() << "BPL" << "\n";
+                    return &ThumbFunctions::conditionalBranch;
                 case 0x6:
-                    std::cout << "BVS" << "\n";
-                    return placeholder;
+                    decodeLog() << "BVS" << "\n";
+                    return &ThumbFunctions::conditionalBranch;
                 case 0x7:
-                    std::cout << "BVC" << "\n";
-                    return placeholder;
+                    decodeLog() << "BVC" << "\n";
+                    return &ThumbFunctions::conditionalBranch;
                 case 0x8:
-                    std::cout << "BHI" << "\n";
-                    return placeholder;
+                    decodeLog() << "BHI" << "\n";
+                    return &ThumbFunctions::conditionalBranch;
                 case 0x9:
-                    std::cout << "BLS" << "\n";
-                    return placeholder;
+                    decodeLog() << "BLS" << "\n";
+                    return &ThumbFunctions::conditionalBranch;
                 case 0xA:
-                    std::cout << "BGE" << "\n";
-                    return placeholder;
+                    decodeLog() << "BGE" << "\n";
+                    return &ThumbFunctions::conditionalBranch;
                 case 0xB:
-                    std::cout << "BLT" << "\n";
-                    return placeholder;
+                    decodeLog() << "BLT" << "\n";
+                    return &ThumbFunctions::conditionalBranch;
                 case 0xC:
-                    std::cout << "BGT" << "\n";
-                    return placeholder;
+                    decodeLog() << "BGT" << "\n";
+                    return &ThumbFunctions::conditionalBranch;
                 case 0xD:
-                    std::cout << "BLE" << "\n";
-                    return placeholder;
+                    decodeLog() << "BLE" << "\n";
+                    return &ThumbFunctions::conditionalBranch;
                 case 0xF:
-                    std::cout << "SWI" << "\n";
-                    return placeholder;
+                    decodeLog() << "SWI" << "\n";
+                    return &ThumbFunctions::softwareInterrupt;
             }
         case 0b11100:
-            std::cout << "B" << "\n";
-            return placeholder;
+            decodeLog() << "B" << "\n";
+            return &ThumbFunctions::branch;
         case 0b11110:
             //IMPORTANT this is 2 instructions, 32 bit
             //First half
-            std::cout << "BL" << "\n";
-            std::cout << "BLX" << "\n";
-            return placeholder;
+            decodeLog() << "BL" << "\n";
+            decodeLog() << "BLX" << "\n";
+            return &ThumbFunctions::branchLinkHigh;
         case 0b11111:
-            std::cout << "BL" << "\n";
-            return placeholder;
+            decodeLog() << "BL" << "\n";
+            return &ThumbFunctions::branchLink;
         case 0b11101:
-            std::cout << "BLX" << "\n";
+            decodeLog() << "BLX" << "\n";
             return placeholder;
         default:
-            std::cout << "PLACEHOLDER" << "\n";
+            decodeLog() << "PLACEHOLDER" << "\n";
             return placeholder;
     }
 }
 /*
-* BEGIN INSTRUCTION TEST METHODS
-*   testDecode: used when a python test module spawns a process using a integer
-*   instruction. Converts the instruction to a uint32_t and passes it through the instructions
-*   decode methods. On the python side it expects the proper instruction and asserts the correct
-*   instruction is printed.
+* BEGIN THUMB FUNCTIONS METHODS
 */
-void InstructionTests::testDecode(char* strInstruction){
-    std::cout << "String instruction of: " << strInstruction <<"\n";
-    uint32_t instruction = (uint32_t)std::strtol(strInstruction, NULL, 10);
-    std::bitset<32> y(instruction);
-    std::cout << "Recieved instruction of: " << y <<"\n";
-    Instruction instrct = Instruction(instruction);
-    instrct.decode();
+void ThumbFunctions::softwareInterrupt(uint16_t data){
+    //comment field is the low byte
+    CPU::getActive()->softwareInterrupt(data & 0xFF);
 }
-void InstructionTests::testThumbDecode(char* strInstruction){
-    std::cout << "String instruction of: " << strInstruction <<"\n";
-    uint16_t instruction = (uint16_t)std::strtol(strInstruction, NULL, 10);
-    std::bitset<16> y(instruction);
-    std::cout << "Recieved instruction of: " << y <<"\n";
-    ThumbInstruction instrct = ThumbInstruction(instruction);
-    instrct.decode();
+void ThumbFunctions::branch(uint16_t data){
+    RegisterFile* registers = CPU::getActive()->getRegisters();
+    //11 bit offset in halfwords from PC, which is this instruction plus 4
+    int32_t offset = (int32_t)((uint32_t)data << 21) >> 20;
+    registers->branch(registers->getRegister(RegisterFile::PC) + offset);
 }
-void InstructionTests::runTests(int argc, char** argv){
-    if (strcmp( argv[1], "-t") == 0){
-        std::cout << "Decoding Thumb Instruction" <<"\n";
-        testThumbDecode(argv[2]);
+void ThumbFunctions::conditionalBranch(uint16_t data){
+    RegisterFile* registers = CPU::getActive()->getRegisters();
+    if (!registers->conditionPassed((data >> 8) & 0xF)){
         return;
     }
-    testDecode(argv[1]);
+    int32_t offset = (int32_t)((uint32_t)data << 24) >> 23;
+    registers->branch(registers->getRegister(RegisterFile::PC) + offset);
 }
-int main(int argc, char** argv){
-    std::cout << "Starting" << "\n";
+void ThumbFunctions::branchLinkHigh(uint16_t data){
+    RegisterFile* registers = CPU::getActive()->getRegisters();
+    //PC is this half plus 4, which is what the offset counts from
+    int32_t offset = (int32_t)((uint32_t)data << 21) >> 9;
+    registers->setRegister(RegisterFile::LR, registers->getRegister(RegisterFile::PC) + offset);
+}
+void ThumbFunctions::branchLink(uint16_t data){
+    CPU* cpu = CPU::getActive();
+    RegisterFile* registers = cpu->getRegisters();
+    //returns to the halfword after this one, bit 0 set to come back in THUMB
+    uint32_t next = registers->getRegister(RegisterFile::PC) - 2;
+    uint32_t target = registers->getRegister(RegisterFile::LR) + ((data & 0x7FF) << 1);
+    registers->setRegister(RegisterFile::LR, next | 1);
+    registers->branch(target);
+    if (cpu->getProfiler()->isRunning()){
+        cpu->getProfiler()->call(target, next | 1);
+    }
+}
+void ThumbFunctions::branchExchange(uint16_t data){
+    CPU* cpu = CPU::getActive();
+    RegisterFile* registers = cpu->getRegisters();
+    uint32_t target = registers->getRegister((data >> 3) & 0xF);
+    //bit 0 picks the state, clear goes back to ARM
+    registers->setCPSR((registers->getCPSR() & ~RegisterFile::THUMB) | ((target & 1) ? (uint32_t)RegisterFile::THUMB : 0));
+    registers->branch(target);
+    //BX LR or the POP {r3}; BX r3 a return through a low register compiles to
+    if (cpu->getProfiler()->isRunning()){
+        cpu->getProfiler()->ret(target);
+    }
+}
+void ThumbFunctions::popPC(uint16_t data){
+    CPU* cpu = CPU::getActive();
+    RegisterFile* registers = cpu->getRegisters();
+    Memory* memory = cpu->getMemory();
+    uint32_t sp = registers->getRegister(RegisterFile::SP);
+    for (uint8_t i = 0; i < 8; i++){
+        if (data & (1 << i)){
+            registers->setRegister(i, memory->load32(sp));
+            sp += 4;
+        }
+    }
+    //no interworking on the ARM7, POP {pc} stays in THUMB whatever bit 0 is
+    uint32_t target = memory->load32(sp);
+    registers->setRegister(RegisterFile::SP, sp + 4);
+    registers->branch(target);
+    if (cpu->getProfiler()->isRunning()){
+        cpu->getProfiler()->ret(target);
+    }
+}
+/*
+* BEGIN BRANCH FUNCTIONS METHODS
+*/
+void BranchFunctions::softwareInterrupt(uint32_t data){
+    CPU* cpu = CPU::getActive();
+    if (!cpu->getRegisters()->conditionPassed(data >> 28)){
+        return;
+    }
+    //the BIOS reads the comment from the top byte of the field, swi 0x60000 is Div
+    cpu->softwareInterrupt((data >> 16) & 0xFF);
+}
+void BranchFunctions::branch(uint32_t data){
+    RegisterFile* registers = CPU::getActive()->getRegisters();
+    if (!registers->conditionPassed(data >> 28)){
+        return;
+    }
+    int32_t offset = (int32_t)(data << 8) >> 6;
+    registers->branch(registers->getRegister(RegisterFile::PC) + offset);
+}
+void BranchFunctions::branchLink(uint32_t data){
+    CPU* cpu = CPU::getActive();
+    RegisterFile* registers = cpu->getRegisters();
+    if (!registers->conditionPassed(data >> 28)){
+        return;
+    }
+    //PC is this instruction plus 8, which is what the offset counts from
+    uint32_t pc = registers->getRegister(RegisterFile::PC);
+    int32_t offset = (int32_t)(data << 8) >> 6;
+    registers->setRegister(RegisterFile::LR, pc - 4);
+    registers->branch(pc + offset);
+    if (cpu->getProfiler()->isRunning()){
+        cpu->getProfiler()->call(pc + offset, pc - 4);
+    }
+}
+void BranchFunctions::branchExchange(uint32_t data){
+    CPU* cpu = CPU::getActive();
+    RegisterFile* registers = cpu->getRegisters();
+    if (!registers->conditionPassed(data >> 28)){
+        return;
+    }
+    uint32_t target = registers->getRegister(data & 0xF);
+    registers->setCPSR((registers->getCPSR() & ~RegisterFile::THUMB) | ((target & 1) ? (uint32_t)RegisterFile::THUMB : 0));
+    registers->branch(target);
+    if (cpu->getProfiler()->isRunning()){
+        cpu->getProfiler()->ret(target);
+    }
+}
+void BranchFunctions::popPC(uint32_t data){
+    CPU* cpu = CPU::getActive();
+    RegisterFile* registers = cpu->getRegisters();
+    if (!registers->conditionPassed(data >> 28)){
+        return;
+    }
+    Memory* memory = cpu->getMemory();
+    uint32_t sp = registers->getRegister(RegisterFile::SP);
+    //written back first, SP in the list (unpredictable) ends up with the loaded value
+    registers->setRegister(RegisterFile::SP, sp + 4 * __builtin_popcount(data & 0xFFFF));
+    for (uint8_t i = 0; i < 15; i++){
+        if (data & (1 << i)){
+            registers->setRegister(i, memory->load32(sp));
+            sp += 4;
+        }
+    }
+    //LDM does not interwork on the ARM7, the low bits are dropped
+    uint32_t target = memory->load32(sp);
+    registers->branch(target);
+    if (cpu->getProfiler()->isRunning()){
+        cpu->getProfiler()->ret(target);
+    }
+}
+/*
+* BEGIN DECODE HANDLERS METHODS
+*/
+template <typename T>
+uint16_t DecodeHandlers::intern(T* table, std::atomic<uint16_t>* count, std::atomic<uintptr_t>* keys, uint16_t* indices, T func){
+    uintptr_t key = (uintptr_t)func;
+    if (!key){
+        return NONE;
+    }
+    //a slot's index is written before its key, so whoever sees the key sees the index
+    uint32_t slot = (uint32_t)(((uint64_t)key * 0x9E3779B97F4A7C15ull) >> (64 - MAP_BITS));
+    for (;; slot = (slot + 1) & (MAP_SLOTS - 1)){
+        uintptr_t found = keys[slot].load(std::memory_order_acquire);
+        if (found == key){
+            return indices[slot];
+        }
+        if (!found){
+            break;
+        }
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    //slots only fill under the lock, whatever was added since is further along this probe
+    for (;; slot = (slot + 1) & (MAP_SLOTS - 1)){
+        uintptr_t found = keys[slot].load(std::memory_order_relaxed);
+        if (found == key){
+            return indices[slot];
+        }
+        if (!found){
+            break;
+        }
+    }
+    //the placeholder is numbered from the start but has no slot until it is first asked for
+    uint16_t total = count->load(std::memory_order_relaxed);
+    uint16_t index = total;
+    for (uint16_t i = 1; i < total; i++){
+        if (table[i] == func){
+            index = i;
+            break;
+        }
+    }
+    if (index == total){
+        if (total == MAX_HANDLERS){
+            return PLACEHOLDER;
+        }
+        table[total] = func;
+        count->store(total + 1, std::memory_order_release);
+    }
+    indices[slot] = index;
+    keys[slot].store(key, std::memory_order_release);
+    return index;
+}
+uint16_t DecodeHandlers::armIndex(Func func){
+    return intern(armTable, &armCount, armKeys, armIndices, func);
+}
+uint16_t DecodeHandlers::thumbIndex(ThumbFunc func){
+    return intern(thumbTable, &thumbCount, thumbKeys, thumbIndices, func);
+}
+Func DecodeHandlers::arm(uint16_t index){
+    return armTable[index];
+}
+ThumbFunc DecodeHandlers::thumb(uint16_t index){
+    return thumbTable[index];
+}
+/*
+* BEGIN ROM DECODE METHODS
+*/
+std::shared_ptr<const RomDecode> RomDecode::get(const uint8_t* rom, uint32_t length){
+    //one entry per ROM, weak in the registry so a ROM nobody runs any more is freed, the key outlives it;
+    //what get() hands out shares ownership of the entry
+    struct Entry {
+        std::once_flag built;
+        std::unique_ptr<const RomDecode> decode;
+    };
+    static std::mutex lock;
+    static std::map<std::pair<uint64_t, uint32_t>, std::weak_ptr<Entry> > registry;
+    uint64_t romHash = hash(rom, length);
+    std::shared_ptr<Entry> entry;
+    {
+        //held only to find or add the entry, instances of other ROMs never wait on a decode
+        std::lock_guard<std::mutex> guard(lock);
+        std::weak_ptr<Entry>& slot = registry[std::make_pair(romHash, length)];
+        entry = slot.lock();
+        if (!entry){
+            entry = std::make_shared<Entry>();
+            slot = entry;
+        }
+    }
+    //a second instance of the same ROM waits here for the first instead of making its own
+    std::call_once(entry->built, [&](){
+        entry->decode.reset(new RomDecode(length, romHash));
+    });
+    return std::shared_ptr<const RomDecode>(entry, entry->decode.get());
+}
+RomDecode::RomDecode(uint32_t length, uint64_t hash){
+    this->romHash = hash;
+    this->length = length;
+    uint32_t pages = (length + Memory::PAGE_SIZE - 1) / Memory::PAGE_SIZE;
+    this->armPages.reset(new std::atomic<DecodedInstruction*>[pages]);
+    this->thumbPages.reset(new std::atomic<DecodedInstruction*>[pages]);
+    for (uint32_t i = 0; i < pages; i++){
+        armPages[i].store(0, std::memory_order_relaxed);
+        thumbPages[i].store(0, std::memory_order_relaxed);
+    }
+    this->pageCount.store(0);
+    builds.fetch_add(1);
+}
+const DecodedInstruction* RomDecode::getArm(uint32_t offset, const uint8_t* rom) const{
+    if (offset / 4 >= length / 4){
+        return 0;
+    }
+    const DecodedInstruction* page = armPages[offset / Memory::PAGE_SIZE].load(std::memory_order_acquire);
+    if (!page){
+        page = decodePage(offset / Memory::PAGE_SIZE, false, rom);
+    }
+    return &page[(offset & (Memory::PAGE_SIZE - 1)) / 4];
+}
+const DecodedInstruction* RomDecode::getThumb(uint32_t offset, const uint8_t* rom) const{
+    if (offset / 2 >= length / 2){
+        return 0;
+    }
+    const DecodedInstruction* page = thumbPages[offset / Memory::PAGE_SIZE].load(std::memory_order_acquire);
+    if (!page){
+        page = decodePage(offset / Memory::PAGE_SIZE, true, rom);
+    }
+    return &page[(offset & (Memory::PAGE_SIZE - 1)) / 2];
+}
+const DecodedInstruction* RomDecode::decodePage(uint32_t page, bool thumb, const uint8_t* rom) const{
+    std::lock_guard<std::mutex> guard(lock);
+    std::atomic<DecodedInstruction*>& slot = thumb ? thumbPages[page] : armPages[page];
+    //whoever held the lock before us may have just decoded it
+    DecodedInstruction* entries = slot.load(std::memory_order_relaxed);
+    if (entries){
+        return entries;
+    }
+    uint32_t start = page * Memory::PAGE_SIZE;
+    uint32_t end = length - start < Memory::PAGE_SIZE ? length : start + Memory::PAGE_SIZE;
+    if (thumb){
+        entries = arena.allocate(Memory::PAGE_SIZE / 2);
+        for (uint32_t offset = start; offset + 2 <= end; offset += 2){
+            uint16_t data;
+            memcpy(&data, rom + offset, 2);
+            decodeThumb(data, &entries[(offset - start) / 2]);
+        }
+    } else {
+        entries = arena.allocate(Memory::PAGE_SIZE / 4);
+        for (uint32_t offset = start; offset + 4 <= end; offset += 4){
+            uint32_t data;
+            memcpy(&data, rom + offset, 4);
+            decodeArm(data, &entries[(offset - start) / 4]);
+        }
+    }
+    //every entry is written before a reader without the lock can see the page
+    slot.store(entries, std::memory_order_release);
+    pageCount.fetch_add(1);
+    return entries;
+}
+uint64_t RomDecode::getHash() const{
+    return romHash;
+}
+uint32_t RomDecode::getLength() const{
+    return length;
+}
+uint64_t RomDecode::getBytes() const{
+    std::lock_guard<std::mutex> guard(lock);
+    uint32_t pages = (length + Memory::PAGE_SIZE - 1) / Memory::PAGE_SIZE;
+    return sizeof(RomDecode) + (uint64_t)pages * 2 * sizeof(std::atomic<DecodedInstruction*>) + arena.getBytes();
+}
+uint32_t RomDecode::getPageCount() const{
+    return pageCount.load();
+}
+uint64_t RomDecode::hash(const uint8_t* data, uint32_t length){
+    uint64_t value = 0xCBF29CE484222325ull;
+    for (uint32_t i = 0; i < length; i++){
+        value = (value ^ data[i]) * 0x100000001B3ull;
+    }
+    return value;
+}
+uint32_t RomDecode::getBuildCount(){
+    return builds.load();
+}
+Func RomDecode::decodeArm(uint32_t data){
+    bool quiet = quietDecode;
+    quietDecode = true;
+    Instruction instruction(data);
+    Func func = instruction.decode();
+    quietDecode = quiet;
+    return func;
+}
+ThumbFunc RomDecode::decodeThumb(uint16_t data){
+    bool quiet = quietDecode;
+    quietDecode = true;
+    ThumbFunc func = ThumbInstruction(data).decode();
+    quietDecode = quiet;
+    return func;
+}
+void RomDecode::decodeArm(uint32_t data, DecodedInstruction* entry){
+    entry->handler = DecodeHandlers::armIndex(decodeArm(data));
+    entry->data = data;
+    entry->condition = data >> 28;
+    entry->rn = (data >> 16) & 0xF;
+    entry->rd = (data >> 12) & 0xF;
+    entry->rm = data & 0xF;
+    //bit 4 set is a shift by Rs (or a multiply/halfword transfer, where 8 -> 11 is Rs too)
+    uint8_t type = ((data >> 5) & 3) << 5;
+    entry->shift = (data & 0x10) ? (DecodedInstruction::SHIFT_BY_REGISTER | type | ((data >> 8) & 0xF)) : (type | ((data >> 7) & 0x1F));
+    entry->imm = 0;
+    entry->cycles = 1;
+    bool load = (data >> 20) & 1;
+    switch ((data >> 25) & 7){
+        case 0b000:
+            if ((data & 0x0F0000F0) == 0x00000090){
+                //MUL/MLA and the long forms: Rd (RdHi) is 16 -> 19 and Rn (RdLo) 12 -> 15, the
+                //multiplier's own cycles depend on Rs and are added as it runs
+                entry->rd = (data >> 16) & 0xF;
+                entry->rn = (data >> 12) & 0xF;
+                entry->cycles = 1 + ((data >> 21) & 1) + ((data >> 23) & 1);
+            } else if ((data & 0x0F900090) == 0x01000080){
+                //the ARMv5TE halfword multiplies, same registers as above, SMLALxy issues over two cycles
+                entry->rd = (data >> 16) & 0xF;
+                entry->rn = (data >> 12) & 0xF;
+                entry->cycles = ((data >> 21) & 3) == 0b10 ? 2 : 1;
+            } else if ((data & 0x0FB00FF0) == 0x01000090){
+                //SWP
+                entry->cycles = 4;
+            } else if ((data & 0x0FFFFFF0) == 0x012FFF10){
+                //BX
+                entry->cycles = 3;
+            } else if ((data & 0x90) == 0x90){
+                //halfword and signed transfers, bit 22 is the split immediate
+                entry->imm = (data & (1 << 22)) ? (((data >> 4) & 0xF0) | (data & 0xF)) : 0;
+                entry->cycles = load ? (entry->rd == 15 ? 5 : 3) : 2;
+            } else {
+                //data processing with a register, a shift by register takes an extra internal cycle
+                bool test = ((data >> 23) & 3) == 0b10;
+                entry->cycles = 1 + ((data >> 4) & 1) + (entry->rd == 15 && !test ? 2 : 0);
+            }
+            break;
+        case 0b001: {
+            //data processing immediate, an 8 bit value rotated right by twice bits 8 -> 11
+            uint32_t rotate = ((data >> 8) & 0xF) * 2;
+            uint32_t value = data & 0xFF;
+            entry->imm = rotate ? (value >> rotate) | (value << (32 - rotate)) : value;
+            bool test = ((data >> 23) & 3) == 0b10;
+            entry->cycles = entry->rd == 15 && !test ? 3 : 1;
+            break;
+        }
+        case 0b010:
+        case 0b011:
+            //LDR/STR, the offset is the shifted register when bit 25 is set
+            entry->imm = (data & (1 << 25)) ? 0 : data & 0xFFF;
+            entry->cycles = load ? (entry->rd == 15 ? 5 : 3) : 2;
+            break;
+        case 0b100: {
+            //LDM/STM, one cycle per register
+            entry->imm = data & 0xFFFF;
+            uint8_t count = __builtin_popcount(data & 0xFFFF);
+            entry->cycles = load ? count + ((data >> 15) & 1 ? 4 : 2) : count + 1;
+            break;
+        }
+        case 0b101:
+            //B/BL, offset in words from PC
+            entry->imm = (uint32_t)((int32_t)(data << 8) >> 6);
+            entry->cycles = 3;
+            break;
+        case 0b111:
+            if (data & (1 << 24)){
+                //SWI comment, the byte the BIOS reads out of the field
+                entry->imm = (data >> 16) & 0xFF;
+                entry->cycles = 3;
+            }
+            break;
+    }
+}
+void RomDecode::decodeThumb(uint16_t data, DecodedInstruction* entry){
+    entry->handler = DecodeHandlers::thumbIndex(decodeThumb(data));
+    entry->data = data;
+    entry->condition = 0xE;
+    //the usual places, formats that keep them elsewhere move them below
+    entry->rd = data & 7;
+    entry->rn = (data >> 3) & 7;
+    entry->rm = (data >> 6) & 7;
+    entry->shift = 0;
+    entry->imm = 0;
+    entry->cycles = 1;
+    uint8_t op = (data >> 11) & 0x1F;
+    bool load = (data >> 11) & 1;
+    switch (op){
+        case 0b00000:
+        case 0b00001:
+        case 0b00010:
+            //LSL/LSR/ASR by an immediate
+            entry->shift = (op << 5) | ((data >> 6) & 0x1F);
+            entry->imm = (data >> 6) & 0x1F;
+            break;
+        case 0b00011:
+            //ADD/SUB, register or 3 bit immediate
+            entry->imm = (data & (1 << 10)) ? (data >> 6) & 7 : 0;
+            break;
+        case 0b00100:
+        case 0b00101:
+        case 0b00110:
+        case 0b00111:
+            //MOV/CMP/ADD/SUB with an 8 bit immediate
+            entry->rd = (data >> 8) & 7;
+            entry->rn = entry->rd;
+            entry->imm = data & 0xFF;
+            break;
+        case 0b01000:
+            entry->rm = (data >> 3) & 7;
+            if (data & (1 << 10)){
+                //hi register operations and BX, H1/H2 are bits 7 and 6
+                entry->rd = (data & 7) | ((data >> 4) & 8);
+                entry->rm = (data >> 3) & 0xF;
+                entry->rn = entry->rd;
+                bool bx = ((data >> 8) & 3) == 3;
+                entry->cycles = bx || (entry->rd == 15 && ((data >> 8) & 3) != 1) ? 3 : 1;
+            } else {
+                //ALU, the shifts by register (LSL/LSR/ASR/ROR) take an extra internal cycle
+                uint8_t alu = (data >> 6) & 0xF;
+                entry->rn = entry->rd;
+                entry->cycles = (alu >= 2 && alu <= 4) || alu == 7 ? 2 : 1;
+            }
+            break;
+        case 0b01001:
+            //LDR PC relative
+            entry->rd = (data >> 8) & 7;
+            entry->rn = 15;
+            entry->imm = (data & 0xFF) << 2;
+            entry->cycles = 3;
+            break;
+        case 0b01010:
+        case 0b01011:
+            //register offset, bit 11 and up are loads except STRH/STRB/STR in the first half
+            entry->cycles = ((data >> 9) & 7) >= 3 ? 3 : 2;
+            break;
+        case 0b01100:
+        case 0b01101:
+            //word offset, scaled
+            entry->imm = ((data >> 6) & 0x1F) << 2;
+            entry->cycles = load ? 3 : 2;
+            break;
+        case 0b01110:
+        case 0b01111:
+            entry->imm = (data >> 6) & 0x1F;
+            entry->cycles = load ? 3 : 2;
+            break;
+        case 0b10000:
+        case 0b10001:
+            entry->imm = ((data >> 6) & 0x1F) << 1;
+            entry->cycles = load ? 3 : 2;
+            break;
+        case 0b10010:
+        case 0b10011:
+            //SP relative
+            entry->rd = (data >> 8) & 7;
+            entry->rn = 13;
+            entry->imm = (data & 0xFF) << 2;
+            entry->cycles = load ? 3 : 2;
+            break;
+        case 0b10100:
+        case 0b10101:
+            //ADD rd, PC/SP, #imm
+            entry->rd = (data >> 8) & 7;
+            entry->rn = load ? 13 : 15;
+            entry->imm = (data & 0xFF) << 2;
+            break;
+        case 0b10110:
+        case 0b10111:
+            entry->rd = 13;
+            entry->rn = 13;
+            if (((data >> 9) & 3) == 0b10){
+                //PUSH/POP, the R bit (LR or PC) is bit 8 of the list
+                entry->imm = data & 0x1FF;
+                uint8_t count = __builtin_popcount(data & 0x1FF);
+                entry->cycles = load ? count + ((data >> 8) & 1 ? 4 : 2) : count + 1;
+            } else {
+                //ADD SP, #+-imm
+                entry->imm = (data & 0x7F) << 2;
+            }
+            break;
+        case 0b11000:
+        case 0b11001: {
+            //STMIA/LDMIA
+            entry->rn = (data >> 8) & 7;
+            entry->imm = data & 0xFF;
+            uint8_t count = __builtin_popcount(data & 0xFF);
+            entry->cycles = load ? count + 2 : count + 1;
+            break;
+        }
+        case 0b11010:
+        case 0b11011:
+            if (((data >> 8) & 0xF) == 0xF){
+                //SWI comment field
+                entry->imm = data & 0xFF;
+                entry->cycles = 3;
+            } else {
+                //B<cond>, what it takes when taken
+                entry->condition = (data >> 8) & 0xF;
+                entry->imm = (uint32_t)((int32_t)((uint32_t)data << 24) >> 23);
+                entry->cycles = 3;
+            }
+            break;
+        case 0b11100:
+            entry->imm = (uint32_t)((int32_t)((uint32_t)data << 21) >> 20);
+            entry->cycles = 3;
+            break;
+        case 0b11110:
+            //BL first half, the high part of the offset
+            entry->imm = (uint32_t)((int32_t)((uint32_t)data << 21) >> 9);
+            break;
+        case 0b11111:
+            //BL second half, the low part
+            entry->imm = (data & 0x7FF) << 1;
+            entry->cycles = 3;
+            break;
+    }
+}
+/*
+* BEGIN DECODE CACHE METHODS
+*/
+DecodeCache::DecodeCache(Memory* memory) : ramPages(Memory::IO_PAGE){
+    this->memory = memory;
+    memset(&scratch, 0, sizeof(scratch));
+    for (uint32_t i = 0; i < ramPages.size(); i++){
+        ramPages[i] = {0, 0};
+    }
+    this->romData = 0;
+    this->romLength = 0;
+    this->ramDecodes = 0;
+}
+void DecodeCache::attachRom(){
+    romData = memory->getRom();
+    romLength = memory->getRomSize();
+    rom = romData ? RomDecode::get(romData, romLength) : std::shared_ptr<const RomDecode>();
+}
+const RomDecode* DecodeCache::getRomDecode(){
+    return rom.get();
+}
+bool DecodeCache::romInRange(uint32_t address, uint8_t width, uint32_t* offset){
+    uint8_t region = (address >> 24) & 0xF;
+    if (region < Memory::ROM || region >= Memory::SRAM){
+        return false;
+    }
+    if (memory->getRom() != romData || memory->getRomSize() != romLength){
+        attachRom();
+    }
+    //the bus mirrors the cartridge past its end, those few are decoded uncached
+    *offset = address & 0x1FFFFFF;
+    return rom && *offset + width <= romLength;
+}
+DecodeCache::RamPage* DecodeCache::getRamPage(uint32_t address, uint32_t* offset){
+    uint8_t region = (address >> 24) & 0xF;
+    uint32_t page;
+    if (region == Memory::EWRAM){
+        *offset = address & (Memory::EWRAM_SIZE - 1);
+        page = Memory::EWRAM_PAGE + *offset / Memory::PAGE_SIZE;
+    } else if (region == Memory::IWRAM){
+        *offset = address & (Memory::IWRAM_SIZE - 1);
+        page = Memory::IWRAM_PAGE + *offset / Memory::PAGE_SIZE;
+    } else {
+        return 0;
+    }
+    RamPage& entry = ramPages[page];
+    if (!entry.arm){
+        //handler 0 is not decoded yet, which is what the arena hands out
+        entry.arm = arena.allocate(Memory::PAGE_SIZE / 4);
+        entry.thumb = arena.allocate(Memory::PAGE_SIZE / 2);
+    }
+    *offset &= Memory::PAGE_SIZE - 1;
+    return &entry;
+}
+const DecodedInstruction* DecodeCache::getArmEntry(uint32_t address){
+    address &= ~3u;
+    uint32_t offset;
+    if (romInRange(address, 4, &offset)){
+        return rom->getArm(offset, romData);
+    }
+    RamPage* page = getRamPage(address, &offset);
+    if (!page){
+        RomDecode::decodeArm(memory->peek(address, 4), &scratch);
+        return &scratch;
+    }
+    DecodedInstruction* entry = &page->arm[offset / 4];
+    //a fetch, not a data read, so no watchpoint sees it
+    uint32_t data = memory->peek(address, 4);
+    if (!entry->handler || entry->data != data){
+        RomDecode::decodeArm(data, entry);
+        ramDecodes++;
+    }
+    return entry;
+}
+const DecodedInstruction* DecodeCache::getThumbEntry(uint32_t address){
+    address &= ~1u;
+    uint32_t offset;
+    if (romInRange(address, 2, &offset)){
+        return rom->getThumb(offset, romData);
+    }
+    RamPage* page = getRamPage(address, &offset);
+    if (!page){
+        RomDecode::decodeThumb(memory->peek(address, 2), &scratch);
+        return &scratch;
+    }
+    DecodedInstruction* entry = &page->thumb[offset / 2];
+    uint16_t data = memory->peek(address, 2);
+    if (!entry->handler || entry->data != data){
+        RomDecode::decodeThumb(data, entry);
+        ramDecodes++;
+    }
+    return entry;
+}
+Func DecodeCache::getArm(uint32_t address){
+    return DecodeHandlers::arm(getArmEntry(address)->handler);
+}
+ThumbFunc DecodeCache::getThumb(uint32_t address){
+    return DecodeHandlers::thumb(getThumbEntry(address)->handler);
+}
+void DecodeCache::flush(){
+    arena.reset();
+    for (uint32_t i = 0; i < ramPages.size(); i++){
+        ramPages[i] = {0, 0};
+    }
+}
+uint64_t DecodeCache::getRamBytes(){
+    return ramPages.size() * sizeof(RamPage) + arena.getBytes();
+}
+uint64_t DecodeCache::getRamDecodes(){
+    return ramDecodes;
+}
+/*
+* BEGIN INSTRUCTION TEST METHODS
+*   testDecode: used when a python test module spawns a process using a integer
+*   instruction. Converts the instruction to a uint32_t and passes it through the instructions
+*   decode methods. On the python side it expects the proper instruction and asserts the correct
+*   instruction is printed.
+*/
+void InstructionTests::testDecode(char* strInstruction){
+    std::cout << "String instruction of: " << strInstruction <<"\n";
+    uint32_t instruction = (uint32_t)std::strtol(strInstruction, NULL, 10);
+    std::bitset<32> y(instruction);
+    std::cout << "Recieved instruction of: " << y <<"\n";
+    Instruction instrct = Instruction(instruction);
+    instrct.decode();
+}
+void InstructionTests::testThumbDecode(char* strInstruction){
+    std::cout << "String instruction of: " << strInstruction <<"\n";
+    uint16_t instruction = (uint16_t)std::strtol(strInstruction, NULL, 10);
+    std::bitset<16> y(instruction);
+    std::cout << "Recieved instruction of: " << y <<"\n";
+    ThumbInstruction instrct = ThumbInstruction(instruction);
+    instrct.decode();
+}
+void InstructionTests::runTests(int argc, char** argv){
+    if (strcmp( argv[1], "-t") == 0){
+        std::cout << "Decoding Thumb Instruction" <<"\n";
+        testThumbDecode(argv[2]);
+        return;
+    }
+    if (strcmp( argv[1], "-s") == 0){
+        HardwareTests::runTest(argv[2]);
+        return;
+    }
+    if (strcmp( argv[1], "-b") == 0){
+        HardwareBenchmarks::run(argv[2]);
+        return;
+    }
+    testDecode(argv[1]);
+}
+/*
+* BEGIN HARDWARE TEST METHODS
+*   Each test returns true on success, runTest prints the result in the form
+*   the python side expects.
+*/
+//records the order events fire in for testScheduler
+struct SchedulerTestLog {
+    Scheduler* scheduler;
+    int fired[64];
+    uint64_t firedAt[64];
+    int count;
+};
+static void schedulerTestEvent(void* context, uint64_t late){
+    SchedulerTestLog* log = (SchedulerTestLog*)context;
+    log->fired[log->count] = 0;
+    log->firedAt[log->count] = log->scheduler->getCycles() - late;
+    log->count++;
+}
+static void schedulerTestRepeat(void* context, uint64_t late){
+    SchedulerTestLog* log = (SchedulerTestLog*)context;
+    log->fired[log->count] = 1;
+    log->firedAt[log->count] = log->scheduler->getCycles() - late;
+    log->count++;
+    //reschedule relative to when it should have fired so lateness never drifts
+    log->scheduler->schedule(Scheduler::HBLANK, log->scheduler->getCycles() - late + 100);
+}
+bool HardwareTests::testScheduler(){
+    Scheduler scheduler;
+    //heap order under random schedule/cancel/reschedule
+    uint32_t seed = 12345;
+    uint64_t expected[Scheduler::EVENT_COUNT];
+    bool pending[Scheduler::EVENT_COUNT] = {};
+    for (int round = 0; round < 2000; round++){
+        seed = seed * 1103515245 + 12345;
+        Scheduler::eventType type = (Scheduler::eventType)((seed >> 16) % Scheduler::EVENT_COUNT);
+        seed = seed * 1103515245 + 12345;
+        if ((seed >> 16) % 4 == 0){
+            scheduler.cancel(type);
+            pending[type] = false;
+        } else {
+            expected[type] = (seed >> 8) % 5000;
+            scheduler.schedule(type, expected[type]);
+            pending[type] = true;
+        }
+        uint64_t minimum = UINT64_MAX;
+        for (int i = 0; i < Scheduler::EVENT_COUNT; i++){
+            if (pending[i] != scheduler.isScheduled((Scheduler::eventType)i)){
+                return false;
+            }
+            if (pending[i] && expected[i] < minimum){
+                minimum = expected[i];
+            }
+        }
+        if (scheduler.getNextEventCycle() != minimum){
+            return false;
+        }
+    }
+    //events fire at their cycle from inside CPU::run, slices end on them
+    CPU cpu;
+    SchedulerTestLog log;
+    log.scheduler = cpu.getScheduler();
+    log.count = 0;
+    cpu.getScheduler()->setHandler(Scheduler::TIMER0, schedulerTestEvent, &log);
+    cpu.getScheduler()->setHandler(Scheduler::HBLANK, schedulerTestRepeat, &log);
+    cpu.getScheduler()->schedule(Scheduler::TIMER0, 250);
+    cpu.getScheduler()->schedule(Scheduler::HBLANK, 100);
+    cpu.run(350);
+    if (log.count != 4 || cpu.getScheduler()->getCycles() != 350){
+        return false;
+    }
+    int order[4] = {1, 1, 0, 1};
+    uint64_t at[4] = {100, 200, 250, 300};
+    for (int i = 0; i < 4; i++){
+        if (log.fired[i] != order[i] || log.firedAt[i] != at[i]){
+            return false;
+        }
+    }
+    //a halted cpu skips to the next event without stepping
+    cpu.setHalted(true);
+    cpu.run(1000);
+    return cpu.getScheduler()->getCycles() == 1350 && log.count == 14;
+}
+bool HardwareTests::testTimers(){
+    CPU cpu;
+    Timers* timers = cpu.getTimers();
+    Interrupts* interrupts = cpu.getInterrupts();
+    //TM0 prescaler 64 from 0xFF00, overflows every 256 ticks = 16384 cycles
+    timers->writeReload(0, 0xFF00);
+    timers->writeControl(0, Timers::ENABLE | Timers::IRQ_ENABLE | 1);
+    //TM1 counts TM0 overflows starting 2 below overflow
+    timers->writeReload(1, 0xFFFE);
+    timers->writeControl(1, Timers::ENABLE | Timers::COUNT_UP | Timers::IRQ_ENABLE);
+    cpu.run(64 * 10 + 5);
+    if (timers->readCounter(0) != 0xFF0A || timers->readCounter(1) != 0xFFFE){
+        return false;
+    }
+    cpu.run(16384 - 645);
+    if (timers->readCounter(0) != 0xFF00 || timers->readCounter(1) != 0xFFFF || timers->getOverflowCount(0) != 1){
+        return false;
+    }
+    if (interrupts->getIF() != Interrupts::TIMER0){
+        return false;
+    }
+    interrupts->acknowledge(Interrupts::TIMER0);
+    //second TM0 overflow cascades into a TM1 overflow, which reloads TM1
+    cpu.run(16384);
+    if (timers->getOverflowCount(1) != 1 || timers->readCounter(1) != 0xFFFE){
+        return false;
+    }
+    if (interrupts->getIF() != (Interrupts::TIMER0 | Interrupts::TIMER1)){
+        return false;
+    }
+    //stopping latches the counter, the value must hold while time passes
+    cpu.run(100 * 64);
+    timers->writeControl(0, 1);
+    uint16_t stopped = timers->readCounter(0);
+    cpu.run(100000);
+    if (stopped != 0xFF64 || timers->readCounter(0) != stopped || cpu.getScheduler()->isScheduled(Scheduler::TIMER0)){
+        return false;
+    }
+    //a fast timer left running for a long time costs one event per overflow, not per cycle
+    timers->writeReload(2, 0);
+    timers->writeControl(2, Timers::ENABLE | 3);
+    cpu.setHalted(true);
+    cpu.run(((uint64_t)0x10000 << 10) * 3 + 1024 * 7);
+    return timers->getOverflowCount(2) == 3 && timers->readCounter(2) == 7;
+}
+bool HardwareTests::testDMA(){
+    CPU* cpu = new CPU();
+    Memory* memory = cpu->getMemory();
+    DMA* dma = cpu->getDMA();
+    Scheduler* scheduler = cpu->getScheduler();
+    bool passed = true;
+    //HBlank is driven by hand below, keep the LCD from firing it too
+    scheduler->cancel(Scheduler::HBLANK);
+    //the CPU idles in IWRAM nothing here writes, ANDEQ r0, r0, r0 that fails in a cycle a step
+    cpu->getRegisters()->setRegister(RegisterFile::PC, 0x3007000 + 8);
+    for (uint32_t i = 0; i < 0x1000; i += 2){
+        memory->store16(0x2000000 + i, (uint16_t)(i * 7));
+    }
+    //DMA3 immediate, 32 bit EWRAM -> VRAM through the registers, takes the memmove path
+    memory->store32(0x40000D4, 0x2000000);
+    memory->store32(0x40000D8, 0x6004000);
+    memory->store16(0x40000DC, 0x400);
+    memory->store16(0x40000DE, DMA::ENABLE | DMA::WORD | DMA::IRQ_ENABLE);
+    cpu->run(10);
+    passed &= memcmp(memory->getVram() + 0x4000, memory->getReadPointer(0x2000000, 0x1000), 0x1000) == 0;
+    passed &= dma->getFastTransferCount() == 1 && !dma->isActive(3);
+    passed &= (memory->load16(0x40000DE) & DMA::ENABLE) == 0;
+    passed &= (cpu->getInterrupts()->getIF() & Interrupts::DMA3) != 0;
+    //bus was busy 2 + 6 + 2 + 1023 * 8 cycles, all stolen from the cpu
+    passed &= scheduler->getCycles() == 2 + 6 + 2 + 1023 * 8 + 2;
+    //overlapping forward copy has to repeat the pattern like real hardware
+    memory->store16(0x3000000, 0x1111);
+    memory->store16(0x3000002, 0x2222);
+    memory->store32(0x40000D4, 0x3000000);
+    memory->store32(0x40000D8, 0x3000004);
+    memory->store16(0x40000DC, 8);
+    memory->store16(0x40000DE, DMA::ENABLE);
+    cpu->run(100);
+    for (uint32_t i = 0; i < 10; i++){
+        passed &= memory->load16(0x3000000 + i * 2) == ((i & 1) ? 0x2222 : 0x1111);
+    }
+    passed &= dma->getSlowTransferCount() == 1;
+    //HBlank repeat with a reloading destination, decrementing source (opposite steps, per unit)
+    memory->store32(0x40000B0, 0x2000010);
+    memory->store32(0x40000B4, 0x3001000);
+    memory->store16(0x40000B8, 4);
+    memory->store16(0x40000BA, DMA::ENABLE | DMA::REPEAT | (DMA::HBLANK << 12) | (DMA::DECREMENT << 7) | (DMA::RELOAD << 5));
+    cpu->run(100);
+    passed &= memory->load16(0x3001000) == 0;
+    for (int line = 0; line < 2; line++){
+        dma->onHBlank();
+        cpu->run(100);
+        for (uint32_t i = 0; i < 4; i++){
+            uint32_t expectedSource = 0x10 - line * 8 - i * 2;
+            passed &= memory->load16(0x3001000 + i * 2) == (uint16_t)(expectedSource * 7);
+        }
+    }
+    passed &= dma->isActive(0);
+    //fixed destination goes through the bus, one store per unit
+    memory->store32(0x40000BC, 0x2000000);
+    memory->store32(0x40000C0, 0x40000A0);
+    memory->store16(0x40000C6, DMA::ENABLE | DMA::WORD | DMA::REPEAT | (DMA::SPECIAL << 12) | (DMA::FIXED << 5));
+    dma->onFifoRequest(0x40000A0);
+    cpu->run(100);
+    passed &= memory->load32(0x40000A0) == memory->load32(0x200000C);
+    passed &= dma->getSlowTransferCount() == 4;
+    delete cpu;
+    return passed;
+}
+bool HardwareTests::testBios(){
+    CPU* cpu = new CPU();
+    CPU::setActive(cpu);
+    Memory* memory = cpu->getMemory();
+    RegisterFile* registers = cpu->getRegisters();
+    bool passed = true;
+    //without HLE a SWI enters supervisor mode at the BIOS vector
+    registers->setCPSR(RegisterFile::SYSTEM | RegisterFile::THUMB);
+    registers->setRegister(RegisterFile::PC, 0x8000104);
+    ThumbInstruction(0xDF06).decode()(0xDF06);
+    passed &= registers->getMode() == RegisterFile::SUPERVISOR && !registers->isThumb();
+    passed &= registers->getRegister(RegisterFile::PC) == 0x10 && registers->getRegister(RegisterFile::LR) == 0x8000102;
+    passed &= registers->getSPSR() == (RegisterFile::SYSTEM | RegisterFile::THUMB);
+    //and from ARM, conditions apply
+    registers->setCPSR(RegisterFile::SYSTEM);
+    registers->setRegister(RegisterFile::PC, 0x8000108);
+    RomDecode::decodeArm(0x0F060000)(0x0F060000);
+    passed &= registers->getMode() == RegisterFile::SYSTEM;
+    Instruction(0xEF060000).decode()(0xEF060000);
+    passed &= registers->getMode() == RegisterFile::SUPERVISOR && registers->getRegister(RegisterFile::PC) == 0x10;
+    passed &= registers->getRegister(RegisterFile::LR) == 0x8000104 && registers->getSPSR() == RegisterFile::SYSTEM;
+    registers->setCPSR(RegisterFile::SYSTEM | RegisterFile::THUMB);
+    cpu->setBiosHLE(true);
+    //Div and DivArm
+    registers->setRegister(0, -7);
+    registers->setRegister(1, 2);
+    cpu->softwareInterrupt(BiosFunctions::DIV);
+    passed &= (int32_t)registers->getRegister(0) == -3 && (int32_t)registers->getRegister(1) == -1 && registers->getRegister(3) == 3;
+    registers->setRegister(0, 10);
+    registers->setRegister(1, 100);
+    cpu->softwareInterrupt(BiosFunctions::DIV_ARM);
+    passed &= registers->getRegister(0) == 10 && registers->getRegister(1) == 0;
+    //swi 0x60000 from an ARM routine in IWRAM is the same Div
+    registers->setCPSR(RegisterFile::SYSTEM);
+    registers->setRegister(0, 100);
+    registers->setRegister(1, 7);
+    RomDecode::decodeArm(0xEF060000)(0xEF060000);
+    passed &= registers->getRegister(0) == 14 && registers->getRegister(1) == 2 && registers->getMode() == RegisterFile::SYSTEM;
+    registers->setCPSR(RegisterFile::SYSTEM | RegisterFile::THUMB);
+    //Sqrt
+    registers->setRegister(0, 1000000);
+    cpu->softwareInterrupt(BiosFunctions::SQRT);
+    passed &= registers->getRegister(0) == 1000;
+    registers->setRegister(0, 0xFFFFFFFF);
+    cpu->softwareInterrupt(BiosFunctions::SQRT);
+    passed &= registers->getRegister(0) == 0xFFFF;
+    //ArcTan of 1.0 (1.14 fixed point) is pi/4, which the BIOS returns as about 0x2000
+    registers->setRegister(0, 0x4000);
+    cpu->softwareInterrupt(BiosFunctions::ARC_TAN);
+    passed &= (int32_t)registers->getRegister(0) > 0x1FF0 && (int32_t)registers->getRegister(0) < 0x2010;
+    //past 46340 the products wrap like the real BIOS rather than overflowing
+    registers->setRegister(0, 0x10000);
+    cpu->softwareInterrupt(BiosFunctions::ARC_TAN);
+    passed &= registers->getRegister(0) == 0xFFFFA2F9 && registers->getRegister(1) == 0;
+    //CpuSet halfword fill and CpuFastSet copy (rounded up to 8 words)
+    memory->store16(0x2000000, 0xBEEF);
+    registers->setRegister(0, 0x2000000);
+    registers->setRegister(1, 0x3000000);
+    registers->setRegister(2, 5 | (1 << 24));
+    cpu->softwareInterrupt(BiosFunctions::CPU_SET);
+    passed &= memory->load16(0x3000008) == 0xBEEF && memory->load16(0x300000A) == 0;
+    for (uint32_t i = 0; i < 16; i++){
+        memory->store32(0x2000100 + i * 4, i + 1);
+    }
+    registers->setRegister(0, 0x2000100);
+    registers->setRegister(1, 0x3000100);
+    registers->setRegister(2, 3);
+    cpu->softwareInterrupt(BiosFunctions::CPU_FAST_SET);
+    passed &= memory->load32(0x300011C) == 8 && memory->load32(0x3000120) == 0;
+    //LZ77 "ABCABCABCABC": 3 literals then a 9 byte copy from 3 back, into VRAM
+    const uint8_t lz77[] = {0x10, 12, 0, 0, 0x10, 'A', 'B', 'C', 0x60, 0x02};
+    for (uint32_t i = 0; i < sizeof(lz77); i++){
+        memory->store8(0x2000200 + i, lz77[i]);
+    }
+    registers->setRegister(0, 0x2000200);
+    registers->setRegister(1, 0x6000000);
+    cpu->softwareInterrupt(BiosFunctions::LZ77_UNCOMP_VRAM);
+    passed &= memcmp(memory->getVram(), "ABCABCABCABC", 12) == 0;
+    //RL: a run of 5 'x' then 2 literals, into WRAM
+    const uint8_t rl[] = {0x30, 7, 0, 0, 0x82, 'x', 0x01, 'y', 'z'};
+    for (uint32_t i = 0; i < sizeof(rl); i++){
+        memory->store8(0x2000300 + i, rl[i]);
+    }
+    registers->setRegister(0, 0x2000300);
+    registers->setRegister(1, 0x3000200);
+    cpu->softwareInterrupt(BiosFunctions::RL_UNCOMP_WRAM);
+    passed &= memcmp(memory->getReadPointer(0x3000200, 7), "xxxxxyz", 7) == 0;
+    //Huffman, 8 bit symbols: root with two leaves 'a' (0) and 'b' (1), stream "abba"
+    const uint8_t huff[] = {0x28, 4, 0, 0, 1, 0xC0, 'a', 'b', 0, 0, 0, 0x60};
+    for (uint32_t i = 0; i < sizeof(huff); i++){
+        memory->store8(0x2000400 + i, huff[i]);
+    }
+    registers->setRegister(0, 0x2000400);
+    registers->setRegister(1, 0x3000300);
+    cpu->softwareInterrupt(BiosFunctions::HUFF_UNCOMP);
+    passed &= memcmp(memory->getReadPointer(0x3000300, 4), "abba", 4) == 0;
+    //BgAffineSet, scale 1 at angle 0 gives the identity matrix
+    memory->store32(0x2000500, 100 << 8);
+    memory->store32(0x2000504, 50 << 8);
+    memory->store16(0x2000508, 120);
+    memory->store16(0x200050A, 80);
+    memory->store16(0x200050C, 0x100);
+    memory->store16(0x200050E, 0x100);
+    memory->store16(0x2000510, 0);
+    registers->setRegister(0, 0x2000500);
+    registers->setRegister(1, 0x3000400);
+    registers->setRegister(2, 1);
+    cpu->softwareInterrupt(BiosFunctions::BG_AFFINE_SET);
+    passed &= memory->load16(0x3000400) == 0x100 && memory->load16(0x3000402) == 0;
+    passed &= memory->load16(0x3000404) == 0 && memory->load16(0x3000406) == 0x100;
+    passed &= (int32_t)memory->load32(0x3000408) == (100 - 120) * 256 && (int32_t)memory->load32(0x300040C) == (50 - 80) * 256;
+    //ObjAffineSet, quarter turn with stride 8 (straight into OAM layout)
+    memory->store16(0x2000600, 0x100);
+    memory->store16(0x2000602, 0x100);
+    memory->store16(0x2000604, 0x4000);
+    registers->setRegister(0, 0x2000600);
+    registers->setRegister(1, 0x7000006);
+    registers->setRegister(2, 1);
+    registers->setRegister(3, 8);
+    cpu->softwareInterrupt(BiosFunctions::OBJ_AFFINE_SET);
+    passed &= memory->load16(0x7000006) == 0 && (int16_t)memory->load16(0x700000E) == -0x100;
+    passed &= memory->load16(0x7000016) == 0x100 && memory->load16(0x700001E) == 0;
+    //HLE calls still take time
+    passed &= cpu->getScheduler()->getCycles() > 0;
+    delete cpu;
+    return passed;
+}
+//Test data for the decompression checks and benchmark, kind: 0 tiles, 1 tilemap, 2 text, 3 noise
+std::vector<uint8_t> HardwareTests::makeBlob(int kind, uint32_t size, uint32_t seed){
+    static const char* words[] = {"the ", "sword ", "of ", "light ", "you ", "found ", "a ", "key! ", "\n", "hero "};
+    std::vector<uint8_t> blob;
+    while (blob.size() < size){
+        seed = seed * 1103515245 + 12345;
+        uint32_t random = seed >> 16;
+        switch (kind){
+            case 0: {
+                //4bpp 8x8 tile built from a handful of row patterns
+                for (int row = 0; row < 8; row++){
+                    uint32_t pattern = ((random >> (row & 3)) & 3) * 0x11111111u + (row & 1) * 0x01000010u;
+                    for (int b = 0; b < 4; b++){
+                        blob.push_back(pattern >> (b * 8));
+                    }
+                }
+                break;
+            }
+            case 1: {
+                //screen entries counting up through a tile range with occasional runs
+                uint16_t entry = (random & 0x3FF) | ((random & 0x3000) << 2);
+                uint32_t run = 1 + (random % 12);
+                for (uint32_t i = 0; i < run; i++){
+                    uint16_t value = (random & 1) ? entry : entry + i;
+                    blob.push_back(value & 0xFF);
+                    blob.push_back(value >> 8);
+                }
+                break;
+            }
+            case 2: {
+                const char* word = words[random % 10];
+                blob.insert(blob.end(), word, word + strlen(word));
+                break;
+            }
+            default:
+                blob.push_back((random % 7) * 37);
+                break;
+        }
+    }
+    blob.resize(size);
+    return blob;
+}
+std::vector<uint8_t> HardwareTests::compressLZ77(const std::vector<uint8_t>& data){
+    //greedy with 3 byte hash chains, allows overlapping matches so short displacements show up
+    std::vector<uint8_t> out;
+    uint32_t size = data.size();
+    uint32_t header = 0x10 | (size << 8);
+    for (int i = 0; i < 4; i++){
+        out.push_back(header >> (i * 8));
+    }
+    std::vector<int32_t> head(1 << 12, -1);
+    std::vector<int32_t> previous(size, -1);
+    uint32_t position = 0;
+    while (position < size){
+        size_t flagIndex = out.size();
+        out.push_back(0);
+        for (int block = 0; block < 8 && position < size; block++){
+            uint32_t bestLength = 0;
+            uint32_t bestDisplacement = 0;
+            if (position + 3 <= size){
+                uint32_t hash = (data[position] * 33 * 33 + data[position + 1] * 33 + data[position + 2]) & 0xFFF;
+                int32_t candidate = head[hash];
+                for (int depth = 0; depth < 32 && candidate >= 0 && position - candidate <= 0x1000; depth++){
+                    uint32_t length = 0;
+                    while (length < 18 && position + length < size && data[candidate + length] == data[position + length]){
+                        length++;
+                    }
+                    if (length > bestLength){
+                        bestLength = length;
+                        bestDisplacement = position - candidate;
+                    }
+                    candidate = previous[candidate];
+                }
+            }
+            uint32_t advance = bestLength >= 3 ? bestLength : 1;
+            if (bestLength >= 3){
+                out[flagIndex] |= 0x80 >> block;
+                out.push_back(((bestLength - 3) << 4) | ((bestDisplacement - 1) >> 8));
+                out.push_back((bestDisplacement - 1) & 0xFF);
+            } else {
+                out.push_back(data[position]);
+            }
+            for (uint32_t i = 0; i < advance; i++, position++){
+                if (position + 3 <= size){
+                    uint32_t hash = (data[position] * 33 * 33 + data[position + 1] * 33 + data[position + 2]) & 0xFFF;
+                    previous[position] = head[hash];
+                    head[hash] = position;
+                }
+            }
+        }
+    }
+    while (out.size() & 3){
+        out.push_back(0);
+    }
+    return out;
+}
+std::vector<uint8_t> HardwareTests::compressRL(const std::vector<uint8_t>& data){
+    std::vector<uint8_t> out;
+    uint32_t size = data.size();
+    uint32_t header = 0x30 | (size << 8);
+    for (int i = 0; i < 4; i++){
+        out.push_back(header >> (i * 8));
+    }
+    uint32_t position = 0;
+    std::vector<uint8_t> literals;
+    while (position < size){
+        uint32_t run = 1;
+        while (run < 130 && position + run < size && data[position + run] == data[position]){
+            run++;
+        }
+        if (run >= 3 || literals.size() == 128 || position + run >= size){
+            if (run < 3){
+                literals.insert(literals.end(), data.begin() + position, data.begin() + position + run);
+                position += run;
+            }
+            while (!literals.empty()){
+                uint32_t chunk = literals.size() < 128 ? literals.size() : 128;
+                out.push_back(chunk - 1);
+                out.insert(out.end(), literals.begin(), literals.begin() + chunk);
+                literals.erase(literals.begin(), literals.begin() + chunk);
+            }
+            if (run >= 3){
+                out.push_back(0x80 | (run - 3));
+                out.push_back(data[position]);
+                position += run;
+            }
+            continue;
+        }
+        literals.insert(literals.end(), data.begin() + position, data.begin() + position + run);
+        position += run;
+    }
+    while (out.size() & 3){
+        out.push_back(0);
+    }
+    return out;
+}
+bool HardwareTests::testDecompression(){
+    CPU* cpu = new CPU();
+    Memory* memory = cpu->getMemory();
+    RegisterFile* registers = cpu->getRegisters();
+    bool passed = true;
+    const uint32_t sizes[] = {1, 7, 33, 4097, 0x7FFF};
+    for (int kind = 0; kind < 4; kind++){
+        for (int sizeIndex = 0; sizeIndex < 5; sizeIndex++){
+            uint32_t size = sizes[sizeIndex];
+            std::vector<uint8_t> data = makeBlob(kind, size, kind * 77 + size);
+            for (int format = 0; format < 2; format++){
+                std::vector<uint8_t> packed = format ? compressRL(data) : compressLZ77(data);
+                //the host kernel on its own gives back the original exactly
+                std::vector<uint8_t> decoded(size + 1, 0xAA);
+                bool ok = format ? BiosFunctions::rlDecode(&packed[4], &packed[0] + packed.size(), &decoded[0], size)
+                    : BiosFunctions::lz77Decode(&packed[4], &packed[0] + packed.size(), &decoded[0], size);
+                passed &= ok && memcmp(&decoded[0], &data[0], size) == 0 && decoded[size] == 0xAA;
+                for (uint32_t i = 0; i < packed.size(); i++){
+                    memory->store8(0x2000000 + i, packed[i]);
+                }
+                //WRAM and VRAM through the SWI against the byte at a time versions
+                for (int vram = 0; vram < 2; vram++){
+                    uint32_t dest = vram ? 0x6000000 : 0x3000000;
+                    std::vector<uint8_t> expected(size);
+                    memset(memory->getWritePointer(dest, 0x8000), 0x55, 0x8000);
+                    registers->setRegister(0, 0x2000000);
+                    registers->setRegister(1, dest);
+                    uint32_t slowCycles = format ? BiosFunctions::rlUnCompBytewise(registers, memory, vram)
+                        : BiosFunctions::lz77UnCompBytewise(registers, memory, vram);
+                    memcpy(&expected[0], memory->getReadPointer(dest, size), size);
+                    memset(memory->getWritePointer(dest, 0x8000), 0x55, 0x8000);
+                    uint32_t fastCycles = format ? BiosFunctions::rlUnComp(registers, memory, vram)
+                        : BiosFunctions::lz77UnComp(registers, memory, vram);
+                    passed &= memcmp(&expected[0], memory->getReadPointer(dest, size), size) == 0;
+                    passed &= fastCycles == slowCycles;
+                    //an odd VRAM size leaves its last byte unwritten like the halfword stores would
+                    passed &= !vram || !(size & 1) || memory->load8(dest + size - 1) == 0x55;
+                    passed &= memory->load8(dest + size) == 0x55;
+                }
+            }
+        }
+    }
+    delete cpu;
+    return passed;
+}
+void HardwareTests::makeScene(CPU* cpu, uint8_t mode, uint32_t seed){
+    Memory* memory = cpu->getMemory();
+    uint32_t state = seed * 2654435761u + 1;
+    #define SCENE_RANDOM() (state ^= state << 13, state ^= state >> 17, state ^= state << 5, state)
+    for (uint32_t i = 0; i < 0x18000; i += 4){
+        memory->store32(0x6000000 + i, SCENE_RANDOM());
+    }
+    for (uint32_t i = 0; i < 0x400; i += 4){
+        memory->store32(0x5000000 + i, SCENE_RANDOM());
+    }
+    for (uint32_t sprite = 0; sprite < 128; sprite++){
+        uint32_t bits = SCENE_RANDOM();
+        //any shape up to 32 pixels (a busy game, not past the OBJ line budget), a quarter affine
+        //(some double size), an eighth semi-transparent
+        uint16_t attribute0 = (SCENE_RANDOM() % 160) | ((bits % 3) << 14) | ((bits >> 2) & 1 ? 0 : 1 << 8);
+        attribute0 |= (attribute0 & (1 << 8)) && ((bits >> 3) & 1) ? 1 << 9 : 0;
+        attribute0 |= ((bits >> 4) & 7) == 0 ? 1 << 10 : 0;
+        attribute0 |= (bits >> 7) & 1 ? 1 << 13 : 0;
+        uint16_t attribute1 = (SCENE_RANDOM() % 272) | (((bits >> 8) % 3) << 14) | (((bits >> 10) & 0x1F) << 9);
+        uint16_t attribute2 = (SCENE_RANDOM() & 0xFFF) | 0x200;
+        memory->store16(0x7000000 + sprite * 8, attribute0);
+        memory->store16(0x7000002 + sprite * 8, attribute1);
+        memory->store16(0x7000004 + sprite * 8, attribute2);
+        //affine parameters sit in the fourth halfword of each entry, keep them near identity
+        int16_t parameter = ((sprite & 3) == 0 || (sprite & 3) == 3 ? 0x100 : 0) + (int16_t)(SCENE_RANDOM() % 0x80) - 0x40;
+        memory->store16(0x7000006 + sprite * 8, parameter);
+    }
+    memory->store16(0x4000000, mode | (1 << 6) | (0x1F << 8) | (1 << 13));
+    for (uint32_t bg = 0; bg < 4; bg++){
+        memory->store16(0x4000008 + bg * 2, (SCENE_RANDOM() & 0xFFBF) | (bg << 8));
+        memory->store16(0x4000010 + bg * 4, SCENE_RANDOM());
+        memory->store16(0x4000012 + bg * 4, SCENE_RANDOM());
+    }
+    for (uint32_t base = 0x4000020; base < 0x4000040; base += 0x10){
+        memory->store16(base, 0x100 + SCENE_RANDOM() % 0x40);
+        memory->store16(base + 2, SCENE_RANDOM() % 0x40);
+        memory->store16(base + 4, SCENE_RANDOM() % 0x40);
+        memory->store16(base + 6, 0xC0 + SCENE_RANDOM() % 0x80);
+        memory->store32(base + 8, SCENE_RANDOM() % 0x4000);
+        memory->store32(base + 12, SCENE_RANDOM() % 0x4000);
+    }
+    //WIN0 over the middle of the screen with effects off inside
+    memory->store16(0x4000040, (40 << 8) | 200);
+    memory->store16(0x4000044, (30 << 8) | 130);
+    memory->store16(0x4000048, 0x1F);
+    memory->store16(0x400004A, 0x3F);
+    memory->store16(0x4000050, (SCENE_RANDOM() & 0x3F3F) | (1 << 6));
+    memory->store16(0x4000052, SCENE_RANDOM() & 0x1F1F);
+    memory->store16(0x4000054, SCENE_RANDOM() & 0x1F);
+    #undef SCENE_RANDOM
+}
+void HardwareTests::makeBusyMachine(CPU* cpu, uint32_t seed){
+    Memory* memory = cpu->getMemory();
+    makeScene(cpu, 1, seed);
+    for (uint32_t i = 0; i < 0x40000; i += 4){
+        memory->store32(0x2000000 + i, (i + seed) * 0x9E3779B9);
+    }
+    //square and noise playing, FIFO A fed by DMA1 off TM0 at 32768 Hz
+    memory->store16(0x4000084, 0x80);
+    memory->store16(0x4000080, 0xFF77);
+    memory->store16(0x4000082, 0x0B0E);
+    memory->store16(0x4000062, 0xF040);
+    memory->store16(0x4000064, 0x8000 | 1750);
+    memory->store16(0x4000078, 0xF000);
+    memory->store16(0x400007C, 0x8000 | 0x21);
+    memory->store32(0x40000BC, 0x2000000);
+    memory->store32(0x40000C0, APU::FIFO_A);
+    memory->store16(0x40000C6, 0xB640);
+    memory->store16(0x4000100, 0x10000 - 512);
+    memory->store16(0x4000102, 0x80);
+    //TM1 counting TM0 overflows with its IRQ on
+    memory->store16(0x4000106, Timers::ENABLE | Timers::COUNT_UP | Timers::IRQ_ENABLE);
+    //DMA3 copying 16 words of EWRAM into IWRAM every HBlank, both sides moving on
+    memory->store32(0x40000D4, 0x2010000);
+    memory->store32(0x40000D8, 0x3000000);
+    memory->store16(0x40000DC, 16);
+    memory->store16(0x40000DE, DMA::ENABLE | DMA::REPEAT | DMA::WORD | (DMA::HBLANK << 12));
+    memory->store16(0x4000004, PPU::VBLANK_IRQ | PPU::HBLANK_IRQ);
+    cpu->setHalted(true);
+}
+bool HardwareTests::testPPU(){
+    CPU* cpu = new CPU();
+    Memory* memory = cpu->getMemory();
+    PPU* ppu = cpu->getPPU();
+    bool passed = true;
+    //timing: VBlank starts at line 160, VCOUNT match on line 5, flags and IRQs follow
+    memory->store16(0x4000004, PPU::VBLANK_IRQ | PPU::VCOUNT_IRQ | (5 << 8));
+    cpu->setHalted(true);
+    cpu->run(PPU::LINE_CYCLES * 5 + 10);
+    passed &= memory->load16(0x4000006) == 5;
+    passed &= (memory->load16(0x4000004) & PPU::VCOUNT_FLAG) != 0;
+    passed &= (cpu->getInterrupts()->getIF() & Interrupts::VCOUNT) != 0;
+    cpu->run(PPU::HDRAW_CYCLES);
+    passed &= (memory->load16(0x4000004) & PPU::HBLANK_FLAG) != 0;
+    cpu->run(PPU::LINE_CYCLES * 155 - PPU::HDRAW_CYCLES);
+    passed &= memory->load16(0x4000006) == 160 && ppu->getFrameCount() == 1;
+    passed &= (memory->load16(0x4000004) & (PPU::VBLANK_FLAG | PPU::HBLANK_FLAG)) == PPU::VBLANK_FLAG;
+    passed &= (cpu->getInterrupts()->getIF() & Interrupts::VBLANK) != 0;
+    cpu->run(PPU::LINE_CYCLES * 68);
+    passed &= memory->load16(0x4000006) == 0 && (memory->load16(0x4000004) & PPU::VBLANK_FLAG) == 0;
+    //mode 0: BG0 red tile over a BG1 green strip scrolled 4 pixels, a white sprite, blue backdrop
+    memory->store16(0x5000000, 0x7C00);
+    memory->store16(0x5000002, 0x001F);
+    memory->store16(0x5000004, 0x03E0);
+    memory->store16(0x5000202, 0x7FFF);
+    for (uint32_t i = 0; i < 32; i += 2){
+        memory->store16(0x6000020 + i, 0x1111);
+        memory->store16(0x6000040 + i, 0x2222);
+        memory->store16(0x6010060 + i, 0x1111);
+    }
+    memory->store16(0x6004000, 1);
+    memory->store16(0x6004800, 2);
+    memory->store16(0x6004802, 2);
+    memory->store16(0x4000008, 8 << 8);
+    memory->store16(0x400000A, (9 << 8) | 1);
+    memory->store16(0x4000014, 4);
+    memory->store16(0x7000000, 20);
+    memory->store16(0x7000002, 100);
+    memory->store16(0x7000004, 3);
+    memory->store16(0x4000000, (1 << 6) | ((PPU::BG0 | PPU::BG1 | PPU::OBJ) << 8));
+    ppu->renderFrame();
+    const uint32_t* frame = ppu->getFrame();
+    passed &= frame[3] == PPU::toRGBA(0x001F) && frame[8] == PPU::toRGBA(0x03E0);
+    passed &= frame[12] == PPU::toRGBA(0x7C00) && frame[8 * 240] == PPU::toRGBA(0x7C00);
+    passed &= frame[20 * 240 + 100] == PPU::toRGBA(0x7FFF) && frame[20 * 240 + 108] == PPU::toRGBA(0x7C00);
+    //alpha: BG0 over BG1 at 8/16 each, brighten: backdrop to white
+    memory->store16(0x4000050, PPU::BG0 | (1 << 6) | (PPU::BG1 << 8));
+    memory->store16(0x4000052, 8 | (8 << 8));
+    ppu->renderFrame();
+    passed &= frame[3] == PPU::toRGBA(15 | (15 << 5)) && frame[8] == PPU::toRGBA(0x03E0);
+    memory->store16(0x4000050, PPU::BACKDROP | (2 << 6));
+    memory->store16(0x4000054, 16);
+    ppu->renderFrame();
+    passed &= frame[12] == PPU::toRGBA(0x7FFF) && frame[3] == PPU::toRGBA(0x001F);
+    //the color table is toRGBA, the palette mirror follows every kind of palette write
+    for (uint32_t color = 0; color < 0x8000; color++){
+        passed &= PPU::getColorTable()[color] == PPU::toRGBA(color);
+    }
+    memory->store16(0x5000010, 0x1234);
+    memory->store32(0x5000200, 0x7FFF0421);
+    memory->store8(0x50003FE, 0x55);
+    memset(memory->getWritePointer(0x5000100, 4), 0x3C, 4);
+    const uint32_t* palette = ppu->getPaletteRGBA();
+    passed &= palette[8] == PPU::toRGBA(0x1234) && palette[0x100] == PPU::toRGBA(0x0421);
+    passed &= palette[0x101] == PPU::toRGBA(0x7FFF) && palette[0x1FF] == PPU::toRGBA(0x5555);
+    passed &= palette[0x80] == PPU::toRGBA(0x3C3C) && palette[0x81] == PPU::toRGBA(0x3C3C);
+    passed &= palette[0] == PPU::toRGBA(0x7C00);
+    //random scenes, every line composed both ways
+    uint32_t reference[PPU::WIDTH];
+    for (uint8_t mode = 0; mode < 6; mode++){
+        for (uint32_t seed = 1; seed < 4; seed++){
+            makeScene(cpu, mode, seed * 10 + mode);
+            for (uint8_t line = 0; line < PPU::HEIGHT; line++){
+                ppu->renderLine(line);
+                ppu->composeScalar(reference);
+                passed &= memcmp(reference, ppu->getFrame() + line * PPU::WIDTH, sizeof(reference)) == 0;
+            }
+        }
+    }
+    delete cpu;
+    return passed;
+}
+bool HardwareTests::testTileCache(){
+    CPU* cpu = new CPU();
+    Memory* memory = cpu->getMemory();
+    PPU* ppu = cpu->getPPU();
+    TileCache* cache = ppu->getTileCache();
+    bool passed = true;
+    //every tile unpacks to the same indices as reading the nibbles out of VRAM
+    makeScene(cpu, 0, 7);
+    for (uint32_t tile = 0; tile < TileCache::TILE_COUNT; tile++){
+        const uint8_t* indices = cache->getTile(tile);
+        for (uint32_t i = 0; i < 64; i++){
+            passed &= indices[i] == ((memory->getVram()[tile * 32 + i / 2] >> ((i & 1) * 4)) & 0xF);
+        }
+    }
+    //a static screen is all hits from the second frame on
+    ppu->renderFrame();
+    cache->resetStats();
+    ppu->renderFrame();
+    passed &= cache->getMisses() == 0 && cache->getHits() > 0 && cache->getHitRate() == 1.0;
+    //each way of writing VRAM shows up on the next frame: store16, store8, a write pointer (DMA, BIOS)
+    memory->store16(0x4000000, (PPU::BG0 << 8));
+    memory->store16(0x4000008, 8 << 8);
+    memory->store16(0x4000010, 0);
+    memory->store16(0x4000012, 0);
+    memory->store16(0x4000050, 0);
+    memory->store16(0x5000002, 0x001F);
+    memory->store16(0x5000004, 0x03E0);
+    memory->store16(0x5000006, 0x7C00);
+    memory->store16(0x6004000, 1);
+    memory->store16(0x6000020, 0x0001);
+    ppu->renderFrame();
+    passed &= ppu->getFrame()[0] == PPU::toRGBA(0x001F);
+    memory->store16(0x6000020, 0x0002);
+    ppu->renderFrame();
+    passed &= ppu->getFrame()[0] == PPU::toRGBA(0x03E0);
+    memory->store8(0x6000020, 0x03);
+    ppu->renderFrame();
+    passed &= ppu->getFrame()[0] == PPU::toRGBA(0x7C00) && ppu->getFrame()[2] == PPU::toRGBA(0x7C00);
+    memset(memory->getWritePointer(0x6000020, 32), 0x11, 32);
+    ppu->renderFrame();
+    passed &= ppu->getFrame()[0] == PPU::toRGBA(0x001F) && ppu->getFrame()[7 * 240 + 7] == PPU::toRGBA(0x001F);
+    delete cpu;
+    return passed;
+}
+bool HardwareTests::testAffine(){
+    CPU* cpu = new CPU();
+    Memory* memory = cpu->getMemory();
+    PPU* ppu = cpu->getPPU();
+    bool passed = true;
+    //mode 2 BG2 zoomed 2x across: texels 0 0 1 1 2 2 ..., one tile of colors 1 -> 8 in the top left
+    memory->store16(0x5000000, 0x7C00);
+    for (uint32_t i = 1; i < 9; i++){
+        memory->store16(0x5000000 + i * 2, i * 0x421);
+    }
+    //byte writes to BG VRAM fill the whole halfword, so two pixels at a time
+    for (uint32_t i = 0; i < 4; i++){
+        memory->store16(0x6000040 + i * 2, (i * 2 + 1) | ((i * 2 + 2) << 8));
+    }
+    memory->store16(0x6004000, 0x0001);
+    memory->store16(0x4000000, 2 | (PPU::BG2 << 8));
+    memory->store16(0x400000C, 8 << 8);
+    memory->store16(0x4000020, 0x80);
+    memory->store16(0x4000022, 0);
+    memory->store16(0x4000024, 0);
+    memory->store16(0x4000026, 0x100);
+    memory->store32(0x4000028, 0);
+    memory->store32(0x400002C, 0);
+    ppu->renderFrame();
+    const uint32_t* frame = ppu->getFrame();
+    passed &= frame[0] == PPU::toRGBA(0x421) && frame[1] == PPU::toRGBA(0x421) && frame[2] == PPU::toRGBA(0x842);
+    passed &= frame[15] == PPU::toRGBA(8 * 0x421) && frame[16] == PPU::toRGBA(0x7C00);
+    //no wrap: a texel left of the map is transparent, with wrap it comes from the right edge
+    memory->store32(0x4000028, (uint32_t)-0x100);
+    memory->store16(0x600400E, 0x0100);
+    ppu->renderFrame();
+    passed &= frame[0] == PPU::toRGBA(0x7C00) && frame[2] == PPU::toRGBA(0x421);
+    memory->store16(0x400000C, (8 << 8) | (1 << 13));
+    ppu->renderFrame();
+    passed &= frame[0] == PPU::toRGBA(8 * 0x421) && frame[2] == PPU::toRGBA(0x421);
+    //random rotations, scales and flips in every affine mode, SIMD against the scalar reference
+    uint32_t state = 12345;
+    std::vector<uint32_t> reference(PPU::WIDTH * PPU::HEIGHT);
+    for (uint8_t mode = 1; mode < 6; mode++){
+        for (uint32_t seed = 0; seed < 4; seed++){
+            makeScene(cpu, mode, seed * 31 + mode);
+            for (uint32_t base = 0x4000020; base < 0x4000040; base += 0x10){
+                for (uint32_t i = 0; i < 4; i++){
+                    state = state * 1103515245 + 12345;
+                    memory->store16(base + i * 2, (state >> 8) & 0xFFFF);
+                }
+                state = state * 1103515245 + 12345;
+                memory->store32(base + 8, state & 0x0FFFFFFF);
+                state = state * 1103515245 + 12345;
+                memory->store32(base + 12, state & 0x0FFFFFFF);
+            }
+            for (uint32_t group = 0; group < 32; group++){
+                for (uint32_t i = 0; i < 4; i++){
+                    state = state * 1103515245 + 12345;
+                    memory->store16(0x7000006 + group * 32 + i * 8, (state >> 8) & 0xFFFF);
+                }
+            }
+            ppu->setScalarAffine(true);
+            ppu->renderFrame();
+            memcpy(&reference[0], ppu->getFrame(), reference.size() * 4);
+            ppu->setScalarAffine(false);
+            ppu->renderFrame();
+            passed &= memcmp(&reference[0], ppu->getFrame(), reference.size() * 4) == 0;
+        }
+    }
+    delete cpu;
+    return passed;
+}
+bool HardwareTests::testOamCache(){
+    CPU* cpu = new CPU();
+    Memory* memory = cpu->getMemory();
+    PPU* ppu = cpu->getPPU();
+    OamCache* cache = ppu->getOamCache();
+    bool passed = true;
+    for (uint32_t seed = 1; seed < 6; seed++){
+        makeScene(cpu, seed % 3, seed);
+        //hide a few sprites the two ways OAM allows
+        memory->store16(0x7000000 + seed * 8, (memory->load16(0x7000000 + seed * 8) & ~(1 << 8)) | (1 << 9));
+        memory->store16(0x7000008 + seed * 8, memory->load16(0x7000008 + seed * 8) | (3 << 14));
+        cache->update();
+        //every line's bucket is exactly the enabled sprites whose box covers it, in OAM order
+        for (uint32_t line = 0; line < PPU::HEIGHT; line++){
+            uint32_t count;
+            const uint8_t* sprites = cache->getLine(line, &count);
+            uint32_t expected = 0;
+            for (uint32_t sprite = 0; sprite < 128; sprite++){
+                uint16_t attribute0 = memory->load16(0x7000000 + sprite * 8);
+                uint16_t attribute1 = memory->load16(0x7000002 + sprite * 8);
+                bool affine = attribute0 & (1 << 8);
+                bool doubleSize = attribute0 & (1 << 9);
+                uint8_t shape = attribute0 >> 14;
+                if ((!affine && doubleSize) || shape == 3 || ((attribute0 >> 10) & 3) == 3){
+                    continue;
+                }
+                static const int32_t heights[3][4] = {{8, 16, 32, 64}, {8, 8, 16, 32}, {16, 32, 32, 64}};
+                int32_t height = heights[shape][attribute1 >> 14] * (affine && doubleSize ? 2 : 1);
+                int32_t y = attribute0 & 0xFF;
+                y = y + height > 256 ? y - 256 : y;
+                if ((int32_t)line >= y && (int32_t)line < y + height){
+                    passed &= expected < count && sprites[expected] == sprite;
+                    expected++;
+                }
+            }
+            passed &= expected == count;
+        }
+    }
+    //nothing written, nothing decoded; a palette change decodes one entry, a move also rebuilds
+    ppu->renderFrame();
+    uint64_t decodes = cache->getDecodeCount();
+    uint64_t rebuilds = cache->getRebuildCount();
+    ppu->renderFrame();
+    passed &= cache->getDecodeCount() == decodes && cache->getRebuildCount() == rebuilds;
+    memory->store16(0x7000004, memory->load16(0x7000004) ^ 0x1000);
+    ppu->renderFrame();
+    passed &= cache->getDecodeCount() == decodes + 1 && cache->getRebuildCount() == rebuilds;
+    memory->store16(0x7000000, (memory->load16(0x7000000) & ~0xFF) | ((memory->load16(0x7000000) + 1) & 0xFF));
+    ppu->renderFrame();
+    passed &= cache->getDecodeCount() == decodes + 2 && cache->getRebuildCount() == rebuilds + 1;
+    //OAM DMA goes through a write pointer, a sprite moved that way shows up on the next frame
+    memory->store16(0x4000000, PPU::OBJ << 8);
+    memory->store16(0x4000050, 0);
+    memory->store16(0x5000000, 0);
+    memory->store16(0x5000202, 0x7FFF);
+    for (uint32_t i = 0; i < 32; i += 2){
+        memory->store16(0x6010000 + i, 0x1111);
+    }
+    uint16_t entries[128 * 4];
+    for (uint32_t sprite = 0; sprite < 128; sprite++){
+        entries[sprite * 4] = 1 << 9;
+        entries[sprite * 4 + 1] = 0;
+        entries[sprite * 4 + 2] = 0;
+        entries[sprite * 4 + 3] = memory->load16(0x7000006 + sprite * 8);
+    }
+    entries[0] = 50;
+    entries[1] = 60;
+    memcpy(memory->getWritePointer(0x7000000, sizeof(entries)), entries, sizeof(entries));
+    ppu->renderFrame();
+    passed &= ppu->getFrame()[50 * 240 + 60] == PPU::toRGBA(0x7FFF) && ppu->getFrame()[50 * 240 + 68] == PPU::toRGBA(0);
+    uint32_t count;
+    cache->getLine(50, &count);
+    passed &= count == 1;
+    delete cpu;
+    return passed;
+}
+bool HardwareTests::testThreaded(){
+    bool passed = true;
+    //two machines get the same scene and the same writes, one draws inline and one on the render thread
+    CPU* cpus[2] = {new CPU(), new CPU()};
+    for (int i = 0; i < 2; i++){
+        makeScene(cpus[i], 0, 7);
+        cpus[i]->setHalted(true);
+    }
+    PPU* threaded = cpus[1]->getPPU();
+    threaded->setThreadedRendering(true);
+    passed &= threaded->isThreadedRendering() && !cpus[0]->getPPU()->isThreadedRendering();
+    uint32_t state = 12345;
+    #define THREADED_RANDOM() (state ^= state << 13, state ^= state >> 17, state ^= state << 5, state)
+    for (int step = 0; step < 600; step++){
+        //switching over and back mid frame must not lose anything either
+        if (step == 300 || step == 400){
+            threaded->setThreadedRendering(step == 400);
+        }
+        uint32_t cycles = 200 + THREADED_RANDOM() % 6000;
+        uint32_t kind = THREADED_RANDOM() % 7;
+        uint32_t value = THREADED_RANDOM();
+        uint32_t data = THREADED_RANDOM();
+        for (int i = 0; i < 2; i++){
+            Memory* memory = cpus[i]->getMemory();
+            switch (kind){
+                case 0:
+                    memory->store16(0x5000000 + (value & 0x3FE), data);
+                    break;
+                case 1:
+                    memory->store32(0x6000000 + (value % 0x18000 & ~3), data);
+                    break;
+                case 2:
+                    memory->store16(0x7000000 + (value & 0x3FE), data);
+                    break;
+                case 3:
+                    memory->store16(0x4000010 + (value & 0xE), data);
+                    break;
+                case 4:
+                    //affine parameters and reference points
+                    memory->store16(0x4000020 + (value & 0x1E), data);
+                    break;
+                case 5:
+                    memory->store16(0x4000000, (value % 6) | (1 << 6) | (data & 0xFF00) | ((data & 0x3F) ? 0 : 1 << 7));
+                    break;
+                default:
+                    memory->store16(0x4000050 + (value & 6), data);
+                    break;
+            }
+            cpus[i]->run(cycles);
+        }
+        passed &= memcmp(cpus[0]->getPPU()->getFrame(), threaded->getFrame(), PPU::WIDTH * PPU::HEIGHT * 4) == 0;
+        passed &= cpus[0]->getPPU()->getFrameCount() == threaded->getFrameCount();
+        if (step % 50 == 0){
+            passed &= memcmp(cpus[0]->getPPU()->getPaletteRGBA(), threaded->getPaletteRGBA(), 512 * 4) == 0;
+        }
+    }
+    #undef THREADED_RANDOM
+    passed &= threaded->getFrameCount() > 4;
+    //renderFrame goes through the thread too
+    cpus[0]->getPPU()->renderFrame();
+    threaded->renderFrame();
+    passed &= memcmp(cpus[0]->getPPU()->getFrame(), threaded->getFrame(), PPU::WIDTH * PPU::HEIGHT * 4) == 0;
+    delete cpus[0];
+    delete cpus[1];
+    return passed;
+}
+bool HardwareTests::testHeadless(){
+    bool passed = true;
+    //a drawing and a headless machine have to look the same to the CPU
+    CPU* cpus[2] = {new CPU(), new CPU()};
+    for (int i = 0; i < 2; i++){
+        Memory* memory = cpus[i]->getMemory();
+        makeScene(cpus[i], 1, 3);
+        memory->store16(0x4000004, PPU::VBLANK_IRQ | PPU::HBLANK_IRQ | PPU::VCOUNT_IRQ | (100 << 8));
+        memory->store16(0x4000022, 0x30);
+        memory->store16(0x4000026, 0xFFE0);
+        cpus[i]->setHalted(true);
+    }
+    PPU* headless = cpus[1]->getPPU();
+    //the frame already under way is still drawn, nothing after it
+    headless->setFrameSkip(0);
+    std::vector<uint32_t> first;
+    for (int step = 0; step < 300; step++){
+        if (headless->getFrameCount() == 1 && first.empty()){
+            first.assign(headless->getFrame(), headless->getFrame() + PPU::WIDTH * PPU::HEIGHT);
+        }
+        for (int i = 0; i < 2; i++){
+            cpus[i]->run(997);
+        }
+        Memory* memories[2] = {cpus[0]->getMemory(), cpus[1]->getMemory()};
+        passed &= memories[0]->load16(0x4000004) == memories[1]->load16(0x4000004);
+        passed &= memories[0]->load16(0x4000006) == memories[1]->load16(0x4000006);
+        passed &= cpus[0]->getInterrupts()->getIF() == cpus[1]->getInterrupts()->getIF();
+        for (int i = 0; i < 2; i++){
+            cpus[i]->getInterrupts()->acknowledge(0xFFFF);
+        }
+    }
+    passed &= headless->getFrameCount() == cpus[0]->getPPU()->getFrameCount() && headless->getFrameCount() > 0;
+    passed &= headless->getDrawnFrameCount() == 1 && cpus[0]->getPPU()->getDrawnFrameCount() == cpus[0]->getPPU()->getFrameCount();
+    const uint32_t* frame = headless->getFrame();
+    passed &= !first.empty() && memcmp(first.data(), frame, PPU::WIDTH * PPU::HEIGHT * 4) == 0;
+    //a requested frame matches the one drawn all along, skipped lines still stepped the affine reference
+    headless->requestFrame();
+    while (headless->getDrawnFrameCount() == 1){
+        for (int i = 0; i < 2; i++){
+            cpus[i]->run(PPU::LINE_CYCLES);
+        }
+    }
+    passed &= memcmp(cpus[0]->getPPU()->getFrame(), frame, PPU::WIDTH * PPU::HEIGHT * 4) == 0;
+    //every third frame
+    headless->setFrameSkip(3);
+    cpus[1]->run((uint64_t)PPU::LINE_CYCLES * PPU::TOTAL_LINES * 9);
+    passed &= headless->getDrawnFrameCount() == 5;
+    delete cpus[0];
+    delete cpus[1];
+    return passed;
+}
+bool HardwareTests::testAPU(){
+    bool passed = true;
+    CPU* cpu = new CPU();
+    Memory* memory = cpu->getMemory();
+    APU* apu = cpu->getAPU();
+    AudioRing* output = apu->getOutput();
+    cpu->setHalted(true);
+    std::vector<int16_t> samples(APU::OUTPUT_FRAMES * 2);
+    //channel 1: 50% square at 131072 / (2048 - 1917) = 1000.6 Hz, full volume, both sides
+    memory->store16(0x4000084, 0x80);
+    memory->store16(0x4000080, 0x1177);
+    memory->store16(0x4000082, 2);
+    memory->store16(0x4000062, 0xF080);
+    memory->store16(0x4000064, 0x8000 | 1917);
+    passed &= apu->getChannelStatus() == 1 && (memory->load16(0x4000084) & 0x8F) == 0x81;
+    //one emulated second pulled out in pieces the way a frontend would
+    uint32_t frames = 0;
+    uint32_t crossings = 0;
+    bool positive = true;
+    for (int i = 0; i < 8; i++){
+        cpu->run(16777216 / 8);
+        apu->sync();
+        uint32_t count = output->read(samples.data(), APU::OUTPUT_FRAMES);
+        for (uint32_t j = 0; j < count; j++){
+            crossings += (samples[j * 2] >= 0) != positive;
+            positive = samples[j * 2] >= 0;
+            passed &= samples[j * 2] == samples[j * 2 + 1];
+        }
+        frames += count;
+    }
+    passed &= frames >= APU::OUTPUT_RATE - 2 && frames <= APU::OUTPUT_RATE;
+    passed &= crossings >= 1990 && crossings <= 2010;
+    passed &= output->getDropped() == 0;
+    //length enabled with 64 ticks at 256 Hz, the channel stops after 0.25 s
+    memory->store16(0x4000064, 0xC000 | 1917);
+    cpu->run(16777216 / 5);
+    passed &= apu->getChannelStatus() == 1;
+    cpu->run(16777216 / 10);
+    passed &= apu->getChannelStatus() == 0;
+    output->read(samples.data(), APU::OUTPUT_FRAMES);
+    //FIFO A fed by DMA1 from a table of 64s, TM0 at 32768 Hz, PSG off
+    memory->store16(0x4000080, 0);
+    for (uint32_t i = 0; i < 0x2000; i++){
+        memory->store8(0x2000000 + i, 64);
+    }
+    memory->store16(0x4000082, 0x0B04);
+    memory->store32(0x40000BC, 0x2000000);
+    memory->store32(0x40000C0, APU::FIFO_A);
+    memory->store16(0x40000C6, 0xB640);
+    memory->store16(0x4000100, 0x10000 - 512);
+    memory->store16(0x4000102, 0x80);
+    cpu->run(16777216 / 10);
+    apu->sync();
+    uint32_t count = output->read(samples.data(), APU::OUTPUT_FRAMES);
+    passed &= count > 4000;
+    for (uint32_t j = count - 2000; j < count * 2; j++){
+        passed &= samples[j] == 64 * 2 * 64;
+    }
+    passed &= apu->getFifoCount(0) > 0 && apu->getFifoCount(1) == 0;
+    //SIMD mixing against the scalar reference over random inputs and settings
+    uint32_t state = 99;
+    #define APU_RANDOM() (state ^= state << 13, state ^= state >> 17, state ^= state << 5, state)
+    int16_t inputs[4][250];
+    int16_t mixed[2][500];
+    for (int round = 0; round < 50; round++){
+        memory->store16(0x4000080, APU_RANDOM());
+        memory->store16(0x4000082, APU_RANDOM() & 0x770F);
+        memory->store16(0x4000088, APU_RANDOM() & 0x3FE);
+        for (int i = 0; i < 250; i++){
+            inputs[0][i] = (int16_t)(APU_RANDOM() % 121) - 60;
+            inputs[1][i] = (int16_t)(APU_RANDOM() % 121) - 60;
+            inputs[2][i] = (int8_t)APU_RANDOM();
+            inputs[3][i] = (int8_t)APU_RANDOM();
+        }
+        apu->mix(inputs[0], inputs[1], inputs[2], inputs[3], 250, mixed[0]);
+        apu->mixScalar(inputs[0], inputs[1], inputs[2], inputs[3], 250, mixed[1]);
+        passed &= memcmp(mixed[0], mixed[1], sizeof(mixed[0])) == 0;
+    }
+    //same for the resampler, fed uneven pieces
+    Resampler resamplers[2] = {Resampler(APU::NATIVE_RATE, APU::OUTPUT_RATE), Resampler(APU::NATIVE_RATE, APU::OUTPUT_RATE)};
+    resamplers[1].setScalar(true);
+    std::vector<int16_t> in(600);
+    std::vector<int16_t> out[2] = {std::vector<int16_t>(1000), std::vector<int16_t>(1000)};
+    uint32_t totals[2] = {0, 0};
+    for (int round = 0; round < 200; round++){
+        uint32_t length = 1 + APU_RANDOM() % 300;
+        for (uint32_t i = 0; i < length * 2; i++){
+            in[i] = APU_RANDOM();
+        }
+        uint32_t produced[2];
+        for (int i = 0; i < 2; i++){
+            produced[i] = resamplers[i].process(in.data(), length, out[i].data());
+            totals[i] += produced[i];
+        }
+        passed &= produced[0] == produced[1] && memcmp(out[0].data(), out[1].data(), produced[0] * 4) == 0;
+    }
+    #undef APU_RANDOM
+    passed &= totals[0] > 0 && totals[0] == totals[1];
+    delete cpu;
+    return passed;
+}
+bool HardwareTests::testRewind(){
+    bool passed = true;
+    const uint64_t frameCycles = (uint64_t)PPU::LINE_CYCLES * PPU::TOTAL_LINES;
+    CPU* cpu = new CPU();
+    Memory* memory = cpu->getMemory();
+    makeBusyMachine(cpu, 9);
+    RewindBuffer* buffer = new RewindBuffer(8 << 20, 2);
+    //what the machine looked like at every snapshot, newest last
+    std::vector<std::vector<uint8_t> > history;
+    uint32_t random = 17;
+    for (int frame = 0; frame < 40; frame++){
+        for (int i = 0; i < 8; i++){
+            random ^= random << 13, random ^= random >> 17, random ^= random << 5;
+            memory->store32(0x2000000 + (random & 0x3FFFC), random);
+            memory->store16(0x6000000 + (random % 0x18000 & ~1u), random >> 16);
+        }
+        cpu->getRegisters()->setRegister(4, frame);
+        cpu->run(frameCycles + (random & 0x3FF));
+        uint32_t before = buffer->getSnapshotCount();
+        cpu->captureRewind(buffer);
+        if (buffer->getSnapshotCount() != before){
+            history.push_back(dumpMachine(cpu));
+        }
+    }
+    passed &= history.size() == 20 && buffer->getSnapshotCount() == 20;
+    //a few steps back, a few new frames on top, then all the way back
+    for (int i = 0; i < 5; i++){
+        passed &= cpu->rewind(buffer) && dumpMachine(cpu) == history.back();
+        history.pop_back();
+    }
+    for (int frame = 0; frame < 6; frame++){
+        memory->store32(0x3000100, frame);
+        cpu->run(frameCycles);
+        uint32_t before = buffer->getSnapshotCount();
+        cpu->captureRewind(buffer);
+        if (buffer->getSnapshotCount() != before){
+            history.push_back(dumpMachine(cpu));
+        }
+    }
+    passed &= buffer->getSnapshotCount() == history.size();
+    while (!history.empty()){
+        passed &= cpu->rewind(buffer) && dumpMachine(cpu) == history.back();
+        history.pop_back();
+    }
+    passed &= !cpu->rewind(buffer);
+    delete buffer;
+    //a ring too small for everything keeps the newest snapshots and drops the rest
+    buffer = new RewindBuffer(96 << 10, 1);
+    for (int frame = 0; frame < 30; frame++){
+        memory->store32(0x2000000 + frame * 0x1000, frame);
+        cpu->run(frameCycles);
+        cpu->captureRewind(buffer);
+        history.push_back(dumpMachine(cpu));
+    }
+    passed &= buffer->getSnapshotCount() > 1 && buffer->getSnapshotCount() < 30 && buffer->getBytesUsed() <= (96 << 10);
+    uint32_t kept = buffer->getSnapshotCount();
+    for (uint32_t i = 0; i < kept; i++){
+        passed &= cpu->rewind(buffer) && dumpMachine(cpu) == history.back();
+        history.pop_back();
+    }
+    passed &= !cpu->rewind(buffer);
+    delete buffer;
+    delete cpu;
+    return passed;
+}
+//counts runs for testRunner, half of the tasks split into more tasks
+struct PoolTestTask {
+    WorkPool* pool;
+    std::atomic<uint32_t>* runs;
+    std::atomic<uint32_t>* workers;
+    bool split;
+};
+static void poolTestRun(void* context, uint32_t worker){
+    PoolTestTask* task = (PoolTestTask*)context;
+    task->runs->fetch_add(1);
+    task->workers->fetch_or(1u << worker);
+    if (task->split){
+        task->split = false;
+        for (int i = 0; i < 3; i++){
+            task->pool->submit(&poolTestRun, task);
+        }
+    }
+    //long enough for the other workers to come looking
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+}
+bool HardwareTests::testRunner(){
+    bool passed = true;
+    //every task runs exactly once, the ones submitted from inside tasks too
+    std::atomic<uint32_t> runs(0);
+    std::atomic<uint32_t> workers(0);
+    std::vector<PoolTestTask> tasks(200);
+    WorkPool* pool = new WorkPool(4);
+    for (int round = 0; round < 2; round++){
+        runs.store(0);
+        for (uint32_t i = 0; i < tasks.size(); i++){
+            tasks[i] = {pool, &runs, &workers, (i & 1) == 1};
+            pool->submit(&poolTestRun, &tasks[i]);
+        }
+        pool->wait();
+        passed &= runs.load() == 100 + 100 * 4;
+    }
+    passed &= pool->getWorkerCount() == 4 && workers.load() == 0xF;
+    delete pool;
+    //same manifest on 1 and 3 threads: the same hashes, and the input has to show in them
+    const char* romPath = "/tmp/gba_runner_test.gba";
+    const char* inputPath = "/tmp/gba_runner_test.txt";
+    std::vector<uint8_t> rom = makeBlob(3, 0x10000, 21);
+    std::ofstream(romPath, std::ios::binary).write((const char*)rom.data(), rom.size());
+    std::ofstream(inputPath) << "0 0\n5 9\n12 200\n";
+    std::ostringstream manifest;
+    manifest << "# rom input frames\n";
+    for (int i = 0; i < 2; i++){
+        manifest << romPath << " - 20\n" << romPath << " " << inputPath << " 20\n" << romPath << " " << inputPath << " 1\n";
+    }
+    manifest << "/tmp/gba_runner_missing.gba - 20\n";
+    std::istringstream manifestIn(manifest.str());
+    std::vector<RunnerJob> jobs[2];
+    passed &= HeadlessRunner::parseManifest(manifestIn, &jobs[0]) && jobs[0].size() == 7;
+    jobs[1] = jobs[0];
+    HeadlessRunner::runJobs(&jobs[0], 1);
+    HeadlessRunner::runJobs(&jobs[1], 3);
+    for (uint32_t i = 0; i < jobs[0].size(); i++){
+        passed &= jobs[0][i].loaded == (i < 6) && jobs[1][i].loaded == (i < 6) && jobs[0][i].hash == jobs[1][i].hash;
+    }
+    passed &= jobs[0][0].hash == jobs[0][3].hash && jobs[0][1].hash == jobs[0][4].hash;
+    passed &= jobs[0][0].hash != jobs[0][1].hash && jobs[0][1].hash != jobs[0][2].hash;
+    //a job on its own gives the same hash as inside the batch
+    CPU* cpu = new CPU();
+    cpu->getMemory()->loadRom(rom.data(), rom.size());
+    cpu->getMemory()->setIORegister(0x4000130, 0x3FF);
+    cpu->getPPU()->setFrameSkip(0);
+    for (int frame = 0; frame < 20; frame++){
+        if (frame == 18){
+            cpu->getPPU()->requestFrame();
+        }
+        cpu->run((uint64_t)PPU::LINE_CYCLES * PPU::TOTAL_LINES);
+    }
+    passed &= HeadlessRunner::hashMachine(cpu) == jobs[0][0].hash;
+    delete cpu;
+    std::istringstream bad("rom-without-frames -\n");
+    std::vector<RunnerJob> none;
+    passed &= !HeadlessRunner::parseManifest(bad, &none);
+    remove(romPath);
+    remove(inputPath);
+    return passed;
+}
+bool HardwareTests::testDecodeCache(){
+    bool passed = true;
+    std::vector<uint8_t> rom = makeBlob(3, 0x8000, 31);
+    //an AND and a THUMB SWI somewhere in it
+    uint32_t andWord = 0xE0000000;
+    uint16_t swiHalf = 0xDF05;
+    memcpy(&rom[0x100], &andWord, 4);
+    memcpy(&rom[0x206], &swiHalf, 2);
+    uint32_t builds = RomDecode::getBuildCount();
+    CPU* cpus[3] = {new CPU(), new CPU(), new CPU()};
+    for (int i = 0; i < 3; i++){
+        std::vector<uint8_t> other = rom;
+        other[0x7FFF] ^= i == 2;
+        cpus[i]->getMemory()->loadRom(other.data(), other.size());
+    }
+    //every entry is what decoding the word there gives, through any mirror
+    DecodeCache* cache = cpus[0]->getDecodeCache();
+    for (uint32_t offset = 0; offset < rom.size(); offset += 0x1F4){
+        uint32_t word;
+        uint16_t half;
+        memcpy(&word, &rom[offset & ~3u], 4);
+        memcpy(&half, &rom[offset & ~1u], 2);
+        uint32_t base = 0x8000000 + 0x2000000 * (offset % 3);
+        passed &= cache->getArm(base + offset) == RomDecode::decodeArm(word);
+        passed &= cache->getThumb(base + offset) == RomDecode::decodeThumb(half);
+    }
+    passed &= cache->getArm(0x8000100) == &DataProcessingFunctions::bitwiseAnd;
+    passed &= cache->getThumb(0xC000206) == &ThumbFunctions::softwareInterrupt;
+    //past the end is whatever the bus mirrors there, decoded on the spot
+    passed &= cache->getArm(0x8000100 + rom.size()) == &DataProcessingFunctions::bitwiseAnd;
+    //the same cartridge is decoded once, a different one gets its own
+    cpus[1]->getDecodeCache()->getArm(0x8000000);
+    cpus[2]->getDecodeCache()->getArm(0x8000000);
+    passed &= cache->getRomDecode() == cpus[1]->getDecodeCache()->getRomDecode();
+    passed &= cache->getRomDecode() != cpus[2]->getDecodeCache()->getRomDecode();
+    passed &= RomDecode::getBuildCount() == builds + 2;
+    //only the pages looked up are decoded, ARM and THUMB apart; the other instance of the
+    //cartridge finds them done, entries in a page are side by side
+    const RomDecode* shared = cache->getRomDecode();
+    uint32_t pages = shared->getPageCount();
+    passed &= pages == 16 && cpus[2]->getDecodeCache()->getRomDecode()->getPageCount() == 1;
+    passed &= cpus[1]->getDecodeCache()->getArmEntry(0x8007FFC) == cache->getArmEntry(0x8007FF8) + 1;
+    passed &= cpus[1]->getDecodeCache()->getThumbEntry(0x8004000) == cache->getThumbEntry(0xA004000);
+    passed &= shared->getPageCount() == pages;
+    //code in IWRAM is decoded once, and again after it is overwritten
+    Memory* memory = cpus[0]->getMemory();
+    memory->store32(0x3000100, andWord);
+    passed &= cache->getArm(0x3000100) == &DataProcessingFunctions::bitwiseAnd;
+    passed &= cache->getArm(0x3008100) == &DataProcessingFunctions::bitwiseAnd && cache->getRamDecodes() == 1;
+    memory->store32(0x3000100, 0xE1A00000);
+    passed &= cache->getArm(0x3000100) == RomDecode::decodeArm(0xE1A00000) && cache->getRamDecodes() == 2;
+    //a store next to the code (a variable, the stack) leaves its decode alone
+    memory->store16(0x2000200, swiHalf);
+    passed &= cache->getThumb(0x2000200) == &ThumbFunctions::softwareInterrupt;
+    memory->store8(0x2000FFF, 1);
+    memory->store16(0x2000202, 0);
+    passed &= cache->getThumb(0x2000200) == &ThumbFunctions::softwareInterrupt && cache->getRamDecodes() == 3;
+    //RAM is per machine
+    passed &= cpus[1]->getDecodeCache()->getRamDecodes() == 0 && cpus[1]->getDecodeCache()->getRamBytes() < cache->getRamBytes();
+    //loading another cartridge moves the cache over to it
+    memory->loadRom(rom.data(), 0x4000);
+    passed &= cache->getArm(0x8000100) == &DataProcessingFunctions::bitwiseAnd;
+    passed &= cache->getRomDecode() != cpus[1]->getDecodeCache()->getRomDecode() && RomDecode::getBuildCount() == builds + 3;
+    //once nobody holds a cartridge's decode it is gone and the next user builds it again
+    delete cpus[0];
+    delete cpus[1];
+    CPU* cpu = new CPU();
+    cpu->getMemory()->loadRom(rom.data(), rom.size());
+    passed &= cpu->getDecodeCache()->getArm(0x8000100) == &DataProcessingFunctions::bitwiseAnd;
+    passed &= RomDecode::getBuildCount() == builds + 4;
+    delete cpu;
+    delete cpus[2];
+    //asked for from several threads at once, every cartridge is still built once
+    std::vector<uint8_t> roms[2] = {makeBlob(3, 0x8000, 41), makeBlob(3, 0x8000, 43)};
+    std::shared_ptr<const RomDecode> decodes[4];
+    std::vector<std::thread> threads;
+    builds = RomDecode::getBuildCount();
+    for (int i = 0; i < 4; i++){
+        threads.emplace_back([&roms, &decodes, i](){
+            decodes[i] = RomDecode::get(roms[i & 1].data(), roms[i & 1].size());
+        });
+    }
+    for (uint32_t i = 0; i < threads.size(); i++){
+        threads[i].join();
+    }
+    passed &= decodes[0] == decodes[2] && decodes[1] == decodes[3] && decodes[0] != decodes[1];
+    passed &= RomDecode::getBuildCount() == builds + 2;
+    //threads racing through the same fresh pages all get the one entry, decoded once
+    threads.clear();
+    std::vector<const DecodedInstruction*> seen[4];
+    for (int i = 0; i < 4; i++){
+        threads.emplace_back([&roms, &decodes, &seen, i](){
+            for (uint32_t offset = 0; offset < roms[0].size(); offset += 0x3FC){
+                seen[i].push_back(decodes[0]->getArm(offset, roms[0].data()));
+                seen[i].push_back(decodes[0]->getThumb(roms[0].size() - 2 - offset, roms[0].data()));
+            }
+        });
+    }
+    for (uint32_t i = 0; i < threads.size(); i++){
+        threads[i].join();
+    }
+    passed &= seen[0] == seen[1] && seen[0] == seen[2] && seen[0] == seen[3] && decodes[0]->getPageCount() == 16;
+    for (uint32_t offset = 0, i = 0; offset < roms[0].size(); offset += 0x3FC, i += 2){
+        uint32_t word;
+        memcpy(&word, &roms[0][offset & ~3u], 4);
+        passed &= DecodeHandlers::arm(seen[0][i]->handler) == RomDecode::decodeArm(word) && seen[0][i]->data == word;
+    }
+    passed &= decodes[1]->getPageCount() == 0 && decodes[0]->getArm(0x8000, roms[0].data()) == 0;
+    return passed;
+}
+bool HardwareTests::testMovie(){
+    bool passed = true;
+    const char* romPath = "/tmp/gba_movie_test.gba";
+    const char* scriptPath = "/tmp/gba_movie_test.txt";
+    const char* moviePath = "/tmp/gba_movie_test.gbm";
+    std::vector<uint8_t> rom = makeBlob(3, 0x10000, 23);
+    std::ofstream(romPath, std::ios::binary).write((const char*)rom.data(), rom.size());
+    std::ofstream(scriptPath) << "0 0\n5 9\n12 200\n";
+    //a script holds each line until the next, past the end of a movie nothing is pressed
+    InputMovie movie;
+    std::ifstream script(scriptPath);
+    passed &= movie.readScript(script, 20) && movie.getFrameCount() == 20;
+    passed &= movie.getKeys(4) == 0 && movie.getKeys(5) == 9 && movie.getKeys(11) == 9;
+    passed &= movie.getKeys(12) == 0x200 && movie.getKeys(19) == 0x200 && movie.getKeys(20) == 0;
+    //round trip through the file
+    movie.setRomHash(0x0123456789ABCDEFull);
+    movie.setFinalHash(0xFEDCBA9876543210ull);
+    passed &= movie.save(moviePath);
+    InputMovie loaded;
+    passed &= loaded.load(moviePath) && loaded.getFrameCount() == 20;
+    passed &= loaded.getRomHash() == movie.getRomHash() && loaded.getFinalHash() == movie.getFinalHash();
+    for (uint32_t frame = 0; frame < 21; frame++){
+        passed &= loaded.getKeys(frame) == movie.getKeys(frame);
+    }
+    //a script is not a movie, and neither is a movie cut short
+    passed &= !loaded.load(scriptPath) && loaded.getFrameCount() == 0;
+    std::ifstream in(moviePath, std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    std::ofstream(moviePath, std::ios::binary).write(bytes.data(), bytes.size() - 1);
+    passed &= !loaded.load(moviePath);
+    //the runner takes either and gets the same run out of both
+    movie.save(moviePath);
+    std::ostringstream manifest;
+    manifest << romPath << " " << scriptPath << " 20\n" << romPath << " " << moviePath << " 20\n" << romPath << " - 20\n";
+    std::istringstream manifestIn(manifest.str());
+    std::vector<RunnerJob> jobs;
+    passed &= HeadlessRunner::parseManifest(manifestIn, &jobs);
+    HeadlessRunner::runJobs(&jobs, 1);
+    passed &= jobs[0].loaded && jobs[1].loaded && jobs[0].hash == jobs[1].hash && jobs[0].hash != jobs[2].hash;
+    //a replay comes out the same every time; different input only shows because KEYINPUT is
+    //in the hashed I/O page, which says nothing about the game until code runs
+    uint64_t hashes[3];
+    for (int i = 0; i < 3; i++){
+        CPU* cpu = new CPU();
+        cpu->getMemory()->loadRom(rom.data(), rom.size());
+        if (i == 2){
+            InputMovie other = movie;
+            other.clear();
+            //until code runs nothing reads the keypad, the last frame's keys are all that stay behind
+            for (uint32_t frame = 0; frame < 20; frame++){
+                other.record(movie.getKeys(frame) ^ (frame == 19));
+            }
+            hashes[i] = HeadlessRunner::playMovie(cpu, other, 20);
+        } else {
+            hashes[i] = HeadlessRunner::playMovie(cpu, movie, 20);
+        }
+        delete cpu;
+    }
+    passed &= hashes[0] == hashes[1] && hashes[0] != hashes[2] && hashes[0] == jobs[0].hash;
+    //-p records the final hash and checks against it, and refuses a movie made on another ROM
+    char frames[] = "20";
+    char flag[] = "-p";
+    char* record[] = {0, flag, (char*)romPath, (char*)moviePath, (char*)scriptPath, frames};
+    char* play[] = {0, flag, (char*)romPath, (char*)moviePath};
+    passed &= HeadlessRunner::replay(6, record) == 0;
+    passed &= loaded.load(moviePath) && loaded.getFinalHash() == hashes[0];
+    passed &= HeadlessRunner::replay(4, play) == 0;
+    loaded.setFinalHash(hashes[2]);
+    loaded.save(moviePath);
+    passed &= HeadlessRunner::replay(4, play) == 1;
+    loaded.setFinalHash(hashes[0]);
+    loaded.setRomHash(loaded.getRomHash() + 1);
+    loaded.save(moviePath);
+    passed &= HeadlessRunner::replay(4, play) == 1;
+    remove(romPath);
+    remove(scriptPath);
+    remove(moviePath);
+    return passed;
+}
+uint32_t HardwareTests::referenceAccessCycles(uint16_t waitControl, uint32_t address, uint8_t width, bool sequential){
+    static const uint32_t firstWaits[4] = {4, 3, 2, 8};
+    uint8_t region = (address >> 24) & 0xF;
+    switch (region){
+        case Memory::EWRAM:
+            return width == 4 ? 6 : 3;
+        case Memory::PALETTE:
+        case Memory::VRAM:
+            return width == 4 ? 2 : 1;
+        case Memory::SRAM:
+            return 1 + firstWaits[waitControl & 3];
+        case 0x8:
+        case 0x9:
+        case 0xA:
+        case 0xB:
+        case 0xC:
+        case 0xD: {
+            uint32_t first;
+            uint32_t next;
+            if (region < 0xA){
+                first = 1 + firstWaits[(waitControl >> 2) & 3];
+                next = 1 + ((waitControl & 0x10) ? 1 : 2);
+            } else if (region < 0xC){
+                first = 1 + firstWaits[(waitControl >> 5) & 3];
+                next = 1 + ((waitControl & 0x80) ? 1 : 4);
+            } else {
+                first = 1 + firstWaits[(waitControl >> 8) & 3];
+                next = 1 + ((waitControl & 0x400) ? 1 : 8);
+            }
+            uint32_t cycles = sequential ? next : first;
+            return width == 4 ? cycles + next : cycles;
+        }
+        default:
+            return 1;
+    }
+}
+bool HardwareTests::testWaitStates(){
+    bool passed = true;
+    CPU* cpu = new CPU();
+    Memory* memory = cpu->getMemory();
+    //the table after any WAITCNT agrees with working it out by hand, 0 first (what DMA timing was built on)
+    uint32_t random = 17;
+    for (int round = 0; round < 64; round++){
+        uint16_t waitControl = 0;
+        if (round){
+            random ^= random << 13, random ^= random >> 17, random ^= random << 5;
+            waitControl = random & 0x5FFF;
+            memory->store16(0x4000204, waitControl);
+        }
+        passed &= memory->load16(0x4000204) == waitControl;
+        for (uint32_t region = 0; region < 16; region++){
+            for (uint8_t width = 1; width <= 4; width <<= 1){
+                for (int sequential = 0; sequential < 2; sequential++){
+                    uint32_t address = (region << 24) | (random & 0xFFFFFC);
+                    passed &= memory->getAccessCycles(address, width, sequential) ==
+                        referenceAccessCycles(waitControl, address, width, sequential);
+                }
+            }
+        }
+    }
+    //WS0 3 + 2 (first) and 2 + 1 (sequential), no prefetch
+    memory->store16(0x4000204, 0x0014);
+    passed &= memory->getFetchCycles(0x8000100, 2) == 4 && memory->getFetchCycles(0x8000102, 2) == 2;
+    memory->addInternalCycles(100);
+    passed &= memory->getFetchCycles(0x8000104, 4) == 4 && memory->getFetchCycles(0x8000200, 2) == 4;
+    //with prefetch idle cycles fill the buffer, 8 halfwords at most, 1 cycle each
+    memory->store16(0x4000204, 0x4014);
+    passed &= memory->getFetchCycles(0x8000100, 2) == 4;
+    memory->addInternalCycles(100);
+    for (uint32_t i = 0; i < 8; i++){
+        passed &= memory->getFetchCycles(0x8000102 + i * 2, 2) == 1;
+    }
+    passed &= memory->getFetchCycles(0x8000112, 2) == 2;
+    //one buffered and one on its way: 1 for the first, 2 less the cycle already spent for the second
+    memory->addInternalCycles(3);
+    passed &= memory->getFetchCycles(0x8000114, 4) == 2;
+    //code running from RAM leaves the cartridge bus to the buffer, an EWRAM word is 6 cycles, 3 halfwords
+    passed &= memory->getFetchCycles(0x2000000, 4) == 6 && memory->getFetchCycles(0x8000118, 4) == 1;
+    //a load from the cartridge throws the buffer away, a jump does too
+    memory->addInternalCycles(100);
+    passed &= memory->getDataCycles(0x8001000, 4, false) == 6 && memory->getFetchCycles(0x800011C, 2) == 4;
+    memory->addInternalCycles(100);
+    passed &= memory->getFetchCycles(0x8000400, 2) == 4 && memory->getFetchCycles(0x8000402, 2) == 2;
+    //a load from RAM does not
+    passed &= memory->getDataCycles(0x2000000, 4, false) == 6 && memory->getFetchCycles(0x8000404, 4) == 1;
+    //128K blocks start non-sequential whatever came before
+    passed &= memory->getFetchCycles(0x801FFFE, 2) == 4 && memory->getFetchCycles(0x8020000, 2) == 4;
+    passed &= memory->getDataCycles(0x8040000, 2, true) == 4 && memory->getDataCycles(0x8040002, 2, true) == 2;
+    //save states carry WAITCNT and the buffer
+    SaveState* state = new SaveState();
+    memory->store16(0x4000204, 0x4014);
+    memory->getFetchCycles(0x8000100, 2);
+    memory->addInternalCycles(5);
+    cpu->saveState(state);
+    memory->store16(0x4000204, 0x031B);
+    passed &= memory->getAccessCycles(0x8000000, 2, false) == 3 && memory->getAccessCycles(0xE000000, 1, false) == 9;
+    cpu->loadState(state);
+    passed &= memory->getAccessCycles(0x8000000, 2, false) == 4 && memory->getAccessCycles(0xE000000, 1, false) == 5;
+    passed &= memory->getFetchCycles(0x8000102, 2) == 1 && memory->getFetchCycles(0x8000104, 2) == 1;
+    delete state;
+    delete cpu;
+    return passed;
+}
+bool HardwareTests::testInterrupts(){
+    bool passed = true;
+    CPU* cpu = new CPU();
+    Memory* memory = cpu->getMemory();
+    Interrupts* interrupts = cpu->getInterrupts();
+    RegisterFile* registers = cpu->getRegisters();
+    //TM0 overflows every 256 cycles, the first one at cycle 256
+    cpu->getTimers()->writeReload(0, 0xFF00);
+    cpu->getTimers()->writeControl(0, Timers::ENABLE | Timers::IRQ_ENABLE);
+    memory->store16(0x4000200, Interrupts::TIMER0);
+    memory->store16(0x4000208, 1);
+    //zeroes in IWRAM (and the empty BIOS) are ANDEQ r0, r0, r0, which fails in one cycle, so
+    //every step is a cycle and PC moves a word
+    registers->setRegister(RegisterFile::PC, 0x3000000 + 8);
+    //taken on the overflow cycle itself, not a cycle later
+    cpu->run(255);
+    passed &= registers->getMode() == RegisterFile::SYSTEM && !interrupts->isPending();
+    cpu->run(1);
+    passed &= registers->getMode() == RegisterFile::IRQ && registers->getRegister(RegisterFile::PC) == 0x20;
+    //256 steps ran, LR is the next one (0x3000400) plus 4
+    passed &= registers->getRegister(RegisterFile::LR) == 0x3000404 && registers->getSPSR() == RegisterFile::SYSTEM;
+    //inside the handler the I bit holds it off while IF is still set
+    passed &= (registers->getCPSR() & RegisterFile::IRQ_DISABLE) && !interrupts->isPending() && interrupts->isRequesting();
+    cpu->run(10);
+    passed &= registers->getMode() == RegisterFile::IRQ && registers->getRegister(RegisterFile::PC) == 0x20 + 10 * 4;
+    //acknowledge and return, the next overflow comes in again
+    memory->store16(0x4000202, Interrupts::TIMER0);
+    passed &= !interrupts->isRequesting();
+    registers->setCPSR(registers->getSPSR());
+    cpu->run(245);
+    passed &= registers->getMode() == RegisterFile::SYSTEM;
+    cpu->run(1);
+    passed &= registers->getMode() == RegisterFile::IRQ;
+    //with IME off the request waits, turning IME on takes it straight away
+    memory->store16(0x4000202, Interrupts::TIMER0);
+    registers->setCPSR(registers->getSPSR());
+    memory->store16(0x4000208, 0);
+    cpu->run(256);
+    passed &= registers->getMode() == RegisterFile::SYSTEM && interrupts->isRequesting() && !interrupts->isPending();
+    passed &= !cpu->getScheduler()->isScheduled(Scheduler::IRQ);
+    memory->store16(0x4000208, 1);
+    passed &= interrupts->isPending() && cpu->getScheduler()->getNextEventCycle() == cpu->getScheduler()->getCycles();
+    cpu->run(1);
+    passed &= registers->getMode() == RegisterFile::IRQ;
+    //the same for the I bit, returning to code that still has it set takes nothing until it clears
+    memory->store16(0x4000202, Interrupts::TIMER0);
+    registers->setCPSR(RegisterFile::SYSTEM | RegisterFile::IRQ_DISABLE);
+    cpu->run(256);
+    passed &= registers->getMode() == RegisterFile::SYSTEM && !interrupts->isPending();
+    registers->setCPSR(RegisterFile::SYSTEM);
+    passed &= interrupts->isPending();
+    cpu->run(1);
+    passed &= registers->getMode() == RegisterFile::IRQ;
+    //halt ends on IE & IF whatever IME says, without taking anything
+    memory->store16(0x4000202, Interrupts::TIMER0);
+    registers->setCPSR(RegisterFile::SYSTEM);
+    memory->store16(0x4000208, 0);
+    cpu->setHalted(true);
+    cpu->run(300);
+    passed &= !cpu->isHalted() && registers->getMode() == RegisterFile::SYSTEM;
+    memory->store16(0x4000202, Interrupts::TIMER0);
+    memory->store16(0x4000200, 0);
+    cpu->setHalted(true);
+    cpu->run(1000);
+    passed &= cpu->isHalted();
+    //a state loaded into another machine tells that machine's controller about its I bit
+    memory->store16(0x4000200, Interrupts::TIMER0);
+    memory->store16(0x4000208, 1);
+    registers->setCPSR(RegisterFile::SYSTEM | RegisterFile::IRQ_DISABLE);
+    cpu->run(300);
+    SaveState* state = new SaveState();
+    cpu->saveState(state);
+    CPU* other = new CPU();
+    other->loadState(state);
+    passed &= other->getInterrupts()->isRequesting() && !other->getInterrupts()->isPending();
+    other->getRegisters()->setCPSR(RegisterFile::SYSTEM);
+    passed &= other->getInterrupts()->isPending() && !interrupts->isPending();
+    other->run(1);
+    passed &= other->getRegisters()->getMode() == RegisterFile::IRQ && registers->getMode() == RegisterFile::SYSTEM;
+    delete state;
+    delete other;
+    delete cpu;
+    return passed;
+}
+bool HardwareTests::testDebugger(){
+    bool passed = true;
+    CPU* cpu = new CPU();
+    Memory* memory = cpu->getMemory();
+    Scheduler* scheduler = cpu->getScheduler();
+    Debugger* debugger = cpu->getDebugger();
+    RegisterFile* registers = cpu->getRegisters();
+    //two ANDEQs that fail and a branch back to the first, in IWRAM the DMA below leaves alone
+    memory->store32(0x3004000, 0);
+    memory->store32(0x3004004, 0);
+    memory->store32(0x3004008, 0xEAFFFFFC);
+    registers->setRegister(RegisterFile::PC, 0x3004008);
+    //nothing set, nothing stops
+    cpu->run(1000);
+    passed &= debugger->getStopReason() == Debugger::NONE;
+    //a breakpoint on the instruction at PC - 8 stops in front of it, running again steps over it once
+    debugger->addBreakpoint(0x3004000);
+    debugger->addBreakpoint(0x3004008);
+    passed &= debugger->hasBreakpoints();
+    uint64_t start = scheduler->getCycles();
+    cpu->run(1000);
+    passed &= debugger->getStopReason() == Debugger::BREAKPOINT && debugger->getStopAddress() == 0x3004000;
+    passed &= debugger->isStopped() && scheduler->getCycles() == start && registers->getRegister(RegisterFile::PC) == 0x3004008;
+    cpu->run(1000);
+    passed &= debugger->getStopAddress() == 0x3004008 && registers->getRegister(RegisterFile::PC) == 0x3004010;
+    //over the branch and round to the top again
+    cpu->run(1000);
+    passed &= debugger->getStopAddress() == 0x3004000 && registers->getRegister(RegisterFile::PC) == 0x3004008;
+    //another address in the same marked block, and one in a block of its own, never match
+    debugger->removeBreakpoint(0x3004000);
+    debugger->removeBreakpoint(0x3004008);
+    debugger->addBreakpoint(0x300400C);
+    debugger->addBreakpoint(0x8000000);
+    cpu->run(1000);
+    passed &= debugger->getStopReason() == Debugger::NONE;
+    //the top four address bits are not decoded
+    debugger->addBreakpoint(0x13004004);
+    cpu->run(1000);
+    passed &= debugger->getStopReason() == Debugger::BREAKPOINT && debugger->getStopAddress() == 0x3004004;
+    debugger->clear();
+    passed &= !debugger->hasBreakpoints();
+    //THUMB is PC - 4, a B to itself
+    memory->store16(0x3004100, 0xE7FE);
+    registers->setCPSR(RegisterFile::SYSTEM | RegisterFile::THUMB);
+    registers->setRegister(RegisterFile::PC, 0x3004104);
+    debugger->addBreakpoint(0x3004100);
+    cpu->run(1000);
+    passed &= debugger->getStopReason() == Debugger::BREAKPOINT && debugger->getStopAddress() == 0x3004100;
+    cpu->run(1000);
+    passed &= debugger->getStopAddress() == 0x3004100 && registers->getRegister(RegisterFile::PC) == 0x3004104;
+    debugger->clear();
+    registers->setCPSR(RegisterFile::SYSTEM);
+    registers->setRegister(RegisterFile::PC, 0x3004008);
+    //the stop is kept until the next run
+    passed &= debugger->getStopReason() == Debugger::BREAKPOINT;
+    cpu->run(10);
+    //stores: only the watched range counts, the rest of its page goes through
+    debugger->addWatchpoint(0x3000080, 4, false, true);
+    passed &= !memory->getWritePointer(0x3000000, 4) && memory->getReadPointer(0x3000000, 4);
+    memory->store32(0x3000200, 1);
+    memory->store32(0x3000084, 1);
+    memory->load32(0x3000080);
+    passed &= debugger->getWatchHits() == 0 && debugger->getStopReason() == Debugger::NONE;
+    memory->store8(0x3000083, 0x5A);
+    passed &= debugger->getWatchHits() == 1 && debugger->getStopReason() == Debugger::WATCH_WRITE;
+    passed &= debugger->getStopAddress() == 0x3000083 && memory->load8(0x3000083) == 0x5A;
+    //a run resumes, a hit inside it (DMA falling back to the bus) ends it after the transfer
+    for (uint32_t i = 0; i < 0x400; i += 4){
+        memory->store32(0x2000000 + i, i * 3);
+    }
+    memory->store32(0x40000D4, 0x2000000);
+    memory->store32(0x40000D8, 0x3000000);
+    memory->store16(0x40000DC, 0x100);
+    memory->store16(0x40000DE, DMA::ENABLE | DMA::WORD);
+    start = scheduler->getCycles();
+    cpu->run(100000);
+    passed &= debugger->getStopReason() == Debugger::WATCH_WRITE && debugger->getStopAddress() == 0x3000080;
+    passed &= scheduler->getCycles() < start + 100000 && cpu->getDMA()->getFastTransferCount() == 0;
+    passed &= memory->load32(0x3000080) == 0x80 * 3 && memory->load32(0x30003FC) == 0x3FC * 3;
+    //halfword stores behind byte writes to palette and word stores to SRAM are reported as such
+    debugger->addWatchpoint(0x5000010, 2, false, true);
+    debugger->addWatchpoint(0xE000002, 1, false, true);
+    uint64_t hits = debugger->getWatchHits();
+    memory->store8(0x5000011, 0x33);
+    memory->store32(0xE000000, 0x11223344);
+    passed &= debugger->getWatchHits() == hits + 2 && memory->load16(0x5000010) == 0x3333;
+    //loads, ROM has no pages and every load there reaches the list
+    debugger->clear();
+    passed &= memory->getWritePointer(0x3000000, 4) != 0;
+    debugger->addWatchpoint(0x2000010, 2, true, false);
+    debugger->addWatchpoint(0x8000000, 4, true, false);
+    cpu->run(10);
+    memory->store16(0x2000010, 7);
+    memory->load16(0x2000020);
+    memory->load32(0x8001000);
+    memory->load32(0x3000000);
+    passed &= debugger->getStopReason() == Debugger::NONE && !memory->getReadPointer(0x2000000, 4);
+    memory->load8(0x2000011);
+    passed &= debugger->getStopReason() == Debugger::WATCH_READ && debugger->getStopAddress() == 0x2000011;
+    cpu->run(10);
+    memory->load32(0x8000000);
+    passed &= debugger->getStopReason() == Debugger::WATCH_READ && debugger->getStopAddress() == 0x8000000;
+    debugger->removeWatchpoint(0x8000000);
+    debugger->removeWatchpoint(0x2000010);
+    cpu->run(10);
+    memory->load32(0x8000000);
+    memory->load8(0x2000011);
+    passed &= debugger->getStopReason() == Debugger::NONE && memory->getReadPointer(0x2000000, 4);
+    delete cpu;
+    return passed;
+}
+bool HardwareTests::testTrace(){
+    bool passed = true;
+    const char* paths[] = {"/tmp/gba_trace_test_a.gbt", "/tmp/gba_trace_test_b.gbt", "/tmp/gba_trace_test_c.gbt"};
+    //made up steps over several chunks: straight line runs, jumps, THUMB, registers and stores
+    std::vector<TraceStep> steps(10000);
+    uint32_t seed = 1;
+    uint32_t address = 0x8000000;
+    uint32_t values[TraceStep::REGISTERS] = {0};
+    for (uint32_t i = 0; i < steps.size(); i++){
+        TraceStep* step = &steps[i];
+        seed = seed * 1103515245 + 12345;
+        step->thumb = (i / 500) & 1;
+        if (!(seed & 0x700)){
+            address = 0x8000000 + ((seed >> 8) & 0xFFFF) * 4;
+        }
+        step->address = address;
+        step->opcode = step->thumb ? (seed >> 16) : seed;
+        address += step->thumb ? 2 : 4;
+        if (seed & 0x10000){
+            values[(seed >> 20) & 15] += (seed >> 24) - 128;
+        }
+        if (!(seed & 0x3000)){
+            values[TraceStep::CPSR] ^= 0x20;
+        }
+        memcpy(step->registers, values, sizeof(values));
+        for (uint32_t w = 0; w < ((seed >> 28) & 3); w++){
+            step->writes.push_back({0x3000000 + ((seed >> 4) & 0x7FFC) + w * 4, seed ^ w, (uint8_t)(1 << (w % 3))});
+        }
+    }
+    for (int file = 0; file < 3; file++){
+        TraceWriter writer;
+        passed &= writer.open(paths[file]);
+        //b differs in r3 from step 9000 on, c stops at 8000
+        uint32_t count = file == 2 ? 8000 : steps.size();
+        for (uint32_t i = 0; i < count; i++){
+            TraceStep step = steps[i];
+            if (file == 1 && i >= 9000){
+                step.registers[3] ^= 1;
+            }
+            for (uint32_t w = 0; w < step.writes.size(); w++){
+                writer.write(step.writes[w].address, step.writes[w].width, step.writes[w].value);
+            }
+            writer.step(step.address, step.opcode, step.thumb, step.registers);
+        }
+        passed &= writer.getStepCount() == count;
+        passed &= writer.close();
+    }
+    TraceReader readers[3];
+    for (int file = 0; file < 3; file++){
+        passed &= readers[file].open(paths[file]);
+    }
+    passed &= readers[0].getStepCount() == 10000 && readers[2].getStepCount() == 8000;
+    TraceStep step;
+    for (uint32_t i = 0; i < steps.size(); i++){
+        passed &= readers[0].getStep(i, &step) && step == steps[i] && step.index == i;
+    }
+    //out of order and across chunks
+    uint32_t picks[] = {7000, 5, TraceWriter::CHUNK_STEPS, TraceWriter::CHUNK_STEPS - 1, 9999, 0};
+    for (uint32_t i = 0; i < sizeof(picks) / sizeof(picks[0]); i++){
+        passed &= readers[0].getStep(picks[i], &step) && step == steps[picks[i]];
+    }
+    passed &= !readers[0].getStep(10000, &step);
+    passed &= TraceReader::findDivergence(&readers[0], &readers[0]) == UINT64_MAX;
+    passed &= TraceReader::findDivergence(&readers[0], &readers[1]) == 9000;
+    passed &= TraceReader::findDivergence(&readers[1], &readers[0]) == 9000;
+    passed &= TraceReader::findDivergence(&readers[0], &readers[2]) == 8000;
+    //a file that was never closed has no footer
+    {
+        TraceWriter open;
+        open.open(paths[2]);
+        open.step(0x8000000, 0, false, values);
+        TraceReader early;
+        passed &= !early.open(paths[2]);
+    }
+    //from the CPU: a loop with a call in it, opcodes from the bus, registers as they change, stores between steps
+    std::vector<uint8_t> rom(0x1000);
+    uint32_t code[] = {
+        0xE0000291,     //0x00 MUL r0, r1, r2
+        0xE0030290,     //0x04 MUL r3, r0, r2
+        0xEB000004,     //0x08 BL 0x8000020
+        0xE0040293,     //0x0C MUL r4, r3, r2
+        0xEAFFFFFA,     //0x10 B 0x8000000
+        0, 0, 0,
+        0xE0050290,     //0x20 MUL r5, r0, r2
+        0xE12FFF1E};    //0x24 BX lr
+    memcpy(rom.data(), code, sizeof(code));
+    uint32_t order[] = {0x00, 0x04, 0x08, 0x20, 0x24, 0x0C, 0x10, 0x00};
+    CPU* cpu = new CPU();
+    Memory* memory = cpu->getMemory();
+    RegisterFile* registers = cpu->getRegisters();
+    memory->loadRom(rom.data(), rom.size());
+    registers->setRegister(1, 6);
+    registers->setRegister(2, 7);
+    TraceWriter writer;
+    passed &= writer.open(paths[0]);
+    cpu->setTrace(&writer);
+    cpu->run(200);
+    uint64_t mark = writer.getStepCount();
+    registers->setRegister(7, 5);
+    memory->store32(0x40000D4, 0x8000000);
+    memory->store32(0x40000D8, 0x3000000);
+    memory->store16(0x40000DC, 4);
+    memory->store16(0x40000DE, DMA::ENABLE | DMA::WORD);
+    cpu->run(200);
+    cpu->setTrace(0);
+    uint64_t traced = writer.getStepCount();
+    passed &= writer.close() && memory->getWritePointer(0x3000000, 4) != 0;
+    passed &= memory->load32(0x300000C) == memory->load32(0x800000C);
+    TraceReader reader;
+    passed &= reader.open(paths[0]) && reader.getStepCount() == traced && traced > mark + 8 && mark > 8;
+    //round the loop and through the call, each step with the registers it left behind
+    for (uint32_t i = 0; i < sizeof(order) / sizeof(order[0]); i++){
+        passed &= reader.getStep(i, &step) && step.address == 0x8000000 + order[i] && !step.thumb;
+        passed &= step.opcode == code[order[i] / 4];
+    }
+    passed &= reader.getStep(0, &step) && step.registers[0] == 42 && (step.changed & 1);
+    passed &= reader.getStep(2, &step) && step.registers[RegisterFile::LR] == 0x800000C && (step.changed & (1 << RegisterFile::LR));
+    passed &= reader.getStep(3, &step) && step.registers[5] == 42 * 7 && step.changed == 1 << 5;
+    //the register write lands on the first step after it, the DMA's stores on a later one
+    passed &= reader.getStep(mark, &step) && step.registers[7] == 5 && (step.changed & (1 << 7));
+    uint32_t dmaWrites = 0;
+    uint32_t ioWrites = step.writes.size();
+    for (uint64_t i = mark + 1; i < traced; i++){
+        reader.getStep(i, &step);
+        for (uint32_t w = 0; w < step.writes.size(); w++){
+            dmaWrites += (step.writes[w].address & ~0xF) == 0x3000000 && step.writes[w].width == 4;
+        }
+    }
+    passed &= ioWrites == 6 && dmaWrites == 4;
+    delete cpu;
+    for (int file = 0; file < 3; file++){
+        remove(paths[file]);
+    }
+    return passed;
+}
+bool HardwareTests::testProfiler(){
+    bool passed = true;
+    //ARM: two calls from 0x8000000, one returning by BX LR and one by POP {r4, pc},
+    //then BX over to THUMB for a call two deep that backs out through BX LR then POP.
+    //The callees count r5/r6 down by MULS so some samples land in each, the zero
+    //halfwords are LSL r0, nothing
+    std::vector<uint8_t> rom(0x1000);
+    struct { uint32_t address; uint32_t value; uint8_t width; } code[] = {
+        {0x000, 0xEB00003E, 4},     //BL 0x8000100
+        {0x004, 0x1B00003D, 4},     //BLNE 0x8000100, Z is set by then
+        {0x008, 0xEB00005C, 4},     //BL 0x8000180
+        {0x00C, 0xE12FFF13, 4},     //BX r3
+        {0x100, 0xE0150295, 4},     //MULS r5, r5, r2
+        {0x104, 0x1AFFFFFD, 4},     //BNE 0x8000100
+        {0x108, 0xE12FFF1E, 4},     //BX LR
+        {0x180, 0xE0160296, 4},     //MULS r6, r6, r2
+        {0x184, 0x1AFFFFFD, 4},     //BNE 0x8000180
+        {0x188, 0xE8BD8010, 4},     //POP {r4, pc}
+        {0x200, 0xF000, 2},         //BL 0x8000300
+        {0x202, 0xF87E, 2},
+        {0x204, 0xE7FE, 2},         //B 0x8000204
+        {0x310, 0xF000, 2},         //BL 0x8000400
+        {0x312, 0xF876, 2},
+        {0x314, 0xBD10, 2},         //POP {r4, pc}
+        {0x420, 0x4770, 2}};        //BX LR
+    for (uint32_t i = 0; i < sizeof(code) / sizeof(code[0]); i++){
+        memcpy(&rom[code[i].address], &code[i].value, code[i].width);
+    }
+    CPU* cpu = new CPU();
+    Memory* memory = cpu->getMemory();
+    RegisterFile* registers = cpu->getRegisters();
+    Debugger* debugger = cpu->getDebugger();
+    Profiler* profiler = cpu->getProfiler();
+    memory->loadRom(rom.data(), rom.size());
+    registers->setRegister(2, 2);
+    registers->setRegister(5, 1 << 24);
+    registers->setRegister(6, 1 << 28);
+    registers->setRegister(3, 0x8000201);
+    registers->setRegister(RegisterFile::SP, 0x3000100);
+    memory->store32(0x3000100, 0x44);
+    memory->store32(0x3000104, 0x800000C);
+    memory->store32(0x3000108, 0x55);
+    memory->store32(0x300010C, 0x8000205);
+    registers->setRegister(RegisterFile::PC, 0x8000008);
+    profiler->start(16);
+    passed &= profiler->isRunning() && cpu->getScheduler()->isScheduled(Scheduler::PROFILE);
+    //run to address and check the depth the profiler has got to there
+    auto runTo = [&](uint32_t address, uint32_t depth){
+        debugger->addBreakpoint(address);
+        cpu->run(10000);
+        bool stopped = debugger->getStopReason() == Debugger::BREAKPOINT && debugger->getStopAddress() == address;
+        debugger->clear();
+        return stopped && profiler->getDepth() == depth;
+    };
+    passed &= runTo(0x8000104, 1);
+    //back by BX LR, and the BLNE that did not run called nothing
+    passed &= runTo(0x8000008, 0) && registers->getRegister(RegisterFile::LR) == 0x8000004;
+    passed &= runTo(0x8000188, 1);
+    passed &= runTo(0x800000C, 0) && registers->getRegister(4) == 0x44;
+    //the BX into THUMB returns to nobody and is ignored
+    passed &= runTo(0x8000420, 2) && registers->isThumb();
+    passed &= runTo(0x8000314, 1);
+    passed &= runTo(0x8000204, 0) && registers->getRegister(4) == 0x55 && registers->getRegister(RegisterFile::SP) == 0x3000110;
+    //some time at the root, then nothing more once stopped
+    cpu->run(200);
+    profiler->stop();
+    uint64_t samples = profiler->getSampleCount();
+    cpu->run(1000);
+    passed &= !profiler->isRunning() && profiler->getSampleCount() == samples && samples > 0;
+    //every stack that ran shows up once and the counts add up to the samples
+    std::ostringstream folded;
+    profiler->writeFolded(folded, 0);
+    std::istringstream lines(folded.str());
+    std::map<std::string, uint64_t> stacks;
+    std::string stack;
+    uint64_t count;
+    uint64_t total = 0;
+    while (lines >> stack >> count){
+        stacks[stack] += count;
+        total += count;
+    }
+    passed &= total == samples && stacks.size() == 5 && stacks.count("root") && stacks.count("0x08000100") && stacks.count("0x08000180");
+    passed &= stacks.count("0x08000300") && stacks.count("0x08000300;0x08000400");
+    std::istringstream map("# made up\n08000100 T armFunc\n08000180 T armPop\n0x08000300 thumbFunc\n08000400 t inner\nnot a symbol\n");
+    SymbolMap symbols;
+    passed &= symbols.read(map) == 4 && symbols.getSymbolCount() == 4;
+    passed &= symbols.lookup(0x80000FF) == 0 && strcmp(symbols.lookup(0x8000305), "thumbFunc") == 0;
+    std::ostringstream named;
+    profiler->writeFolded(named, &symbols);
+    std::ostringstream expected;
+    expected << "root " << stacks["root"] << "\narmFunc " << stacks["0x08000100"] << "\narmPop " << stacks["0x08000180"];
+    expected << "\nthumbFunc " << stacks["0x08000300"] << "\nthumbFunc;inner " << stacks["0x08000300;0x08000400"] << "\n";
+    passed &= named.str() == expected.str();
+    //deeper than MAX_DEPTH stays at MAX_DEPTH, clear forgets everything
+    for (uint32_t i = 0; i < Profiler::MAX_DEPTH + 10; i++){
+        profiler->call(0x8000100, 0x8000004 + i * 4);
+    }
+    passed &= profiler->getDepth() == Profiler::MAX_DEPTH;
+    profiler->ret(0x8000004);
+    passed &= profiler->getDepth() == 0;
+    profiler->clear();
+    std::ostringstream empty;
+    profiler->writeFolded(empty, 0);
+    passed &= profiler->getSampleCount() == 0 && empty.str().empty();
+    //stopped, the handlers only branch and the call tree does not see them
+    registers->setCPSR(registers->getCPSR() & ~RegisterFile::THUMB);
+    registers->setRegister(RegisterFile::PC, 0x8000008);
+    BranchFunctions::branchLink(0xEB00003E);
+    passed &= registers->getRegister(RegisterFile::LR) == 0x8000004 && registers->getRegister(RegisterFile::PC) == 0x8000108;
+    registers->setRegister(RegisterFile::LR, 0x8000211);
+    BranchFunctions::branchExchange(0xE12FFF1E);
+    passed &= registers->isThumb() && registers->getRegister(RegisterFile::PC) == 0x8000214;
+    ThumbFunctions::branchLinkHigh(0xF000);
+    registers->setRegister(RegisterFile::PC, 0x8000216);
+    ThumbFunctions::branchLink(0xF8F6);
+    passed &= registers->getRegister(RegisterFile::LR) == 0x8000215 && registers->getRegister(RegisterFile::PC) == 0x8000404;
+    registers->setRegister(RegisterFile::SP, 0x3000100);
+    memory->store32(0x3000100, 0x44);
+    memory->store32(0x3000104, 0x8000215);
+    ThumbFunctions::popPC(0xBD10);
+    passed &= registers->getRegister(4) == 0x44 && registers->getRegister(RegisterFile::SP) == 0x3000108;
+    passed &= registers->isThumb() && registers->getRegister(RegisterFile::PC) == 0x8000218;
+    registers->setCPSR(registers->getCPSR() & ~RegisterFile::THUMB);
+    registers->setRegister(RegisterFile::SP, 0x3000100);
+    memory->store32(0x3000104, 0x8000004);
+    BranchFunctions::popPC(0xE8BD8010);
+    passed &= registers->getRegister(RegisterFile::SP) == 0x3000108 && registers->getRegister(RegisterFile::PC) == 0x800000C;
+    passed &= profiler->getDepth() == 0 && profiler->getSampleCount() == 0;
+    delete cpu;
+    return passed;
+}
+bool HardwareTests::testDecodedInstructions(){
+    bool passed = true;
+    //the arena: zeroed runs back to back, a reset hands the same memory out again
+    DecodeArena arena;
+    DecodedInstruction* first = arena.allocate(100);
+    first[99].handler = 7;
+    DecodedInstruction* second = arena.allocate(50);
+    passed &= second == first + 100 && ((uintptr_t)first & 63) == 0 && arena.getBlockCount() == 1;
+    DecodedInstruction* big = arena.allocate(DecodeArena::BLOCK_ENTRIES + 1);
+    passed &= arena.getBlockCount() == 2 && big[DecodeArena::BLOCK_ENTRIES].handler == 0;
+    arena.reset();
+    passed &= arena.allocate(100) == first && first[99].handler == 0 && arena.getBlockCount() == 2;
+    //fields come out of the word whichever format keeps them where
+    DecodedInstruction entry;
+    RomDecode::decodeArm(0xE2813C02, &entry);       //ADD r3, r1, #0x200
+    passed &= entry.rd == 3 && entry.rn == 1 && entry.imm == 0x200 && entry.cycles == 1 && entry.condition == 0xE;
+    passed &= DecodeHandlers::arm(entry.handler) == &DataProcessingFunctions::addImmeadiate;
+    RomDecode::decodeArm(0x10821315, &entry);       //ADDNE r1, r2, r5, LSL r3
+    passed &= entry.rd == 1 && entry.rn == 2 && entry.rm == 5 && entry.condition == 0x1 && entry.cycles == 2;
+    passed &= entry.shift == (DecodedInstruction::SHIFT_BY_REGISTER | 3);
+    RomDecode::decodeArm(0xE1A0F10E, &entry);       //MOV pc, lr, LSL #2
+    passed &= entry.rd == 15 && entry.rm == 14 && entry.shift == 2 && entry.cycles == 3;
+    RomDecode::decodeArm(0xE5912FFC, &entry);       //LDR r2, [r1, #0xFFC]
+    passed &= entry.rd == 2 && entry.rn == 1 && entry.imm == 0xFFC && entry.cycles == 3;
+    RomDecode::decodeArm(0xE1D430B6, &entry);       //LDRH r3, [r4, #6]
+    passed &= entry.rd == 3 && entry.rn == 4 && entry.imm == 6 && entry.cycles == 3;
+    RomDecode::decodeArm(0xE8BD8010, &entry);       //POP {r4, pc}
+    passed &= entry.imm == 0x8010 && entry.cycles == 6 && DecodeHandlers::arm(entry.handler) == &BranchFunctions::popPC;
+    RomDecode::decodeArm(0xEBFFFFFE, &entry);       //BL to itself
+    passed &= entry.imm == (uint32_t)-8 && entry.cycles == 3 && DecodeHandlers::arm(entry.handler) == &BranchFunctions::branchLink;
+    RomDecode::decodeArm(0xE0A54392, &entry);       //UMLAL r4, r5, r2, r3
+    passed &= entry.rd == 5 && entry.rn == 4 && entry.rm == 2 && (entry.shift & 0xF) == 3 && entry.cycles == 3;
+    RomDecode::decodeThumb(0x4770, &entry);         //BX lr
+    passed &= entry.rm == 14 && entry.cycles == 3 && DecodeHandlers::thumb(entry.handler) == &ThumbFunctions::branchExchange;
+    RomDecode::decodeThumb(0x44F7, &entry);         //ADD pc, lr (H1 and H2)
+    passed &= entry.rd == 15 && entry.rm == 14;
+    RomDecode::decodeThumb(0x6A8B, &entry);         //LDR r3, [r1, #0x28]
+    passed &= entry.rd == 3 && entry.rn == 1 && entry.imm == 0x28 && entry.cycles == 3;
+    RomDecode::decodeThumb(0xD0FE, &entry);         //BEQ to itself
+    passed &= entry.condition == 0 && entry.imm == (uint32_t)-4;
+    RomDecode::decodeThumb(0xB5F0, &entry);         //PUSH {r4-r7, lr}
+    passed &= entry.imm == 0x1F0 && entry.cycles == 6 && entry.rn == 13;
+    RomDecode::decodeThumb(0xDF05, &entry);
+    passed &= entry.imm == 5 && DecodeHandlers::thumb(entry.handler) == &ThumbFunctions::softwareInterrupt;
+    RomDecode::decodeArm(0xEF050000, &entry);
+    passed &= entry.imm == 5 && DecodeHandlers::arm(entry.handler) == &BranchFunctions::softwareInterrupt;
+    //a handler keeps its number, whoever decodes it first
+    RomDecode::decodeArm(0xE0000000, &entry);
+    uint16_t andIndex = entry.handler;
+    RomDecode::decodeArm(0xE0011002, &entry);
+    passed &= entry.handler == andIndex && DecodeHandlers::armIndex(&DataProcessingFunctions::bitwiseAnd) == andIndex;
+    passed &= DecodeHandlers::armIndex(placeholder) == DecodeHandlers::PLACEHOLDER;
+    //the unconditional space has nothing on the ARM7, the factory gives the placeholder for it
+    passed &= RomDecode::decodeArm(0xF5D0F000) == (Func)placeholder;
+    Instruction unconditional(0xFA000000);
+    passed &= unconditional.decode() == (Func)placeholder;
+    //a cartridge page's entries are one array, RAM pages come out of the instance's arena
+    std::vector<uint8_t> rom = makeBlob(3, 0x4000, 5);
+    CPU* cpu = new CPU();
+    Memory* memory = cpu->getMemory();
+    DecodeCache* cache = cpu->getDecodeCache();
+    memory->loadRom(rom.data(), rom.size());
+    const DecodedInstruction* start = cache->getArmEntry(0x8003000);
+    passed &= cache->getArmEntry(0x8003FFC) == start + 0x3FF && cache->getThumbEntry(0x8000012) == cache->getThumbEntry(0x8000010) + 1;
+    for (uint32_t offset = 0; offset < rom.size(); offset += 0x124){
+        uint32_t word;
+        memcpy(&word, &rom[offset & ~3u], 4);
+        RomDecode::decodeArm(word, &entry);
+        passed &= memcmp(cache->getArmEntry(0x8000000 + offset), &entry, sizeof(entry)) == 0;
+    }
+    memory->store32(0x3000000, 0xE2813C02);
+    memory->store32(0x3000004, 0xE8BD8010);
+    const DecodedInstruction* ram = cache->getArmEntry(0x3000000);
+    passed &= cache->getArmEntry(0x3000004) == ram + 1 && ram->imm == 0x200;
+    uint64_t bytes = cache->getRamBytes();
+    //rewritten code is decoded again in the same place
+    memory->store32(0x3000000, 0xE5912FFC);
+    passed &= cache->getArmEntry(0x3000000) == ram && ram->imm == 0xFFC && cache->getRamBytes() == bytes;
+    for (uint32_t page = 0; page < 8; page++){
+        cache->getThumbEntry(0x2000000 + page * Memory::PAGE_SIZE);
+    }
+    passed &= cache->getRamBytes() == bytes && cache->getRamDecodes() == 3 + 8;
+    //a flush forgets RAM and refills from the start of the same blocks
+    cache->flush();
+    passed &= cache->getArmEntry(0x3000000) == ram && cache->getRamBytes() == bytes && cache->getRamDecodes() == 12;
+    passed &= cache->getArm(0x3000000) == RomDecode::decodeArm(0xE5912FFC);
+    //outside ROM and RAM the scratch entry
+    passed &= cache->getThumbEntry(0x6000000) == cache->getArmEntry(0x6000000);
+    //a cartridge's last halfword is in the shared table, only the word there is past the end
+    passed &= cache->getThumbEntry(0x8003FFE) == cache->getRomDecode()->getThumb(0x3FFE, memory->getRom());
+    passed &= cache->getArmEntry(0x8003FFC) == cache->getRomDecode()->getArm(0x3FFC, memory->getRom());
+    //step() runs the entry at PC - 8 and moves PC on: MUL r0, r1, r2 then B back to it
+    RegisterFile* registers = cpu->getRegisters();
+    Scheduler* scheduler = cpu->getScheduler();
+    memory->store32(0x3000100, 0xE0000291);
+    memory->store32(0x3000104, 0xEAFFFFFD);
+    registers->setRegister(1, 6);
+    registers->setRegister(2, 7);
+    registers->setRegister(RegisterFile::PC, 0x3000108);
+    uint64_t cycles = scheduler->getCycles();
+    //one cycle for the MUL and one for the multiplier, IWRAM fetches have no wait states
+    cpu->run(1);
+    passed &= registers->getRegister(0) == 42 && registers->getRegister(RegisterFile::PC) == 0x300010C;
+    passed &= scheduler->getCycles() == cycles + 2;
+    cpu->run(1);
+    passed &= registers->getRegister(RegisterFile::PC) == 0x3000108 && scheduler->getCycles() == cycles + 2 + 3;
+    //MULEQ with Z clear is the fetch and nothing else
+    memory->store32(0x3000100, 0x00000291);
+    registers->setRegister(0, 0);
+    cycles = scheduler->getCycles();
+    cpu->run(1);
+    passed &= registers->getRegister(0) == 0 && registers->getRegister(RegisterFile::PC) == 0x300010C && scheduler->getCycles() == cycles + 1;
+    //the same branch from EWRAM pays for its fetch over the 16 bit bus
+    memory->store32(0x2000104, 0xEAFFFFFD);
+    registers->setRegister(RegisterFile::PC, 0x200010C);
+    cycles = scheduler->getCycles();
+    cpu->run(1);
+    passed &= registers->getRegister(RegisterFile::PC) == 0x2000108;
+    passed &= scheduler->getCycles() == cycles + 3 + memory->getAccessCycles(0x2000104, 4, true) - 1;
+    //THUMB BNE to itself, taken with Z clear and falling through with it set
+    memory->store16(0x3000200, 0xD1FE);
+    registers->setCPSR(RegisterFile::SYSTEM | RegisterFile::THUMB);
+    registers->setRegister(RegisterFile::PC, 0x3000204);
+    cpu->run(1);
+    passed &= registers->getRegister(RegisterFile::PC) == 0x3000204;
+    registers->setCPSR(RegisterFile::SYSTEM | RegisterFile::THUMB | RegisterFile::Z);
+    cpu->run(1);
+    passed &= registers->getRegister(RegisterFile::PC) == 0x3000206;
+    delete cpu;
+    return passed;
+}
+uint64_t HardwareTests::referenceMultiply(uint32_t a, uint32_t b, bool isSigned){
+    //magnitudes multiplied in 16 bit pieces, the sign put back by hand
+    bool negative = false;
+    if (isSigned && (a >> 31)){
+        a = 0 - a;
+        negative = !negative;
+    }
+    if (isSigned && (b >> 31)){
+        b = 0 - b;
+        negative = !negative;
+    }
+    uint64_t low = (uint64_t)(a & 0xFFFF) * (b & 0xFFFF);
+    uint64_t middle = (uint64_t)(a >> 16) * (b & 0xFFFF) + (uint64_t)(a & 0xFFFF) * (b >> 16);
+    uint64_t high = (uint64_t)(a >> 16) * (b >> 16);
+    uint64_t result = low + (middle << 16) + (high << 32);
+    return negative ? 0 - result : result;
+}
+uint32_t HardwareTests::referenceMultiplierCycles(uint32_t rs, bool isSigned){
+    for (uint32_t cycles = 1; cycles < 4; cycles++){
+        uint32_t rest = rs >> (cycles * 8);
+        uint32_t ones = 0xFFFFFFFF >> (cycles * 8);
+        if (rest == 0 || (isSigned && rest == ones)){
+            return cycles;
+        }
+    }
+    return 4;
+}
+bool HardwareTests::testMultiply(){
+    bool passed = true;
+    //every form decodes to its handler (the words CPUTests.py decodes)
+    struct { uint32_t word; Func func; } decodes[] = {
+        {0xE0090B9A, &MultiplyFunctions::multiply}, {0xE0273998, &MultiplyFunctions::multiplyAccumulate},
+        {0xE0887399, &MultiplyFunctions::unsignedMultiplyLong}, {0xE0A87399, &MultiplyFunctions::unsignedMultiplyAccumulateLong},
+        {0xE0C87399, &MultiplyFunctions::signedMultiplyLong}, {0xE0E87399, &MultiplyFunctions::signedMultiplyAccumulateLong},
+        {0xE10739C8, &MultiplyFunctions::signedMultiplyAccumulateHalfwords},
+        {0xE12739C8, &MultiplyFunctions::signedMultiplyAccumulateWordHalfword},
+        {0xE12709E8, &MultiplyFunctions::signedMultiplyWordHalfword},
+        {0xE1487AC9, &MultiplyFunctions::signedMultiplyAccumulateLongHalfwords},
+        {0xE16709C8, &MultiplyFunctions::signedMultiplyHalfwords}};
+    for (uint32_t i = 0; i < sizeof(decodes) / sizeof(decodes[0]); i++){
+        passed &= RomDecode::decodeArm(decodes[i].word) == decodes[i].func;
+    }
+    //m: every boundary both ways, then what the reference says for a spread of values
+    passed &= MultiplyFunctions::multiplierCycles(0, false) == 1 && MultiplyFunctions::multiplierCycles(0xFF, false) == 1;
+    passed &= MultiplyFunctions::multiplierCycles(0x100, false) == 2 && MultiplyFunctions::multiplierCycles(0xFFFFFFFF, false) == 4;
+    passed &= MultiplyFunctions::multiplierCycles(0xFFFFFFFF, true) == 1 && MultiplyFunctions::multiplierCycles(0xFFFFFF00, true) == 1;
+    passed &= MultiplyFunctions::multiplierCycles(0xFFFF8000, true) == 2 && MultiplyFunctions::multiplierCycles(0x80000000, true) == 4;
+    for (uint32_t shift = 0; shift < 32; shift++){
+        for (int32_t delta = -1; delta <= 1; delta++){
+            uint32_t value = (1u << shift) + delta;
+            for (int sign = 0; sign < 2; sign++){
+                passed &= MultiplyFunctions::multiplierCycles(value, sign) == referenceMultiplierCycles(value, sign);
+                passed &= MultiplyFunctions::multiplierCycles(~value, sign) == referenceMultiplierCycles(~value, sign);
+            }
+        }
+    }
+    //the handlers on random operands against the reference: results, flags and cycles
+    CPU* cpu = new CPU();
+    CPU::setActive(cpu);
+    RegisterFile* registers = cpu->getRegisters();
+    Scheduler* scheduler = cpu->getScheduler();
+    uint32_t seed = 99;
+    auto random = [&seed](){
+        seed ^= seed << 13, seed ^= seed >> 17, seed ^= seed << 5;
+        return seed;
+    };
+    //small and negative numbers are what fixed point code feeds these, and where m changes
+    auto operand = [&random](){
+        uint32_t value = random();
+        switch (random() & 7){
+            case 0: return value & 0xFF;
+            case 1: return value | 0xFFFFFF00;
+            case 2: return value & 0xFFFF;
+            case 3: return value | 0xFFFF0000;
+            case 4: return value & 0xFFFFFF;
+            case 5: return (random() & 1) ? 0x80000000u : (random() & 1 ? 0u : 0xFFFFFFFFu);
+            default: return value;
+        }
+    };
+    const uint32_t rounds = 20000;
+    for (uint32_t form = 0; form < 11; form++){
+        for (uint32_t round = 0; round < rounds; round++){
+            //four different registers below the PC, for Rd (RdHi), Rn (RdLo), Rs and Rm
+            uint8_t order[13] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12};
+            for (uint32_t i = 0; i < 4; i++){
+                uint32_t pick = i + random() % (13 - i);
+                std::swap(order[i], order[pick]);
+            }
+            uint8_t rd = order[0], rn = order[1], rs = order[2], rm = order[3];
+            uint32_t values[4] = {operand(), operand(), operand(), operand()};
+            registers->setRegister(rd, values[0]);
+            registers->setRegister(rn, values[1]);
+            registers->setRegister(rs, values[2]);
+            registers->setRegister(rm, values[3]);
+            uint32_t flags = random() & 0xF8000000;
+            registers->setFlags(0xF8000000, flags);
+            //now and then a condition that fails: EQ with Z clear
+            bool skip = (random() & 15) == 0;
+            uint32_t condition = skip ? 0x0 : 0xE;
+            if (skip){
+                registers->setFlags(RegisterFile::Z, 0);
+                flags &= ~RegisterFile::Z;
+            }
+            bool setFlags = form < 6 && (random() & 1);
+            bool x = random() & 1;
+            bool y = random() & 1;
+            uint32_t word = decodes[form].word & 0x0FF00000;
+            word |= condition << 28 | (uint32_t)rd << 16 | (uint32_t)rn << 12 | (uint32_t)rs << 8 | rm;
+            word |= form < 6 ? (setFlags << 20 | 0x90) : (0x80 | y << 6 | x << 5);
+            if (form == 8 || form == 7){
+                //SMULWy has bit 5 set, SMLAWy clear
+                word = (word & ~0x20) | (form == 8 ? 0x20 : 0);
+            }
+            //what it should come to
+            uint32_t expect[2] = {values[0], values[1]};
+            uint32_t expectFlags = flags;
+            uint32_t cycles = 0;
+            int32_t hx = (int16_t)(values[3] >> (x ? 16 : 0));
+            int32_t hy = (int16_t)(values[2] >> (y ? 16 : 0));
+            uint64_t wide;
+            switch (form){
+                case 0:
+                case 1:
+                    expect[0] = (uint32_t)referenceMultiply(values[3], values[2], false) + (form == 1 ? values[1] : 0);
+                    expectFlags = (flags & ~0xC0000000) | (expect[0] & 0x80000000) | (expect[0] ? 0 : 0x40000000);
+                    cycles = referenceMultiplierCycles(values[2], true);
+                    break;
+                case 2:
+                case 3:
+                case 4:
+                case 5: {
+                    bool isSigned = form >= 4;
+                    wide = referenceMultiply(values[3], values[2], isSigned);
+                    if (form & 1){
+                        //add the halves with the carry by hand
+                        uint32_t low = (uint32_t)wide + values[1];
+                        uint32_t carry = low < values[1];
+                        expect[0] = (uint32_t)(wide >> 32) + values[0] + carry;
+                        expect[1] = low;
+                    } else {
+                        expect[0] = wide >> 32;
+                        expect[1] = (uint32_t)wide;
+                    }
+                    expectFlags = (flags & ~0xC0000000) | (expect[0] & 0x80000000) | (expect[0] || expect[1] ? 0 : 0x40000000);
+                    cycles = referenceMultiplierCycles(values[2], isSigned);
+                    break;
+                }
+                case 6:
+                case 10:
+                    //SMLAxy / SMULxy
+                    expect[0] = (uint32_t)(hx * hy) + (form == 6 ? values[1] : 0);
+                    if (form == 6 && (int64_t)(hx * hy) + (int32_t)values[1] != (int32_t)expect[0]){
+                        expectFlags |= RegisterFile::Q;
+                    }
+                    break;
+                case 7:
+                case 8: {
+                    //SMLAWy / SMULWy, the 48 bit product's top 32 bits
+                    int64_t product = (int64_t)referenceMultiply(values[3], (uint32_t)hy, true) >> 16;
+                    expect[0] = (uint32_t)product + (form == 7 ? values[1] : 0);
+                    if (form == 7 && product + (int32_t)values[1] != (int32_t)expect[0]){
+                        expectFlags |= RegisterFile::Q;
+                    }
+                    break;
+                }
+                case 9: {
+                    //SMLALxy
+                    uint64_t sum = (((uint64_t)values[0] << 32) | values[1]) + (uint64_t)(int64_t)(hx * hy);
+                    expect[0] = sum >> 32;
+                    expect[1] = (uint32_t)sum;
+                    break;
+                }
+            }
+            if (!setFlags && form < 6){
+                expectFlags = flags;
+            }
+            if (skip){
+                expect[0] = values[0];
+                expect[1] = values[1];
+                expectFlags = flags;
+                cycles = 0;
+            }
+            uint64_t before = scheduler->getCycles();
+            RomDecode::decodeArm(word)(word);
+            bool ok = registers->getRegister(rd) == expect[0] && registers->getRegister(rn) == expect[1];
+            ok &= registers->getRegister(rs) == values[2] && registers->getRegister(rm) == values[3];
+            ok &= (registers->getCPSR() & 0xF8000000) == expectFlags && scheduler->getCycles() - before == cycles;
+            passed &= ok;
+        }
+    }
+    CPU::setActive(0);
+    delete cpu;
+    return passed;
+}
+std::vector<uint8_t> HardwareTests::dumpMachine(CPU* cpu){
+    std::vector<uint8_t> result;
+    Memory* memory = cpu->getMemory();
+    for (uint32_t page = 0; page < Memory::PAGE_COUNT; page++){
+        uint32_t length;
+        const uint8_t* data = memory->getPage(page, &length);
+        result.insert(result.end(), data, data + length);
+    }
+    uint64_t values[] = {cpu->getScheduler()->getCycles(), cpu->getScheduler()->getNextEventCycle(),
+        cpu->getInterrupts()->getIF(), cpu->getPPU()->getFrameCount(), cpu->getPPU()->getVCount(),
+        cpu->getTimers()->readCounter(0), cpu->getTimers()->readCounter(1), cpu->getAPU()->getSampleCount(),
+        cpu->getAPU()->getFifoCount(0), cpu->getRegisters()->getRegister(4)};
+    result.insert(result.end(), (const uint8_t*)values, (const uint8_t*)(values + sizeof(values) / sizeof(values[0])));
+    return result;
+}
+bool HardwareTests::testSaveState(){
+    bool passed = true;
+    const uint64_t frameCycles = (uint64_t)PPU::LINE_CYCLES * PPU::TOTAL_LINES;
+    CPU* cpus[2] = {new CPU(), new CPU()};
+    makeBusyMachine(cpus[0], 7);
+    cpus[0]->getRegisters()->setRegister(4, 0x1234);
+    //save part way into a frame so events are pending mid flight
+    cpus[0]->run(frameCycles * 2 + 12345);
+    SaveState* state = new SaveState();
+    cpus[0]->saveState(state);
+    passed &= state->getPagesCopied() == Memory::PAGE_COUNT;
+    //the same frames three times: straight on, after loading back into the same machine
+    //(having scribbled over it) and after loading into a different one
+    std::vector<uint8_t> results[3];
+    for (int pass = 0; pass < 3; pass++){
+        CPU* cpu = cpus[pass == 2];
+        Memory* memory = cpu->getMemory();
+        if (pass == 1){
+            for (uint32_t i = 0; i < 0x8000; i += 4){
+                memory->store32(0x2000000 + i * 7, i);
+                memory->store32(0x6000000 + i * 2, i);
+            }
+            memory->store16(0x4000000, 3);
+            memory->store16(0x4000100, 0);
+            memory->store16(0x4000082, 0);
+            cpu->getRegisters()->setRegister(4, 0);
+            cpu->run(frameCycles / 3);
+            cpu->loadState(state);
+            //the scribbled EWRAM and VRAM, I/O and whatever the DMAs and sound touched in between
+            passed &= state->getPagesCopied() > 10 && state->getPagesCopied() < Memory::PAGE_COUNT;
+        } else if (pass == 2){
+            cpu->loadState(state);
+            passed &= state->getPagesCopied() == Memory::PAGE_COUNT;
+        }
+        uint32_t random = 5;
+        for (int step = 0; step < 40; step++){
+            random ^= random << 13, random ^= random >> 17, random ^= random << 5;
+            memory->store32(0x2000000 + (random & 0x3FFFC), random);
+            memory->store16(0x7000000 + (random & 0x3FE), random >> 16);
+            memory->store16(0x4000010, random);
+            cpu->run(frameCycles / 10 + (random & 0xFFF));
+            cpu->getInterrupts()->acknowledge(random & 0xFFFF);
+        }
+        const uint8_t* frame = (const uint8_t*)cpu->getPPU()->getFrame();
+        results[pass].assign(frame, frame + PPU::WIDTH * PPU::HEIGHT * 4);
+        std::vector<uint8_t> machine = dumpMachine(cpu);
+        results[pass].insert(results[pass].end(), machine.begin(), machine.end());
+        results[pass].push_back(cpu->getAPU()->getChannelStatus());
+    }
+    passed &= results[0] == results[1] && results[0] == results[2];
+    //one store means one page on the next capture, and a restore undoes exactly what moved
+    Memory* memory = cpus[1]->getMemory();
+    cpus[1]->saveState(state);
+    memory->store8(0x2012345, 0xAB);
+    cpus[1]->saveState(state);
+    passed &= state->getPagesCopied() == 1;
+    uint8_t before[2] = {memory->load8(0x2000010), memory->load8(0x6004000)};
+    memory->store8(0x2000010, before[0] + 1);
+    memory->store16(0x6004000, before[1] + 1);
+    cpus[1]->loadState(state);
+    passed &= state->getPagesCopied() == 2;
+    passed &= memory->load8(0x2000010) == before[0] && memory->load8(0x6004000) == before[1];
+    cpus[1]->saveState(state);
+    passed &= state->getPagesCopied() == 0;
+    delete state;
+    delete cpus[0];
+    delete cpus[1];
+    return passed;
+}
+void HardwareTests::runTest(char* name){
+    bool passed = false;
+    if (strcmp(name, "scheduler") == 0){
+        passed = testScheduler();
+    } else if (strcmp(name, "timers") == 0){
+        passed = testTimers();
+    } else if (strcmp(name, "dma") == 0){
+        passed = testDMA();
+    } else if (strcmp(name, "bios") == 0){
+        passed = testBios();
+    } else if (strcmp(name, "decompress") == 0){
+        passed = testDecompression();
+    } else if (strcmp(name, "ppu") == 0){
+        passed = testPPU();
+    } else if (strcmp(name, "tilecache") == 0){
+        passed = testTileCache();
+    } else if (strcmp(name, "affine") == 0){
+        passed = testAffine();
+    } else if (strcmp(name, "oam") == 0){
+        passed = testOamCache();
+    } else if (strcmp(name, "threaded") == 0){
+        passed = testThreaded();
+    } else if (strcmp(name, "headless") == 0){
+        passed = testHeadless();
+    } else if (strcmp(name, "apu") == 0){
+        passed = testAPU();
+    } else if (strcmp(name, "savestate") == 0){
+        passed = testSaveState();
+    } else if (strcmp(name, "rewind") == 0){
+        passed = testRewind();
+    } else if (strcmp(name, "runner") == 0){
+        passed = testRunner();
+    } else if (strcmp(name, "decodecache") == 0){
+        passed = testDecodeCache();
+    } else if (strcmp(name, "movie") == 0){
+        passed = testMovie();
+    } else if (strcmp(name, "waitstates") == 0){
+        passed = testWaitStates();
+    } else if (strcmp(name, "irq") == 0){
+        passed = testInterrupts();
+    } else if (strcmp(name, "debug") == 0){
+        passed = testDebugger();
+    } else if (strcmp(name, "trace") == 0){
+        passed = testTrace();
+    } else if (strcmp(name, "profiler") == 0){
+        passed = testProfiler();
+    } else if (strcmp(name, "decoded") == 0){
+        passed = testDecodedInstructions();
+    } else if (strcmp(name, "multiply") == 0){
+        passed = testMultiply();
+    } else {
+        std::cout << "Unknown test " << name << "\n";
+        return;
+    }
+    std::cout << (passed ? "Passed " : "Failed ") << name << "\n";
+}
+/*
+* BEGIN HARDWARE BENCHMARK METHODS
+*   Run with -b <name>, results are printed, nothing is asserted.
+*/
+void HardwareBenchmarks::benchmarkDecompression(){
+    static const char* kinds[] = {"tiles", "tilemap", "text", "noise"};
+    CPU* cpu = new CPU();
+    Memory* memory = cpu->getMemory();
+    RegisterFile* registers = cpu->getRegisters();
+    const uint32_t size = 0x8000;
+    const int iterations = 200;
+    for (int format = 0; format < 2; format++){
+        for (int kind = 0; kind < 4; kind++){
+            std::vector<uint8_t> data = HardwareTests::makeBlob(kind, size, kind + 1);
+            std::vector<uint8_t> packed = format ? HardwareTests::compressRL(data) : HardwareTests::compressLZ77(data);
+            for (uint32_t i = 0; i < packed.size(); i++){
+                memory->store8(0x2000000 + i, packed[i]);
+            }
+            for (int vram = 0; vram < 2; vram++){
+                double seconds[2];
+                for (int fast = 0; fast < 2; fast++){
+                    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                    for (int i = 0; i < iterations; i++){
+                        registers->setRegister(0, 0x2000000);
+                        registers->setRegister(1, vram ? 0x6000000 : 0x3000000);
+                        if (format){
+                            fast ? BiosFunctions::rlUnComp(registers, memory, vram) : BiosFunctions::rlUnCompBytewise(registers, memory, vram);
+                        } else {
+                            fast ? BiosFunctions::lz77UnComp(registers, memory, vram) : BiosFunctions::lz77UnCompBytewise(registers, memory, vram);
+                        }
+                    }
+                    seconds[fast] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                }
+                double megabytes = (double)size * iterations / (1024 * 1024);
+                std::cout << (format ? "RL   " : "LZ77 ") << kinds[kind] << (vram ? " -> VRAM" : " -> WRAM")
+                    << " ratio " << (double)packed.size() / size
+                    << "  bytewise " << megabytes / seconds[0] << " MB/s"
+                    << "  fast " << megabytes / seconds[1] << " MB/s"
+                    << "  speedup " << seconds[0] / seconds[1] << "x" << "\n";
+            }
+        }
+    }
+    delete cpu;
+}
+void HardwareBenchmarks::benchmarkPPU(){
+    CPU* cpu = new CPU();
+    PPU* ppu = cpu->getPPU();
+    //best of several rounds, a shared core is noisy
+    const int rounds = 5;
+    const int frames = 100;
+    uint32_t line[PPU::WIDTH];
+    for (uint8_t mode = 0; mode < 6; mode++){
+        HardwareTests::makeScene(cpu, mode, mode + 1);
+        ppu->getTileCache()->resetStats();
+        //whole frames, then composition on its own (the layer buffers still hold the last line)
+        double frameSeconds = 1e9;
+        double composeSeconds[2] = {1e9, 1e9};
+        for (int round = 0; round < rounds; round++){
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for (int i = 0; i < frames; i++){
+                ppu->renderFrame();
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / frames;
+            frameSeconds = seconds < frameSeconds ? seconds : frameSeconds;
+            for (int simd = 0; simd < 2; simd++){
+                start = std::chrono::steady_clock::now();
+                for (int i = 0; i < frames * PPU::HEIGHT; i++){
+                    simd ? ppu->compose(line) : ppu->composeScalar(line);
+                }
+                seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / frames;
+                composeSeconds[simd] = seconds < composeSeconds[simd] ? seconds : composeSeconds[simd];
+            }
+        }
+        std::cout << "mode " << (int)mode << "  frame " << frameSeconds * 1e6 << " us"
+            << "  compose scalar " << composeSeconds[0] * 1e6 << " us"
+            << "  compose simd " << composeSeconds[1] * 1e6 << " us"
+            << "  speedup " << composeSeconds[0] / composeSeconds[1] << "x"
+            << "  tile cache hits " << ppu->getTileCache()->getHitRate() * 100 << "%" << "\n";
+    }
+    delete cpu;
+}
+void HardwareBenchmarks::benchmarkAffine(){
+    CPU* cpu = new CPU();
+    Memory* memory = cpu->getMemory();
+    PPU* ppu = cpu->getPPU();
+    const int rounds = 5;
+    const int frames = 100;
+    //mode 2 racing game: both backgrounds rotated and scaled, every sprite affine
+    HardwareTests::makeScene(cpu, 2, 99);
+    memory->store16(0x4000020, 0xB5);
+    memory->store16(0x4000022, 0xFF4B);
+    memory->store16(0x4000024, 0xB5);
+    memory->store16(0x4000026, 0xB5);
+    memory->store16(0x4000030, 0x60);
+    memory->store16(0x4000032, 0xFFA0);
+    memory->store16(0x4000034, 0x90);
+    memory->store16(0x4000036, 0x60);
+    for (uint32_t sprite = 0; sprite < 128; sprite++){
+        memory->store16(0x7000000 + sprite * 8, memory->load16(0x7000000 + sprite * 8) | (1 << 8));
+    }
+    for (int bgOnly = 1; bgOnly >= 0; bgOnly--){
+        memory->store16(0x4000000, 2 | (1 << 6) | ((bgOnly ? 0xC : 0x1C) << 8));
+        double seconds[2] = {1e9, 1e9};
+        for (int round = 0; round < rounds; round++){
+            for (int simd = 0; simd < 2; simd++){
+                ppu->setScalarAffine(!simd);
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                for (int i = 0; i < frames; i++){
+                    ppu->renderFrame();
+                }
+                double frameSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / frames;
+                seconds[simd] = frameSeconds < seconds[simd] ? frameSeconds : seconds[simd];
+            }
+        }
+        ppu->setScalarAffine(false);
+        std::cout << (bgOnly ? "BG2+BG3      " : "BG2+BG3+OBJ  ")
+            << "  scalar " << seconds[0] * 1e6 << " us/frame"
+            << "  simd " << seconds[1] * 1e6 << " us/frame"
+            << "  speedup " << seconds[0] / seconds[1] << "x" << "\n";
+    }
+    delete cpu;
+}
+void HardwareBenchmarks::benchmarkThreaded(){
+    //a running CPU (one cycle per step) with the PPU drawing inline or on the render thread
+    const int rounds = 3;
+    const int frames = 60;
+    std::cout << "hardware threads " << std::thread::hardware_concurrency() << "\n";
+    for (uint8_t mode = 0; mode < 3; mode += 2){
+        double seconds[2] = {1e9, 1e9};
+        for (int round = 0; round < rounds; round++){
+            for (int threaded = 0; threaded < 2; threaded++){
+                CPU* cpu = new CPU();
+                HardwareTests::makeScene(cpu, mode, mode + 1);
+                cpu->getPPU()->setThreadedRendering(threaded);
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                cpu->run((uint64_t)PPU::LINE_CYCLES * PPU::TOTAL_LINES * frames);
+                cpu->getPPU()->getFrame();
+                double frameSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / frames;
+                seconds[threaded] = frameSeconds < seconds[threaded] ? frameSeconds : seconds[threaded];
+                delete cpu;
+            }
+        }
+        std::cout << "mode " << (int)mode
+            << "  inline " << 1 / seconds[0] << " fps"
+            << "  threaded " << 1 / seconds[1] << " fps"
+            << "  speedup " << seconds[0] / seconds[1] << "x" << "\n";
+    }
+}
+void HardwareBenchmarks::benchmarkHeadless(){
+    //emulated frames per second of the video hardware alone (CPU halted), drawing every frame down to none
+    const int rounds = 5;
+    const int frames = 120;
+    static const uint32_t skips[] = {1, 4, 0};
+    for (uint8_t mode = 0; mode < 3; mode += 2){
+        std::cout << "mode " << (int)mode;
+        for (uint32_t skip : skips){
+            double best = 1e9;
+            for (int round = 0; round < rounds; round++){
+                CPU* cpu = new CPU();
+                HardwareTests::makeScene(cpu, mode, mode + 1);
+                cpu->setHalted(true);
+                cpu->getPPU()->setFrameSkip(skip);
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                cpu->run((uint64_t)PPU::LINE_CYCLES * PPU::TOTAL_LINES * frames);
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / frames;
+                best = seconds < best ? seconds : best;
+                delete cpu;
+            }
+            std::cout << (skip == 1 ? "  every frame " : skip ? "  every 4th " : "  headless ") << 1 / best << " fps";
+        }
+        std::cout << "\n";
+    }
+}
+void HardwareBenchmarks::benchmarkAPU(){
+    const int rounds = 3;
+    const int seconds = 4;
+    std::vector<int16_t> drain(APU::OUTPUT_FRAMES * 2);
+    //everything busy: two squares, wave, noise, both FIFOs fed by DMA at 32768 Hz; then with the APU off
+    double perSecond[2] = {1e9, 1e9};
+    for (int round = 0; round < rounds; round++){
+        for (int on = 1; on >= 0; on--){
+            CPU* cpu = new CPU();
+            Memory* memory = cpu->getMemory();
+            cpu->setHalted(true);
+            for (uint32_t i = 0; i < 0x40000; i += 4){
+                memory->store32(0x2000000 + i, i * 0x9E3779B9);
+            }
+            memory->store16(0x4000084, on ? 0x80 : 0);
+            memory->store16(0x4000080, 0xFF77);
+            memory->store16(0x4000082, 0xBB0E | (1 << 14));
+            memory->store16(0x4000062, 0xF040);
+            memory->store16(0x4000064, 0x8000 | 1750);
+            memory->store16(0x4000068, 0xA0C0);
+            memory->store16(0x400006C, 0x8000 | 1900);
+            memory->store16(0x4000070, 0x80);
+            memory->store16(0x4000072, 0x2000);
+            memory->store16(0x4000074, 0x8000 | 1800);
+            memory->store16(0x4000078, 0xF000);
+            memory->store16(0x400007C, 0x8000 | 0x21);
+            for (int fifo = 0; fifo < 2; fifo++){
+                memory->store32(0x40000BC + fifo * 12, 0x2000000 + fifo * 0x20000);
+                memory->store32(0x40000C0 + fifo * 12, fifo ? APU::FIFO_B : APU::FIFO_A);
+                memory->store16(0x40000C6 + fifo * 12, 0xB640);
+                memory->store16(0x4000100 + fifo * 4, 0x10000 - 512);
+                memory->store16(0x4000102 + fifo * 4, 0x80);
+            }
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for (int i = 0; i < seconds * 8; i++){
+                cpu->run(16777216 / 8);
+                cpu->getAPU()->getOutput()->read(drain.data(), APU::OUTPUT_FRAMES);
+            }
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / seconds;
+            perSecond[on] = elapsed < perSecond[on] ? elapsed : perSecond[on];
+            delete cpu;
+        }
+    }
+    std::cout << "all channels " << perSecond[1] * 1e3 << " ms per emulated second"
+        << "  APU off (timers + FIFO DMA only) " << perSecond[0] * 1e3 << " ms"
+        << "  audio " << (perSecond[1] - perSecond[0]) * 1e3 << " ms" << "\n";
+    //mix + resample alone for one emulated second (128 batches of 256 samples)
+    CPU* cpu = new CPU();
+    APU* apu = cpu->getAPU();
+    cpu->getMemory()->store16(0x4000080, 0xFF77);
+    cpu->getMemory()->store16(0x4000082, 0x330E);
+    int16_t inputs[4][APU::MAX_BATCH];
+    for (int i = 0; i < APU::MAX_BATCH; i++){
+        inputs[0][i] = (i * 7) % 121 - 60;
+        inputs[1][i] = (i * 13) % 121 - 60;
+        inputs[2][i] = (int8_t)(i * 37);
+        inputs[3][i] = (int8_t)(i * 91);
+    }
+    int16_t mixed[APU::MAX_BATCH * 2];
+    int16_t resampled[APU::MAX_BATCH * 4];
+    double mixSeconds[2] = {1e9, 1e9};
+    for (int round = 0; round < 5; round++){
+        for (int simd = 0; simd < 2; simd++){
+            Resampler resampler(APU::NATIVE_RATE, APU::OUTPUT_RATE);
+            resampler.setScalar(!simd);
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for (int repeat = 0; repeat < 10; repeat++){
+                for (int batch = 0; batch < APU::NATIVE_RATE / APU::MAX_BATCH; batch++){
+                    if (simd){
+                        apu->mix(inputs[0], inputs[1], inputs[2], inputs[3], APU::MAX_BATCH, mixed);
+                    } else {
+                        apu->mixScalar(inputs[0], inputs[1], inputs[2], inputs[3], APU::MAX_BATCH, mixed);
+                    }
+                    resampler.process(mixed, APU::MAX_BATCH, resampled);
+                }
+            }
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / 10;
+            mixSeconds[simd] = elapsed < mixSeconds[simd] ? elapsed : mixSeconds[simd];
+        }
+    }
+    std::cout << "mix + resample per emulated second  scalar " << mixSeconds[0] * 1e6 << " us"
+        << "  simd " << mixSeconds[1] * 1e6 << " us"
+        << "  speedup " << mixSeconds[0] / mixSeconds[1] << "x" << "\n";
+    delete cpu;
+}
+void HardwareBenchmarks::benchmarkSaveState(){
+    const uint64_t frameCycles = (uint64_t)PPU::LINE_CYCLES * PPU::TOTAL_LINES;
+    const int frames = 300;
+    CPU* cpu = new CPU();
+    Memory* memory = cpu->getMemory();
+    HardwareTests::makeBusyMachine(cpu, 11);
+    SaveState* state = new SaveState();
+    cpu->saveState(state);
+    std::vector<uint8_t> copy(Memory::PAGE_COUNT * Memory::PAGE_SIZE);
+    double seconds[4] = {0, 0, 0, 0};
+    uint64_t pages = 0;
+    for (int frame = 0; frame < frames; frame++){
+        //a game frame: a few variables in EWRAM and IWRAM, OAM and a scroll register
+        for (uint32_t i = 0; i < 64; i++){
+            memory->store32(0x2003000 + i * 4, frame * i);
+            memory->store32(0x3007000 + i * 4, frame + i);
+        }
+        for (uint32_t i = 0; i < 0x400; i += 4){
+            memory->store32(0x7000000 + i, frame * 0x10001 + i);
+        }
+        memory->store16(0x4000010, frame);
+        cpu->run(frameCycles);
+        //incremental: the pages touched this frame, into the state from the frame before
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        cpu->saveState(state);
+        seconds[0] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        pages += state->getPagesCopied();
+        //full: every page, the way a snapshot without dirty pages has to
+        start = std::chrono::steady_clock::now();
+        for (uint32_t page = 0; page < Memory::PAGE_COUNT; page++){
+            uint32_t length;
+            const uint8_t* data = memory->getPage(page, &length);
+            memcpy(&copy[page * Memory::PAGE_SIZE], data, length);
+        }
+        seconds[1] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        //a frame of rewinding: run one more frame and load the state back
+        cpu->run(frameCycles);
+        start = std::chrono::steady_clock::now();
+        cpu->loadState(state);
+        seconds[2] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        start = std::chrono::steady_clock::now();
+        for (uint32_t page = 0; page < Memory::PAGE_COUNT; page++){
+            uint32_t length;
+            uint8_t* data = memory->getPage(page, &length);
+            memcpy(data, &copy[page * Memory::PAGE_SIZE], length);
+        }
+        seconds[3] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    std::cout << "pages per frame " << (double)pages / frames << " of " << Memory::PAGE_COUNT << "\n";
+    std::cout << "snapshot incremental " << seconds[0] / frames * 1e6 << " us  full " << seconds[1] / frames * 1e6 << " us"
+        << "  (" << seconds[1] / seconds[0] << "x)" << "\n";
+    std::cout << "restore incremental " << seconds[2] / frames * 1e6 << " us  full " << seconds[3] / frames * 1e6 << " us"
+        << "  (" << seconds[3] / seconds[2] << "x)" << "\n";
+    delete state;
+    delete cpu;
+}
+void HardwareBenchmarks::benchmarkRewind(){
+    const uint64_t frameCycles = (uint64_t)PPU::LINE_CYCLES * PPU::TOTAL_LINES;
+    const uint32_t capacity = 32 << 20;
+    const int frames = 1200;
+    //with the HBlank DMA streaming 10K of fresh data into IWRAM every frame, and without
+    for (int run = 0; run < 4; run++){
+        uint32_t interval = run & 1 ? 4 : 1;
+        bool streaming = run < 2;
+        CPU* cpu = new CPU();
+        Memory* memory = cpu->getMemory();
+        HardwareTests::makeBusyMachine(cpu, 13);
+        if (!streaming){
+            memory->store16(0x40000DE, 0);
+        }
+        RewindBuffer* buffer = new RewindBuffer(capacity, interval);
+        double total = 0;
+        double worst = 0;
+        uint64_t bytes = 0;
+        uint32_t snapshots = 0;
+        for (int frame = 0; frame < frames; frame++){
+            //same frame of game writes as the save state benchmark
+            for (uint32_t i = 0; i < 64; i++){
+                memory->store32(0x2003000 + i * 4, frame * i);
+                memory->store32(0x3007000 + i * 4, frame + i);
+            }
+            for (uint32_t i = 0; i < 0x400; i += 4){
+                memory->store32(0x7000000 + i, frame * 0x10001 + i);
+            }
+            memory->store16(0x4000010, frame);
+            cpu->run(frameCycles);
+            uint32_t before = buffer->getSnapshotCount();
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            cpu->captureRewind(buffer);
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (buffer->getSnapshotCount() != before && frame){
+                total += elapsed;
+                worst = elapsed > worst ? elapsed : worst;
+                bytes += buffer->getLastDeltaSize();
+                snapshots++;
+            }
+        }
+        double perSnapshot = (double)bytes / snapshots;
+        //60 frames a second
+        double minutes = capacity / perSnapshot * interval / 60 / 60;
+        std::cout << (streaming ? "streaming" : "quiet") << " every " << interval << " frames: capture " << total / snapshots * 1e6 << " us average, "
+            << worst * 1e6 << " us worst, " << perSnapshot << " bytes per snapshot (" << snapshots
+            << " kept " << buffer->getSnapshotCount() << "), " << minutes << " minutes in " << (capacity >> 20) << " MB" << "\n";
+        //stepping back through all of it
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        uint32_t steps = 0;
+        while (cpu->rewind(buffer)){
+            steps++;
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "    rewind " << elapsed / steps * 1e6 << " us per step over " << steps << " steps" << "\n";
+        delete buffer;
+        delete cpu;
+    }
+}
+void HardwareBenchmarks::benchmarkRunner(){
+    const char* romPath = "/tmp/gba_runner_bench.gba";
+    std::vector<uint8_t> rom = HardwareTests::makeBlob(3, 0x100000, 5);
+    //the loop from testTrace at the reset vector, so every job runs multiplies, a call and
+    //its return along with the scheduler, timers and PPU
+    uint32_t code[] = {0xE0000291, 0xE0030290, 0xEB000004, 0xE0040293, 0xEAFFFFFA, 0, 0, 0, 0xE0050290, 0xE12FFF1E};
+    memcpy(rom.data(), code, sizeof(code));
+    std::ofstream(romPath, std::ios::binary).write((const char*)rom.data(), rom.size());
+    uint32_t cores = std::thread::hardware_concurrency();
+    cores = cores ? cores : 1;
+    //enough jobs that every thread count divides them into whole rounds several times over
+    std::ostringstream manifest;
+    for (int i = 0; i < 48; i++){
+        manifest << romPath << " - " << 200 + (i % 4) * 50 << "\n";
+    }
+    std::cout << "hardware threads " << cores << "\n";
+    double base = 0;
+    for (uint32_t threads = 1; threads <= (cores > 2 ? cores : 2); threads *= 2){
+        std::istringstream in(manifest.str());
+        std::vector<RunnerJob> jobs;
+        HeadlessRunner::parseManifest(in, &jobs);
+        double seconds = HeadlessRunner::runJobs(&jobs, threads);
+        uint64_t frames = 0;
+        for (uint32_t i = 0; i < jobs.size(); i++){
+            frames += jobs[i].frames;
+        }
+        double rate = frames / seconds;
+        base = threads == 1 ? rate : base;
+        std::cout << threads << " threads: " << rate << " frames/s, " << rate / base << "x" << "\n";
+    }
+    remove(romPath);
+}
+//one instance of benchmarkDecodeCache, decoding its cartridge privately or through the registry
+struct DecodeBenchTask {
+    CPU* cpu;
+    const std::vector<uint8_t>* rom;
+    bool shared;
+    std::shared_ptr<const RomDecode> decode;
+    double seconds;
+};
+static void decodeBenchRun(void* context, uint32_t worker){
+    (void)worker;
+    DecodeBenchTask* task = (DecodeBenchTask*)context;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    //warming up is a lookup in every page, ARM and THUMB, as an instance that ran all of the cartridge would
+    const std::vector<uint8_t>& rom = *task->rom;
+    if (task->shared){
+        DecodeCache* cache = task->cpu->getDecodeCache();
+        cache->attachRom();
+        for (uint32_t offset = 0; offset < rom.size(); offset += Memory::PAGE_SIZE){
+            cache->getArmEntry(0x8000000 + offset);
+            cache->getThumbEntry(0x8000000 + offset);
+        }
+    } else {
+        task->decode = std::make_shared<const RomDecode>(rom.size(), RomDecode::hash(rom.data(), rom.size()));
+        for (uint32_t offset = 0; offset < rom.size(); offset += Memory::PAGE_SIZE){
+            task->decode->getArm(offset, rom.data());
+            task->decode->getThumb(offset, rom.data());
+        }
+    }
+    task->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+void HardwareBenchmarks::benchmarkDecodeCache(){
+    const uint32_t instances = 64;
+    std::vector<uint8_t> rom = HardwareTests::makeBlob(3, 0x100000, 9);
+    uint32_t cores = std::thread::hardware_concurrency();
+    cores = cores ? cores : 1;
+    std::cout << "hardware threads " << cores << ", " << instances << " instances of a " << (rom.size() >> 10) << "K cartridge" << "\n";
+    std::vector<CPU*> cpus(instances);
+    for (uint32_t i = 0; i < instances; i++){
+        cpus[i] = new CPU();
+        cpus[i]->getMemory()->loadRom(rom.data(), rom.size());
+    }
+    double total[2];
+    for (int shared = 0; shared < 2; shared++){
+        std::vector<DecodeBenchTask> tasks(instances);
+        uint32_t builds = RomDecode::getBuildCount();
+        WorkPool* pool = new WorkPool(cores);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < instances; i++){
+            tasks[i] = {cpus[i], &rom, shared == 1, std::shared_ptr<const RomDecode>(), 0};
+            pool->submit(&decodeBenchRun, &tasks[i]);
+        }
+        pool->wait();
+        total[shared] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        delete pool;
+        //every instance holds its tables until all of them are ready, as they would running side by side
+        uint64_t bytes = 0;
+        double worst = 0;
+        double sum = 0;
+        for (uint32_t i = 0; i < instances; i++){
+            bytes += shared ? 0 : tasks[i].decode->getBytes();
+            worst = tasks[i].seconds > worst ? tasks[i].seconds : worst;
+            sum += tasks[i].seconds;
+        }
+        bytes = shared ? cpus[0]->getDecodeCache()->getRomDecode()->getBytes() : bytes;
+        std::cout << (shared ? "shared " : "private") << ": " << RomDecode::getBuildCount() - builds << " decodes, "
+            << (bytes >> 10) << " KB of tables, warm-up " << total[shared] * 1e3 << " ms wall, "
+            << sum / instances * 1e3 << " ms average per instance, " << worst * 1e3 << " ms worst" << "\n";
+    }
+    std::cout << "saved " << ((uint64_t)(instances - 1) * cpus[0]->getDecodeCache()->getRomDecode()->getBytes() >> 20) << " MB and "
+        << (total[0] - total[1]) * 1e3 << " ms of warm-up (" << total[0] / total[1] << "x)" << "\n";
+    //looking up through the shared tables once they are warm
+    DecodeCache* cache = cpus[0]->getDecodeCache();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    uintptr_t check = 0;
+    for (uint32_t address = 0x8000000; address < 0x8000000 + rom.size(); address += 2){
+        check += (uintptr_t)cache->getThumb(address);
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "warm THUMB lookup " << elapsed / (rom.size() / 2) * 1e9 << " ns (" << (check & 1) << ")" << "\n";
+    for (uint32_t i = 0; i < instances; i++){
+        delete cpus[i];
+    }
+}
+void HardwareBenchmarks::benchmarkMovie(){
+    std::vector<uint8_t> rom = HardwareTests::makeBlob(3, 0x100000, 11);
+    //a few minutes of someone playing: a new key combination every few frames
+    InputMovie movie;
+    uint32_t random = 3;
+    uint16_t keys = 0;
+    for (uint32_t frame = 0; frame < 3600; frame++){
+        random ^= random << 13, random ^= random >> 17, random ^= random << 5;
+        keys = (random & 7) ? keys : random >> 16;
+        movie.record(keys);
+    }
+    //the same movie on the same ROM has to come out the same on every replay, fps is the benchmark;
+    //the blob is run as code, whatever of it decodes to an implemented handler executes
+    uint64_t first = 0;
+    for (int run = 0; run < 3; run++){
+        CPU* cpu = new CPU();
+        cpu->getMemory()->loadRom(rom.data(), rom.size());
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        uint64_t hash = HeadlessRunner::playMovie(cpu, movie, movie.getFrameCount());
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        first = run ? first : hash;
+        std::cout << "replay " << run << ": " << movie.getFrameCount() << " frames hash " << std::hex << hash << std::dec
+            << (hash == first ? "" : " DIFFERS") << ", " << seconds * 1e3 << " ms, " << movie.getFrameCount() / seconds
+            << " fps (" << movie.getFrameCount() / seconds / 60 << "x real time)" << "\n";
+        delete cpu;
+    }
+}
+void HardwareBenchmarks::benchmarkWaitStates(){
+    Memory* memory = new Memory();
+    memory->store16(0x4000204, 0x4317);
+    //a mix of what a game touches: mostly cartridge and IWRAM, some EWRAM, I/O and VRAM
+    static const uint32_t bases[8] = {0x8000000, 0x8000000, 0x3000000, 0x3000000, 0x2000000, 0x4000000, 0x6000000, 0xA000000};
+    std::vector<uint32_t> addresses(1 << 16);
+    std::vector<uint8_t> widths(addresses.size());
+    uint32_t random = 29;
+    for (uint32_t i = 0; i < addresses.size(); i++){
+        random ^= random << 13, random ^= random >> 17, random ^= random << 5;
+        addresses[i] = bases[random & 7] | ((random >> 8) & 0xFFFC);
+        widths[i] = 1 << ((random >> 4) % 3);
+    }
+    const int rounds = 200;
+    double seconds[2];
+    uint64_t totals[2] = {0, 0};
+    for (int table = 0; table < 2; table++){
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int round = 0; round < rounds; round++){
+            for (uint32_t i = 0; i < addresses.size(); i++){
+                bool sequential = i & 1;
+                totals[table] += table ? memory->getAccessCycles(addresses[i], widths[i], sequential) :
+                    HardwareTests::referenceAccessCycles(memory->getIORegister(0x4000204), addresses[i], widths[i], sequential);
+            }
+        }
+        seconds[table] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    double accesses = (double)rounds * addresses.size();
+    std::cout << "switch on WAITCNT " << seconds[0] / accesses * 1e9 << " ns, table " << seconds[1] / accesses * 1e9
+        << " ns per access (" << seconds[0] / seconds[1] << "x), " << (totals[0] == totals[1] ? "same cycles" : "CYCLES DIFFER") << "\n";
+    //straight line THUMB from the cartridge, one internal cycle every fourth instruction
+    for (int enabled = 0; enabled < 2; enabled++){
+        memory->store16(0x4000204, enabled ? 0x4317 : 0x0317);
+        uint64_t cycles = 0;
+        const uint32_t count = 1 << 20;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < count; i++){
+            cycles += memory->getFetchCycles(0x8000000 + (i & 0xFFFF) * 2, 2);
+            if ((i & 3) == 3){
+                memory->addInternalCycles(1);
+                cycles++;
+            }
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "prefetch " << (enabled ? "on " : "off") << ": " << (double)cycles / count << " cycles per instruction, "
+            << elapsed / count * 1e9 << " ns per fetch" << "\n";
+    }
+    delete memory;
+}
+void HardwareBenchmarks::benchmarkInterrupts(){
+    //the CPU running (one cycle a step) while TM0 requests every 64 cycles, held off by the I bit
+    const uint64_t cycles = 1 << 26;
+    CPU* cpu = new CPU();
+    Memory* memory = cpu->getMemory();
+    cpu->getTimers()->writeReload(0, 0xFFC0);
+    cpu->getTimers()->writeControl(0, Timers::ENABLE | Timers::IRQ_ENABLE);
+    memory->store16(0x4000200, Interrupts::TIMER0);
+    memory->store16(0x4000208, 1);
+    cpu->getRegisters()->setCPSR(RegisterFile::SYSTEM | RegisterFile::IRQ_DISABLE);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (uint64_t done = 0; done < cycles; done += 1 << 16){
+        cpu->run(1 << 16);
+        //the handler would do this
+        memory->store16(0x4000202, Interrupts::TIMER0);
+    }
+    double event = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    //what polling would add: IE, IF and IME read through the bus once per step
+    uint64_t taken = 0;
+    start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < cycles; i++){
+        taken += (memory->load16(0x4000200) & memory->load16(0x4000202)) && (memory->load16(0x4000208) & 1);
+    }
+    double polling = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "event driven: " << event / cycles * 1e9 << " ns per step, polling would add "
+        << polling / cycles * 1e9 << " ns per step (" << (event + polling) / event << "x the loop) (" << (taken & 1) << ")" << "\n";
+    delete cpu;
+}
+void HardwareBenchmarks::benchmarkDebugger(){
+    //the step loop and the bus with nothing set, then with breakpoints and watchpoints somewhere else
+    const uint64_t cycles = 1 << 26;
+    const uint32_t accesses = 1 << 26;
+    CPU* cpu = new CPU();
+    Memory* memory = cpu->getMemory();
+    Debugger* debugger = cpu->getDebugger();
+    RegisterFile* registers = cpu->getRegisters();
+    //a loop in IWRAM: 15 MUL r0, r1, r2 (two cycles each) and a B back, 33 cycles for 16 steps
+    for (uint32_t i = 0; i < 15; i++){
+        memory->store32(0x3000000 + i * 4, 0xE0000291);
+    }
+    memory->store32(0x300003C, 0xEAFFFFEF);
+    registers->setRegister(1, 6);
+    registers->setRegister(2, 7);
+    registers->setRegister(RegisterFile::PC, 0x3000008);
+    const double steps = (double)cycles * 16 / 33;
+    double runs[2];
+    for (int pass = 0; pass < 2; pass++){
+        if (pass){
+            debugger->addBreakpoint(0x8100000);
+        }
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        cpu->run(cycles);
+        runs[pass] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    debugger->clear();
+    std::cout << "steps: " << runs[0] / steps * 1e9 << " ns with no breakpoints, " << runs[1] / steps * 1e9
+        << " ns with one in another block (r0 " << registers->getRegister(0) << ")" << "\n";
+    static const char* setups[] = {"nothing watched", "EWRAM watched", "another IWRAM page watched"};
+    for (int setup = 0; setup < 3; setup++){
+        debugger->clear();
+        if (setup == 1){
+            debugger->addWatchpoint(0x2000000, 4, true, true);
+        } else if (setup == 2){
+            debugger->addWatchpoint(0x3004000, 4, true, true);
+        }
+        uint32_t sum = 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < accesses; i++){
+            uint32_t address = 0x3000000 + ((i * 4) & 0x3FFC);
+            memory->store32(address, i);
+            sum += memory->load32(address ^ 0x100);
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << setups[setup] << ": " << seconds / accesses * 1e9 << " ns per IWRAM store + load (" << (sum & 1) << ")" << "\n";
+    }
+    delete cpu;
+}
+void HardwareBenchmarks::benchmarkTrace(){
+    //steps with and without a trace going to disk, then finding where two such traces part
+    const uint64_t cycles = 1 << 23;
+    const char* paths[] = {"/tmp/gba_trace_bench_a.gbt", "/tmp/gba_trace_bench_b.gbt"};
+    //the loop from testTrace: multiplies and a call, so registers move on most steps
+    std::vector<uint8_t> rom(0x1000);
+    uint32_t code[] = {0xE0000291, 0xE0030290, 0xEB000004, 0xE0040293, 0xEAFFFFFA, 0, 0, 0, 0xE0050290, 0xE12FFF1E};
+    memcpy(rom.data(), code, sizeof(code));
+    double seconds[3];
+    uint64_t bytes = 0;
+    uint64_t steps = 0;
+    for (int pass = 0; pass < 3; pass++){
+        CPU* cpu = new CPU();
+        cpu->getMemory()->loadRom(rom.data(), rom.size());
+        cpu->getRegisters()->setRegister(2, 7);
+        TraceWriter writer;
+        if (pass){
+            writer.open(paths[pass - 1]);
+            cpu->setTrace(&writer);
+        }
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (uint64_t done = 0; done < cycles; done += 1 << 16){
+            //a register that moves and a store every so often, the second trace goes its own way at the end
+            cpu->getRegisters()->setRegister(1, done >> 16);
+            cpu->getMemory()->store32(0x3000000 + ((done >> 14) & 0x7FFC), done);
+            if (pass == 2 && done + (1 << 16) >= cycles){
+                cpu->getRegisters()->setRegister(2, 1);
+            }
+            cpu->run(1 << 16);
+        }
+        if (pass){
+            writer.close();
+            bytes = writer.getBytesWritten();
+            steps = writer.getStepCount();
+        }
+        seconds[pass] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        delete cpu;
+    }
+    std::cout << "untraced " << seconds[0] / steps * 1e9 << " ns per step, traced " << seconds[1] / steps * 1e9
+        << " ns per step (" << seconds[1] / seconds[0] << "x), " << (double)bytes / steps << " bytes per step" << "\n";
+    TraceReader a;
+    TraceReader b;
+    a.open(paths[0]);
+    b.open(paths[1]);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    uint64_t divergence = TraceReader::findDivergence(&a, &b);
+    double diff = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "diff of " << a.getStepCount() << " steps: first divergence at " << divergence << " in "
+        << diff * 1e3 << " ms (" << a.getStepCount() / diff / 1e6 << " M steps/s)" << "\n";
+    a.close();
+    b.close();
+    remove(paths[0]);
+    remove(paths[1]);
+}
+void HardwareBenchmarks::benchmarkProfiler(){
+    //steps with the profiler off and sampling, then calls and returns on their own
+    const uint64_t cycles = 1 << 23;
+    double seconds[2];
+    //the loop from testTrace: seven steps round, one of them a BL and one the BX LR back
+    std::vector<uint8_t> rom(0x1000);
+    uint32_t code[] = {0xE0000291, 0xE0030290, 0xEB000004, 0xE0040293, 0xEAFFFFFA, 0, 0, 0, 0xE0050290, 0xE12FFF1E};
+    memcpy(rom.data(), code, sizeof(code));
+    uint64_t round = 0;
+    for (int pass = 0; pass < 2; pass++){
+        CPU* cpu = new CPU();
+        cpu->getMemory()->loadRom(rom.data(), rom.size());
+        cpu->getRegisters()->setRegister(2, 7);
+        if (!pass){
+            //cycles once round the loop, from one stop at its top to the next
+            Debugger* debugger = cpu->getDebugger();
+            debugger->addBreakpoint(0x8000000);
+            cpu->run(1000);
+            cpu->run(1000);
+            uint64_t first = cpu->getScheduler()->getCycles();
+            cpu->run(1000);
+            round = cpu->getScheduler()->getCycles() - first;
+            debugger->clear();
+        }
+        else{
+            cpu->getProfiler()->start(Profiler::DEFAULT_INTERVAL);
+        }
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        cpu->run(cycles);
+        seconds[pass] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        delete cpu;
+    }
+    double steps = (double)cycles / round * 7;
+    std::cout << "off " << seconds[0] / steps * 1e9 << " ns per step, sampling " << seconds[1] / steps * 1e9
+        << " ns per step (" << seconds[1] / seconds[0] << "x), " << round << " cycles round the loop" << "\n";
+    //chains 8 deep starting from one of 64 functions, every call matched by its return
+    Scheduler scheduler;
+    Profiler profiler(&scheduler);
+    const uint32_t calls = 1 << 22;
+    uint32_t seed = 1;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < calls; i += 8){
+        seed = seed * 1103515245 + 12345;
+        for (uint32_t depth = 0; depth < 8; depth++){
+            profiler.call(0x8000000 + (((seed >> 16) + depth) & 63) * 0x100, 0x8100000 + depth * 4);
+        }
+        for (uint32_t depth = 8; depth > 0; depth--){
+            profiler.ret(0x8100000 + (depth - 1) * 4);
+        }
+    }
+    double callSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << calls << " calls and returns: " << callSeconds / calls * 1e9 << " ns per pair" << "\n";
+}
+void HardwareBenchmarks::benchmarkDecodedInstructions(){
+    //decoding into entries, then going over them: straight through the array the way a
+    //block runs, and looked up one address at a time
+    std::vector<uint8_t> rom = HardwareTests::makeBlob(3, 0x400000, 17);
+    //the first instruction of a fresh cartridge only waits for its own page
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    RomDecode* first = new RomDecode(rom.size(), 0);
+    first->getArm(0, rom.data());
+    double ready = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "first entry ready in " << ready * 1e6 << " us, " << (first->getBytes() >> 10) << " KB" << "\n";
+    delete first;
+    //every page in turn, ARM then THUMB, the way the first lookup in each one decodes it
+    RomDecode* decode = new RomDecode(rom.size(), 0);
+    start = std::chrono::steady_clock::now();
+    for (uint32_t offset = 0; offset < rom.size(); offset += Memory::PAGE_SIZE){
+        decode->getArm(offset, rom.data());
+        decode->getThumb(offset, rom.data());
+    }
+    double built = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    uint32_t words = rom.size() / 4;
+    std::cout << "decoded " << (rom.size() >> 10) << "K as ARM and THUMB in " << built * 1e3 << " ms ("
+        << built / (words + rom.size() / 2) * 1e9 << " ns per instruction), " << (decode->getBytes() >> 20) << " MB" << "\n";
+    const uint32_t passes = 16;
+    uint64_t cycles = 0;
+    start = std::chrono::steady_clock::now();
+    for (uint32_t pass = 0; pass < passes; pass++){
+        for (uint32_t offset = 0; offset < rom.size(); offset += Memory::PAGE_SIZE){
+            const DecodedInstruction* entry = decode->getArm(offset, rom.data());
+            for (uint32_t i = 0; i < Memory::PAGE_SIZE / 4; i++, entry++){
+                cycles += entry->cycles + entry->rd + (uintptr_t)DecodeHandlers::arm(entry->handler);
+            }
+        }
+    }
+    double streamed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    CPU* cpu = new CPU();
+    cpu->getMemory()->loadRom(rom.data(), rom.size());
+    DecodeCache* cache = cpu->getDecodeCache();
+    start = std::chrono::steady_clock::now();
+    for (uint32_t pass = 0; pass < passes; pass++){
+        for (uint32_t address = 0x8000000; address < 0x8000000 + rom.size(); address += 4){
+            const DecodedInstruction* entry = cache->getArmEntry(address);
+            cycles += entry->cycles + entry->rd + (uintptr_t)DecodeHandlers::arm(entry->handler);
+        }
+    }
+    double looked = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "streamed " << streamed / passes / words * 1e9 << " ns per entry, looked up "
+        << looked / passes / words * 1e9 << " ns per entry (" << (cycles & 1) << ")" << "\n";
+    //numbering what the words decode to, the step every entry of a bulk decode takes
+    std::vector<Func> funcs;
+    for (uint32_t i = 0; i < words; i += 97){
+        uint32_t word;
+        memcpy(&word, &rom[i * 4], 4);
+        Func func = RomDecode::decodeArm(word);
+        //mostly the placeholder, which is numbered first; each distinct handler once
+        if (std::find(funcs.begin(), funcs.end(), func) == funcs.end()){
+            funcs.push_back(func);
+        }
+    }
+    const uint32_t interned = 1 << 22;
+    start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < interned; i++){
+        cycles += DecodeHandlers::armIndex(funcs[i % funcs.size()]);
+    }
+    double interning = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "handler numbered in " << interning / interned * 1e9 << " ns, " << funcs.size() << " handlers (" << (cycles & 1) << ")" << "\n";
+    //RAM code rewritten every pass: the changed word decoded again, and the whole cache flushed
+    Memory* memory = cpu->getMemory();
+    const uint32_t rounds = 2000;
+    for (int flush = 0; flush < 2; flush++){
+        start = std::chrono::steady_clock::now();
+        for (uint32_t round = 0; round < rounds; round++){
+            memory->store32(0x3000000, round);
+            if (flush){
+                cache->flush();
+            }
+            for (uint32_t address = 0x3000000; address < 0x3000000 + Memory::PAGE_SIZE; address += 4){
+                cycles += cache->getArmEntry(address)->cycles;
+            }
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << (flush ? "flushed" : "rewritten") << " page decoded again: " << seconds / rounds * 1e6 << " us, arena "
+            << (cache->getRamBytes() >> 10) << " KB" << "\n";
+    }
+    delete cpu;
+    delete decode;
+}
+void HardwareBenchmarks::benchmarkMultiply(){
+    //each form through its handler the way a fixed point inner loop hits it, then m on its own
+    struct { const char* name; uint32_t word; } forms[] = {
+        {"MUL", 0xE0090B9A}, {"MLAS", 0xE0373998}, {"UMULL", 0xE0887399}, {"UMLAL", 0xE0A87399},
+        {"SMULL", 0xE0C87399}, {"SMLAL", 0xE0E87399}, {"SMULBT", 0xE16709C8}, {"SMLAWT", 0xE12739C8},
+        {"SMLALBT", 0xE1487AC9}};
+    CPU* cpu = new CPU();
+    CPU::setActive(cpu);
+    RegisterFile* registers = cpu->getRegisters();
+    const uint32_t count = 1 << 22;
+    for (uint32_t form = 0; form < sizeof(forms) / sizeof(forms[0]); form++){
+        Func func = RomDecode::decodeArm(forms[form].word);
+        uint32_t seed = 7;
+        uint64_t cycles = cpu->getScheduler()->getCycles();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < count; i++){
+            //a fresh multiplier every time so m moves around: 16.16 values, small and negative
+            seed = seed * 1103515245 + 12345;
+            registers->setRegister((forms[form].word >> 8) & 0xF, (int32_t)seed >> (seed & 15));
+            registers->setRegister(forms[form].word & 0xF, seed ^ 0x10000);
+            func(forms[form].word);
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << forms[form].name << " " << seconds / count * 1e9 << " ns (" << count / seconds / 1e6 << " M/s), m averaged "
+            << (double)(cpu->getScheduler()->getCycles() - cycles) / count << "\n";
+    }
+    uint32_t seed = 7;
+    uint32_t total = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < count; i++){
+        seed = seed * 1103515245 + 12345;
+        total += MultiplyFunctions::multiplierCycles((int32_t)seed >> (seed & 31), seed & 1);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "multiplierCycles " << seconds / count * 1e9 << " ns (" << (total & 1) << ")" << "\n";
+    CPU::setActive(0);
+    delete cpu;
+}
+void HardwareBenchmarks::run(char* name){
+    if (strcmp(name, "decompress") == 0){
+        benchmarkDecompression();
+    } else if (strcmp(name, "ppu") == 0){
+        benchmarkPPU();
+    } else if (strcmp(name, "affine") == 0){
+        benchmarkAffine();
+    } else if (strcmp(name, "threaded") == 0){
+        benchmarkThreaded();
+    } else if (strcmp(name, "headless") == 0){
+        benchmarkHeadless();
+    } else if (strcmp(name, "apu") == 0){
+        benchmarkAPU();
+    } else if (strcmp(name, "savestate") == 0){
+        benchmarkSaveState();
+    } else if (strcmp(name, "rewind") == 0){
+        benchmarkRewind();
+    } else if (strcmp(name, "runner") == 0){
+        benchmarkRunner();
+    } else if (strcmp(name, "decodecache") == 0){
+        benchmarkDecodeCache();
+    } else if (strcmp(name, "movie") == 0){
+        benchmarkMovie();
+    } else if (strcmp(name, "waitstates") == 0){
+        benchmarkWaitStates();
+    } else if (strcmp(name, "irq") == 0){
+        benchmarkInterrupts();
+    } else if (strcmp(name, "debug") == 0){
+        benchmarkDebugger();
+    } else if (strcmp(name, "trace") == 0){
+        benchmarkTrace();
+    } else if (strcmp(name, "profiler") == 0){
+        benchmarkProfiler();
+    } else if (strcmp(name, "decoded") == 0){
+        benchmarkDecodedInstructions();
+    } else if (strcmp(name, "multiply") == 0){
+        benchmarkMultiply();
+    } else {
+        std::cout << "Unknown benchmark " << name << "\n";
+        return;
+    }
+    std::cout << "Finished " << name << "\n";
+}
+/*
+* BEGIN HEADLESS RUNNER METHODS
+*   Input scripts are text, one change per line: the frame it applies from and
+*   the pressed keys as a hex KEYINPUT mask (bit 0 A ... bit 9 L), which hold
+*   until the next line, or movies (see Movie.h), which a script is expanded
+*   into anyway. Every job gets its own CPU, nothing is shared between them,
+*   and draws no frames except the last one so it can go into the hash.
+*/
+bool HeadlessRunner::parseManifest(std::istream& in, std::vector<RunnerJob>* jobs){
+    std::string line;
+    while (std::getline(in, line)){
+        if (line.empty() || line[0] == '#'){
+            continue;
+        }
+        std::istringstream fields(line);
+        RunnerJob job;
+        if (!(fields >> job.rom >> job.input >> job.frames)){
+            std::cout << "Bad manifest line: " << line << "\n";
+            return false;
+        }
+        job.loaded = false;
+        job.hash = 0;
+        job.seconds = 0;
+        job.worker = 0;
+        jobs->push_back(job);
+    }
+    return true;
+}
+uint64_t HeadlessRunner::hashMachine(CPU* cpu){
+    uint64_t hash = 14695981039346656037ull;
+    //the registers first, where the game is and what it was working on
+    RegisterFile* registers = cpu->getRegisters();
+    uint32_t values[17];
+    for (uint8_t i = 0; i < 16; i++){
+        values[i] = registers->getRegister(i);
+    }
+    values[16] = registers->getCPSR();
+    for (uint32_t i = 0; i < sizeof(values); i++){
+        hash = (hash ^ ((const uint8_t*)values)[i]) * 1099511628211ull;
+    }
+    Memory* memory = cpu->getMemory();
+    for (uint32_t page = 0; page < Memory::PAGE_COUNT; page++){
+        uint32_t length;
+        const uint8_t* data = memory->getPage(page, &length);
+        for (uint32_t i = 0; i < length; i++){
+            hash = (hash ^ data[i]) * 1099511628211ull;
+        }
+    }
+    const uint8_t* frame = (const uint8_t*)cpu->getPPU()->getFrame();
+    for (uint32_t i = 0; i < PPU::WIDTH * PPU::HEIGHT * 4; i++){
+        hash = (hash ^ frame[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+bool HeadlessRunner::loadInput(const std::string& path, uint32_t frames, InputMovie* movie){
+    movie->clear();
+    if (path == "-"){
+        return true;
+    }
+    if (movie->load(path.c_str())){
+        return true;
+    }
+    std::ifstream script(path.c_str());
+    return script && movie->readScript(script, frames);
+}
+uint64_t HeadlessRunner::playMovie(CPU* cpu, const InputMovie& movie, uint32_t frames){
+    Memory* memory = cpu->getMemory();
+    PPU* ppu = cpu->getPPU();
+    ppu->setFrameSkip(0);
+    for (uint32_t frame = 0; frame < frames; frame++){
+        //KEYINPUT is active low
+        memory->setIORegister(0x4000130, ~movie.getKeys(frame) & 0x3FF);
+        //frame 0 is drawn anyway, the one asked for here is the one starting as this frame ends
+        if (frame + 2 == frames){
+            ppu->requestFrame();
+        }
+        cpu->run((uint64_t)PPU::LINE_CYCLES * PPU::TOTAL_LINES);
+    }
+    return hashMachine(cpu);
+}
+void HeadlessRunner::runJob(void* context, uint32_t worker){
+    RunnerJob* job = (RunnerJob*)context;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    job->worker = worker;
+    InputMovie movie;
+    if (!loadInput(job->input, job->frames, &movie)){
+        return;
+    }
+    CPU* cpu = new CPU();
+    if (!cpu->getMemory()->loadRom(job->rom.c_str())){
+        delete cpu;
+        return;
+    }
+    job->loaded = true;
+    job->hash = playMovie(cpu, movie, job->frames);
+    delete cpu;
+    job->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+double HeadlessRunner::runJobs(std::vector<RunnerJob>* jobs, uint32_t threads){
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    WorkPool pool(threads);
+    for (uint32_t i = 0; i < jobs->size(); i++){
+        pool.submit(&HeadlessRunner::runJob, &(*jobs)[i]);
+    }
+    pool.wait();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+void HeadlessRunner::printResults(const std::vector<RunnerJob>& jobs, double seconds, uint32_t threads){
+    uint64_t frames = 0;
+    uint32_t failed = 0;
+    for (uint32_t i = 0; i < jobs.size(); i++){
+        const RunnerJob& job = jobs[i];
+        if (!job.loaded){
+            std::cout << "job " << i << " " << job.rom << " failed to load the rom or input script" << "\n";
+            failed++;
+            continue;
+        }
+        frames += job.frames;
+        std::cout << "job " << i << " " << job.rom << " " << job.input << " " << job.frames << " frames hash "
+            << std::hex << job.hash << std::dec << " " << job.seconds * 1e3 << " ms "
+            << job.frames / job.seconds << " fps worker " << job.worker << "\n";
+    }
+    std::cout << jobs.size() << " jobs (" << failed << " failed) " << frames << " frames in " << seconds << " s, "
+        << frames / seconds << " frames/s on " << threads << " threads" << "\n";
+}
+int HeadlessRunner::run(int argc, char** argv){
+    if (argc < 3){
+        std::cout << "Usage: -r <manifest> [threads]" << "\n";
+        return 2;
+    }
+    std::ifstream manifest(argv[2]);
+    std::vector<RunnerJob> jobs;
+    if (!manifest || !parseManifest(manifest, &jobs)){
+        std::cout << "Cannot read manifest " << argv[2] << "\n";
+        return 2;
+    }
+    uint32_t threads = argc > 3 ? strtoul(argv[3], 0, 10) : 0;
+    if (!threads){
+        threads = std::thread::hardware_concurrency();
+        threads = threads ? threads : 1;
+    }
+    double seconds = runJobs(&jobs, threads);
+    printResults(jobs, seconds, threads);
+    for (uint32_t i = 0; i < jobs.size(); i++){
+        if (!jobs[i].loaded){
+            return 1;
+        }
+    }
+    return 0;
+}
+int HeadlessRunner::replay(int argc, char** argv){
+    if (argc != 4 && argc != 6){
+        std::cout << "Usage: -p <rom> <movie> [<script> <frames>]" << "\n";
+        return 2;
+    }
+    CPU* cpu = new CPU();
+    Memory* memory = cpu->getMemory();
+    if (!memory->loadRom(argv[2])){
+        std::cout << "Cannot load rom " << argv[2] << "\n";
+        delete cpu;
+        return 2;
+    }
+    uint64_t romHash = RomDecode::hash(memory->getRom(), memory->getRomSize());
+    InputMovie movie;
+    bool recording = argc == 6;
+    if (recording){
+        std::ifstream script(argv[4]);
+        if (!script || !movie.readScript(script, strtoul(argv[5], 0, 10))){
+            std::cout << "Cannot read input script " << argv[4] << "\n";
+            delete cpu;
+            return 2;
+        }
+        movie.setRomHash(romHash);
+    } else if (!movie.load(argv[3])){
+        std::cout << "Cannot read movie " << argv[3] << "\n";
+        delete cpu;
+        return 2;
+    } else if (movie.getRomHash() != romHash){
+        std::cout << "Movie was recorded on a different rom" << "\n";
+        delete cpu;
+        return 1;
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    uint64_t hash = playMovie(cpu, movie, movie.getFrameCount());
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    delete cpu;
+    std::cout << movie.getFrameCount() << " frames hash " << std::hex << hash << std::dec << " " << seconds * 1e3
+        << " ms " << movie.getFrameCount() / seconds << " fps" << "\n";
+    if (recording){
+        movie.setFinalHash(hash);
+        if (!movie.save(argv[3])){
+            std::cout << "Cannot write movie " << argv[3] << "\n";
+            return 2;
+        }
+        std::cout << "Recorded " << argv[3] << "\n";
+        return 0;
+    }
+    if (!movie.getFinalHash()){
+        std::cout << "No final hash recorded" << "\n";
+        return 0;
+    }
+    if (movie.getFinalHash() != hash){
+        std::cout << "Differs from the recording, recorded " << std::hex << movie.getFinalHash() << std::dec << "\n";
+        return 1;
+    }
+    std::cout << "Matches the recording" << "\n";
+    return 0;
+}
+void HeadlessRunner::printStep(const TraceStep& step){
+    std::cout << "  step " << step.index << std::hex << " " << step.address << (step.thumb ? " thumb " : " arm ") << step.opcode;
+    for (uint32_t i = 0; i < TraceStep::CPSR; i++){
+        std::cout << " r" << std::dec << i << "=" << std::hex << step.registers[i];
+    }
+    std::cout << " cpsr=" << step.registers[TraceStep::CPSR];
+    for (uint32_t i = 0; i < step.writes.size(); i++){
+        std::cout << " [" << step.writes[i].address << "]." << (uint32_t)step.writes[i].width << "=" << step.writes[i].value;
+    }
+    std::cout << std::dec << "\n";
+}
+int HeadlessRunner::diffTraces(int argc, char** argv){
+    if (argc != 4){
+        std::cout << "Usage: -d <trace> <trace>" << "\n";
+        return 2;
+    }
+    TraceReader traces[2];
+    for (int i = 0; i < 2; i++){
+        if (!traces[i].open(argv[2 + i])){
+            std::cout << "Cannot read trace " << argv[2 + i] << "\n";
+            return 2;
+        }
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    uint64_t divergence = TraceReader::findDivergence(&traces[0], &traces[1]);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (divergence == UINT64_MAX){
+        std::cout << "Same " << traces[0].getStepCount() << " steps (" << seconds * 1e3 << " ms)" << "\n";
+        return 0;
+    }
+    std::cout << "First divergence at step " << divergence << " (" << seconds * 1e3 << " ms)" << "\n";
+    for (int i = 0; i < 2; i++){
+        TraceStep step;
+        std::cout << argv[2 + i] << "\n";
+        if (traces[i].getStep(divergence, &step)){
+            printStep(step);
+        } else {
+            std::cout << "  ends after " << traces[i].getStepCount() << " steps" << "\n";
+        }
+    }
+    return 1;
+}
+int main(int argc, char** argv){
+    std::cout << "Starting" << "\n";
+    //the runner, replays and trace diffs are batch jobs, they exit instead of waiting to be killed
+    if (argc > 1 && strcmp(argv[1], "-r") == 0){
+        return HeadlessRunner::run(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "-p") == 0){
+        return HeadlessRunner::replay(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "-d") == 0){
+        return HeadlessRunner::diffTraces(argc, argv);
+    }
     InstructionTests::runTests(argc, argv);
     while(1){};
 }
@@ -0,0 +1,320 @@
+#ifndef DMA_H
+#define DMA_H
+#include <stdint.h>
+#include <string.h>
+#include "Scheduler.h"
+#include "Memory.h"
+#include "Interrupts.h"
+
+/*
+* DMA0 -> DMA3:
+*   registers (per channel, 12 bytes apart starting at 0x40000B0):
+*       SAD    source address, write only
+*       DAD    destination address, write only
+*       CNT_L  unit count, 0 means the maximum (0x4000, 0x10000 for DMA3)
+*       CNT_H  bits 5 -> 6   destination adjust (increment, decrement, fixed, increment/reload)
+*              bits 7 -> 8   source adjust (increment, decrement, fixed)
+*              bit  9        repeat on every trigger
+*              bit  10       32 bit units
+*              bits 12 -> 13 start timing (immediate, VBlank, HBlank, special)
+*              bit  14       IRQ at end
+*              bit  15       enable
+*   A transfer is a DMAx scheduler event. Immediate transfers schedule it 2
+*   cycles after the enable write, the other timings are started by the PPU
+*   (onHBlank/onVBlank) and the sound FIFOs (onFifoRequest). Since events of the
+*   same cycle fire in eventType order, DMA0 always wins over DMA3.
+*   When a channel runs its units are moved in one go and the cycles the bus was
+*   busy are added to the timeline, which is the time the CPU loses.
+*   FAST PATH:
+*       If both sides step the same way through plain memory (Memory hands out a
+*       pointer for the whole range) the copy is a memmove, or a fill loop for a
+*       fixed source. Anything with a fixed destination (FIFOs, I/O) or a range
+*       the bus will not map goes through load/store one unit at a time.
+*/
+class DMA {
+    public:
+        enum controlBits {REPEAT = 1 << 9, WORD = 1 << 10, IRQ_ENABLE = 1 << 14, ENABLE = 1 << 15};
+        enum adjust {INCREMENT, DECREMENT, FIXED, RELOAD};
+        enum timing {IMMEDIATE, VBLANK, HBLANK, SPECIAL};
+        DMA(Scheduler* scheduler, Memory* memory, Interrupts* interrupts);
+        void reset();
+        void mapRegisters();
+        void writeControl(uint8_t index, uint16_t value);
+        uint16_t readControl(uint8_t index);
+        void onHBlank();
+        void onVBlank();
+        //a sound FIFO at fifoAddress ran low
+        void onFifoRequest(uint32_t fifoAddress);
+        bool isActive(uint8_t index);
+        uint64_t getFastTransferCount();
+        uint64_t getSlowTransferCount();
+    private:
+        struct Channel {
+            DMA* owner;
+            uint8_t index;
+            uint16_t control;
+            uint32_t source;
+            uint32_t dest;
+            uint32_t count;
+            uint32_t reloadDest;
+            uint32_t reloadCount;
+        };
+        Channel channels[4];
+        Scheduler* scheduler;
+        Memory* memory;
+        Interrupts* interrupts;
+        uint64_t fastTransfers;
+        uint64_t slowTransfers;
+        uint32_t registerAddress(uint8_t index);
+        void latch(uint8_t index);
+        void trigger(uint8_t timing);
+        void transfer(uint8_t index);
+        bool copyFast(uint32_t source, uint32_t dest, int32_t sourceStep, int32_t destStep, uint32_t unit, uint32_t count);
+        void copySlow(uint32_t source, uint32_t dest, int32_t sourceStep, int32_t destStep, uint32_t unit, uint32_t count);
+        static void transferEvent(void* context, uint64_t late);
+        static uint16_t ioRead(void* context, uint32_t address);
+        static void ioWrite(void* context, uint32_t address, uint16_t value);
+    public:
+        //the latched channels for save states, pending transfers live in the scheduler's state
+        struct State {
+            Channel channels[4];
+        };
+        void saveState(State* state);
+        void loadState(const State* state);
+};
+/*
+* BEGIN DMA METHODS
+*/
+inline DMA::DMA(Scheduler* scheduler, Memory* memory, Interrupts* interrupts){
+    this->scheduler = scheduler;
+    this->memory = memory;
+    this->interrupts = interrupts;
+    for (uint8_t i = 0; i < 4; i++){
+        channels[i].owner = this;
+        channels[i].index = i;
+        scheduler->setHandler((Scheduler::eventType)(Scheduler::DMA0 + i), &DMA::transferEvent, &channels[i]);
+    }
+    reset();
+}
+inline void DMA::reset(){
+    for (uint8_t i = 0; i < 4; i++){
+        channels[i].control = 0;
+        channels[i].source = 0;
+        channels[i].dest = 0;
+        channels[i].count = 0;
+        channels[i].reloadDest = 0;
+        channels[i].reloadCount = 0;
+        scheduler->cancel((Scheduler::eventType)(Scheduler::DMA0 + i));
+    }
+    fastTransfers = 0;
+    slowTransfers = 0;
+}
+inline uint32_t DMA::registerAddress(uint8_t index){
+    return 0x40000B0 + index * 12;
+}
+inline void DMA::mapRegisters(){
+    for (uint8_t i = 0; i < 4; i++){
+        for (uint32_t offset = 0; offset < 12; offset += 2){
+            memory->setIOHandler(registerAddress(i) + offset, &DMA::ioRead, &DMA::ioWrite, this);
+        }
+    }
+}
+inline void DMA::latch(uint8_t index){
+    //the address and count registers are only read when the channel is enabled
+    Channel* channel = &channels[index];
+    uint32_t base = registerAddress(index);
+    uint32_t source = memory->getIORegister(base) | ((uint32_t)memory->getIORegister(base + 2) << 16);
+    uint32_t dest = memory->getIORegister(base + 4) | ((uint32_t)memory->getIORegister(base + 6) << 16);
+    uint32_t count = memory->getIORegister(base + 8);
+    channel->source = source & (index == 0 ? 0x07FFFFFF : 0x0FFFFFFF);
+    channel->dest = dest & (index == 3 ? 0x0FFFFFFF : 0x07FFFFFF);
+    count &= (index == 3 ? 0xFFFF : 0x3FFF);
+    if (!count){
+        count = index == 3 ? 0x10000 : 0x4000;
+    }
+    channel->count = count;
+    channel->reloadDest = channel->dest;
+    channel->reloadCount = count;
+}
+inline void DMA::writeControl(uint8_t index, uint16_t value){
+    Channel* channel = &channels[index];
+    bool wasEnabled = channel->control & ENABLE;
+    channel->control = value;
+    Scheduler::eventType event = (Scheduler::eventType)(Scheduler::DMA0 + index);
+    if (!(value & ENABLE)){
+        scheduler->cancel(event);
+        return;
+    }
+    if (wasEnabled){
+        return;
+    }
+    latch(index);
+    if (((value >> 12) & 0b11) == IMMEDIATE){
+        scheduler->scheduleIn(event, 2);
+    }
+}
+inline uint16_t DMA::readControl(uint8_t index){
+    return channels[index].control;
+}
+inline bool DMA::isActive(uint8_t index){
+    return channels[index].control & ENABLE;
+}
+inline void DMA::trigger(uint8_t timing){
+    for (uint8_t i = 0; i < 4; i++){
+        uint16_t control = channels[i].control;
+        if ((control & ENABLE) && ((control >> 12) & 0b11) == timing){
+            scheduler->scheduleIn((Scheduler::eventType)(Scheduler::DMA0 + i), 0);
+        }
+    }
+}
+inline void DMA::onHBlank(){
+    trigger(HBLANK);
+}
+inline void DMA::onVBlank(){
+    trigger(VBLANK);
+}
+inline void DMA::onFifoRequest(uint32_t fifoAddress){
+    //only DMA1 and DMA2 can feed the sound FIFOs
+    for (uint8_t i = 1; i < 3; i++){
+        Channel* channel = &channels[i];
+        if ((channel->control & ENABLE) && ((channel->control >> 12) & 0b11) == SPECIAL && channel->dest == fifoAddress){
+            scheduler->scheduleIn((Scheduler::eventType)(Scheduler::DMA0 + i), 0);
+        }
+    }
+}
+inline void DMA::transfer(uint8_t index){
+    Channel* channel = &channels[index];
+    uint16_t control = channel->control;
+    uint8_t timing = (control >> 12) & 0b11;
+    bool fifo = timing == SPECIAL && (index == 1 || index == 2);
+    uint32_t unit = (control & WORD) || fifo ? 4 : 2;
+    uint32_t count = fifo ? 4 : channel->count;
+    uint8_t sourceAdjust = (control >> 7) & 0b11;
+    uint8_t destAdjust = (control >> 5) & 0b11;
+    int32_t sourceStep = sourceAdjust == INCREMENT ? unit : sourceAdjust == DECREMENT ? -(int32_t)unit : 0;
+    int32_t destStep = destAdjust == DECREMENT ? -(int32_t)unit : destAdjust == FIXED ? 0 : unit;
+    if (fifo){
+        destStep = 0;
+    }
+    uint32_t source = channel->source & ~(unit - 1);
+    uint32_t dest = channel->dest & ~(unit - 1);
+    if (copyFast(source, dest, sourceStep, destStep, unit, count)){
+        fastTransfers++;
+    } else {
+        copySlow(source, dest, sourceStep, destStep, unit, count);
+        slowTransfers++;
+    }
+    //2 internal cycles, then the first unit is non sequential and the rest sequential
+    uint64_t cycles = 2 + memory->getAccessCycles(source, unit, false) + memory->getAccessCycles(dest, unit, false);
+    cycles += (uint64_t)(count - 1) * (memory->getAccessCycles(source, unit, true) + memory->getAccessCycles(dest, unit, true));
+    scheduler->addCycles(cycles);
+    channel->source += sourceStep * (int32_t)count;
+    channel->dest += destStep * (int32_t)count;
+    if ((control & REPEAT) && timing != IMMEDIATE){
+        channel->count = channel->reloadCount;
+        if (destAdjust == RELOAD){
+            channel->dest = channel->reloadDest;
+        }
+    } else {
+        channel->control &= ~ENABLE;
+        memory->setIORegister(registerAddress(index) + 10, channel->control);
+    }
+    if (control & IRQ_ENABLE){
+        interrupts->raise(Interrupts::DMA0 << index);
+    }
+}
+inline bool DMA::copyFast(uint32_t source, uint32_t dest, int32_t sourceStep, int32_t destStep, uint32_t unit, uint32_t count){
+    if (destStep == 0){
+        return false;
+    }
+    uint32_t bytes = unit * count;
+    uint32_t destLow = destStep > 0 ? dest : dest - bytes + unit;
+    uint8_t* to = memory->getWritePointer(destLow, bytes);
+    if (!to){
+        return false;
+    }
+    if (sourceStep == 0){
+        //fixed source, every unit gets the same value
+        const uint8_t* from = memory->getReadPointer(source, unit);
+        if (!from){
+            return false;
+        }
+        if (unit == 4){
+            uint32_t value;
+            memcpy(&value, from, 4);
+            for (uint32_t i = 0; i < count; i++){
+                memcpy(to + i * 4, &value, 4);
+            }
+        } else {
+            uint16_t value;
+            memcpy(&value, from, 2);
+            for (uint32_t i = 0; i < count; i++){
+                memcpy(to + i * 2, &value, 2);
+            }
+        }
+        return true;
+    }
+    if (sourceStep != destStep){
+        return false;
+    }
+    uint32_t sourceLow = sourceStep > 0 ? source : source - bytes + unit;
+    const uint8_t* from = memory->getReadPointer(sourceLow, bytes);
+    if (!from){
+        return false;
+    }
+    //a unit by unit copy only matches memmove when it never reads a unit it already wrote
+    bool overlaps = from < to + bytes && to < from + bytes;
+    if (overlaps && (sourceStep > 0 ? to > from : to < from)){
+        return false;
+    }
+    memmove(to, from, bytes);
+    return true;
+}
+inline void DMA::copySlow(uint32_t source, uint32_t dest, int32_t sourceStep, int32_t destStep, uint32_t unit, uint32_t count){
+    for (uint32_t i = 0; i < count; i++){
+        if (unit == 4){
+            memory->store32(dest, memory->load32(source));
+        } else {
+            memory->store16(dest, memory->load16(source));
+        }
+        source += sourceStep;
+        dest += destStep;
+    }
+}
+inline uint64_t DMA::getFastTransferCount(){
+    return fastTransfers;
+}
+inline uint64_t DMA::getSlowTransferCount(){
+    return slowTransfers;
+}
+inline void DMA::transferEvent(void* context, uint64_t late){
+    (void)late;
+    Channel* channel = (Channel*)context;
+    channel->owner->transfer(channel->index);
+}
+inline uint16_t DMA::ioRead(void* context, uint32_t address){
+    DMA* self = (DMA*)context;
+    uint32_t offset = (address - 0x40000B0) % 12;
+    if (offset == 10){
+        return self->readControl((address - 0x40000B0) / 12);
+    }
+    //addresses and counts are write only
+    return 0;
+}
+inline void DMA::ioWrite(void* context, uint32_t address, uint16_t value){
+    DMA* self = (DMA*)context;
+    uint32_t offset = (address - 0x40000B0) % 12;
+    if (offset == 10){
+        self->writeControl((address - 0x40000B0) / 12, value);
+    }
+}
+inline void DMA::saveState(State* state){
+    memcpy(state->channels, channels, sizeof(channels));
+}
+inline void DMA::loadState(const State* state){
+    memcpy(channels, state->channels, sizeof(channels));
+    for (uint8_t i = 0; i < 4; i++){
+        channels[i].owner = this;
+    }
+}
+#endif
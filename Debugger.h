@@ -0,0 +1,234 @@
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include "Memory.h"
+#include "Scheduler.h"
+
+/*
+* DEBUGGER:
+*   Breakpoints and watchpoints that cost nothing while none are set.
+*   BREAKPOINTS:
+*       an instruction address (bits 28 -> 31 ignored like the bus does) the
+*       run stops in front of. Besides the sorted list of addresses every 256
+*       byte block of code holding one is marked in a bitmap, so the CPU runs
+*       its plain slice loop while there are none and, once there are, only
+*       steps inside a marked block look at the list. The decoded code itself
+*       is shared between instances (see RomDecode) and cannot carry the mark,
+*       the bitmap is this instance's.
+*       Running again from a breakpoint steps over it once.
+*   WATCHPOINTS:
+*       a range of addresses whose loads and/or stores stop the run after the
+*       access. The bus only gets the pages under the ranges flagged (see
+*       Memory.h), so accesses elsewhere never get here and accesses to a
+*       watched page outside every range are one lookup in the list.
+*   A write listener (the execution trace, see Trace.h) has every store
+*   passed to it, which flags all of writable memory for writes while it is set.
+*   A hit does not unwind anything, it schedules Scheduler::DEBUG for the
+*   current cycle. Like an interrupt that ends the CPU's slice once the step
+*   under way is done, the event marks the debugger stopped and run() returns
+*   early; getStopReason and getStopAddress tell why until the next run.
+*/
+class Debugger {
+    public:
+        enum stopReason {NONE, BREAKPOINT, WATCH_READ, WATCH_WRITE};
+        enum {BLOCK_SHIFT = 8};
+        Debugger(Scheduler* scheduler, Memory* memory);
+        void addBreakpoint(uint32_t address);
+        void removeBreakpoint(uint32_t address);
+        bool hasBreakpoints();
+        //called in front of every step while there are breakpoints, stops the run on one
+        bool checkBreakpoint(uint32_t address);
+        void addWatchpoint(uint32_t address, uint32_t length, bool reads, bool writes);
+        //removes every watchpoint starting at address
+        void removeWatchpoint(uint32_t address);
+        //drops every breakpoint and watchpoint
+        void clear();
+        //ends the run once the current step is over, the first reason given wins
+        void requestStop(stopReason reason, uint32_t address);
+        bool isStopped();
+        //called by run() before it starts, forgets the last stop
+        void resume();
+        stopReason getStopReason();
+        uint32_t getStopAddress();
+        //accesses that fell inside a watched range
+        uint64_t getWatchHits();
+        //every store goes to func as well (the execution trace), NULL to stop
+        void setWriteListener(WatchFunc func, void* context);
+    private:
+        struct Watch {
+            uint32_t address;
+            uint32_t length;
+            bool reads;
+            bool writes;
+        };
+        Scheduler* scheduler;
+        Memory* memory;
+        //one bit per block of the 256M the bus decodes, allocated with the first breakpoint
+        std::vector<uint64_t> blocks;
+        std::vector<uint32_t> breakpoints;
+        std::vector<Watch> watches;
+        stopReason reason;
+        uint32_t stopAddress;
+        bool stopped;
+        //the breakpoint run() was resumed from, not taken again on the first step
+        bool stepOver;
+        uint64_t watchHits;
+        WatchFunc writeListener;
+        void* listenerContext;
+        void markBlocks();
+        void mapWatches();
+        static void watchHit(void* context, uint32_t address, uint8_t width, bool write, uint32_t value);
+        static void stopEvent(void* context, uint64_t late);
+};
+/*
+* BEGIN DEBUGGER METHODS
+*/
+inline Debugger::Debugger(Scheduler* scheduler, Memory* memory){
+    this->scheduler = scheduler;
+    this->memory = memory;
+    this->reason = NONE;
+    this->stopAddress = 0;
+    this->stopped = false;
+    this->stepOver = false;
+    this->watchHits = 0;
+    this->writeListener = 0;
+    this->listenerContext = 0;
+    scheduler->setHandler(Scheduler::DEBUG, &Debugger::stopEvent, this);
+    memory->setWatchHandler(&Debugger::watchHit, this);
+}
+inline void Debugger::addBreakpoint(uint32_t address){
+    address &= 0x0FFFFFFF;
+    std::vector<uint32_t>::iterator at = std::lower_bound(breakpoints.begin(), breakpoints.end(), address);
+    if (at == breakpoints.end() || *at != address){
+        breakpoints.insert(at, address);
+    }
+    markBlocks();
+}
+inline void Debugger::removeBreakpoint(uint32_t address){
+    address &= 0x0FFFFFFF;
+    std::vector<uint32_t>::iterator at = std::lower_bound(breakpoints.begin(), breakpoints.end(), address);
+    if (at != breakpoints.end() && *at == address){
+        breakpoints.erase(at);
+    }
+    markBlocks();
+}
+inline void Debugger::markBlocks(){
+    if (breakpoints.empty()){
+        blocks.clear();
+        return;
+    }
+    blocks.assign((0x10000000 >> BLOCK_SHIFT) / 64, 0);
+    for (uint32_t i = 0; i < breakpoints.size(); i++){
+        uint32_t block = breakpoints[i] >> BLOCK_SHIFT;
+        blocks[block >> 6] |= 1ull << (block & 63);
+    }
+}
+inline bool Debugger::hasBreakpoints(){
+    return !blocks.empty();
+}
+inline bool Debugger::checkBreakpoint(uint32_t address){
+    bool skip = stepOver;
+    stepOver = false;
+    address &= 0x0FFFFFFF;
+    uint32_t block = address >> BLOCK_SHIFT;
+    if (!(blocks[block >> 6] & (1ull << (block & 63)))){
+        return false;
+    }
+    if (!std::binary_search(breakpoints.begin(), breakpoints.end(), address) || (skip && address == stopAddress)){
+        return false;
+    }
+    requestStop(BREAKPOINT, address);
+    return true;
+}
+inline void Debugger::addWatchpoint(uint32_t address, uint32_t length, bool reads, bool writes){
+    watches.push_back({address, length ? length : 1, reads, writes});
+    mapWatches();
+}
+inline void Debugger::removeWatchpoint(uint32_t address){
+    for (uint32_t i = 0; i < watches.size(); ){
+        if (watches[i].address == address){
+            watches.erase(watches.begin() + i);
+        } else {
+            i++;
+        }
+    }
+    mapWatches();
+}
+inline void Debugger::mapWatches(){
+    //the bus keeps no count per page, build its flags again from the list
+    memory->clearWatches();
+    for (uint32_t i = 0; i < watches.size(); i++){
+        memory->watchRange(watches[i].address, watches[i].length, watches[i].reads, watches[i].writes);
+    }
+    if (writeListener){
+        //all of writable memory, each region once (the bus folds the mirrors onto the same pages)
+        static const uint32_t writable[][2] = {{0x2000000, Memory::EWRAM_SIZE}, {0x3000000, Memory::IWRAM_SIZE},
+            {0x4000000, Memory::IO_SIZE}, {0x5000000, Memory::PALETTE_SIZE}, {0x6000000, Memory::VRAM_SIZE},
+            {0x7000000, Memory::OAM_SIZE}, {0xE000000, Memory::SRAM_SIZE}};
+        for (uint32_t i = 0; i < sizeof(writable) / sizeof(writable[0]); i++){
+            memory->watchRange(writable[i][0], writable[i][1], false, true);
+        }
+    }
+}
+inline void Debugger::setWriteListener(WatchFunc func, void* context){
+    this->writeListener = func;
+    this->listenerContext = context;
+    mapWatches();
+}
+inline void Debugger::clear(){
+    breakpoints.clear();
+    markBlocks();
+    watches.clear();
+    mapWatches();
+}
+inline void Debugger::watchHit(void* context, uint32_t address, uint8_t width, bool write, uint32_t value){
+    Debugger* debugger = (Debugger*)context;
+    if (write && debugger->writeListener){
+        debugger->writeListener(debugger->listenerContext, address, width, write, value);
+    }
+    for (uint32_t i = 0; i < debugger->watches.size(); i++){
+        const Watch& watch = debugger->watches[i];
+        if (!(write ? watch.writes : watch.reads)){
+            continue;
+        }
+        //overlap of [address, address + width) with the watched range
+        if ((uint64_t)address + width > watch.address && address < (uint64_t)watch.address + watch.length){
+            debugger->watchHits++;
+            debugger->requestStop(write ? WATCH_WRITE : WATCH_READ, address);
+            return;
+        }
+    }
+}
+inline void Debugger::requestStop(stopReason reason, uint32_t address){
+    if (this->reason != NONE){
+        return;
+    }
+    this->reason = reason;
+    this->stopAddress = address;
+    scheduler->schedule(Scheduler::DEBUG, scheduler->getCycles());
+}
+inline void Debugger::stopEvent(void* context, uint64_t late){
+    (void)late;
+    ((Debugger*)context)->stopped = true;
+}
+inline bool Debugger::isStopped(){
+    return stopped;
+}
+inline void Debugger::resume(){
+    stepOver = reason == BREAKPOINT;
+    reason = NONE;
+    stopped = false;
+    scheduler->cancel(Scheduler::DEBUG);
+}
+inline Debugger::stopReason Debugger::getStopReason(){
+    return reason;
+}
+inline uint32_t Debugger::getStopAddress(){
+    return stopAddress;
+}
+inline uint64_t Debugger::getWatchHits(){
+    return watchHits;
+}
+#endif
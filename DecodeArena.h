@@ -0,0 +1,113 @@
+#ifndef DECODEARENA_H
+#define DECODEARENA_H
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+/*
+* DECODED INSTRUCTION:
+*   One instruction the way the CPU wants to find it when it runs it, 16 bytes
+*   of plain data so four share a cache line and a run of straight line code
+*   is a run of consecutive lines:
+*       handler     index into the decoders' handler table, 0 is not decoded yet
+*       rd rn rm    register fields, already pulled out of whichever bits the
+*                   format keeps them in (THUMB high registers included)
+*       shift       amount in bits 0 -> 4, type in 5 -> 6; with bit 7 set the
+*                   amount comes from the register in bits 0 -> 3 instead
+*       cycles      what the instruction takes on a bus with no wait states,
+*                   the waits come from the access table as it runs
+*       condition   ARM condition field, 0xE for THUMB but its B<cond>
+*       imm         the immediate with rotation, scaling and sign extension
+*                   done (register list for LDM/STM, PUSH and POP)
+*       data        the opcode, for whatever is not worth a field of its own
+*/
+struct alignas(16) DecodedInstruction {
+    enum {SHIFT_BY_REGISTER = 0x80};
+    uint16_t handler;
+    uint8_t rd;
+    uint8_t rn;
+    uint8_t rm;
+    uint8_t shift;
+    uint8_t cycles;
+    uint8_t condition;
+    uint32_t imm;
+    uint32_t data;
+};
+static_assert(sizeof(DecodedInstruction) == 16, "a decoded instruction is a quarter of a cache line");
+/*
+* DECODE ARENA:
+*   Where decoded instructions live. Runs of entries come out of big cache line
+*   aligned blocks by moving a cursor, a run asked for is one contiguous array,
+*   zeroed, and nothing is given back on its own. reset() gives everything back
+*   at once by putting the cursor back to the start, the blocks are kept and
+*   handed out again so a flushed cache refills without touching the allocator.
+*   A run longer than BLOCK_ENTRIES gets a block its size.
+*/
+class DecodeArena {
+    public:
+        enum {BLOCK_ENTRIES = 1 << 16};
+        DecodeArena();
+        ~DecodeArena();
+        DecodeArena(const DecodeArena&) = delete;
+        DecodeArena& operator=(const DecodeArena&) = delete;
+        DecodedInstruction* allocate(uint32_t count);
+        void reset();
+        //what the blocks take up, used or not
+        uint64_t getBytes() const;
+        uint32_t getBlockCount() const;
+    private:
+        struct Block {
+            DecodedInstruction* entries;
+            uint32_t size;
+        };
+        std::vector<Block> blocks;
+        //the block being handed out and how far into it
+        uint32_t block;
+        uint32_t used;
+};
+/*
+* BEGIN DECODE ARENA METHODS
+*/
+inline DecodeArena::DecodeArena(){
+    this->block = 0;
+    this->used = 0;
+}
+inline DecodeArena::~DecodeArena(){
+    for (uint32_t i = 0; i < blocks.size(); i++){
+        free(blocks[i].entries);
+    }
+}
+inline DecodedInstruction* DecodeArena::allocate(uint32_t count){
+    //blocks too small for this run are skipped until the next reset
+    while (block < blocks.size() && blocks[block].size - used < count){
+        block++;
+        used = 0;
+    }
+    if (block == blocks.size()){
+        uint32_t size = count > BLOCK_ENTRIES ? count : (uint32_t)BLOCK_ENTRIES;
+        //aligned_alloc wants a multiple of the alignment, 4 entries to the line
+        size_t bytes = ((size_t)size * sizeof(DecodedInstruction) + 63) & ~(size_t)63;
+        blocks.push_back({(DecodedInstruction*)aligned_alloc(64, bytes), size});
+        used = 0;
+    }
+    DecodedInstruction* entries = blocks[block].entries + used;
+    used += count;
+    memset(entries, 0, (size_t)count * sizeof(DecodedInstruction));
+    return entries;
+}
+inline void DecodeArena::reset(){
+    block = 0;
+    used = 0;
+}
+inline uint64_t DecodeArena::getBytes() const{
+    uint64_t bytes = 0;
+    for (uint32_t i = 0; i < blocks.size(); i++){
+        bytes += (uint64_t)blocks[i].size * sizeof(DecodedInstruction);
+    }
+    return bytes;
+}
+inline uint32_t DecodeArena::getBlockCount() const{
+    return blocks.size();
+}
+#endif
@@ -0,0 +1,176 @@
+#ifndef INTERRUPTS_H
+#define INTERRUPTS_H
+#include <stdint.h>
+#include "Memory.h"
+#include "Scheduler.h"
+
+/*
+* INTERRUPT CONTROLLER:
+*   IE  0x4000200 which sources are allowed to interrupt
+*   IF  0x4000202 which sources are requesting, written 1 to acknowledge
+*   IME 0x4000208 master enable, bit 0
+*   Hardware calls raise() with its source bit, the CPU side decides when to
+*   take the exception.
+*   Nobody polls: every change to IE, IF, IME or the CPSR I bit (the register
+*   file reports those, see setCpuEnabled) recomputes two flags once,
+*       requesting  IE & IF, what ends a halt whatever IME and the I bit say
+*       pending     requesting, IME on and the I bit clear, what takes the IRQ
+*   and when requesting turns on the IRQ event is scheduled for the current
+*   cycle. That ends the CPU's run slice at once (or fires in the dispatch
+*   already under way) and the event handler wakes the CPU or enters the
+*   exception, so between events the instruction loop never looks here.
+*/
+class Interrupts {
+    public:
+        enum interruptSource {VBLANK = 1 << 0, HBLANK = 1 << 1, VCOUNT = 1 << 2,
+            TIMER0 = 1 << 3, TIMER1 = 1 << 4, TIMER2 = 1 << 5, TIMER3 = 1 << 6,
+            SERIAL = 1 << 7, DMA0 = 1 << 8, DMA1 = 1 << 9, DMA2 = 1 << 10, DMA3 = 1 << 11,
+            KEYPAD = 1 << 12, GAMEPAK = 1 << 13};
+        Interrupts(Scheduler* scheduler);
+        void reset();
+        void raise(uint16_t source);
+        uint16_t getIE();
+        uint16_t getIF();
+        uint16_t getIME();
+        void setIE(uint16_t value);
+        //writing a 1 to an IF bit clears it
+        void acknowledge(uint16_t value);
+        void setIME(uint16_t value);
+        //the CPSR I bit is clear
+        void setCpuEnabled(bool enabled);
+        //an enabled source is requesting, IME is on and the CPU takes IRQs
+        bool isPending();
+        //an enabled source is requesting
+        bool isRequesting();
+        void mapRegisters(Memory* memory);
+        //the registers and the CPU's I bit, the flags are worked out again on load
+        struct State {
+            uint16_t enabled;
+            uint16_t requested;
+            uint16_t master;
+            bool cpuEnabled;
+        };
+        void saveState(State* state);
+        void loadState(const State* state);
+    private:
+        Scheduler* scheduler;
+        uint16_t enabled;
+        uint16_t requested;
+        uint16_t master;
+        bool cpuEnabled;
+        bool requesting;
+        bool pending;
+        void update();
+        static uint16_t ioRead(void* context, uint32_t address);
+        static void ioWrite(void* context, uint32_t address, uint16_t value);
+};
+/*
+* BEGIN INTERRUPTS METHODS
+*/
+inline Interrupts::Interrupts(Scheduler* scheduler){
+    this->scheduler = scheduler;
+    reset();
+}
+inline void Interrupts::reset(){
+    enabled = 0;
+    requested = 0;
+    master = 0;
+    //the register file comes out of reset with the I bit clear
+    cpuEnabled = true;
+    requesting = false;
+    pending = false;
+}
+inline void Interrupts::update(){
+    bool wasRequesting = requesting;
+    bool wasPending = pending;
+    requesting = (enabled & requested) != 0;
+    pending = requesting && master && cpuEnabled;
+    //only the edges are worth an event, the CPU has already seen the levels
+    if (((requesting && !wasRequesting) || (pending && !wasPending)) && !scheduler->isScheduled(Scheduler::IRQ)){
+        scheduler->schedule(Scheduler::IRQ, scheduler->getCycles());
+    }
+}
+inline void Interrupts::raise(uint16_t source){
+    if (requested & source){
+        return;
+    }
+    requested |= source;
+    update();
+}
+inline uint16_t Interrupts::getIE(){
+    return enabled;
+}
+inline uint16_t Interrupts::getIF(){
+    return requested;
+}
+inline uint16_t Interrupts::getIME(){
+    return master;
+}
+inline void Interrupts::setIE(uint16_t value){
+    enabled = value & 0x3FFF;
+    update();
+}
+inline void Interrupts::acknowledge(uint16_t value){
+    requested &= ~value;
+    update();
+}
+inline void Interrupts::setIME(uint16_t value){
+    master = value & 1;
+    update();
+}
+inline void Interrupts::setCpuEnabled(bool enabled){
+    cpuEnabled = enabled;
+    update();
+}
+inline bool Interrupts::isPending(){
+    return pending;
+}
+inline bool Interrupts::isRequesting(){
+    return requesting;
+}
+inline void Interrupts::saveState(State* state){
+    state->enabled = enabled;
+    state->requested = requested;
+    state->master = master;
+    state->cpuEnabled = cpuEnabled;
+}
+inline void Interrupts::loadState(const State* state){
+    enabled = state->enabled;
+    requested = state->requested;
+    master = state->master;
+    cpuEnabled = state->cpuEnabled;
+    //the scheduler's own state already has the IRQ event if it was due
+    requesting = (enabled & requested) != 0;
+    pending = requesting && master && cpuEnabled;
+}
+inline void Interrupts::mapRegisters(Memory* memory){
+    memory->setIOHandler(0x4000200, &Interrupts::ioRead, &Interrupts::ioWrite, this);
+    memory->setIOHandler(0x4000202, &Interrupts::ioRead, &Interrupts::ioWrite, this);
+    memory->setIOHandler(0x4000208, &Interrupts::ioRead, &Interrupts::ioWrite, this);
+}
+inline uint16_t Interrupts::ioRead(void* context, uint32_t address){
+    Interrupts* self = (Interrupts*)context;
+    switch (address & 0x3FF){
+        case 0x200:
+            return self->getIE();
+        case 0x202:
+            return self->getIF();
+        default:
+            return self->getIME();
+    }
+}
+inline void Interrupts::ioWrite(void* context, uint32_t address, uint16_t value){
+    Interrupts* self = (Interrupts*)context;
+    switch (address & 0x3FF){
+        case 0x200:
+            self->setIE(value);
+            return;
+        case 0x202:
+            self->acknowledge(value);
+            return;
+        default:
+            self->setIME(value);
+            return;
+    }
+}
+#endif
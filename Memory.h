@@ -0,0 +1,913 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <fstream>
+#include <atomic>
+
+//I/O register hooks, address is the halfword aligned register address
+typedef uint16_t (* IOReadFunc)(void* context, uint32_t address);
+typedef void (* IOWriteFunc)(void* context, uint32_t address, uint16_t value);
+//watchpoint hook, called before the access happens, value is what a store is about to write
+typedef void (* WatchFunc)(void* context, uint32_t address, uint8_t width, bool write, uint32_t value);
+
+/*
+* MEMORY (the bus):
+*   region is address bits 24 -> 27
+*       0x0 BIOS     16K   read only
+*       0x2 EWRAM    256K  mirrored
+*       0x3 IWRAM    32K   mirrored
+*       0x4 I/O      1K    register hooks, plain storage when nothing is hooked
+*       0x5 PALETTE  1K    mirrored, byte writes fill the whole halfword
+*       0x6 VRAM     96K   mirrored every 128K, the last 32K mirrors 0x10000
+*       0x7 OAM      1K    mirrored, byte writes ignored
+*       0x8 -> 0xD   ROM   three mirrors of the cartridge (different wait states)
+*       0xE SRAM     64K   8 bit bus
+*   Everything that is plain memory sits in the regions table (base, mask) so a
+*   load is one table lookup and a memcpy. Only I/O, VRAM's odd mirror and the
+*   byte write rules take a branch.
+*   getReadPointer / getWritePointer hand out direct pointers to a contiguous
+*   range for bulk users (DMA, BIOS calls), NULL when the range is I/O, crosses a
+*   mirror boundary or is not plain memory, in which case the caller has to fall
+*   back to per unit loads and stores.
+*   VRAM writes (stores and getWritePointer) also set a bit per 32 byte tile in
+*   vramDirty, palette writes a bit per color in paletteDirty and OAM writes a
+*   bit per 8 byte entry in oamDirty, so the renderer's caches know what to
+*   rebuild.
+*   PAGES:
+*       every writable region is also cut into 4K pages (1K for I/O, palette
+*       and OAM) numbered EWRAM, IWRAM, I/O, palette, VRAM, OAM, SRAM, and every
+*       store marks its page in pageDirty. getPageVersions() folds those bits
+*       into a version per page, drawn from one counter shared by every Memory,
+*       so a version names one page's content exactly. A save state that
+*       remembers the versions it copied only has to copy pages whose version
+*       moved, in either direction.
+*   WAIT STATES:
+*       what an access costs comes from accessTable, one byte per region, width
+*       and sequential/non-sequential, rebuilt from WAITCNT (0x4000204) when it
+*       is written or restored and never looked at otherwise. The cartridge
+*       windows take their first access and sequential access from their own
+*       WAITCNT fields, a word on the 16 bit cartridge bus is one of each (two
+*       sequential ones when already sequential). SRAM has an 8 bit bus and
+*       one wait field for every width.
+*   PREFETCH:
+*       with WAITCNT bit 14 set the cartridge keeps reading opcodes ahead while
+*       the CPU is busy elsewhere, up to 8 halfwords. The model keeps the next
+*       address it will deliver, how many halfwords are ready and the cycles
+*       put toward the next one: getFetchCycles (opcodes) takes from the buffer
+*       at 1 cycle a halfword, getDataCycles and addInternalCycles give the
+*       buffer the cycles the cartridge bus sat idle, a data access to the
+*       cartridge empties it, and so does a fetch anywhere but the next address.
+*       A sequential access across a 128K block is non-sequential on the bus.
+*   WATCHPOINTS:
+*       every entry of the regions table carries watch bits (reads, writes)
+*       that are clear unless something in that region is watched, so an
+*       unwatched access pays one test of a byte it loads anyway. A set bit
+*       sends the access to watchAccess first, which looks the address up in
+*       the per page watch bits (BIOS and ROM have no pages and go straight
+*       through) and only then calls the watch handler. Watched ranges make
+*       getReadPointer / getWritePointer answer NULL for their region so DMA
+*       and the BIOS calls fall back to the bus and get seen too. The renderer
+*       reading VRAM, palette and OAM directly is not an access.
+*/
+class Memory {
+    public:
+        enum region {BIOS = 0x0, EWRAM = 0x2, IWRAM = 0x3, IO = 0x4, PALETTE = 0x5,
+            VRAM = 0x6, OAM = 0x7, ROM = 0x8, SRAM = 0xE};
+        enum sizes {BIOS_SIZE = 0x4000, EWRAM_SIZE = 0x40000, IWRAM_SIZE = 0x8000, IO_SIZE = 0x400,
+            PALETTE_SIZE = 0x400, VRAM_SIZE = 0x18000, OAM_SIZE = 0x400, SRAM_SIZE = 0x10000};
+        enum pages {PAGE_SIZE = 0x1000, EWRAM_PAGE = 0, IWRAM_PAGE = EWRAM_PAGE + EWRAM_SIZE / PAGE_SIZE,
+            IO_PAGE = IWRAM_PAGE + IWRAM_SIZE / PAGE_SIZE, PALETTE_PAGE = IO_PAGE + 1, VRAM_PAGE = PALETTE_PAGE + 1,
+            OAM_PAGE = VRAM_PAGE + VRAM_SIZE / PAGE_SIZE, SRAM_PAGE = OAM_PAGE + 1,
+            PAGE_COUNT = SRAM_PAGE + SRAM_SIZE / PAGE_SIZE};
+        Memory();
+        void reset();
+        bool loadRom(const char* path);
+        void loadRom(const uint8_t* data, uint32_t length);
+        void loadBios(const uint8_t* data, uint32_t length);
+        uint32_t getRomSize();
+        //the cartridge as loaded, getRomSize() bytes, NULL before a load
+        const uint8_t* getRom();
+        uint8_t load8(uint32_t address);
+        uint16_t load16(uint32_t address);
+        uint32_t load32(uint32_t address);
+        void store8(uint32_t address, uint8_t value);
+        void store16(uint32_t address, uint16_t value);
+        void store32(uint32_t address, uint32_t value);
+        //direct access to a contiguous range, NULL means use load/store
+        const uint8_t* getReadPointer(uint32_t address, uint32_t length);
+        uint8_t* getWritePointer(uint32_t address, uint32_t length);
+        //bytes of plain memory from address to the end of its region/mirror, 0 if not plain memory
+        uint32_t getMappedLength(uint32_t address);
+        void setIOHandler(uint32_t address, IOReadFunc read, IOWriteFunc write, void* context);
+        //raw register backing, what a read returns when no read hook is set
+        uint16_t getIORegister(uint32_t address);
+        void setIORegister(uint32_t address, uint16_t value);
+        //cycles one access takes, width in bytes, from the WAITCNT table
+        uint32_t getAccessCycles(uint32_t address, uint8_t width, bool sequential);
+        //an opcode fetch by the CPU, through the prefetch buffer when it is on
+        uint32_t getFetchCycles(uint32_t address, uint8_t width);
+        //a load or store by the CPU
+        uint32_t getDataCycles(uint32_t address, uint8_t width, bool sequential);
+        //cycles the CPU spent without the bus, the prefetch buffer fills meanwhile
+        void addInternalCycles(uint32_t cycles);
+        //the prefetch buffer, saved and restored with the machine
+        struct Prefetch {
+            uint32_t address;
+            uint32_t count;
+            uint32_t credit;
+        };
+        Prefetch getPrefetch();
+        void setPrefetch(const Prefetch& prefetch);
+        uint8_t* getVram();
+        uint8_t* getPalette();
+        uint8_t* getOam();
+        //one bit per 32 byte VRAM tile, set on write, cleared by whoever caches the tile
+        uint64_t* getVramDirty();
+        //one bit per 16 bit palette entry, same deal
+        uint64_t* getPaletteDirty();
+        //one bit per 8 byte OAM entry
+        uint64_t* getOamDirty();
+        //start and length of a page
+        uint8_t* getPage(uint32_t page, uint32_t* length);
+        //brings the per page versions up to date with the stores since the last call
+        const uint64_t* getPageVersions();
+        //overwrite a page from outside (save state restore), it takes the given version,
+        //0 (not known) leaves it dirty so it gets a fresh one
+        void restorePage(uint32_t page, const uint8_t* data, uint64_t version);
+        //the page address falls in, PAGE_COUNT for BIOS, ROM and unmapped
+        uint32_t getPageOf(uint32_t address);
+        void setWatchHandler(WatchFunc func, void* context);
+        //hand loads and/or stores to the pages under address..address + length to the watch handler
+        void watchRange(uint32_t address, uint32_t length, bool reads, bool writes);
+        void clearWatches();
+        //a load no watchpoint sees, for tools looking at memory (a trace reading opcodes)
+        uint32_t peek(uint32_t address, uint8_t width);
+    private:
+        enum watchBits {WATCH_READ = 1, WATCH_WRITE = 2};
+        struct Region {
+            uint8_t* base;
+            uint32_t mask;
+            uint8_t watch;
+        };
+        struct IOHandler {
+            IOReadFunc read;
+            IOWriteFunc write;
+            void* context;
+        };
+        uint8_t bios[BIOS_SIZE];
+        uint8_t ewram[EWRAM_SIZE];
+        uint8_t iwram[IWRAM_SIZE];
+        uint8_t io[IO_SIZE];
+        uint8_t palette[PALETTE_SIZE];
+        uint8_t vram[VRAM_SIZE];
+        uint8_t oam[OAM_SIZE];
+        uint8_t sram[SRAM_SIZE];
+        std::vector<uint8_t> rom;
+        uint32_t romSize;
+        Region regions[16];
+        IOHandler ioHandlers[IO_SIZE / 2];
+        uint64_t vramDirty[VRAM_SIZE / 32 / 64];
+        uint64_t paletteDirty[PALETTE_SIZE / 2 / 64];
+        uint64_t oamDirty[OAM_SIZE / 8 / 64];
+        uint64_t pageDirty[(PAGE_COUNT + 63) / 64];
+        uint64_t pageVersions[PAGE_COUNT];
+        //cycles by region << 3 | sequential << 2 | width >> 1
+        uint8_t accessTable[16 * 8];
+        bool prefetchEnabled;
+        Prefetch prefetch;
+        uint64_t readWatches[(PAGE_COUNT + 63) / 64];
+        uint64_t writeWatches[(PAGE_COUNT + 63) / 64];
+        WatchFunc watchFunc;
+        void* watchContext;
+        void mapRegions();
+        //the slow path behind a set watch bit
+        void watchAccess(uint32_t address, uint8_t width, bool write, uint32_t value);
+        void updateWaitStates(uint16_t waitControl);
+        static void waitControlWrite(void* context, uint32_t address, uint16_t value);
+        //the buffer gets cycles of idle cartridge bus
+        void fillPrefetch(uint32_t cycles);
+        uint32_t vramOffset(uint32_t address);
+        void markVramDirty(uint32_t offset, uint32_t length);
+        void markPage(uint32_t page);
+        void markPages(uint32_t firstPage, uint32_t offset, uint32_t length);
+        static uint64_t nextPageVersion();
+        bool rangeInRegion(uint32_t address, uint32_t length, uint32_t* offset);
+        uint16_t loadIO16(uint32_t address);
+        void storeIO16(uint32_t address, uint16_t value);
+};
+/*
+* BEGIN MEMORY METHODS
+*/
+inline Memory::Memory(){
+    rom.resize(0x4000, 0);
+    romSize = 0;
+    memset(bios, 0, sizeof(bios));
+    memset(ioHandlers, 0, sizeof(ioHandlers));
+    setIOHandler(0x4000204, 0, &Memory::waitControlWrite, this);
+    watchFunc = 0;
+    watchContext = 0;
+    clearWatches();
+    reset();
+}
+inline void Memory::reset(){
+    memset(ewram, 0, sizeof(ewram));
+    memset(iwram, 0, sizeof(iwram));
+    memset(io, 0, sizeof(io));
+    memset(palette, 0, sizeof(palette));
+    memset(vram, 0, sizeof(vram));
+    memset(vramDirty, 0xFF, sizeof(vramDirty));
+    memset(paletteDirty, 0xFF, sizeof(paletteDirty));
+    memset(oamDirty, 0xFF, sizeof(oamDirty));
+    memset(pageDirty, 0, sizeof(pageDirty));
+    memset(pageVersions, 0, sizeof(pageVersions));
+    for (uint32_t page = 0; page < PAGE_COUNT; page++){
+        markPage(page);
+    }
+    memset(oam, 0, sizeof(oam));
+    memset(sram, 0xFF, sizeof(sram));
+    mapRegions();
+    updateWaitStates(0);
+}
+inline void Memory::mapRegions(){
+    for (int i = 0; i < 16; i++){
+        regions[i].base = 0;
+        regions[i].mask = 0;
+    }
+    regions[BIOS].base = bios;
+    regions[BIOS].mask = BIOS_SIZE - 1;
+    regions[EWRAM].base = ewram;
+    regions[EWRAM].mask = EWRAM_SIZE - 1;
+    regions[IWRAM].base = iwram;
+    regions[IWRAM].mask = IWRAM_SIZE - 1;
+    regions[PALETTE].base = palette;
+    regions[PALETTE].mask = PALETTE_SIZE - 1;
+    regions[OAM].base = oam;
+    regions[OAM].mask = OAM_SIZE - 1;
+    //rom is padded to a power of two so the mask keeps reads inside the buffer
+    for (int i = ROM; i < SRAM; i++){
+        regions[i].base = &rom[0];
+        regions[i].mask = (uint32_t)rom.size() - 1;
+    }
+    regions[SRAM].base = sram;
+    regions[SRAM].mask = SRAM_SIZE - 1;
+}
+inline bool Memory::loadRom(const char* path){
+    std::ifstream file(path, std::ios::binary);
+    if (!file){
+        return false;
+    }
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (data.empty()){
+        return false;
+    }
+    loadRom(&data[0], (uint32_t)data.size());
+    return true;
+}
+inline void Memory::loadRom(const uint8_t* data, uint32_t length){
+    if (length > 0x2000000){
+        length = 0x2000000;
+    }
+    uint32_t padded = 0x4000;
+    while (padded < length){
+        padded <<= 1;
+    }
+    rom.assign(padded, 0);
+    memcpy(&rom[0], data, length);
+    romSize = length;
+    mapRegions();
+}
+inline void Memory::loadBios(const uint8_t* data, uint32_t length){
+    memset(bios, 0, sizeof(bios));
+    memcpy(bios, data, length < BIOS_SIZE ? length : (uint32_t)BIOS_SIZE);
+}
+inline uint32_t Memory::getRomSize(){
+    return romSize;
+}
+inline const uint8_t* Memory::getRom(){
+    return rom.empty() ? 0 : &rom[0];
+}
+inline uint32_t Memory::vramOffset(uint32_t address){
+    uint32_t offset = address & 0x1FFFF;
+    if (offset >= VRAM_SIZE){
+        offset -= 0x8000;
+    }
+    return offset;
+}
+inline uint8_t Memory::load8(uint32_t address){
+    uint8_t region = (address >> 24) & 0xF;
+    if (regions[region].watch & WATCH_READ){
+        watchAccess(address, 1, false, 0);
+    }
+    if (region == IO){
+        uint16_t value = loadIO16(address & ~1);
+        return (address & 1) ? value >> 8 : value & 0xFF;
+    }
+    if (region == VRAM){
+        return vram[vramOffset(address)];
+    }
+    Region* mapped = &regions[region];
+    if (!mapped->base){
+        return 0;
+    }
+    return mapped->base[address & mapped->mask];
+}
+inline uint16_t Memory::load16(uint32_t address){
+    address &= ~1;
+    uint8_t region = (address >> 24) & 0xF;
+    uint16_t value;
+    if (regions[region].watch & WATCH_READ){
+        watchAccess(address, 2, false, 0);
+    }
+    if (region == IO){
+        return loadIO16(address);
+    }
+    if (region == VRAM){
+        memcpy(&value, &vram[vramOffset(address)], 2);
+        return value;
+    }
+    if (region == SRAM){
+        return sram[address & (SRAM_SIZE - 1)] * 0x0101;
+    }
+    Region* mapped = &regions[region];
+    if (!mapped->base){
+        return 0;
+    }
+    memcpy(&value, &mapped->base[address & mapped->mask], 2);
+    return value;
+}
+inline uint32_t Memory::load32(uint32_t address){
+    address &= ~3;
+    uint8_t region = (address >> 24) & 0xF;
+    uint32_t value;
+    if (regions[region].watch & WATCH_READ){
+        watchAccess(address, 4, false, 0);
+    }
+    if (region == IO){
+        return loadIO16(address) | ((uint32_t)loadIO16(address + 2) << 16);
+    }
+    if (region == VRAM){
+        memcpy(&value, &vram[vramOffset(address)], 4);
+        return value;
+    }
+    if (region == SRAM){
+        return sram[address & (SRAM_SIZE - 1)] * 0x01010101;
+    }
+    Region* mapped = &regions[region];
+    if (!mapped->base){
+        return 0;
+    }
+    memcpy(&value, &mapped->base[address & mapped->mask], 4);
+    return value;
+}
+inline void Memory::store8(uint32_t address, uint8_t value){
+    uint8_t region = (address >> 24) & 0xF;
+    //palette and VRAM pass it on as a halfword store, which reports itself
+    if ((regions[region].watch & WATCH_WRITE) && region != PALETTE && region != VRAM){
+        watchAccess(address, 1, true, value);
+    }
+    switch (region){
+        case EWRAM:
+            ewram[address & (EWRAM_SIZE - 1)] = value;
+            markPage(EWRAM_PAGE + ((address & (EWRAM_SIZE - 1)) >> 12));
+            return;
+        case IWRAM:
+            iwram[address & (IWRAM_SIZE - 1)] = value;
+            markPage(IWRAM_PAGE + ((address & (IWRAM_SIZE - 1)) >> 12));
+            return;
+        case IO: {
+            uint32_t aligned = address & ~1;
+            uint16_t current = getIORegister(aligned);
+            if (address & 1){
+                storeIO16(aligned, (current & 0x00FF) | (value << 8));
+            } else {
+                storeIO16(aligned, (current & 0xFF00) | value);
+            }
+            return;
+        }
+        case PALETTE:
+            //8 bit writes land on both halves of the halfword
+            store16(address & ~1, value * 0x0101);
+            return;
+        case VRAM:
+            //only the background area takes byte writes (as a halfword), OBJ tiles ignore them
+            if (vramOffset(address) < 0x10000){
+                store16(address & ~1, value * 0x0101);
+            }
+            return;
+        case SRAM:
+            sram[address & (SRAM_SIZE - 1)] = value;
+            markPage(SRAM_PAGE + ((address & (SRAM_SIZE - 1)) >> 12));
+            return;
+        default:
+            //BIOS, ROM, OAM and unmapped ignore byte writes
+            return;
+    }
+}
+inline void Memory::store16(uint32_t address, uint16_t value){
+    address &= ~1;
+    uint8_t region = (address >> 24) & 0xF;
+    if (regions[region].watch & WATCH_WRITE){
+        watchAccess(address, 2, true, value);
+    }
+    switch (region){
+        case EWRAM:
+            memcpy(&ewram[address & (EWRAM_SIZE - 1)], &value, 2);
+            markPage(EWRAM_PAGE + ((address & (EWRAM_SIZE - 1)) >> 12));
+            return;
+        case IWRAM:
+            memcpy(&iwram[address & (IWRAM_SIZE - 1)], &value, 2);
+            markPage(IWRAM_PAGE + ((address & (IWRAM_SIZE - 1)) >> 12));
+            return;
+        case IO:
+            storeIO16(address, value);
+            return;
+        case PALETTE: {
+            uint32_t entry = (address & (PALETTE_SIZE - 1)) >> 1;
+            memcpy(&palette[entry * 2], &value, 2);
+            paletteDirty[entry >> 6] |= 1ull << (entry & 63);
+            markPage(PALETTE_PAGE);
+            return;
+        }
+        case VRAM: {
+            uint32_t offset = vramOffset(address);
+            memcpy(&vram[offset], &value, 2);
+            vramDirty[offset >> 11] |= 1ull << ((offset >> 5) & 63);
+            markPage(VRAM_PAGE + (offset >> 12));
+            return;
+        }
+        case OAM: {
+            uint32_t offset = address & (OAM_SIZE - 1);
+            memcpy(&oam[offset], &value, 2);
+            oamDirty[offset >> 9] |= 1ull << ((offset >> 3) & 63);
+            markPage(OAM_PAGE);
+            return;
+        }
+        case SRAM:
+            sram[address & (SRAM_SIZE - 1)] = (uint8_t)(value >> ((address & 1) * 8));
+            markPage(SRAM_PAGE + ((address & (SRAM_SIZE - 1)) >> 12));
+            return;
+        default:
+            return;
+    }
+}
+inline void Memory::store32(uint32_t address, uint32_t value){
+    address &= ~3;
+    uint8_t region = (address >> 24) & 0xF;
+    //I/O and SRAM go out as two halfword stores, which report themselves
+    if ((regions[region].watch & WATCH_WRITE) && region != IO && region != SRAM){
+        watchAccess(address, 4, true, value);
+    }
+    switch (region){
+        case EWRAM:
+            memcpy(&ewram[address & (EWRAM_SIZE - 1)], &value, 4);
+            markPage(EWRAM_PAGE + ((address & (EWRAM_SIZE - 1)) >> 12));
+            return;
+        case IWRAM:
+            memcpy(&iwram[address & (IWRAM_SIZE - 1)], &value, 4);
+            markPage(IWRAM_PAGE + ((address & (IWRAM_SIZE - 1)) >> 12));
+            return;
+        case PALETTE: {
+            uint32_t entry = (address & (PALETTE_SIZE - 1)) >> 1;
+            memcpy(&palette[entry * 2], &value, 4);
+            paletteDirty[entry >> 6] |= 3ull << (entry & 63);
+            markPage(PALETTE_PAGE);
+            return;
+        }
+        case VRAM: {
+            uint32_t offset = vramOffset(address);
+            memcpy(&vram[offset], &value, 4);
+            vramDirty[offset >> 11] |= 1ull << ((offset >> 5) & 63);
+            markPage(VRAM_PAGE + (offset >> 12));
+            return;
+        }
+        case OAM: {
+            uint32_t offset = address & (OAM_SIZE - 1);
+            memcpy(&oam[offset], &value, 4);
+            oamDirty[offset >> 9] |= 1ull << ((offset >> 3) & 63);
+            markPage(OAM_PAGE);
+            return;
+        }
+        default:
+            //I/O hooks and the 8 bit SRAM bus see two halfword stores
+            store16(address, value & 0xFFFF);
+            store16(address + 2, value >> 16);
+            return;
+    }
+}
+inline bool Memory::rangeInRegion(uint32_t address, uint32_t length, uint32_t* offset){
+    uint8_t region = (address >> 24) & 0xF;
+    uint32_t size;
+    switch (region){
+        case EWRAM:
+            size = EWRAM_SIZE;
+            break;
+        case IWRAM:
+            size = IWRAM_SIZE;
+            break;
+        case PALETTE:
+        case OAM:
+            size = PALETTE_SIZE;
+            break;
+        case VRAM: {
+            //the range must not cross the end of VRAM or the mirrored 32K
+            uint32_t raw = address & 0x1FFFF;
+            uint32_t end = raw < VRAM_SIZE ? VRAM_SIZE : 0x20000;
+            if (raw + length > end){
+                return false;
+            }
+            *offset = vramOffset(address);
+            return true;
+        }
+        default:
+            if (region >= ROM && region < SRAM){
+                uint32_t romOffset = address & 0x1FFFFFF;
+                if (romOffset + length > romSize){
+                    return false;
+                }
+                *offset = romOffset;
+                return true;
+            }
+            return false;
+    }
+    *offset = address & (size - 1);
+    return *offset + length <= size;
+}
+inline const uint8_t* Memory::getReadPointer(uint32_t address, uint32_t length){
+    uint32_t offset;
+    uint8_t region = (address >> 24) & 0xF;
+    if ((regions[region].watch & WATCH_READ) || !rangeInRegion(address, length, &offset)){
+        return 0;
+    }
+    if (region == VRAM){
+        return &vram[offset];
+    }
+    return &regions[region].base[offset];
+}
+inline uint8_t* Memory::getWritePointer(uint32_t address, uint32_t length){
+    uint32_t offset;
+    uint8_t region = (address >> 24) & 0xF;
+    if (region >= ROM || (regions[region].watch & WATCH_WRITE) || !rangeInRegion(address, length, &offset)){
+        return 0;
+    }
+    if (region == VRAM){
+        //the caller is about to write the whole range
+        markVramDirty(offset, length);
+        markPages(VRAM_PAGE, offset, length);
+        return &vram[offset];
+    }
+    //only EWRAM, IWRAM, palette and OAM are left by here
+    static const uint8_t firstPages[8] = {0, 0, EWRAM_PAGE, IWRAM_PAGE, 0, PALETTE_PAGE, 0, OAM_PAGE};
+    markPages(firstPages[region], offset, length);
+    if (region == PALETTE && length){
+        for (uint32_t entry = offset >> 1; entry <= (offset + length - 1) >> 1; entry++){
+            paletteDirty[entry >> 6] |= 1ull << (entry & 63);
+        }
+    }
+    if (region == OAM && length){
+        for (uint32_t entry = offset >> 3; entry <= (offset + length - 1) >> 3; entry++){
+            oamDirty[entry >> 6] |= 1ull << (entry & 63);
+        }
+    }
+    return &regions[region].base[offset];
+}
+inline void Memory::markVramDirty(uint32_t offset, uint32_t length){
+    if (!length){
+        return;
+    }
+    for (uint32_t tile = offset >> 5; tile <= (offset + length - 1) >> 5; tile++){
+        vramDirty[tile >> 6] |= 1ull << (tile & 63);
+    }
+}
+inline uint32_t Memory::getMappedLength(uint32_t address){
+    uint8_t region = (address >> 24) & 0xF;
+    switch (region){
+        case EWRAM:
+            return EWRAM_SIZE - (address & (EWRAM_SIZE - 1));
+        case IWRAM:
+            return IWRAM_SIZE - (address & (IWRAM_SIZE - 1));
+        case PALETTE:
+        case OAM:
+            return PALETTE_SIZE - (address & (PALETTE_SIZE - 1));
+        case VRAM: {
+            uint32_t raw = address & 0x1FFFF;
+            return (raw < VRAM_SIZE ? VRAM_SIZE : 0x20000) - raw;
+        }
+        default:
+            if (region >= ROM && region < SRAM){
+                uint32_t romOffset = address & 0x1FFFFFF;
+                return romOffset < romSize ? romSize - romOffset : 0;
+            }
+            return 0;
+    }
+}
+inline void Memory::setIOHandler(uint32_t address, IOReadFunc read, IOWriteFunc write, void* context){
+    IOHandler* handler = &ioHandlers[(address & (IO_SIZE - 1)) >> 1];
+    handler->read = read;
+    handler->write = write;
+    handler->context = context;
+}
+inline uint16_t Memory::getIORegister(uint32_t address){
+    uint16_t value;
+    memcpy(&value, &io[address & (IO_SIZE - 2)], 2);
+    return value;
+}
+inline void Memory::setIORegister(uint32_t address, uint16_t value){
+    memcpy(&io[address & (IO_SIZE - 2)], &value, 2);
+    markPage(IO_PAGE);
+}
+inline uint16_t Memory::loadIO16(uint32_t address){
+    if ((address & 0xFFFFFF) >= IO_SIZE){
+        return 0;
+    }
+    IOHandler* handler = &ioHandlers[(address & (IO_SIZE - 1)) >> 1];
+    if (handler->read){
+        return handler->read(handler->context, address);
+    }
+    return getIORegister(address);
+}
+inline void Memory::storeIO16(uint32_t address, uint16_t value){
+    if ((address & 0xFFFFFF) >= IO_SIZE){
+        return;
+    }
+    setIORegister(address, value);
+    IOHandler* handler = &ioHandlers[(address & (IO_SIZE - 1)) >> 1];
+    if (handler->write){
+        handler->write(handler->context, address, value);
+    }
+}
+inline void Memory::updateWaitStates(uint16_t waitControl){
+    //first access wait states by field value, the sequential ones differ per window
+    static const uint8_t firstWaits[4] = {4, 3, 2, 8};
+    static const uint8_t sequentialWaits[3][2] = {{2, 1}, {4, 1}, {8, 1}};
+    for (uint32_t region = 0; region < 16; region++){
+        uint8_t first = 1;
+        uint8_t sequential = 1;
+        uint8_t wide = 1;
+        if (region == EWRAM){
+            first = sequential = 3;
+            wide = 2;
+        } else if (region == PALETTE || region == VRAM){
+            wide = 2;
+        } else if (region >= ROM && region < SRAM){
+            uint32_t window = (region - ROM) >> 1;
+            uint32_t shift = 2 + window * 3;
+            first = 1 + firstWaits[(waitControl >> shift) & 3];
+            sequential = 1 + sequentialWaits[window][(waitControl >> (shift + 2)) & 1];
+        } else if (region == SRAM){
+            first = sequential = 1 + firstWaits[waitControl & 3];
+        }
+        uint8_t* entry = &accessTable[region << 3];
+        entry[0] = entry[1] = first;
+        entry[4] = entry[5] = sequential;
+        if (region >= ROM && region < SRAM){
+            //two halfwords, the second always sequential
+            entry[2] = first + sequential;
+            entry[6] = sequential * 2;
+        } else {
+            entry[2] = first * wide;
+            entry[6] = sequential * wide;
+        }
+    }
+    prefetchEnabled = (waitControl >> 14) & 1;
+    prefetch.address = 0;
+    prefetch.count = 0;
+    prefetch.credit = 0;
+}
+inline void Memory::waitControlWrite(void* context, uint32_t address, uint16_t value){
+    //only WAITCNT is hooked
+    (void)address;
+    ((Memory*)context)->updateWaitStates(value);
+}
+inline uint32_t Memory::getAccessCycles(uint32_t address, uint8_t width, bool sequential){
+    return accessTable[((address >> 21) & 0x78) | (sequential << 2) | (width >> 1)];
+}
+inline uint32_t Memory::getFetchCycles(uint32_t address, uint8_t width){
+    uint8_t region = (address >> 24) & 0xF;
+    if (region < ROM || region >= SRAM){
+        //a fetch from RAM leaves the cartridge bus to the buffer
+        uint32_t cycles = getAccessCycles(address, width, true);
+        fillPrefetch(cycles);
+        return cycles;
+    }
+    uint32_t halfwords = width >> 1;
+    if (address == prefetch.address && (address & 0x1FFFF)){
+        if (prefetchEnabled && prefetch.count >= halfwords){
+            prefetch.count -= halfwords;
+            prefetch.address += width;
+            return 1;
+        }
+        //what is buffered takes a cycle each, the rest is read now less what is on its way already
+        uint32_t cycles = prefetch.count + (halfwords - prefetch.count) * getAccessCycles(address, 2, true) - prefetch.credit;
+        prefetch.count = 0;
+        prefetch.credit = 0;
+        prefetch.address += width;
+        return cycles > 1 ? cycles : 1;
+    }
+    prefetch.count = 0;
+    prefetch.credit = 0;
+    prefetch.address = address + width;
+    return getAccessCycles(address, width, false);
+}
+inline uint32_t Memory::getDataCycles(uint32_t address, uint8_t width, bool sequential){
+    uint32_t cycles = getAccessCycles(address, width, sequential && (address & 0x1FFFF));
+    uint8_t region = (address >> 24) & 0xF;
+    if (region >= ROM && region < SRAM){
+        //the cartridge bus was taken, what was buffered is gone and the next fetch starts over
+        prefetch.count = 0;
+        prefetch.credit = 0;
+        prefetch.address = 0;
+    } else {
+        fillPrefetch(cycles);
+    }
+    return cycles;
+}
+inline void Memory::addInternalCycles(uint32_t cycles){
+    fillPrefetch(cycles);
+}
+inline void Memory::fillPrefetch(uint32_t cycles){
+    if (!prefetchEnabled || !prefetch.address){
+        return;
+    }
+    uint32_t step = getAccessCycles(prefetch.address, 2, true);
+    prefetch.credit += cycles;
+    //the next address to fetch is past what is already buffered
+    uint32_t ready = prefetch.credit / step;
+    if (prefetch.count + ready >= 8){
+        prefetch.count = 8;
+        prefetch.credit = 0;
+        return;
+    }
+    prefetch.count += ready;
+    prefetch.credit -= ready * step;
+}
+inline Memory::Prefetch Memory::getPrefetch(){
+    return prefetch;
+}
+inline void Memory::setPrefetch(const Prefetch& prefetch){
+    this->prefetch = prefetch;
+}
+inline uint8_t* Memory::getVram(){
+    return vram;
+}
+inline uint8_t* Memory::getPalette(){
+    return palette;
+}
+inline uint8_t* Memory::getOam(){
+    return oam;
+}
+inline uint64_t* Memory::getVramDirty(){
+    return vramDirty;
+}
+inline uint64_t* Memory::getPaletteDirty(){
+    return paletteDirty;
+}
+inline uint64_t* Memory::getOamDirty(){
+    return oamDirty;
+}
+inline void Memory::markPage(uint32_t page){
+    pageDirty[page >> 6] |= 1ull << (page & 63);
+}
+inline void Memory::markPages(uint32_t firstPage, uint32_t offset, uint32_t length){
+    //palette and OAM are a single 1K page, everything else 4K
+    if (!length){
+        return;
+    }
+    if (firstPage == PALETTE_PAGE || firstPage == OAM_PAGE){
+        markPage(firstPage);
+        return;
+    }
+    for (uint32_t page = offset >> 12; page <= (offset + length - 1) >> 12; page++){
+        markPage(firstPage + page);
+    }
+}
+inline uint64_t Memory::nextPageVersion(){
+    static std::atomic<uint64_t> counter(0);
+    return counter.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+inline uint8_t* Memory::getPage(uint32_t page, uint32_t* length){
+    *length = PAGE_SIZE;
+    if (page < IWRAM_PAGE){
+        return ewram + (page - EWRAM_PAGE) * PAGE_SIZE;
+    }
+    if (page < IO_PAGE){
+        return iwram + (page - IWRAM_PAGE) * PAGE_SIZE;
+    }
+    if (page < VRAM_PAGE){
+        *length = IO_SIZE;
+        return page == IO_PAGE ? io : palette;
+    }
+    if (page < OAM_PAGE){
+        return vram + (page - VRAM_PAGE) * PAGE_SIZE;
+    }
+    if (page == OAM_PAGE){
+        *length = OAM_SIZE;
+        return oam;
+    }
+    return sram + (page - SRAM_PAGE) * PAGE_SIZE;
+}
+inline const uint64_t* Memory::getPageVersions(){
+    for (uint32_t word = 0; word < (PAGE_COUNT + 63) / 64; word++){
+        while (pageDirty[word]){
+            uint32_t page = word * 64 + __builtin_ctzll(pageDirty[word]);
+            pageDirty[word] &= pageDirty[word] - 1;
+            pageVersions[page] = nextPageVersion();
+        }
+    }
+    return pageVersions;
+}
+inline void Memory::restorePage(uint32_t page, const uint8_t* data, uint64_t version){
+    uint32_t length;
+    uint8_t* target = getPage(page, &length);
+    memcpy(target, data, length);
+    if (version){
+        pageDirty[page >> 6] &= ~(1ull << (page & 63));
+        pageVersions[page] = version;
+    } else {
+        markPage(page);
+    }
+    //the render caches have to look at it again
+    if (page >= VRAM_PAGE && page < OAM_PAGE){
+        markVramDirty((page - VRAM_PAGE) * PAGE_SIZE, PAGE_SIZE);
+    } else if (page == PALETTE_PAGE){
+        memset(paletteDirty, 0xFF, sizeof(paletteDirty));
+    } else if (page == OAM_PAGE){
+        memset(oamDirty, 0xFF, sizeof(oamDirty));
+    } else if (page == IO_PAGE){
+        updateWaitStates(getIORegister(0x4000204));
+    }
+}
+inline uint32_t Memory::getPageOf(uint32_t address){
+    switch ((address >> 24) & 0xF){
+        case EWRAM:
+            return EWRAM_PAGE + ((address & (EWRAM_SIZE - 1)) >> 12);
+        case IWRAM:
+            return IWRAM_PAGE + ((address & (IWRAM_SIZE - 1)) >> 12);
+        case IO:
+            return IO_PAGE;
+        case PALETTE:
+            return PALETTE_PAGE;
+        case VRAM:
+            return VRAM_PAGE + (vramOffset(address) >> 12);
+        case OAM:
+            return OAM_PAGE;
+        case SRAM:
+            return SRAM_PAGE + ((address & (SRAM_SIZE - 1)) >> 12);
+        default:
+            return PAGE_COUNT;
+    }
+}
+inline void Memory::setWatchHandler(WatchFunc func, void* context){
+    this->watchFunc = func;
+    this->watchContext = context;
+}
+inline void Memory::watchRange(uint32_t address, uint32_t length, bool reads, bool writes){
+    //1K steps, the smallest page, so every page under the range gets its bit
+    uint64_t end = (uint64_t)address + (length ? length : 1);
+    for (uint64_t at = address & ~0x3FFu; at < end; at += 0x400){
+        uint32_t page = getPageOf((uint32_t)at);
+        Region* region = &regions[(at >> 24) & 0xF];
+        if (reads){
+            region->watch |= WATCH_READ;
+        }
+        if (writes){
+            region->watch |= WATCH_WRITE;
+        }
+        if (page == PAGE_COUNT){
+            continue;
+        }
+        if (reads){
+            readWatches[page >> 6] |= 1ull << (page & 63);
+        }
+        if (writes){
+            writeWatches[page >> 6] |= 1ull << (page & 63);
+        }
+    }
+}
+inline void Memory::clearWatches(){
+    for (int i = 0; i < 16; i++){
+        regions[i].watch = 0;
+    }
+    memset(readWatches, 0, sizeof(readWatches));
+    memset(writeWatches, 0, sizeof(writeWatches));
+}
+inline uint32_t Memory::peek(uint32_t address, uint8_t width){
+    Region* region = &regions[(address >> 24) & 0xF];
+    uint8_t watch = region->watch;
+    region->watch = 0;
+    uint32_t value = width == 4 ? load32(address) : width == 2 ? load16(address) : load8(address);
+    region->watch = watch;
+    return value;
+}
+inline void Memory::watchAccess(uint32_t address, uint8_t width, bool write, uint32_t value){
+    uint32_t page = getPageOf(address);
+    const uint64_t* watches = write ? writeWatches : readWatches;
+    if (page != PAGE_COUNT && !(watches[page >> 6] & (1ull << (page & 63)))){
+        return;
+    }
+    if (watchFunc){
+        watchFunc(watchContext, address, width, write, value);
+    }
+}
+#endif
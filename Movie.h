@@ -0,0 +1,156 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <istream>
+
+/*
+* INPUT MOVIE:
+*   The keypad state for every frame of a run, so the same run can be played
+*   back as often as wanted with nobody at the keys and no clock involved.
+*   Keys are the pressed ones as a KEYINPUT mask (bit 0 A ... bit 9 L, set
+*   means down), the player writes ~keys to the register before each frame.
+*   Past the last recorded frame nothing is pressed.
+*   On disk, little endian:
+*       "GBAMOVIE"  magic
+*       uint32      version (1)
+*       uint32      frame count
+*       uint64      hash of the ROM it was recorded on
+*       uint64      hash of the machine after the last frame, 0 if not known
+*       uint16      keys, one per frame
+*   The hashes are whatever the recorder put in (the runner uses FNV-1a for
+*   both), the movie only carries them so a replay can tell it went the same way.
+*   readScript expands the runner's text input scripts, one change per line
+*   ("<frame> <hex keys>", holding until the next line), into a movie.
+*/
+class InputMovie {
+    public:
+        enum {VERSION = 1};
+        InputMovie();
+        void clear();
+        //appends the next frame
+        void record(uint16_t keys);
+        uint16_t getKeys(uint32_t frame) const;
+        uint32_t getFrameCount() const;
+        uint64_t getRomHash() const;
+        void setRomHash(uint64_t hash);
+        uint64_t getFinalHash() const;
+        void setFinalHash(uint64_t hash);
+        bool save(const char* path) const;
+        //false if the file is missing, not a movie or cut short, the movie is left empty then
+        bool load(const char* path);
+        //frames frames from a text script, false if it does not parse or is empty
+        bool readScript(std::istream& in, uint32_t frames);
+    private:
+        std::vector<uint16_t> keys;
+        uint64_t romHash;
+        uint64_t finalHash;
+        static void putBytes(std::vector<uint8_t>* out, uint64_t value, uint32_t bytes);
+        static uint64_t getBytes(const uint8_t* in, uint32_t bytes);
+};
+/*
+* BEGIN INPUT MOVIE METHODS
+*/
+inline InputMovie::InputMovie(){
+    clear();
+}
+inline void InputMovie::clear(){
+    keys.clear();
+    romHash = 0;
+    finalHash = 0;
+}
+inline void InputMovie::record(uint16_t keys){
+    this->keys.push_back(keys & 0x3FF);
+}
+inline uint16_t InputMovie::getKeys(uint32_t frame) const{
+    return frame < keys.size() ? keys[frame] : 0;
+}
+inline uint32_t InputMovie::getFrameCount() const{
+    return keys.size();
+}
+inline uint64_t InputMovie::getRomHash() const{
+    return romHash;
+}
+inline void InputMovie::setRomHash(uint64_t hash){
+    this->romHash = hash;
+}
+inline uint64_t InputMovie::getFinalHash() const{
+    return finalHash;
+}
+inline void InputMovie::setFinalHash(uint64_t hash){
+    this->finalHash = hash;
+}
+inline void InputMovie::putBytes(std::vector<uint8_t>* out, uint64_t value, uint32_t bytes){
+    for (uint32_t i = 0; i < bytes; i++){
+        out->push_back((uint8_t)(value >> (i * 8)));
+    }
+}
+inline uint64_t InputMovie::getBytes(const uint8_t* in, uint32_t bytes){
+    uint64_t value = 0;
+    for (uint32_t i = 0; i < bytes; i++){
+        value |= (uint64_t)in[i] << (i * 8);
+    }
+    return value;
+}
+inline bool InputMovie::save(const char* path) const{
+    std::vector<uint8_t> data(8);
+    memcpy(&data[0], "GBAMOVIE", 8);
+    putBytes(&data, VERSION, 4);
+    putBytes(&data, keys.size(), 4);
+    putBytes(&data, romHash, 8);
+    putBytes(&data, finalHash, 8);
+    for (uint32_t i = 0; i < keys.size(); i++){
+        putBytes(&data, keys[i], 2);
+    }
+    std::ofstream file(path, std::ios::binary);
+    file.write((const char*)&data[0], data.size());
+    return (bool)file;
+}
+inline bool InputMovie::load(const char* path){
+    clear();
+    std::ifstream file(path, std::ios::binary);
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    const uint32_t header = 32;
+    if (data.size() < header || memcmp(&data[0], "GBAMOVIE", 8) || getBytes(&data[8], 4) != VERSION){
+        return false;
+    }
+    uint32_t frames = getBytes(&data[12], 4);
+    if (data.size() != header + (uint64_t)frames * 2){
+        return false;
+    }
+    romHash = getBytes(&data[16], 8);
+    finalHash = getBytes(&data[24], 8);
+    keys.resize(frames);
+    for (uint32_t i = 0; i < frames; i++){
+        keys[i] = getBytes(&data[header + i * 2], 2) & 0x3FF;
+    }
+    return true;
+}
+inline bool InputMovie::readScript(std::istream& in, uint32_t frames){
+    clear();
+    std::vector<uint32_t> changeFrames;
+    std::vector<uint16_t> changeKeys;
+    uint32_t frame;
+    std::string mask;
+    while (in >> frame >> mask){
+        changeFrames.push_back(frame);
+        changeKeys.push_back((uint16_t)strtoul(mask.c_str(), 0, 16));
+    }
+    if (!in.eof() || changeFrames.empty()){
+        return false;
+    }
+    uint32_t change = 0;
+    uint16_t held = 0;
+    for (frame = 0; frame < frames; frame++){
+        while (change < changeFrames.size() && changeFrames[change] <= frame){
+            held = changeKeys[change++];
+        }
+        record(held);
+    }
+    return true;
+}
+#endif
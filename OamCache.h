@@ -0,0 +1,155 @@
+#ifndef OAMCACHE_H
+#define OAMCACHE_H
+#include <stdint.h>
+#include <string.h>
+#include "Memory.h"
+
+/*
+* OAM CACHE:
+*   The 128 OAM entries decoded into one array per field, and for every visible
+*   line the sprites whose bounding box covers it, in OAM order.
+*   update() only does work when Memory's OAM dirty bits say something changed:
+*   it re-decodes just the entries that were written and, if any of them moved,
+*   resized or switched on/off, rebuilds the line buckets. A frame where OAM is
+*   untouched costs 2 word tests per line, and the sprite renderer only visits
+*   the sprites on its line instead of parsing all 128 entries.
+*   Affine matrices are not cached, the renderer reads the 4 parameters of the
+*   few affine sprites on a line straight from OAM.
+*/
+class OamCache {
+    public:
+        enum {SPRITES = 128, LINES = 160};
+        enum spriteFlags {ENABLED = 1 << 0, AFFINE = 1 << 1, DOUBLE_SIZE = 1 << 2, COLORS_256 = 1 << 3,
+            HFLIP = 1 << 4, VFLIP = 1 << 5};
+        //decoded attributes, index is the OAM entry
+        int16_t x[SPRITES];
+        int16_t y[SPRITES];
+        uint8_t width[SPRITES];
+        uint8_t height[SPRITES];
+        uint8_t boxWidth[SPRITES];
+        uint8_t boxHeight[SPRITES];
+        uint8_t flags[SPRITES];
+        uint8_t mode[SPRITES];
+        uint8_t priority[SPRITES];
+        uint8_t affineIndex[SPRITES];
+        uint8_t paletteBank[SPRITES];
+        uint16_t tile[SPRITES];
+        OamCache(Memory* memory);
+        //bring the arrays and buckets up to date with OAM
+        void update();
+        //sprites covering a visible line, in OAM order
+        const uint8_t* getLine(uint8_t line, uint32_t* count);
+        //entries decoded and bucket rebuilds so far
+        uint64_t getDecodeCount();
+        uint64_t getRebuildCount();
+    private:
+        Memory* memory;
+        uint8_t lineSprites[LINES][SPRITES];
+        uint8_t lineCount[LINES];
+        uint64_t decodes;
+        uint64_t rebuilds;
+        //decodes one entry, true if its bounding box or enable changed
+        bool decode(uint8_t sprite);
+        void rebuildLines();
+};
+/*
+* BEGIN OAM CACHE METHODS
+*/
+inline OamCache::OamCache(Memory* memory){
+    this->memory = memory;
+    memset(x, 0, sizeof(x));
+    memset(y, 0, sizeof(y));
+    memset(boxHeight, 0, sizeof(boxHeight));
+    memset(flags, 0, sizeof(flags));
+    memset(lineCount, 0, sizeof(lineCount));
+    decodes = 0;
+    rebuilds = 0;
+}
+inline void OamCache::update(){
+    uint64_t* dirty = memory->getOamDirty();
+    if (!(dirty[0] | dirty[1])){
+        return;
+    }
+    bool moved = false;
+    for (uint32_t word = 0; word < 2; word++){
+        while (dirty[word]){
+            uint8_t sprite = word * 64 + __builtin_ctzll(dirty[word]);
+            dirty[word] &= dirty[word] - 1;
+            moved |= decode(sprite);
+        }
+    }
+    if (moved){
+        rebuildLines();
+    }
+}
+inline bool OamCache::decode(uint8_t sprite){
+    //sizes by shape (square, wide, tall) then size
+    static const uint8_t widths[4][4] = {{8, 16, 32, 64}, {16, 32, 32, 64}, {8, 8, 16, 32}, {0, 0, 0, 0}};
+    static const uint8_t heights[4][4] = {{8, 16, 32, 64}, {8, 8, 16, 32}, {16, 32, 32, 64}, {0, 0, 0, 0}};
+    uint16_t attributes[3];
+    memcpy(attributes, memory->getOam() + sprite * 8, 6);
+    decodes++;
+    uint8_t shape = attributes[0] >> 14;
+    uint8_t sizeIndex = attributes[1] >> 14;
+    uint8_t newFlags = 0;
+    newFlags |= (attributes[0] & (1 << 8)) ? AFFINE : 0;
+    newFlags |= (attributes[0] & (1 << 9)) ? DOUBLE_SIZE : 0;
+    newFlags |= (attributes[0] & (1 << 13)) ? COLORS_256 : 0;
+    uint8_t objMode = (attributes[0] >> 10) & 0b11;
+    //bit 9 without the affine bit hides the sprite, shape 3 and mode 3 are prohibited
+    bool enabled = ((newFlags & AFFINE) || !(newFlags & DOUBLE_SIZE)) && shape != 3 && objMode != 3;
+    newFlags |= enabled ? ENABLED : 0;
+    if (!(newFlags & AFFINE)){
+        newFlags |= (attributes[1] & (1 << 12)) ? HFLIP : 0;
+        newFlags |= (attributes[1] & (1 << 13)) ? VFLIP : 0;
+    }
+    uint8_t newWidth = widths[shape][sizeIndex];
+    uint8_t newHeight = heights[shape][sizeIndex];
+    bool doubled = (newFlags & AFFINE) && (newFlags & DOUBLE_SIZE);
+    uint8_t newBoxWidth = doubled ? newWidth * 2 : newWidth;
+    uint8_t newBoxHeight = doubled ? newHeight * 2 : newHeight;
+    int16_t newY = attributes[0] & 0xFF;
+    if (newY + newBoxHeight > 256){
+        newY -= 256;
+    }
+    bool moved = newY != y[sprite] || newBoxHeight != boxHeight[sprite] || (newFlags & ENABLED) != (flags[sprite] & ENABLED);
+    int16_t newX = attributes[1] & 0x1FF;
+    x[sprite] = newX >= 240 ? newX - 512 : newX;
+    y[sprite] = newY;
+    width[sprite] = newWidth;
+    height[sprite] = newHeight;
+    boxWidth[sprite] = newBoxWidth;
+    boxHeight[sprite] = newBoxHeight;
+    flags[sprite] = newFlags;
+    mode[sprite] = objMode;
+    priority[sprite] = (attributes[2] >> 10) & 0b11;
+    affineIndex[sprite] = (attributes[1] >> 9) & 0x1F;
+    paletteBank[sprite] = attributes[2] >> 12;
+    tile[sprite] = attributes[2] & 0x3FF;
+    return moved;
+}
+inline void OamCache::rebuildLines(){
+    rebuilds++;
+    memset(lineCount, 0, sizeof(lineCount));
+    for (uint32_t sprite = 0; sprite < SPRITES; sprite++){
+        if (!(flags[sprite] & ENABLED)){
+            continue;
+        }
+        int32_t top = y[sprite] < 0 ? 0 : y[sprite];
+        int32_t bottom = y[sprite] + boxHeight[sprite] > LINES ? LINES : y[sprite] + boxHeight[sprite];
+        for (int32_t line = top; line < bottom; line++){
+            lineSprites[line][lineCount[line]++] = sprite;
+        }
+    }
+}
+inline const uint8_t* OamCache::getLine(uint8_t line, uint32_t* count){
+    *count = lineCount[line];
+    return lineSprites[line];
+}
+inline uint64_t OamCache::getDecodeCount(){
+    return decodes;
+}
+inline uint64_t OamCache::getRebuildCount(){
+    return rebuilds;
+}
+#endif
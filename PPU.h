@@ -0,0 +1,1180 @@
+#ifndef PPU_H
+#define PPU_H
+#include <stdint.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#include "Scheduler.h"
+#include "Memory.h"
+#include "Interrupts.h"
+#include "DMA.h"
+#include "TileCache.h"
+#include "OamCache.h"
+
+/*
+* PPU (scanline renderer and LCD timing):
+*   TIMING:
+*       228 lines of 1232 cycles, 160 visible. Each line is two scheduler events,
+*       HBLANK at cycle 960 of the line and HDRAW at the end of it, so the
+*       video hardware costs two dispatches a line no matter what the CPU does.
+*       A visible line is rendered when its HBlank starts, with the registers as
+*       they are at that point (HBlank DMA/IRQ effects land on the next line).
+*   REGISTERS (offsets from 0x4000000):
+*       0x00 DISPCNT  bits 0 -> 2 mode, 4 frame select, 6 OBJ 1D mapping,
+*                     7 forced blank, 8 -> 12 BG0-3/OBJ enable, 13 -> 15 windows
+*       0x04 DISPSTAT bits 0 vblank, 1 hblank, 2 vcount match, 3 -> 5 their IRQs,
+*                     8 -> 15 vcount compare
+*       0x06 VCOUNT
+*       0x08 BGxCNT   bits 0 -> 1 priority, 2 -> 3 tile base, 7 256 colors,
+*                     8 -> 12 map base, 13 affine wrap, 14 -> 15 size
+*       0x10 BGxHOFS/VOFS, 0x20 BG2 PA PB PC PD X Y, 0x30 BG3 affine
+*       0x40 WIN0H WIN1H WIN0V WIN1V WININ WINOUT
+*       0x50 BLDCNT BLDALPHA BLDY
+*   LINE PIPELINE:
+*       every layer renders into its own 240 pixel line of BGR555 colors with
+*       bit 15 set where the pixel is opaque, a text background a tile row at a
+*       time (with AVX2 the row's 8 colors are one gather). OBJ also gets a per
+*       pixel priority and flag line. compose() then walks the layers back to
+*       front keeping the top two (color, layer bit) per pixel, which is all
+*       alpha blending needs, and applies the color effect. Those two steps are
+*       straight selects and 16 bit multiplies, done 16 pixels at a time with
+*       AVX2 or 8 with SSE2 (composeScalar is the reference and the fallback).
+*       240 = 15 * 16 so a line has no tail.
+*   AFFINE:
+*       affine backgrounds, bitmaps and sprites all sample a texture along a line
+*       from a 20.8 (BG) or 8.8 (OBJ) start point stepping by PA/PC. affineLine()
+*       turns that into integer texel coordinates 8 (AVX2) or 4 (SSE2) pixels at a
+*       time, wrapping or marking texels off the edge with -1. With AVX2 affine
+*       backgrounds go further and gather map entry, tile pixel and palette color
+*       8 pixels at a time too, and sprites (regular ones count their texels
+*       rather than going through affineLine) gather tile pixel and color and
+*       blend the winners into the OBJ lines 8 at a time. setScalarAffine(true)
+*       forces the one pixel at a time reference path for both, output is the
+*       same bit for bit.
+*   OUTPUT:
+*       blending has to happen on BGR555 to match the hardware, so the composed
+*       line is arbitrary 15 bit colors rather than palette entries. Turning them
+*       into RGBA8888 is a lookup in one 32K entry table shared by every PPU
+*       (an AVX2 gather, 8 pixels per instruction). paletteRGBA mirrors palette
+*       RAM already converted, for palette viewers and the like; it is brought
+*       up to date from the bus's palette dirty bits when asked for.
+*   FRAME SKIPPING:
+*       setFrameSkip(n) only draws every nth frame, 0 draws none unless
+*       requestFrame() asks for the next one. Whether a frame is drawn is decided
+*       when line 0 starts; a skipped frame still runs every HBLANK/HDRAW event,
+*       flag, IRQ, DMA trigger and affine reference step, it just never touches a
+*       pixel. The dirty bits keep piling up meanwhile so the caches are right
+*       when drawing resumes, and getFrame() keeps the last frame drawn.
+*   THREADED RENDERING:
+*       setThreadedRendering(true) moves the drawing to a RenderThread (see
+*       RenderThread.h) running a render-only PPU on its own copy of VRAM,
+*       palette and OAM. Timing, IRQs and DMA triggers stay here on the CPU side,
+*       each HBlank just queues what the line needs, so the pictures come out the
+*       same as drawing inline, just up to a frame later.
+*   Mosaic and the OBJ per line cycle limit are not emulated.
+*/
+class RenderThread;
+class PPU {
+    public:
+        enum screen {WIDTH = 240, HEIGHT = 160, TOTAL_LINES = 228, LINE_CYCLES = 1232, HDRAW_CYCLES = 960};
+        //layer bits, also the BLDCNT target bit order
+        enum layers {BG0 = 1 << 0, BG1 = 1 << 1, BG2 = 1 << 2, BG3 = 1 << 3, OBJ = 1 << 4,
+            BACKDROP = 1 << 5, SEMI_TRANSPARENT = 1 << 6};
+        enum status {VBLANK_FLAG = 1 << 0, HBLANK_FLAG = 1 << 1, VCOUNT_FLAG = 1 << 2,
+            VBLANK_IRQ = 1 << 3, HBLANK_IRQ = 1 << 4, VCOUNT_IRQ = 1 << 5};
+        PPU(Scheduler* scheduler, Memory* memory, Interrupts* interrupts, DMA* dma);
+        //render-only: draws from memory when told to, no timing and no register hooks
+        PPU(Memory* memory);
+        ~PPU();
+        void reset();
+        void mapRegisters();
+        void renderLine(uint8_t line);
+        //every visible line back to back, no timing (screenshots, benchmarks)
+        void renderFrame();
+        //RGBA8888, 240 x 160, row major
+        const uint32_t* getFrame();
+        uint64_t getFrameCount();
+        TileCache* getTileCache();
+        OamCache* getOamCache();
+        uint16_t getVCount();
+        //line composition on its own so the SIMD path can be checked against the scalar one
+        void compose(uint32_t* out);
+        void composeScalar(uint32_t* out);
+        //use the scalar affine background and sprite paths (the reference the SIMD ones have to match)
+        void setScalarAffine(bool scalar);
+        //BGR555 to RGBA8888, the 5 bit channels are widened by repeating their top bits
+        static uint32_t toRGBA(uint16_t color);
+        //toRGBA for all 32K colors, built on first use and shared by every PPU
+        static const uint32_t* getColorTable();
+        //the 512 palette entries as RGBA8888, synced with palette RAM on every call
+        const uint32_t* getPaletteRGBA();
+        //draw lines on a second thread, getFrame() waits for it to catch up
+        void setThreadedRendering(bool threaded);
+        bool isThreadedRendering();
+        //draw every nth frame from the next one on, 0 for none (headless), 1 is the default
+        void setFrameSkip(uint32_t interval);
+        uint32_t getFrameSkip();
+        //draw the next frame that starts whatever the frame skip says
+        void requestFrame();
+        //frames actually drawn, frames whose lines were all skipped are not counted
+        uint64_t getDrawnFrameCount();
+        //BG2/BG3 internal reference points the next renderLine starts from
+        void setAffineReference(const int32_t* x, const int32_t* y);
+        //overwrite the frame, to carry a half drawn picture over to another PPU
+        void loadFrame(const uint32_t* pixels);
+        //timing and the affine reference points for save states, the picture itself is not
+        //part of it (the next frame redraws it) and neither are the frame skip settings
+        struct State {
+            uint64_t frameCount;
+            uint16_t vcount;
+            uint16_t statusFlags;
+            int32_t affineX[2];
+            int32_t affineY[2];
+            bool drawing;
+        };
+        void saveState(State* state);
+        void loadState(const State* state);
+    private:
+        Scheduler* scheduler;
+        Memory* memory;
+        Interrupts* interrupts;
+        DMA* dma;
+        TileCache tileCache;
+        OamCache oamCache;
+        const uint32_t* colorTable;
+        uint32_t paletteRGBA[512];
+        uint32_t frame[HEIGHT * WIDTH];
+        uint64_t frameCount;
+        uint16_t vcount;
+        uint16_t statusFlags;
+        //internal affine reference points for BG2 and BG3, 20.8 fixed point
+        int32_t affineX[2];
+        int32_t affineY[2];
+        //per line work buffers, 8 pixels of slack either side for tile overhang
+        uint16_t bgLines[4][WIDTH + 16];
+        uint16_t* bgLine[4];
+        uint16_t objLine[WIDTH];
+        uint16_t objPriority[WIDTH];
+        uint16_t objFlags[WIDTH];
+        uint8_t objWindow[WIDTH];
+        uint16_t windowMask[WIDTH];
+        //what compose() works from, filled in by renderLine
+        uint8_t enabledLayers;
+        uint8_t bgPriority[4];
+        uint16_t backdrop;
+        bool scalarAffine;
+        RenderThread* renderThread;
+        uint32_t frameSkip;
+        bool frameRequested;
+        //whether the frame in progress is being drawn
+        bool drawing;
+        uint64_t drawnFrames;
+        uint16_t register16(uint32_t offset);
+        uint16_t paletteColor(uint32_t index);
+        void renderTextBackground(uint8_t bg, uint8_t line);
+        void renderAffineBackground(uint8_t bg);
+        void affineLine(int32_t x, int32_t y, int32_t pa, int32_t pc, int32_t count,
+            int32_t width, int32_t height, bool wrap, int32_t* tx, int32_t* ty);
+        void renderBitmapBackground(uint8_t mode);
+        void renderSprites(uint8_t line);
+        void buildWindows(uint8_t line);
+        void stepAffine();
+        void reloadAffine();
+        //at line 0: does this frame get drawn
+        void startFrame();
+        //threaded mode: hand the line to the render thread and move the reference points on
+        void submitLine(uint8_t line);
+        const uint32_t* getThreadedPaletteRGBA();
+        void startHBlank(uint64_t cycle);
+        void startLine(uint64_t cycle);
+        static void hblankEvent(void* context, uint64_t late);
+        static void hdrawEvent(void* context, uint64_t late);
+        static uint16_t ioRead(void* context, uint32_t address);
+        static void ioWrite(void* context, uint32_t address, uint16_t value);
+};
+/*
+* BEGIN PPU METHODS
+*/
+inline PPU::PPU(Scheduler* scheduler, Memory* memory, Interrupts* interrupts, DMA* dma) : tileCache(memory), oamCache(memory){
+    this->scheduler = scheduler;
+    this->memory = memory;
+    this->interrupts = interrupts;
+    this->dma = dma;
+    this->colorTable = getColorTable();
+    this->scalarAffine = false;
+    this->renderThread = 0;
+    this->frameSkip = 1;
+    this->frameRequested = false;
+    scheduler->setHandler(Scheduler::HBLANK, &PPU::hblankEvent, this);
+    scheduler->setHandler(Scheduler::HDRAW, &PPU::hdrawEvent, this);
+    reset();
+}
+inline PPU::PPU(Memory* memory) : tileCache(memory), oamCache(memory){
+    this->scheduler = 0;
+    this->memory = memory;
+    this->interrupts = 0;
+    this->dma = 0;
+    this->colorTable = getColorTable();
+    this->scalarAffine = false;
+    this->renderThread = 0;
+    this->frameSkip = 1;
+    this->frameRequested = false;
+    reset();
+}
+inline void PPU::reset(){
+    memset(frame, 0, sizeof(frame));
+    memset(bgLines, 0, sizeof(bgLines));
+    for (int i = 0; i < 4; i++){
+        bgLine[i] = bgLines[i] + 8;
+    }
+    frameCount = 0;
+    drawnFrames = 0;
+    vcount = 0;
+    statusFlags = 0;
+    affineX[0] = affineX[1] = 0;
+    affineY[0] = affineY[1] = 0;
+    startFrame();
+    if (scheduler){
+        scheduler->schedule(Scheduler::HBLANK, scheduler->getCycles() + HDRAW_CYCLES);
+        scheduler->cancel(Scheduler::HDRAW);
+    }
+}
+inline void PPU::mapRegisters(){
+    memory->setIOHandler(0x4000004, &PPU::ioRead, &PPU::ioWrite, this);
+    memory->setIOHandler(0x4000006, &PPU::ioRead, &PPU::ioWrite, this);
+    for (uint32_t address = 0x4000028; address < 0x4000040; address += 2){
+        if ((address & 0xF) >= 8){
+            memory->setIOHandler(address, 0, &PPU::ioWrite, this);
+        }
+    }
+}
+inline uint16_t PPU::register16(uint32_t offset){
+    return memory->getIORegister(0x4000000 + offset);
+}
+inline uint16_t PPU::paletteColor(uint32_t index){
+    uint16_t color;
+    memcpy(&color, memory->getPalette() + index * 2, 2);
+    return color & 0x7FFF;
+}
+inline uint64_t PPU::getFrameCount(){
+    return frameCount;
+}
+inline void PPU::setScalarAffine(bool scalar){
+    this->scalarAffine = scalar;
+}
+inline void PPU::setAffineReference(const int32_t* x, const int32_t* y){
+    affineX[0] = x[0];
+    affineX[1] = x[1];
+    affineY[0] = y[0];
+    affineY[1] = y[1];
+}
+inline void PPU::loadFrame(const uint32_t* pixels){
+    memcpy(frame, pixels, sizeof(frame));
+}
+inline void PPU::setFrameSkip(uint32_t interval){
+    this->frameSkip = interval;
+}
+inline uint32_t PPU::getFrameSkip(){
+    return frameSkip;
+}
+inline void PPU::requestFrame(){
+    this->frameRequested = true;
+}
+inline uint64_t PPU::getDrawnFrameCount(){
+    return drawnFrames;
+}
+inline void PPU::saveState(State* state){
+    state->frameCount = frameCount;
+    state->vcount = vcount;
+    state->statusFlags = statusFlags;
+    memcpy(state->affineX, affineX, sizeof(affineX));
+    memcpy(state->affineY, affineY, sizeof(affineY));
+    state->drawing = drawing;
+}
+inline void PPU::loadState(const State* state){
+    frameCount = state->frameCount;
+    vcount = state->vcount;
+    statusFlags = state->statusFlags;
+    memcpy(affineX, state->affineX, sizeof(affineX));
+    memcpy(affineY, state->affineY, sizeof(affineY));
+    drawing = state->drawing;
+}
+inline bool PPU::isThreadedRendering(){
+    return renderThread != 0;
+}
+inline TileCache* PPU::getTileCache(){
+    return &tileCache;
+}
+inline OamCache* PPU::getOamCache(){
+    return &oamCache;
+}
+inline uint16_t PPU::getVCount(){
+    return vcount;
+}
+inline uint32_t PPU::toRGBA(uint16_t color){
+    uint32_t r = color & 31;
+    uint32_t g = (color >> 5) & 31;
+    uint32_t b = (color >> 10) & 31;
+    r = (r << 3) | (r >> 2);
+    g = (g << 3) | (g >> 2);
+    b = (b << 3) | (b >> 2);
+    return 0xFF000000 | (b << 16) | (g << 8) | r;
+}
+inline const uint32_t* PPU::getColorTable(){
+    struct ColorTable {
+        uint32_t colors[0x8000];
+        ColorTable(){
+            for (uint32_t color = 0; color < 0x8000; color++){
+                colors[color] = toRGBA(color);
+            }
+        }
+    };
+    static const ColorTable table;
+    return table.colors;
+}
+inline const uint32_t* PPU::getPaletteRGBA(){
+    if (renderThread){
+        //the palette dirty bits belong to the render thread now
+        return getThreadedPaletteRGBA();
+    }
+    uint64_t* dirty = memory->getPaletteDirty();
+    for (uint32_t word = 0; word < 512 / 64; word++){
+        while (dirty[word]){
+            uint32_t entry = word * 64 + __builtin_ctzll(dirty[word]);
+            dirty[word] &= dirty[word] - 1;
+            paletteRGBA[entry] = colorTable[paletteColor(entry)];
+        }
+    }
+    return paletteRGBA;
+}
+/*
+* TIMING
+*/
+inline void PPU::startHBlank(uint64_t cycle){
+    statusFlags |= HBLANK_FLAG;
+    if (register16(0x04) & HBLANK_IRQ){
+        interrupts->raise(Interrupts::HBLANK);
+    }
+    if (vcount < HEIGHT){
+        if (!drawing){
+            //nothing drawn, but the reference points move on as if it were
+            stepAffine();
+        } else if (renderThread){
+            submitLine(vcount);
+        } else {
+            renderLine(vcount);
+        }
+        dma->onHBlank();
+    }
+    scheduler->schedule(Scheduler::HDRAW, cycle + (LINE_CYCLES - HDRAW_CYCLES));
+}
+inline void PPU::startLine(uint64_t cycle){
+    statusFlags &= ~HBLANK_FLAG;
+    vcount = vcount + 1 == TOTAL_LINES ? 0 : vcount + 1;
+    uint16_t dispstat = register16(0x04);
+    if (vcount == 0){
+        startFrame();
+    }
+    if (vcount == HEIGHT){
+        statusFlags |= VBLANK_FLAG;
+        drawnFrames += drawing;
+        frameCount++;
+        reloadAffine();
+        if (dispstat & VBLANK_IRQ){
+            interrupts->raise(Interrupts::VBLANK);
+        }
+        dma->onVBlank();
+    }
+    if (vcount == TOTAL_LINES - 1){
+        statusFlags &= ~VBLANK_FLAG;
+    }
+    if (vcount == (dispstat >> 8)){
+        statusFlags |= VCOUNT_FLAG;
+        if (dispstat & VCOUNT_IRQ){
+            interrupts->raise(Interrupts::VCOUNT);
+        }
+    } else {
+        statusFlags &= ~VCOUNT_FLAG;
+    }
+    scheduler->schedule(Scheduler::HBLANK, cycle + HDRAW_CYCLES);
+}
+inline void PPU::startFrame(){
+    drawing = frameRequested || (frameSkip && frameCount % frameSkip == 0);
+    frameRequested = false;
+}
+inline void PPU::hblankEvent(void* context, uint64_t late){
+    PPU* self = (PPU*)context;
+    self->startHBlank(self->scheduler->getCycles() - late);
+}
+inline void PPU::hdrawEvent(void* context, uint64_t late){
+    PPU* self = (PPU*)context;
+    self->startLine(self->scheduler->getCycles() - late);
+}
+inline uint16_t PPU::ioRead(void* context, uint32_t address){
+    PPU* self = (PPU*)context;
+    if ((address & 0x3FF) == 0x06){
+        return self->vcount;
+    }
+    return (self->register16(0x04) & 0xFF38) | self->statusFlags;
+}
+inline void PPU::ioWrite(void* context, uint32_t address, uint16_t value){
+    //the register already holds value, what changes is read back from there
+    (void)value;
+    PPU* self = (PPU*)context;
+    uint32_t offset = address & 0x3FF;
+    if (offset >= 0x28){
+        //writing a reference point restarts it, even mid frame
+        uint8_t bg = offset >= 0x38;
+        uint32_t base = bg ? 0x38 : 0x28;
+        int32_t x = self->register16(base) | (self->register16(base + 2) << 16);
+        int32_t y = self->register16(base + 4) | (self->register16(base + 6) << 16);
+        //28 bit signed, shifted up unsigned so a negative point sign extends without overflowing
+        self->affineX[bg] = (int32_t)((uint32_t)x << 4) >> 4;
+        self->affineY[bg] = (int32_t)((uint32_t)y << 4) >> 4;
+    }
+}
+inline void PPU::reloadAffine(){
+    for (uint8_t bg = 0; bg < 2; bg++){
+        uint32_t base = bg ? 0x38 : 0x28;
+        int32_t x = register16(base) | (register16(base + 2) << 16);
+        int32_t y = register16(base + 4) | (register16(base + 6) << 16);
+        affineX[bg] = (int32_t)((uint32_t)x << 4) >> 4;
+        affineY[bg] = (int32_t)((uint32_t)y << 4) >> 4;
+    }
+}
+inline void PPU::stepAffine(){
+    //PB and PD move the reference point one line down
+    affineX[0] += (int16_t)register16(0x22);
+    affineY[0] += (int16_t)register16(0x26);
+    affineX[1] += (int16_t)register16(0x32);
+    affineY[1] += (int16_t)register16(0x36);
+}
+/*
+* RENDERING
+*/
+inline void PPU::renderFrame(){
+    reloadAffine();
+    for (uint8_t line = 0; line < HEIGHT; line++){
+        if (renderThread){
+            submitLine(line);
+        } else {
+            renderLine(line);
+        }
+    }
+}
+inline void PPU::renderLine(uint8_t line){
+    uint16_t dispcnt = register16(0x00);
+    uint32_t* out = frame + line * WIDTH;
+    if (dispcnt & (1 << 7)){
+        //forced blank shows white
+        for (int x = 0; x < WIDTH; x++){
+            out[x] = 0xFFFFFFFF;
+        }
+        stepAffine();
+        return;
+    }
+    uint8_t mode = dispcnt & 0b111;
+    //which backgrounds each mode has: text, text+affine, affine, bitmaps
+    static const uint8_t modeLayers[8] = {0xF, 0x7, 0xC, 0x4, 0x4, 0x4, 0, 0};
+    enabledLayers = ((dispcnt >> 8) & modeLayers[mode]) | ((dispcnt >> 8) & OBJ);
+    for (uint8_t bg = 0; bg < 4; bg++){
+        bgPriority[bg] = register16(0x08 + bg * 2) & 0b11;
+        if (!(enabledLayers & (1 << bg))){
+            continue;
+        }
+        if (mode >= 3){
+            renderBitmapBackground(mode);
+        } else if (mode == 0 || (mode == 1 && bg < 2)){
+            renderTextBackground(bg, line);
+        } else {
+            renderAffineBackground(bg);
+        }
+    }
+    for (int x = 0; x < WIDTH; x++){
+        objPriority[x] = 4;
+        objWindow[x] = 0;
+    }
+    if (enabledLayers & OBJ){
+        renderSprites(line);
+    }
+    buildWindows(line);
+    backdrop = paletteColor(0);
+    compose(out);
+    stepAffine();
+}
+inline void PPU::renderTextBackground(uint8_t bg, uint8_t line){
+    uint16_t control = register16(0x08 + bg * 2);
+    uint16_t hofs = register16(0x10 + bg * 4) & 0x1FF;
+    uint16_t vofs = register16(0x12 + bg * 4) & 0x1FF;
+    const uint8_t* vram = memory->getVram();
+    uint32_t tileBase = ((control >> 2) & 0b11) * 0x4000;
+    uint32_t mapBase = ((control >> 8) & 0x1F) * 0x800;
+    bool colors256 = control & (1 << 7);
+    uint8_t size = control >> 14;
+    uint32_t width = (size & 1) ? 512 : 256;
+    uint32_t height = (size & 2) ? 512 : 256;
+    uint32_t y = (line + vofs) & (height - 1);
+    //the line starts mid tile, render whole tiles from hofs & ~7 into the slack on the left
+    uint16_t* start = bgLines[bg] + 8 - (hofs & 7);
+    bgLine[bg] = bgLines[bg] + 8;
+    const uint8_t* palette = memory->getPalette();
+    for (uint32_t tile = 0; tile < 31; tile++){
+        uint32_t x = ((hofs & ~7) + tile * 8) & (width - 1);
+        //maps wider or taller than 256 are extra 32x32 screen blocks laid out after each other
+        uint32_t block = (x >> 8) + ((y >> 8) * (width >> 8));
+        uint32_t entryAddress = mapBase + block * 0x800 + ((y >> 3) & 31) * 64 + ((x >> 3) & 31) * 2;
+        uint16_t entry;
+        memcpy(&entry, vram + (entryAddress & 0xFFFF), 2);
+        uint32_t row = (entry & (1 << 11)) ? 7 - (y & 7) : y & 7;
+        const uint8_t* data;
+        uint32_t bank;
+        if (colors256){
+            data = vram + ((tileBase + (entry & 0x3FF) * 64 + row * 8) & 0xFFFF);
+            bank = 0;
+        } else {
+            data = tileCache.getTile(((tileBase + (entry & 0x3FF) * 32) & 0xFFFF) >> 5) + row * 8;
+            bank = (entry >> 12) * 16;
+        }
+        uint16_t* pixels = start + tile * 8;
+#ifdef __AVX2__
+        //the row's 8 colors gathered at once like the affine path; bank + index is at most
+        //255 either way so the gathers stay inside palette RAM
+        __m128i row8 = _mm_loadl_epi64((const __m128i*)data);
+        if (entry & (1 << 10)){
+            row8 = _mm_shuffle_epi8(row8, _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 8, 9, 10, 11, 12, 13, 14, 15));
+        }
+        __m256i indices = _mm256_cvtepu8_epi32(row8);
+        __m256i color = _mm256_i32gather_epi32((const int*)palette, _mm256_add_epi32(indices, _mm256_set1_epi32(bank)), 2);
+        color = _mm256_or_si256(_mm256_and_si256(color, _mm256_set1_epi32(0x7FFF)), _mm256_set1_epi32(0x8000));
+        color = _mm256_andnot_si256(_mm256_cmpeq_epi32(indices, _mm256_setzero_si256()), color);
+        _mm_storeu_si128((__m128i*)pixels, _mm_packus_epi32(_mm256_castsi256_si128(color), _mm256_extracti128_si256(color, 1)));
+#else
+        //one flipped copy of the row instead of a flip test per pixel
+        uint8_t flipped[8];
+        if (entry & (1 << 10)){
+            for (int i = 0; i < 8; i++){
+                flipped[i] = data[7 - i];
+            }
+            data = flipped;
+        }
+        //index 0 is transparent, a select rather than a branch on random tile data;
+        //the palette is read in place as paletteColor() does, bit 15 becomes the opaque flag
+        for (int i = 0; i < 8; i++){
+            uint8_t index = data[i];
+            uint16_t color;
+            memcpy(&color, palette + (bank + index) * 2, 2);
+            pixels[i] = index ? color | 0x8000 : 0;
+        }
+#endif
+    }
+}
+inline void PPU::affineLine(int32_t x, int32_t y, int32_t pa, int32_t pc, int32_t count,
+        int32_t width, int32_t height, bool wrap, int32_t* tx, int32_t* ty){
+    //texel i is ((x + pa * i) >> 8, (y + pc * i) >> 8), wrapped (power of two sizes) or -1 in tx when off the edge
+    int32_t i = 0;
+    if (!scalarAffine){
+#if defined(__AVX2__)
+        __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        __m256i vx = _mm256_add_epi32(_mm256_set1_epi32(x), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(pa)));
+        __m256i vy = _mm256_add_epi32(_mm256_set1_epi32(y), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(pc)));
+        const __m256i stepX = _mm256_set1_epi32(pa * 8);
+        const __m256i stepY = _mm256_set1_epi32(pc * 8);
+        const __m256i minusOne = _mm256_set1_epi32(-1);
+        const __m256i widths = _mm256_set1_epi32(width);
+        const __m256i heights = _mm256_set1_epi32(height);
+        for (; i + 8 <= count; i += 8){
+            __m256i u = _mm256_srai_epi32(vx, 8);
+            __m256i v = _mm256_srai_epi32(vy, 8);
+            if (wrap){
+                u = _mm256_and_si256(u, _mm256_set1_epi32(width - 1));
+                v = _mm256_and_si256(v, _mm256_set1_epi32(height - 1));
+            } else {
+                __m256i inside = _mm256_and_si256(
+                    _mm256_and_si256(_mm256_cmpgt_epi32(u, minusOne), _mm256_cmpgt_epi32(widths, u)),
+                    _mm256_and_si256(_mm256_cmpgt_epi32(v, minusOne), _mm256_cmpgt_epi32(heights, v)));
+                u = _mm256_or_si256(_mm256_and_si256(inside, u), _mm256_andnot_si256(inside, minusOne));
+            }
+            _mm256_storeu_si256((__m256i*)(tx + i), u);
+            _mm256_storeu_si256((__m256i*)(ty + i), v);
+            vx = _mm256_add_epi32(vx, stepX);
+            vy = _mm256_add_epi32(vy, stepY);
+        }
+#elif defined(__SSE2__)
+        __m128i vx = _mm_setr_epi32(x, x + pa, x + pa * 2, x + pa * 3);
+        __m128i vy = _mm_setr_epi32(y, y + pc, y + pc * 2, y + pc * 3);
+        const __m128i stepX = _mm_set1_epi32(pa * 4);
+        const __m128i stepY = _mm_set1_epi32(pc * 4);
+        const __m128i minusOne = _mm_set1_epi32(-1);
+        const __m128i widths = _mm_set1_epi32(width);
+        const __m128i heights = _mm_set1_epi32(height);
+        for (; i + 4 <= count; i += 4){
+            __m128i u = _mm_srai_epi32(vx, 8);
+            __m128i v = _mm_srai_epi32(vy, 8);
+            if (wrap){
+                u = _mm_and_si128(u, _mm_set1_epi32(width - 1));
+                v = _mm_and_si128(v, _mm_set1_epi32(height - 1));
+            } else {
+                __m128i inside = _mm_and_si128(
+                    _mm_and_si128(_mm_cmpgt_epi32(u, minusOne), _mm_cmpgt_epi32(widths, u)),
+                    _mm_and_si128(_mm_cmpgt_epi32(v, minusOne), _mm_cmpgt_epi32(heights, v)));
+                u = _mm_or_si128(_mm_and_si128(inside, u), _mm_andnot_si128(inside, minusOne));
+            }
+            _mm_storeu_si128((__m128i*)(tx + i), u);
+            _mm_storeu_si128((__m128i*)(ty + i), v);
+            vx = _mm_add_epi32(vx, stepX);
+            vy = _mm_add_epi32(vy, stepY);
+        }
+#endif
+    }
+    for (; i < count; i++){
+        int32_t u = (x + pa * i) >> 8;
+        int32_t v = (y + pc * i) >> 8;
+        if (wrap){
+            u &= width - 1;
+            v &= height - 1;
+        } else if (u < 0 || u >= width || v < 0 || v >= height){
+            u = -1;
+        }
+        tx[i] = u;
+        ty[i] = v;
+    }
+}
+inline void PPU::renderAffineBackground(uint8_t bg){
+    uint16_t control = register16(0x08 + bg * 2);
+    uint8_t index = bg - 2;
+    int16_t pa = register16(index ? 0x30 : 0x20);
+    int16_t pc = register16(index ? 0x34 : 0x24);
+    const uint8_t* vram = memory->getVram();
+    uint32_t tileBase = ((control >> 2) & 0b11) * 0x4000;
+    uint32_t mapBase = ((control >> 8) & 0x1F) * 0x800;
+    bool wrap = control & (1 << 13);
+    uint32_t size = 128 << (control >> 14);
+    uint16_t* out = bgLine[bg] = bgLines[bg] + 8;
+    int32_t x = affineX[index];
+    int32_t y = affineY[index];
+    int32_t i = 0;
+#ifdef __AVX2__
+    if (!scalarAffine){
+        //map entry, tile pixel and palette color gathered 8 at a time. Addresses are masked to
+        //64K like the scalar path so every 4 byte gather stays inside VRAM, and 8bpp colors
+        //are at most entry 255 so palette gathers stay inside palette RAM
+        const uint8_t* palette = memory->getPalette();
+        __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        __m256i vx = _mm256_add_epi32(_mm256_set1_epi32(x), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(pa)));
+        __m256i vy = _mm256_add_epi32(_mm256_set1_epi32(y), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(pc)));
+        const __m256i stepX = _mm256_set1_epi32(pa * 8);
+        const __m256i stepY = _mm256_set1_epi32(pc * 8);
+        const __m256i minusOne = _mm256_set1_epi32(-1);
+        const __m256i sizes = _mm256_set1_epi32(size);
+        const __m256i sizeMask = _mm256_set1_epi32(size - 1);
+        const __m256i seven = _mm256_set1_epi32(7);
+        const __m256i low8 = _mm256_set1_epi32(0xFF);
+        const __m256i vramMask = _mm256_set1_epi32(0xFFFF);
+        const __m256i mapBases = _mm256_set1_epi32(mapBase);
+        const __m256i tileBases = _mm256_set1_epi32(tileBase);
+        //map rows are size / 8 entries, size is 128 << n
+        const __m128i rowShift = _mm_cvtsi32_si128(4 + (control >> 14));
+        for (; i < WIDTH; i += 8){
+            __m256i u = _mm256_srai_epi32(vx, 8);
+            __m256i v = _mm256_srai_epi32(vy, 8);
+            __m256i inside = minusOne;
+            if (wrap){
+                u = _mm256_and_si256(u, sizeMask);
+                v = _mm256_and_si256(v, sizeMask);
+            } else {
+                inside = _mm256_and_si256(
+                    _mm256_and_si256(_mm256_cmpgt_epi32(u, minusOne), _mm256_cmpgt_epi32(sizes, u)),
+                    _mm256_and_si256(_mm256_cmpgt_epi32(v, minusOne), _mm256_cmpgt_epi32(sizes, v)));
+            }
+            __m256i mapAddress = _mm256_add_epi32(_mm256_sll_epi32(_mm256_srai_epi32(v, 3), rowShift), _mm256_srai_epi32(u, 3));
+            mapAddress = _mm256_and_si256(_mm256_add_epi32(mapBases, mapAddress), vramMask);
+            __m256i tile = _mm256_and_si256(_mm256_i32gather_epi32((const int*)vram, mapAddress, 1), low8);
+            __m256i pixel = _mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(v, seven), 3), _mm256_and_si256(u, seven));
+            __m256i pixelAddress = _mm256_add_epi32(_mm256_add_epi32(tileBases, _mm256_slli_epi32(tile, 6)), pixel);
+            pixelAddress = _mm256_and_si256(pixelAddress, vramMask);
+            __m256i colorIndex = _mm256_and_si256(_mm256_i32gather_epi32((const int*)vram, pixelAddress, 1), low8);
+            __m256i color = _mm256_and_si256(_mm256_i32gather_epi32((const int*)palette, colorIndex, 2), _mm256_set1_epi32(0x7FFF));
+            __m256i visible = _mm256_andnot_si256(_mm256_cmpeq_epi32(colorIndex, _mm256_setzero_si256()), inside);
+            color = _mm256_and_si256(_mm256_or_si256(color, _mm256_set1_epi32(0x8000)), visible);
+            __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(color), _mm256_extracti128_si256(color, 1));
+            _mm_storeu_si128((__m128i*)(out + i), packed);
+            vx = _mm256_add_epi32(vx, stepX);
+            vy = _mm256_add_epi32(vy, stepY);
+        }
+    }
+#endif
+    if (i == WIDTH){
+        return;
+    }
+    int32_t tx[WIDTH];
+    int32_t ty[WIDTH];
+    affineLine(x, y, pa, pc, WIDTH, size, size, wrap, tx, ty);
+    for (; i < WIDTH; i++){
+        if (tx[i] < 0){
+            out[i] = 0;
+            continue;
+        }
+        uint8_t tile = vram[(mapBase + (ty[i] >> 3) * (size >> 3) + (tx[i] >> 3)) & 0xFFFF];
+        uint8_t color = vram[(tileBase + tile * 64 + (ty[i] & 7) * 8 + (tx[i] & 7)) & 0xFFFF];
+        out[i] = color ? paletteColor(color) | 0x8000 : 0;
+    }
+}
+inline void PPU::renderBitmapBackground(uint8_t mode){
+    //bitmaps are BG2 sampled through its affine transform
+    int16_t pa = register16(0x20);
+    int16_t pc = register16(0x24);
+    const uint8_t* vram = memory->getVram();
+    uint32_t page = (register16(0x00) & (1 << 4)) ? 0xA000 : 0;
+    int32_t width = mode == 5 ? 160 : 240;
+    int32_t height = mode == 5 ? 128 : 160;
+    uint16_t* out = bgLine[2] = bgLines[2] + 8;
+    int32_t tx[WIDTH];
+    int32_t ty[WIDTH];
+    affineLine(affineX[0], affineY[0], pa, pc, WIDTH, width, height, false, tx, ty);
+    for (int i = 0; i < WIDTH; i++){
+        if (tx[i] < 0){
+            out[i] = 0;
+            continue;
+        }
+        if (mode == 4){
+            uint8_t color = vram[page + ty[i] * width + tx[i]];
+            out[i] = color ? paletteColor(color) | 0x8000 : 0;
+            continue;
+        }
+        uint16_t color;
+        memcpy(&color, vram + (mode == 5 ? page : 0) + (ty[i] * width + tx[i]) * 2, 2);
+        out[i] = color | 0x8000;
+    }
+}
+inline void PPU::renderSprites(uint8_t line){
+    const uint8_t* oam = memory->getOam();
+    const uint8_t* vram = memory->getVram();
+    uint16_t dispcnt = register16(0x00);
+    bool mapping1D = dispcnt & (1 << 6);
+    bool bitmapMode = (dispcnt & 0b111) >= 3;
+    oamCache.update();
+    const OamCache& sprites = oamCache;
+    uint32_t count;
+    const uint8_t* lineSprites = oamCache.getLine(line, &count);
+#ifdef __AVX2__
+    //the OBJ tiles brought up to date once for the line, the SIMD path gathers straight from them
+    const uint8_t* objTiles = count && !scalarAffine ? tileCache.getTiles(0x800, 0x400) : 0;
+    const uint8_t* palette = memory->getPalette();
+#endif
+    for (uint32_t i = 0; i < count; i++){
+        uint8_t sprite = lineSprites[i];
+        uint8_t spriteFlags = sprites.flags[sprite];
+        uint8_t objMode = sprites.mode[sprite];
+        bool affine = spriteFlags & OamCache::AFFINE;
+        bool colors256 = spriteFlags & OamCache::COLORS_256;
+        uint32_t baseTile = sprites.tile[sprite];
+        if (bitmapMode && baseTile < 512){
+            continue;
+        }
+        int32_t x = sprites.x[sprite];
+        int32_t y = sprites.y[sprite];
+        int32_t width = sprites.width[sprite];
+        int32_t height = sprites.height[sprite];
+        int32_t boxWidth = sprites.boxWidth[sprite];
+        int32_t boxHeight = sprites.boxHeight[sprite];
+        uint16_t priority = sprites.priority[sprite];
+        uint32_t bank = 0x100 + sprites.paletteBank[sprite] * 16;
+        int16_t pa = 0x100, pb = 0, pc = 0, pd = 0x100;
+        if (affine){
+            uint32_t group = sprites.affineIndex[sprite] * 32;
+            memcpy(&pa, oam + group + 6, 2);
+            memcpy(&pb, oam + group + 14, 2);
+            memcpy(&pc, oam + group + 22, 2);
+            memcpy(&pd, oam + group + 30, 2);
+        }
+        bool hflip = spriteFlags & OamCache::HFLIP;
+        bool vflip = spriteFlags & OamCache::VFLIP;
+        uint32_t rowTiles = mapping1D ? (width >> 3) * (colors256 ? 2 : 1) : 32;
+        int32_t start = x < 0 ? 0 : x;
+        int32_t end = x + boxWidth > WIDTH ? WIDTH : x + boxWidth;
+        uint16_t flags = objMode == 1 ? OBJ | SEMI_TRANSPARENT : OBJ;
+        //affine sprites rotate around their center, texture coordinates are 8.8 and step
+        //by PA/PC along the line. Regular ones are the identity, one row straight across,
+        //so they skip working out texels they can just count
+        int32_t texels[2][WIDTH];
+        if (affine){
+            int32_t dx = start - (x + boxWidth / 2);
+            int32_t dy = line - (y + boxHeight / 2);
+            affineLine(pa * dx + pb * dy + (width << 7), pc * dx + pd * dy + (height << 7), pa, pc,
+                end - start, width, height, false, texels[0], texels[1]);
+        }
+        int32_t px = start;
+#ifdef __AVX2__
+        if (objTiles){
+            //8 pixels at a time: texel, tile, index and color gathered, then the opaque ones that win
+            //on priority blended into the OBJ line. Gathers read the aligned word holding what they want
+            //and shift it down, so none of them reads past the end of VRAM, the tiles or the palette
+            const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+            const __m256i seven = _mm256_set1_epi32(7);
+            const __m256i low8 = _mm256_set1_epi32(0xFF);
+            const __m256i wordMask = _mm256_set1_epi32(~3);
+            const __m256i three = _mm256_set1_epi32(3);
+            const __m256i zero = _mm256_setzero_si256();
+            const __m256i priorities = _mm256_set1_epi32(priority);
+            for (; px + 8 <= end; px += 8){
+                __m256i tx;
+                __m256i ty;
+                __m256i draw = _mm256_set1_epi32(-1);
+                if (affine){
+                    tx = _mm256_loadu_si256((const __m256i*)(texels[0] + px - start));
+                    ty = _mm256_loadu_si256((const __m256i*)(texels[1] + px - start));
+                    draw = _mm256_cmpgt_epi32(tx, _mm256_set1_epi32(-1));
+                } else {
+                    tx = _mm256_add_epi32(_mm256_set1_epi32(px - x), lanes);
+                    ty = _mm256_set1_epi32(line - y);
+                }
+                if (objMode != 2){
+                    __m256i current = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(objPriority + px)));
+                    draw = _mm256_and_si256(draw, _mm256_cmpgt_epi32(current, priorities));
+                }
+                if (_mm256_testz_si256(draw, draw)){
+                    continue;
+                }
+                if (hflip){
+                    tx = _mm256_sub_epi32(_mm256_set1_epi32(width - 1), tx);
+                }
+                if (vflip){
+                    ty = _mm256_sub_epi32(_mm256_set1_epi32(height - 1), ty);
+                }
+                //texels off the sprite are garbage here, masking keeps their gathers in range
+                __m256i tile = _mm256_add_epi32(_mm256_set1_epi32(baseTile), _mm256_mullo_epi32(_mm256_srai_epi32(ty, 3), _mm256_set1_epi32(rowTiles)));
+                tile = _mm256_add_epi32(tile, _mm256_slli_epi32(_mm256_srai_epi32(tx, 3), colors256 ? 1 : 0));
+                tile = _mm256_and_si256(tile, _mm256_set1_epi32(0x3FF));
+                __m256i pixel = _mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(ty, seven), 3), _mm256_and_si256(tx, seven));
+                __m256i address;
+                __m256i index;
+                __m256i entry;
+                if (colors256){
+                    address = _mm256_add_epi32(_mm256_add_epi32(_mm256_set1_epi32(0x10000), _mm256_slli_epi32(tile, 5)), pixel);
+                    address = _mm256_and_si256(address, _mm256_set1_epi32(0x17FFF));
+                    index = _mm256_i32gather_epi32((const int*)vram, _mm256_and_si256(address, wordMask), 1);
+                } else {
+                    address = _mm256_add_epi32(_mm256_slli_epi32(_mm256_add_epi32(tile, _mm256_set1_epi32(0x800)), 6), pixel);
+                    index = _mm256_i32gather_epi32((const int*)objTiles, _mm256_and_si256(address, wordMask), 1);
+                }
+                index = _mm256_and_si256(_mm256_srlv_epi32(index, _mm256_slli_epi32(_mm256_and_si256(address, three), 3)), low8);
+                draw = _mm256_andnot_si256(_mm256_cmpeq_epi32(index, zero), draw);
+                uint32_t mask = _mm256_movemask_ps(_mm256_castsi256_ps(draw));
+                if (!mask){
+                    continue;
+                }
+                if (objMode == 2){
+                    for (; mask; mask &= mask - 1){
+                        objWindow[px + __builtin_ctz(mask)] = 1;
+                    }
+                    continue;
+                }
+                entry = _mm256_add_epi32(index, _mm256_set1_epi32(colors256 ? 0x100 : bank));
+                __m256i color = _mm256_i32gather_epi32((const int*)palette, _mm256_slli_epi32(_mm256_srli_epi32(entry, 1), 2), 1);
+                color = _mm256_srlv_epi32(color, _mm256_slli_epi32(_mm256_and_si256(entry, _mm256_set1_epi32(1)), 4));
+                color = _mm256_or_si256(_mm256_and_si256(color, _mm256_set1_epi32(0x7FFF)), _mm256_set1_epi32(0x8000));
+                __m128i draw16 = _mm_packs_epi32(_mm256_castsi256_si128(draw), _mm256_extracti128_si256(draw, 1));
+                __m128i color16 = _mm_packus_epi32(_mm256_castsi256_si128(color), _mm256_extracti128_si256(color, 1));
+                __m128i* lineOut = (__m128i*)(objLine + px);
+                __m128i* priorityOut = (__m128i*)(objPriority + px);
+                __m128i* flagsOut = (__m128i*)(objFlags + px);
+                _mm_storeu_si128(lineOut, _mm_blendv_epi8(_mm_loadu_si128(lineOut), color16, draw16));
+                _mm_storeu_si128(priorityOut, _mm_blendv_epi8(_mm_loadu_si128(priorityOut), _mm_set1_epi16(priority), draw16));
+                _mm_storeu_si128(flagsOut, _mm_blendv_epi8(_mm_loadu_si128(flagsOut), _mm_set1_epi16(flags), draw16));
+            }
+        }
+#endif
+        uint32_t lastTile = ~0u;
+        const uint8_t* tileData = 0;
+        for (; px < end; px++){
+            //lower OAM index wins ties, so only a strictly better priority can replace a pixel
+            if (objMode != 2 && priority >= objPriority[px]){
+                continue;
+            }
+            int32_t tx = px - x;
+            int32_t ty = line - y;
+            if (affine){
+                tx = texels[0][px - start];
+                ty = texels[1][px - start];
+                if (tx < 0){
+                    continue;
+                }
+            }
+            if (hflip){
+                tx = width - 1 - tx;
+            }
+            if (vflip){
+                ty = height - 1 - ty;
+            }
+            uint32_t tile = (baseTile + (ty >> 3) * rowTiles + (tx >> 3) * (colors256 ? 2 : 1)) & 0x3FF;
+            uint16_t color;
+            if (colors256){
+                uint8_t index = vram[(0x10000 + tile * 32 + (ty & 7) * 8 + (tx & 7)) & 0x17FFF];
+                if (!index){
+                    continue;
+                }
+                color = paletteColor(0x100 + index);
+            } else {
+                //neighbouring pixels mostly share a tile, only go to the cache when it changes
+                if (tile != lastTile){
+                    tileData = tileCache.getTile(0x800 + tile);
+                    lastTile = tile;
+                }
+                uint8_t index = tileData[(ty & 7) * 8 + (tx & 7)];
+                if (!index){
+                    continue;
+                }
+                color = paletteColor(bank + index);
+            }
+            if (objMode == 2){
+                objWindow[px] = 1;
+                continue;
+            }
+            objPriority[px] = priority;
+            objLine[px] = color | 0x8000;
+            objFlags[px] = flags;
+        }
+    }
+}
+inline void PPU::buildWindows(uint8_t line){
+    uint16_t dispcnt = register16(0x00);
+    if (!(dispcnt & 0xE000)){
+        for (int x = 0; x < WIDTH; x++){
+            windowMask[x] = 0x3F;
+        }
+        return;
+    }
+    uint16_t winIn = register16(0x48);
+    uint16_t winOut = register16(0x4A);
+    for (int x = 0; x < WIDTH; x++){
+        windowMask[x] = winOut & 0x3F;
+    }
+    if (dispcnt & (1 << 15)){
+        for (int x = 0; x < WIDTH; x++){
+            if (objWindow[x]){
+                windowMask[x] = (winOut >> 8) & 0x3F;
+            }
+        }
+    }
+    //WIN1 first so WIN0 overrides it
+    for (int window = 1; window >= 0; window--){
+        if (!(dispcnt & (1 << (13 + window)))){
+            continue;
+        }
+        uint16_t horizontal = register16(0x40 + window * 2);
+        uint16_t vertical = register16(0x44 + window * 2);
+        uint8_t top = vertical >> 8, bottom = vertical & 0xFF;
+        bool insideY = top <= bottom ? line >= top && line < bottom : line >= top || line < bottom;
+        if (!insideY){
+            continue;
+        }
+        uint8_t left = horizontal >> 8, right = horizontal & 0xFF;
+        uint16_t enable = (winIn >> (window * 8)) & 0x3F;
+        for (int x = 0; x < WIDTH; x++){
+            bool insideX = left <= right ? x >= left && x < right : x >= left || x < right;
+            if (insideX){
+                windowMask[x] = enable;
+            }
+        }
+    }
+}
+/*
+* COMPOSITION
+*   Layers are applied back to front: priority 3 to 0, inside a priority BG3
+*   down to BG0 then OBJ, so whatever is applied last is on top. Applying a
+*   layer pushes the old top down to second where the layer is opaque and the
+*   window lets it through.
+*/
+inline void PPU::composeScalar(uint32_t* out){
+    uint16_t blendControl = register16(0x50);
+    uint16_t alpha = register16(0x52);
+    uint16_t eva = (alpha & 0x1F) > 16 ? 16 : alpha & 0x1F;
+    uint16_t evb = ((alpha >> 8) & 0x1F) > 16 ? 16 : (alpha >> 8) & 0x1F;
+    uint16_t evy = (register16(0x54) & 0x1F) > 16 ? 16 : register16(0x54) & 0x1F;
+    uint8_t effect = (blendControl >> 6) & 0b11;
+    for (int x = 0; x < WIDTH; x++){
+        uint16_t top = backdrop, second = backdrop;
+        uint16_t topId = BACKDROP, secondId = BACKDROP;
+        for (int priority = 3; priority >= 0; priority--){
+            for (int bg = 3; bg >= 0; bg--){
+                if (!(enabledLayers & (1 << bg)) || bgPriority[bg] != priority){
+                    continue;
+                }
+                uint16_t pixel = bgLine[bg][x];
+                if ((pixel & 0x8000) && (windowMask[x] & (1 << bg))){
+                    second = top;
+                    secondId = topId;
+                    top = pixel & 0x7FFF;
+                    topId = 1 << bg;
+                }
+            }
+            if (objPriority[x] == priority && (windowMask[x] & OBJ)){
+                second = top;
+                secondId = topId;
+                top = objLine[x] & 0x7FFF;
+                topId = objFlags[x];
+            }
+        }
+        bool effects = windowMask[x] & 0x20;
+        bool first = topId & blendControl & 0x3F;
+        bool secondTarget = secondId & (blendControl >> 8) & 0x3F;
+        uint16_t color = top;
+        if (effects && secondTarget && ((topId & SEMI_TRANSPARENT) || (effect == 1 && first))){
+            uint16_t result = 0;
+            for (int shift = 0; shift < 15; shift += 5){
+                uint16_t channel = (((top >> shift) & 31) * eva + ((second >> shift) & 31) * evb) >> 4;
+                result |= (channel > 31 ? 31 : channel) << shift;
+            }
+            color = result;
+        } else if (effects && first && effect >= 2){
+            uint16_t result = 0;
+            for (int shift = 0; shift < 15; shift += 5){
+                uint16_t channel = (top >> shift) & 31;
+                channel = effect == 2 ? channel + (((31 - channel) * evy) >> 4) : channel - ((channel * evy) >> 4);
+                result |= channel << shift;
+            }
+            color = result;
+        }
+        out[x] = colorTable[color];
+    }
+}
+#if defined(__AVX2__)
+//16 pixels a step
+typedef __m256i PixelVector;
+#define PIXELS_PER_STEP 16
+#define VLOAD(p) _mm256_loadu_si256((const __m256i*)(p))
+#define VSTORE(p, v) _mm256_storeu_si256((__m256i*)(p), v)
+#define VSET(x) _mm256_set1_epi16((short)(x))
+#define VAND(a, b) _mm256_and_si256(a, b)
+#define VOR(a, b) _mm256_or_si256(a, b)
+#define VANDNOT(a, b) _mm256_andnot_si256(a, b)
+#define VCMPEQ(a, b) _mm256_cmpeq_epi16(a, b)
+#define VSRAI(a, n) _mm256_srai_epi16(a, n)
+#define VSRLI(a, n) _mm256_srli_epi16(a, n)
+#define VSLLI(a, n) _mm256_slli_epi16(a, n)
+#define VADD(a, b) _mm256_add_epi16(a, b)
+#define VSUB(a, b) _mm256_sub_epi16(a, b)
+#define VMUL(a, b) _mm256_mullo_epi16(a, b)
+#define VMIN(a, b) _mm256_min_epi16(a, b)
+#define VZERO() _mm256_setzero_si256()
+#elif defined(__SSE2__)
+//8 pixels a step
+typedef __m128i PixelVector;
+#define PIXELS_PER_STEP 8
+#define VLOAD(p) _mm_loadu_si128((const __m128i*)(p))
+#define VSTORE(p, v) _mm_storeu_si128((__m128i*)(p), v)
+#define VSET(x) _mm_set1_epi16((short)(x))
+#define VAND(a, b) _mm_and_si128(a, b)
+#define VOR(a, b) _mm_or_si128(a, b)
+#define VANDNOT(a, b) _mm_andnot_si128(a, b)
+#define VCMPEQ(a, b) _mm_cmpeq_epi16(a, b)
+#define VSRAI(a, n) _mm_srai_epi16(a, n)
+#define VSRLI(a, n) _mm_srli_epi16(a, n)
+#define VSLLI(a, n) _mm_slli_epi16(a, n)
+#define VADD(a, b) _mm_add_epi16(a, b)
+#define VSUB(a, b) _mm_sub_epi16(a, b)
+#define VMUL(a, b) _mm_mullo_epi16(a, b)
+#define VMIN(a, b) _mm_min_epi16(a, b)
+#define VZERO() _mm_setzero_si128()
+#endif
+#ifdef PIXELS_PER_STEP
+//mask ? a : b
+#define VSELECT(mask, a, b) VOR(VAND(mask, a), VANDNOT(mask, b))
+#endif
+inline void PPU::compose(uint32_t* out){
+#ifndef PIXELS_PER_STEP
+    composeScalar(out);
+#else
+    uint16_t blendControl = register16(0x50);
+    uint16_t alpha = register16(0x52);
+    uint16_t eva = (alpha & 0x1F) > 16 ? 16 : alpha & 0x1F;
+    uint16_t evb = ((alpha >> 8) & 0x1F) > 16 ? 16 : (alpha >> 8) & 0x1F;
+    uint16_t evy = (register16(0x54) & 0x1F) > 16 ? 16 : register16(0x54) & 0x1F;
+    uint8_t effect = (blendControl >> 6) & 0b11;
+    //the order layers get applied in never changes within a line, work it out once
+    int8_t order[20];
+    int layerCount = 0;
+    for (int priority = 3; priority >= 0; priority--){
+        for (int bg = 3; bg >= 0; bg--){
+            if ((enabledLayers & (1 << bg)) && bgPriority[bg] == priority){
+                order[layerCount++] = bg;
+            }
+        }
+        if (enabledLayers & OBJ){
+            order[layerCount++] = 4 + priority;
+        }
+    }
+    const PixelVector zero = VZERO();
+    const PixelVector low5 = VSET(31);
+    const PixelVector target1 = VSET(blendControl & 0x3F);
+    const PixelVector target2 = VSET((blendControl >> 8) & 0x3F);
+    const PixelVector semi = VSET(SEMI_TRANSPARENT);
+    const PixelVector alphaBlend = VSET(effect == 1 ? 0xFFFF : 0);
+    const PixelVector brightness = VSET(effect >= 2 ? 0xFFFF : 0);
+    for (int x = 0; x < WIDTH; x += PIXELS_PER_STEP){
+        PixelVector top = VSET(backdrop);
+        PixelVector second = top;
+        PixelVector topId = VSET(BACKDROP);
+        PixelVector secondId = topId;
+        PixelVector window = VLOAD(windowMask + x);
+        for (int i = 0; i < layerCount; i++){
+            PixelVector pixels;
+            PixelVector ids;
+            PixelVector visible;
+            if (order[i] < 4){
+                uint16_t bit = 1 << order[i];
+                pixels = VLOAD(bgLine[order[i]] + x);
+                ids = VSET(bit);
+                visible = VAND(VSRAI(pixels, 15), VCMPEQ(VAND(window, ids), ids));
+            } else {
+                pixels = VLOAD(objLine + x);
+                ids = VLOAD(objFlags + x);
+                PixelVector objBit = VSET(OBJ);
+                visible = VAND(VCMPEQ(VLOAD(objPriority + x), VSET(order[i] - 4)), VCMPEQ(VAND(window, objBit), objBit));
+            }
+            second = VSELECT(visible, top, second);
+            secondId = VSELECT(visible, topId, secondId);
+            top = VSELECT(visible, VAND(pixels, VSET(0x7FFF)), top);
+            topId = VSELECT(visible, ids, topId);
+        }
+        PixelVector effects = VCMPEQ(VAND(window, VSET(0x20)), VSET(0x20));
+        PixelVector first = VANDNOT(VCMPEQ(VAND(topId, target1), zero), effects);
+        PixelVector secondTarget = VANDNOT(VCMPEQ(VAND(secondId, target2), zero), effects);
+        PixelVector isSemi = VANDNOT(VCMPEQ(VAND(topId, semi), zero), VSET(0xFFFF));
+        PixelVector blendMask = VAND(secondTarget, VOR(VAND(isSemi, effects), VAND(first, alphaBlend)));
+        PixelVector brightMask = VANDNOT(blendMask, VAND(first, brightness));
+        //per channel: min(31, (a * eva + b * evb) >> 4) and the brighten/darken step
+        PixelVector blended = zero;
+        PixelVector adjusted = zero;
+        for (int shift = 0; shift < 15; shift += 5){
+            PixelVector a = VAND(shift ? VSRLI(top, shift) : top, low5);
+            PixelVector b = VAND(shift ? VSRLI(second, shift) : second, low5);
+            PixelVector mix = VMIN(VSRLI(VADD(VMUL(a, VSET(eva)), VMUL(b, VSET(evb))), 4), low5);
+            PixelVector step = effect == 2 ? VADD(a, VSRLI(VMUL(VSUB(low5, a), VSET(evy)), 4))
+                : VSUB(a, VSRLI(VMUL(a, VSET(evy)), 4));
+            blended = VOR(blended, shift ? VSLLI(mix, shift) : mix);
+            adjusted = VOR(adjusted, shift ? VSLLI(step, shift) : step);
+        }
+        PixelVector color = VSELECT(blendMask, blended, VSELECT(brightMask, adjusted, top));
+#ifdef __AVX2__
+        __m256i low = _mm256_cvtepu16_epi32(_mm256_castsi256_si128(color));
+        __m256i high = _mm256_cvtepu16_epi32(_mm256_extracti128_si256(color, 1));
+        _mm256_storeu_si256((__m256i*)(out + x), _mm256_i32gather_epi32((const int*)colorTable, low, 4));
+        _mm256_storeu_si256((__m256i*)(out + x + 8), _mm256_i32gather_epi32((const int*)colorTable, high, 4));
+#else
+        uint16_t colors[PIXELS_PER_STEP];
+        VSTORE(colors, color);
+        for (int i = 0; i < PIXELS_PER_STEP; i++){
+            out[x + i] = colorTable[colors[i]];
+        }
+#endif
+    }
+#endif
+}
+//the threaded half of the PPU needs RenderThread complete
+#include "RenderThread.h"
+#endif
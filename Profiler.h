@@ -0,0 +1,263 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <istream>
+#include <ostream>
+#include <algorithm>
+#include "Scheduler.h"
+
+/*
+* SYMBOL MAP:
+*   Names for guest addresses, read from a text map with one symbol per line
+*   in the layout nm prints ("<hex address> [type] <name>", 0x prefix
+*   optional). Lines that do not start with an address are skipped, so
+*   comments and section headers can stay in. An address belongs to the
+*   closest symbol at or below it, Thumb bit ignored.
+*/
+class SymbolMap {
+    public:
+        SymbolMap();
+        void add(uint32_t address, const std::string& name);
+        //false if the file cannot be opened
+        bool load(const char* path);
+        //symbols read
+        uint32_t read(std::istream& in);
+        //NULL below the first symbol
+        const char* lookup(uint32_t address) const;
+        uint32_t getSymbolCount() const;
+    private:
+        struct Symbol {
+            uint32_t address;
+            std::string name;
+            bool operator<(const Symbol& other) const { return address < other.address; }
+        };
+        std::vector<Symbol> symbols;
+};
+/*
+* PROFILER:
+*   Which guest functions the cycles go to, by call stack. While sampling,
+*   the handlers for BL (ARM and the Thumb pair), BX and POP/LDMIA sp! with
+*   pc in the list report here once they have branched, so only the calls
+*   and returns that actually ran are seen:
+*       call    descends into the child of the current node for the target,
+*               making it the first time, and pushes the return address
+*       ret     unwinds to the frame expecting that return address; a
+*               return nobody expects (a BX LR used as a jump, a stack
+*               switched by hand) is ignored rather than guessed at
+*   The tree of nodes is the stacks seen so far, every distinct path once,
+*   so a sample is one increment on the current node whatever the depth.
+*   Samples come from Scheduler::PROFILE every interval emulated cycles, not
+*   from host time, so a profile is the same run after run and does not
+*   care how fast the host is. Calls past MAX_DEPTH (runaway recursion, BL
+*   used as a far jump) are counted in the deepest frame instead.
+*   writeFolded prints one line per node with samples, frames from the
+*   outside in separated by ';' and the count last, the input flamegraph.pl
+*   and speedscope take. Frames are the symbol the target falls in when a
+*   map is given and the target in hex otherwise; the stack outside every
+*   call is "root".
+*/
+class Profiler {
+    public:
+        enum {MAX_DEPTH = 256, DEFAULT_INTERVAL = 1024};
+        Profiler(Scheduler* scheduler);
+        //starts sampling, the call tree is kept until clear
+        void start(uint32_t interval);
+        void stop();
+        bool isRunning();
+        void call(uint32_t target, uint32_t returnAddress);
+        //address is where the return goes
+        void ret(uint32_t address);
+        //forgets every sample and the stack
+        void clear();
+        uint64_t getSampleCount();
+        uint32_t getDepth();
+        void writeFolded(std::ostream& out, const SymbolMap* symbols);
+    private:
+        struct Node {
+            uint32_t target;
+            uint32_t parent;
+            uint32_t child;
+            uint32_t sibling;
+            uint64_t samples;
+        };
+        struct Frame {
+            uint32_t node;
+            uint32_t returnAddress;
+        };
+        Scheduler* scheduler;
+        //node 0 is the root
+        std::vector<Node> nodes;
+        std::vector<Frame> stack;
+        uint32_t current;
+        uint32_t interval;
+        bool running;
+        uint64_t sampleCount;
+        uint32_t getChild(uint32_t parent, uint32_t target);
+        std::string frameName(uint32_t node, const SymbolMap* symbols);
+        static void sampleEvent(void* context, uint64_t late);
+};
+/*
+* BEGIN SYMBOL MAP METHODS
+*/
+inline SymbolMap::SymbolMap(){
+}
+inline void SymbolMap::add(uint32_t address, const std::string& name){
+    Symbol symbol = {address & ~1u, name};
+    symbols.insert(std::upper_bound(symbols.begin(), symbols.end(), symbol), symbol);
+}
+inline bool SymbolMap::load(const char* path){
+    std::ifstream file(path);
+    if (!file){
+        return false;
+    }
+    read(file);
+    return true;
+}
+inline uint32_t SymbolMap::read(std::istream& in){
+    uint32_t count = 0;
+    std::string line;
+    while (std::getline(in, line)){
+        std::istringstream fields(line);
+        std::string address, name, last;
+        if (!(fields >> address >> name)){
+            continue;
+        }
+        char* end;
+        uint32_t value = strtoul(address.c_str(), &end, 16);
+        if (*end){
+            continue;
+        }
+        //"<address> <type> <name>", the type is a single letter
+        if (fields >> last && name.size() == 1){
+            name = last;
+        }
+        add(value, name);
+        count++;
+    }
+    return count;
+}
+inline const char* SymbolMap::lookup(uint32_t address) const{
+    Symbol key = {address & ~1u, std::string()};
+    std::vector<Symbol>::const_iterator at = std::upper_bound(symbols.begin(), symbols.end(), key);
+    if (at == symbols.begin()){
+        return 0;
+    }
+    return (at - 1)->name.c_str();
+}
+inline uint32_t SymbolMap::getSymbolCount() const{
+    return symbols.size();
+}
+/*
+* BEGIN PROFILER METHODS
+*/
+inline Profiler::Profiler(Scheduler* scheduler){
+    this->scheduler = scheduler;
+    this->interval = DEFAULT_INTERVAL;
+    this->running = false;
+    scheduler->setHandler(Scheduler::PROFILE, &Profiler::sampleEvent, this);
+    clear();
+}
+inline void Profiler::start(uint32_t interval){
+    this->interval = interval ? interval : 1;
+    running = true;
+    scheduler->scheduleIn(Scheduler::PROFILE, this->interval);
+}
+inline void Profiler::stop(){
+    running = false;
+    scheduler->cancel(Scheduler::PROFILE);
+}
+inline bool Profiler::isRunning(){
+    return running;
+}
+inline void Profiler::clear(){
+    nodes.clear();
+    nodes.push_back({0, 0, 0, 0, 0});
+    stack.clear();
+    current = 0;
+    sampleCount = 0;
+}
+inline uint32_t Profiler::getChild(uint32_t parent, uint32_t target){
+    //child 0 is the root which is nobody's child, so 0 ends the list
+    for (uint32_t node = nodes[parent].child; node; node = nodes[node].sibling){
+        if (nodes[node].target == target){
+            return node;
+        }
+    }
+    uint32_t node = nodes.size();
+    nodes.push_back({target, parent, 0, nodes[parent].child, 0});
+    nodes[parent].child = node;
+    return node;
+}
+inline void Profiler::call(uint32_t target, uint32_t returnAddress){
+    if (stack.size() >= MAX_DEPTH){
+        return;
+    }
+    current = getChild(current, target & ~1u);
+    stack.push_back({current, returnAddress & ~1u});
+}
+inline void Profiler::ret(uint32_t address){
+    address &= ~1u;
+    //usually the top frame, deeper when a callee left without returning (longjmp)
+    for (uint32_t i = stack.size(); i > 0; i--){
+        if (stack[i - 1].returnAddress == address){
+            current = nodes[stack[i - 1].node].parent;
+            stack.resize(i - 1);
+            return;
+        }
+    }
+}
+inline void Profiler::sampleEvent(void* context, uint64_t late){
+    Profiler* self = (Profiler*)context;
+    if (!self->running){
+        //left pending by a save state taken while sampling
+        return;
+    }
+    //a slice that overshot by several intervals spent all of them here
+    uint64_t samples = 1 + late / self->interval;
+    self->nodes[self->current].samples += samples;
+    self->sampleCount += samples;
+    uint64_t cycle = self->scheduler->getCycles() - late % self->interval;
+    self->scheduler->schedule(Scheduler::PROFILE, cycle + self->interval);
+}
+inline uint64_t Profiler::getSampleCount(){
+    return sampleCount;
+}
+inline uint32_t Profiler::getDepth(){
+    return stack.size();
+}
+inline std::string Profiler::frameName(uint32_t node, const SymbolMap* symbols){
+    const char* name = symbols ? symbols->lookup(nodes[node].target) : 0;
+    if (name){
+        return name;
+    }
+    char hex[16];
+    snprintf(hex, sizeof(hex), "0x%08X", nodes[node].target);
+    return hex;
+}
+inline void Profiler::writeFolded(std::ostream& out, const SymbolMap* symbols){
+    std::vector<uint32_t> path;
+    for (uint32_t node = 0; node < nodes.size(); node++){
+        if (!nodes[node].samples){
+            continue;
+        }
+        if (!node){
+            out << "root " << nodes[node].samples << "\n";
+            continue;
+        }
+        path.clear();
+        for (uint32_t at = node; at; at = nodes[at].parent){
+            path.push_back(at);
+        }
+        for (uint32_t i = path.size(); i > 0; i--){
+            out << frameName(path[i - 1], symbols) << (i > 1 ? ";" : " ");
+        }
+        out << nodes[node].samples << "\n";
+    }
+}
+#endif
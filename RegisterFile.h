@@ -0,0 +1,226 @@
+#ifndef REGISTERFILE_H
+#define REGISTERFILE_H
+#include <stdint.h>
+
+//Told the new state of the CPSR I bit whenever it changes
+typedef void (* IrqMaskFunc)(void* context, bool disabled);
+
+/*
+* REGISTER FILE:
+*   r0 -> r15 as the current mode sees them, plus the CPSR.
+*   Banked copies:
+*       r8  -> r12  FIQ only
+*       r13, r14    one pair per privileged mode (user and system share)
+*       SPSR        one per exception mode
+*   setCPSR swaps the banks whenever the mode bits change, so getRegister never
+*   has to look at the mode, and calls the I bit hook whenever that bit changes
+*   (MSR, exception entry, returning through the SPSR all come through here).
+*   Notes:
+*       the mode is the low 5 bits of the CPSR
+*       program counter is 0b1111
+*       stack pointer is 0b1101
+*/
+class RegisterFile {
+    public:
+        enum mode {USER = 0x10, FIQ = 0x11, IRQ = 0x12, SUPERVISOR = 0x13, ABORT = 0x17,
+            UNDEFINED = 0x1B, SYSTEM = 0x1F};
+        //Q is the ARMv5TE saturation flag, only the halfword multiplies set it
+        enum flags {N = 1u << 31, Z = 1 << 30, C = 1 << 29, V = 1 << 28, Q = 1 << 27,
+            IRQ_DISABLE = 1 << 7, FIQ_DISABLE = 1 << 6, THUMB = 1 << 5};
+        enum names {SP = 13, LR = 14, PC = 15};
+        RegisterFile();
+        //state the BIOS leaves behind before jumping to the cartridge
+        void reset();
+        uint32_t getRegister(uint8_t index);
+        void setRegister(uint8_t index, uint32_t value);
+        uint32_t getCPSR();
+        void setCPSR(uint32_t value);
+        //the bits of mask in the condition flags (N Z C V Q) from value, nothing else
+        //changes so there is no bank or IRQ mask to react to
+        void setFlags(uint32_t mask, uint32_t value);
+        uint32_t getSPSR();
+        void setSPSR(uint32_t value);
+        uint8_t getMode();
+        bool isThumb();
+        //jump to target in the current state, PC left reading ahead of it by 8 (ARM) or
+        //4 (THUMB) the way it does between instructions
+        void branch(uint32_t target);
+        //whether branch() or enterException() moved PC since the last clearBranched(), so
+        //whoever runs an instruction knows not to step PC past it
+        bool hasBranched();
+        void clearBranched();
+        //an ARM condition field (bits 28 -> 31 of the opcode) against the flags now
+        bool conditionPassed(uint8_t condition);
+        //enter an exception mode: LR = returnAddress, SPSR = old CPSR, ARM state, IRQs off, PC at the vector
+        void enterException(mode exceptionMode, uint32_t vector, uint32_t returnAddress);
+        //copying a register file copies the hook too, whoever loads one sets it again
+        void setIrqMaskHook(IrqMaskFunc func, void* context);
+    private:
+        uint32_t registers[16];
+        uint32_t cpsr;
+        bool branched;
+        //indexed by bank(): user/system, fiq, irq, supervisor, abort, undefined
+        uint32_t bankedSP[6];
+        uint32_t bankedLR[6];
+        uint32_t bankedSPSR[6];
+        uint32_t userHigh[5];
+        uint32_t fiqHigh[5];
+        IrqMaskFunc irqMaskFunc;
+        void* irqMaskContext;
+        uint8_t bank(uint8_t mode);
+        void switchBank(uint8_t from, uint8_t to);
+};
+/*
+* BEGIN REGISTER FILE METHODS
+*/
+inline RegisterFile::RegisterFile(){
+    irqMaskFunc = 0;
+    irqMaskContext = 0;
+    reset();
+}
+inline void RegisterFile::reset(){
+    for (int i = 0; i < 16; i++){
+        registers[i] = 0;
+    }
+    for (int i = 0; i < 6; i++){
+        bankedSP[i] = 0;
+        bankedLR[i] = 0;
+        bankedSPSR[i] = 0;
+    }
+    for (int i = 0; i < 5; i++){
+        userHigh[i] = 0;
+        fiqHigh[i] = 0;
+    }
+    bankedSP[bank(IRQ)] = 0x03007FA0;
+    bankedSP[bank(SUPERVISOR)] = 0x03007FE0;
+    cpsr = SYSTEM;
+    branched = false;
+    if (irqMaskFunc){
+        irqMaskFunc(irqMaskContext, false);
+    }
+    registers[SP] = 0x03007F00;
+    //reading the first instruction of the cartridge plus 8
+    registers[PC] = 0x08000008;
+}
+inline uint8_t RegisterFile::bank(uint8_t mode){
+    switch (mode){
+        case FIQ:
+            return 1;
+        case IRQ:
+            return 2;
+        case SUPERVISOR:
+            return 3;
+        case ABORT:
+            return 4;
+        case UNDEFINED:
+            return 5;
+        default:
+            return 0;
+    }
+}
+inline void RegisterFile::switchBank(uint8_t from, uint8_t to){
+    uint8_t oldBank = bank(from);
+    uint8_t newBank = bank(to);
+    if (oldBank == newBank){
+        return;
+    }
+    bankedSP[oldBank] = registers[SP];
+    bankedLR[oldBank] = registers[LR];
+    registers[SP] = bankedSP[newBank];
+    registers[LR] = bankedLR[newBank];
+    if (from == FIQ || to == FIQ){
+        uint32_t* save = from == FIQ ? fiqHigh : userHigh;
+        uint32_t* load = to == FIQ ? fiqHigh : userHigh;
+        for (int i = 0; i < 5; i++){
+            save[i] = registers[8 + i];
+            registers[8 + i] = load[i];
+        }
+    }
+}
+inline uint32_t RegisterFile::getRegister(uint8_t index){
+    return registers[index & 0xF];
+}
+inline void RegisterFile::setRegister(uint8_t index, uint32_t value){
+    registers[index & 0xF] = value;
+}
+inline uint32_t RegisterFile::getCPSR(){
+    return cpsr;
+}
+inline void RegisterFile::setCPSR(uint32_t value){
+    switchBank(cpsr & 0x1F, value & 0x1F);
+    uint32_t changed = cpsr ^ value;
+    cpsr = value;
+    if ((changed & IRQ_DISABLE) && irqMaskFunc){
+        irqMaskFunc(irqMaskContext, value & IRQ_DISABLE);
+    }
+}
+inline void RegisterFile::setFlags(uint32_t mask, uint32_t value){
+    mask &= N | Z | C | V | Q;
+    cpsr = (cpsr & ~mask) | (value & mask);
+}
+inline uint32_t RegisterFile::getSPSR(){
+    uint8_t current = bank(getMode());
+    //user and system have no SPSR, reads give the CPSR
+    return current ? bankedSPSR[current] : cpsr;
+}
+inline void RegisterFile::setSPSR(uint32_t value){
+    uint8_t current = bank(getMode());
+    if (current){
+        bankedSPSR[current] = value;
+    }
+}
+inline uint8_t RegisterFile::getMode(){
+    return cpsr & 0x1F;
+}
+inline bool RegisterFile::isThumb(){
+    return cpsr & THUMB;
+}
+inline void RegisterFile::branch(uint32_t target){
+    registers[PC] = (cpsr & THUMB) ? (target & ~1u) + 4 : (target & ~3u) + 8;
+    branched = true;
+}
+inline bool RegisterFile::hasBranched(){
+    return branched;
+}
+inline void RegisterFile::clearBranched(){
+    branched = false;
+}
+inline bool RegisterFile::conditionPassed(uint8_t condition){
+    bool n = cpsr & N;
+    bool z = cpsr & Z;
+    bool c = cpsr & C;
+    bool v = cpsr & V;
+    switch (condition & 0xF){
+        case 0x0: return z;
+        case 0x1: return !z;
+        case 0x2: return c;
+        case 0x3: return !c;
+        case 0x4: return n;
+        case 0x5: return !n;
+        case 0x6: return v;
+        case 0x7: return !v;
+        case 0x8: return c && !z;
+        case 0x9: return !c || z;
+        case 0xA: return n == v;
+        case 0xB: return n != v;
+        case 0xC: return !z && n == v;
+        case 0xD: return z || n != v;
+        default:
+            //AL, and NV which the ARM7 treats as never but nothing should use
+            return (condition & 0xF) != 0xF;
+    }
+}
+inline void RegisterFile::setIrqMaskHook(IrqMaskFunc func, void* context){
+    this->irqMaskFunc = func;
+    this->irqMaskContext = context;
+}
+inline void RegisterFile::enterException(mode exceptionMode, uint32_t vector, uint32_t returnAddress){
+    uint32_t old = cpsr;
+    setCPSR((old & ~(0x1F | THUMB)) | exceptionMode | IRQ_DISABLE);
+    setSPSR(old);
+    registers[LR] = returnAddress;
+    //always ARM, PC reads the vector plus 8 like it does ahead of any instruction
+    registers[PC] = vector + 8;
+    branched = true;
+}
+#endif
@@ -0,0 +1,246 @@
+#ifndef RENDERTHREAD_H
+#define RENDERTHREAD_H
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "Memory.h"
+#include "PPU.h"
+
+/*
+* RENDER THREAD:
+*   Draws the picture on a second thread one step behind the CPU. The thread
+*   owns a shadow Memory and a render-only PPU drawing from it; the CPU side
+*   only ever writes to a single producer single consumer ring of records:
+*       VRAM/PALETTE/OAM DATA  bytes that changed since the last line, found
+*                              from the bus's dirty bits (runs of dirty tiles,
+*                              colors or entries go as one record)
+*       LINE                   line number, the display registers 0x00 -> 0x5F
+*                              and the BG2/BG3 internal reference points
+*   so at HBlank the CPU pays for copying what changed plus ~100 bytes of
+*   registers instead of drawing the line. The render thread replays records
+*   in order through getWritePointer, which marks the shadow's own dirty bits,
+*   so its tile and OAM caches work exactly as they do single threaded and the
+*   frame is the same bit for bit.
+*   The ring is RING_SIZE bytes, records are 16 byte aligned and never straddle
+*   the end (a WRAP record skips what is left). The head and tail are the only
+*   shared state, each written by one side with release and read with acquire.
+*   Both sides yield while waiting rather than spin so they also get along on a
+*   single core. A full ring makes the CPU wait, which only happens when the
+*   renderer is a whole ring behind.
+*   While this is running the CPU side bus's dirty bits are consumed here, the
+*   PPU marks them all again when threaded rendering is switched off.
+*/
+class RenderThread {
+    public:
+        enum {RING_SIZE = 1 << 22};
+        //frame is what the render PPU starts from, lines not redrawn yet keep it
+        RenderThread(Memory* source, const uint32_t* frame);
+        ~RenderThread();
+        //queue what changed in VRAM/palette/OAM and then the line itself
+        void submitLine(uint8_t line, const int32_t* affineX, const int32_t* affineY);
+        //wait until everything queued has been drawn
+        void sync();
+        //sync, then the render PPU's frame
+        const uint32_t* getFrame();
+        //ship pending palette writes, sync, then the render PPU's converted palette
+        const uint32_t* getPaletteRGBA();
+        uint64_t getLinesRendered();
+        uint64_t getBytesQueued();
+    private:
+        enum recordType {VRAM_DATA, PALETTE_DATA, OAM_DATA, LINE, WRAP};
+        struct Record {
+            uint32_t type;
+            uint32_t address;
+            uint32_t length;
+            uint32_t line;
+        };
+        struct LineState {
+            uint16_t io[0x60 / 2];
+            int32_t affineX[2];
+            int32_t affineY[2];
+        };
+        Memory* source;
+        Memory shadow;
+        PPU renderer;
+        std::vector<uint8_t> ring;
+        //head and tail on their own cache lines, each has one writer
+        alignas(64) std::atomic<uint64_t> writePosition;
+        alignas(64) std::atomic<uint64_t> readPosition;
+        std::atomic<uint64_t> linesRendered;
+        std::atomic<bool> running;
+        uint64_t bytesQueued;
+        std::thread thread;
+        void waitForRoom(uint64_t position, uint64_t size);
+        void push(recordType type, uint32_t address, uint32_t line, const void* data, uint32_t length);
+        //one record per run of set bits, clearing them
+        void shipDirty(uint64_t* dirty, uint32_t units, uint32_t unitSize, recordType type, uint32_t address, const uint8_t* base);
+        void shipChanges();
+        void run();
+        void apply(const Record* record);
+};
+/*
+* BEGIN RENDER THREAD METHODS
+*/
+inline RenderThread::RenderThread(Memory* source, const uint32_t* frame) : renderer(&shadow), ring(RING_SIZE){
+    this->source = source;
+    renderer.loadFrame(frame);
+    writePosition.store(0);
+    readPosition.store(0);
+    linesRendered.store(0);
+    running.store(true);
+    bytesQueued = 0;
+    thread = std::thread(&RenderThread::run, this);
+}
+inline RenderThread::~RenderThread(){
+    sync();
+    running.store(false, std::memory_order_release);
+    thread.join();
+}
+inline void RenderThread::submitLine(uint8_t line, const int32_t* affineX, const int32_t* affineY){
+    shipChanges();
+    LineState state;
+    for (uint32_t i = 0; i < 0x60 / 2; i++){
+        state.io[i] = source->getIORegister(0x4000000 + i * 2);
+    }
+    memcpy(state.affineX, affineX, sizeof(state.affineX));
+    memcpy(state.affineY, affineY, sizeof(state.affineY));
+    push(LINE, 0, line, &state, sizeof(state));
+}
+inline void RenderThread::sync(){
+    while (readPosition.load(std::memory_order_acquire) != writePosition.load(std::memory_order_relaxed)){
+        std::this_thread::yield();
+    }
+}
+inline const uint32_t* RenderThread::getFrame(){
+    sync();
+    return renderer.getFrame();
+}
+inline const uint32_t* RenderThread::getPaletteRGBA(){
+    shipDirty(source->getPaletteDirty(), Memory::PALETTE_SIZE / 2, 2, PALETTE_DATA, 0x5000000, source->getPalette());
+    sync();
+    return renderer.getPaletteRGBA();
+}
+inline uint64_t RenderThread::getLinesRendered(){
+    return linesRendered.load(std::memory_order_relaxed);
+}
+inline uint64_t RenderThread::getBytesQueued(){
+    return bytesQueued;
+}
+inline void RenderThread::waitForRoom(uint64_t position, uint64_t size){
+    while (position + size - readPosition.load(std::memory_order_acquire) > RING_SIZE){
+        std::this_thread::yield();
+    }
+}
+inline void RenderThread::push(recordType type, uint32_t address, uint32_t line, const void* data, uint32_t length){
+    uint64_t size = (sizeof(Record) + length + 15) & ~15ull;
+    uint64_t position = writePosition.load(std::memory_order_relaxed);
+    uint64_t room = RING_SIZE - (position & (RING_SIZE - 1));
+    if (room < size){
+        waitForRoom(position, room);
+        Record* wrap = (Record*)&ring[position & (RING_SIZE - 1)];
+        wrap->type = WRAP;
+        position += room;
+        writePosition.store(position, std::memory_order_release);
+    }
+    waitForRoom(position, size);
+    Record* record = (Record*)&ring[position & (RING_SIZE - 1)];
+    record->type = type;
+    record->address = address;
+    record->length = length;
+    record->line = line;
+    memcpy(record + 1, data, length);
+    bytesQueued += size;
+    writePosition.store(position + size, std::memory_order_release);
+}
+inline void RenderThread::shipDirty(uint64_t* dirty, uint32_t units, uint32_t unitSize, recordType type, uint32_t address, const uint8_t* base){
+    uint32_t unit = 0;
+    while (unit < units){
+        uint64_t bits = dirty[unit >> 6] >> (unit & 63);
+        if (!bits){
+            unit = (unit | 63) + 1;
+            continue;
+        }
+        unit += __builtin_ctzll(bits);
+        uint32_t start = unit;
+        while (unit < units && (dirty[unit >> 6] >> (unit & 63)) & 1){
+            dirty[unit >> 6] &= ~(1ull << (unit & 63));
+            unit++;
+        }
+        push(type, address + start * unitSize, 0, base + start * unitSize, (unit - start) * unitSize);
+    }
+}
+inline void RenderThread::shipChanges(){
+    shipDirty(source->getVramDirty(), Memory::VRAM_SIZE / 32, 32, VRAM_DATA, 0x6000000, source->getVram());
+    shipDirty(source->getPaletteDirty(), Memory::PALETTE_SIZE / 2, 2, PALETTE_DATA, 0x5000000, source->getPalette());
+    shipDirty(source->getOamDirty(), Memory::OAM_SIZE / 8, 8, OAM_DATA, 0x7000000, source->getOam());
+}
+inline void RenderThread::run(){
+    while (true){
+        uint64_t position = readPosition.load(std::memory_order_relaxed);
+        if (position == writePosition.load(std::memory_order_acquire)){
+            if (!running.load(std::memory_order_acquire)){
+                return;
+            }
+            std::this_thread::yield();
+            continue;
+        }
+        const Record* record = (const Record*)&ring[position & (RING_SIZE - 1)];
+        uint64_t size;
+        if (record->type == WRAP){
+            size = RING_SIZE - (position & (RING_SIZE - 1));
+        } else {
+            apply(record);
+            size = (sizeof(Record) + record->length + 15) & ~15ull;
+        }
+        readPosition.store(position + size, std::memory_order_release);
+    }
+}
+inline void RenderThread::apply(const Record* record){
+    const uint8_t* data = (const uint8_t*)(record + 1);
+    if (record->type != LINE){
+        memcpy(shadow.getWritePointer(record->address, record->length), data, record->length);
+        return;
+    }
+    const LineState* state = (const LineState*)data;
+    for (uint32_t i = 0; i < 0x60 / 2; i++){
+        shadow.setIORegister(0x4000000 + i * 2, state->io[i]);
+    }
+    renderer.setAffineReference(state->affineX, state->affineY);
+    renderer.renderLine(record->line);
+    linesRendered.fetch_add(1, std::memory_order_relaxed);
+}
+/*
+* BEGIN PPU THREADED METHODS
+*/
+inline PPU::~PPU(){
+    delete renderThread;
+}
+inline const uint32_t* PPU::getFrame(){
+    return renderThread ? renderThread->getFrame() : frame;
+}
+inline void PPU::setThreadedRendering(bool threaded){
+    if (threaded == (renderThread != 0)){
+        return;
+    }
+    if (threaded){
+        renderThread = new RenderThread(memory, frame);
+    } else {
+        loadFrame(renderThread->getFrame());
+        delete renderThread;
+        renderThread = 0;
+    }
+    //either the render thread needs everything or this PPU's caches have missed writes
+    memset(memory->getVramDirty(), 0xFF, Memory::VRAM_SIZE / 32 / 8);
+    memset(memory->getPaletteDirty(), 0xFF, Memory::PALETTE_SIZE / 2 / 8);
+    memset(memory->getOamDirty(), 0xFF, Memory::OAM_SIZE / 8 / 8);
+}
+inline void PPU::submitLine(uint8_t line){
+    renderThread->submitLine(line, affineX, affineY);
+    stepAffine();
+}
+inline const uint32_t* PPU::getThreadedPaletteRGBA(){
+    return renderThread->getPaletteRGBA();
+}
+#endif
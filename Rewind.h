@@ -0,0 +1,235 @@
+#ifndef REWIND_H
+#define REWIND_H
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <deque>
+#include "Memory.h"
+#include "SaveState.h"
+
+/*
+* REWIND BUFFER:
+*   A snapshot every interval frames, kept in a fixed size ring so the history
+*   reaches back as far as the memory allows. Only the newest snapshot is held
+*   whole (state, a SaveState the CPU captures into incrementally, and image, a
+*   flat copy of it: components then every page at PAGE_SIZE stride). Every
+*   older one is a delta, newest XOR the one before, which is mostly zeros and
+*   is stored as a run length code over 8 byte words:
+*       zero words   varint, words equal to the previous snapshot
+*       literal words varint, then that many XOR words
+*   repeated to the end of the image. Pages the capture did not copy have not
+*   changed and go straight into a zero run without being looked at, so a
+*   snapshot costs the pages touched since the last one, XORed once.
+*   Stepping back applies the newest delta to image and state (that is the
+*   snapshot before), invalidating the pages it touched so the next load writes
+*   them back. When the ring is full the oldest deltas are dropped; the chain
+*   from the newest snapshot backwards never breaks.
+*/
+class RewindBuffer {
+    public:
+        //capacity is the ring size in bytes, a snapshot every interval frames
+        RewindBuffer(uint32_t capacity, uint32_t interval);
+        //call once per frame, true if this frame gets a snapshot
+        bool nextFrame();
+        //the newest snapshot, the CPU captures into it and loads from it
+        SaveState* getState();
+        //state was just captured: turn the one before into a delta, every capture has to be pushed
+        //since only the pages copied by the last one are looked at
+        void push();
+        //state was just loaded: make the snapshot before it the newest, false if there is none
+        bool pop();
+        //snapshots that can be stepped back to, the newest one included
+        uint32_t getSnapshotCount();
+        uint64_t getBytesUsed();
+        //compressed size of the last delta
+        uint32_t getLastDeltaSize();
+    private:
+        struct Delta {
+            uint64_t offset;
+            uint32_t size;
+        };
+        SaveState state;
+        uint32_t componentSize;
+        //components padded to whole words, then the pages
+        uint32_t pageOffset;
+        std::vector<uint8_t> image;
+        std::vector<uint8_t> components;
+        std::vector<uint8_t> ring;
+        std::vector<uint8_t> scratch;
+        std::deque<Delta> deltas;
+        //ring write position, grows forever, wrapped on use
+        uint64_t head;
+        uint32_t interval;
+        uint32_t frames;
+        bool hasState;
+        uint32_t lastDeltaSize;
+        void putVarint(uint32_t value);
+        static uint32_t getVarint(const uint8_t** in);
+        //xor newer into image word by word, adding the runs to scratch
+        void encode(const uint8_t* newer, uint32_t offset, uint32_t length, uint32_t* zeroRun, uint32_t* literalStart);
+        void flushLiteral(uint32_t end, uint32_t* zeroRun, uint32_t* literalStart);
+        void store();
+};
+/*
+* BEGIN REWIND BUFFER METHODS
+*/
+inline RewindBuffer::RewindBuffer(uint32_t capacity, uint32_t interval) : ring(capacity){
+    this->componentSize = SaveState::getComponentSize();
+    this->pageOffset = (componentSize + 7) & ~7u;
+    this->image.assign(pageOffset + Memory::PAGE_COUNT * Memory::PAGE_SIZE, 0);
+    this->components.assign(pageOffset, 0);
+    this->head = 0;
+    this->interval = interval ? interval : 1;
+    this->frames = 0;
+    this->hasState = false;
+    this->lastDeltaSize = 0;
+}
+inline bool RewindBuffer::nextFrame(){
+    return frames++ % interval == 0;
+}
+inline SaveState* RewindBuffer::getState(){
+    return &state;
+}
+inline uint32_t RewindBuffer::getSnapshotCount(){
+    return hasState + deltas.size();
+}
+inline uint64_t RewindBuffer::getBytesUsed(){
+    return deltas.empty() ? 0 : head - deltas.front().offset;
+}
+inline uint32_t RewindBuffer::getLastDeltaSize(){
+    return lastDeltaSize;
+}
+inline void RewindBuffer::putVarint(uint32_t value){
+    while (value >= 0x80){
+        scratch.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    scratch.push_back((uint8_t)value);
+}
+inline uint32_t RewindBuffer::getVarint(const uint8_t** in){
+    uint32_t value = 0;
+    for (uint32_t shift = 0; ; shift += 7){
+        uint8_t byte = *(*in)++;
+        value |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)){
+            return value;
+        }
+    }
+}
+inline void RewindBuffer::flushLiteral(uint32_t end, uint32_t* zeroRun, uint32_t* literalStart){
+    //literal words were xored in place in image, take them from there and put the new values back
+    uint32_t count = (end - *literalStart) / 8;
+    putVarint(*zeroRun);
+    putVarint(count);
+    scratch.insert(scratch.end(), &image[*literalStart], &image[end]);
+    *zeroRun = 0;
+    *literalStart = UINT32_MAX;
+}
+inline void RewindBuffer::encode(const uint8_t* newer, uint32_t offset, uint32_t length, uint32_t* zeroRun, uint32_t* literalStart){
+    //image holds the XOR while scanning, push() puts newer in afterwards
+    for (uint32_t position = offset; position < offset + length; position += 8){
+        uint64_t a;
+        uint64_t b;
+        memcpy(&a, &image[position], 8);
+        memcpy(&b, newer + (position - offset), 8);
+        uint64_t difference = a ^ b;
+        memcpy(&image[position], &difference, 8);
+        if (!difference){
+            if (*literalStart != UINT32_MAX){
+                flushLiteral(position, zeroRun, literalStart);
+            }
+            (*zeroRun)++;
+        } else if (*literalStart == UINT32_MAX){
+            *literalStart = position;
+        }
+    }
+    if (*literalStart != UINT32_MAX){
+        flushLiteral(offset + length, zeroRun, literalStart);
+    }
+}
+inline void RewindBuffer::push(){
+    state.writeComponents(components.data());
+    uint8_t* pages = state.getPageImage();
+    if (!hasState){
+        memcpy(image.data(), components.data(), pageOffset);
+        memcpy(&image[pageOffset], pages, Memory::PAGE_COUNT * Memory::PAGE_SIZE);
+        hasState = true;
+        return;
+    }
+    //pages the capture skipped are equal to the snapshot before, copied ones are xored
+    scratch.clear();
+    uint32_t zeroRun = 0;
+    uint32_t literalStart = UINT32_MAX;
+    encode(components.data(), 0, pageOffset, &zeroRun, &literalStart);
+    const uint64_t* copied = state.getCopiedPages();
+    for (uint32_t page = 0; page < Memory::PAGE_COUNT; page++){
+        uint32_t offset = pageOffset + page * Memory::PAGE_SIZE;
+        if (!(copied[page >> 6] & (1ull << (page & 63)))){
+            zeroRun += Memory::PAGE_SIZE / 8;
+            continue;
+        }
+        encode(pages + page * Memory::PAGE_SIZE, offset, Memory::PAGE_SIZE, &zeroRun, &literalStart);
+        memcpy(&image[offset], pages + page * Memory::PAGE_SIZE, Memory::PAGE_SIZE);
+    }
+    memcpy(image.data(), components.data(), pageOffset);
+    //the trailing zero run is implied by the image size
+    store();
+}
+inline void RewindBuffer::store(){
+    uint32_t size = scratch.size();
+    lastDeltaSize = size;
+    if (size > ring.size()){
+        //cannot keep anything older than this
+        deltas.clear();
+        return;
+    }
+    //records never straddle the end of the ring
+    uint64_t position = head;
+    if ((position % ring.size()) + size > ring.size()){
+        position += ring.size() - position % ring.size();
+    }
+    while (!deltas.empty() && deltas.front().offset + ring.size() < position + size){
+        deltas.pop_front();
+    }
+    memcpy(&ring[position % ring.size()], scratch.data(), size);
+    deltas.push_back({position, size});
+    head = position + size;
+}
+inline bool RewindBuffer::pop(){
+    if (deltas.empty()){
+        hasState = false;
+        return false;
+    }
+    Delta delta = deltas.back();
+    deltas.pop_back();
+    head = delta.offset;
+    const uint8_t* in = &ring[delta.offset % ring.size()];
+    const uint8_t* end = in + delta.size;
+    uint8_t* pages = state.getPageImage();
+    uint32_t position = 0;
+    bool componentsTouched = false;
+    while (in < end){
+        position += getVarint(&in) * 8;
+        uint32_t count = getVarint(&in);
+        for (uint32_t i = 0; i < count; i++, position += 8, in += 8){
+            uint64_t a;
+            uint64_t b;
+            memcpy(&a, &image[position], 8);
+            memcpy(&b, in, 8);
+            a ^= b;
+            memcpy(&image[position], &a, 8);
+            if (position < pageOffset){
+                componentsTouched = true;
+                continue;
+            }
+            uint32_t page = (position - pageOffset) / Memory::PAGE_SIZE;
+            memcpy(pages + (position - pageOffset), &a, 8);
+            state.invalidatePage(page);
+        }
+    }
+    if (componentsTouched){
+        state.readComponents(image.data());
+    }
+    return true;
+}
+#endif
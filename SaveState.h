@@ -0,0 +1,165 @@
+#ifndef SAVESTATE_H
+#define SAVESTATE_H
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "Memory.h"
+#include "Scheduler.h"
+#include "Interrupts.h"
+#include "Timers.h"
+#include "DMA.h"
+#include "PPU.h"
+#include "APU.h"
+#include "RegisterFile.h"
+
+/*
+* SAVE STATE:
+*   Everything needed to put a machine back where it was: the register file,
+*   the scheduler's timeline, each component's State and the writable memory.
+*   The components are small and copied whole every time. Memory is copied a
+*   page at a time and only where it has to be:
+*       captureMemory   asks the bus for its page versions (which folds in the
+*                       pages stored to since the last call) and copies just
+*                       the pages whose version differs from the one held here
+*       restoreMemory   writes back just the pages whose version on the bus
+*                       differs from the one held here, and gives them this
+*                       version again so the next capture skips them
+*   Versions come from a counter shared by every Memory, so two different
+*   machines never agree on a version by accident and a state can be loaded
+*   into any of them. Reusing one SaveState after every frame therefore copies
+*   the pages touched that frame and nothing else; a fresh SaveState copies all
+*   PAGE_COUNT pages the first time.
+*   The ROM is not part of it and neither are the frontend's settings (frame
+*   skip, threaded rendering, audio output), the CPU fills in the rest.
+*   Whoever edits the page image directly (the rewind buffer) has to call
+*   invalidatePage, version 0 is never handed out so that page is always
+*   written back.
+*/
+class SaveState {
+    public:
+        SaveState();
+        RegisterFile registers;
+        Scheduler::State scheduler;
+        Interrupts::State interrupts;
+        Timers::State timers;
+        DMA::State dma;
+        PPU::State ppu;
+        APU::State apu;
+        Memory::Prefetch prefetch;
+        bool halted;
+        //copy the pages that moved since this state last saw them
+        void captureMemory(Memory* memory);
+        //put back the pages that moved since this state was captured
+        void restoreMemory(Memory* memory);
+        //pages copied by the last capture or restore
+        uint32_t getPagesCopied();
+        //one bit per page copied by the last capture
+        const uint64_t* getCopiedPages();
+        //PAGE_SIZE bytes per page whatever its length, pages are back to back
+        uint8_t* getPageImage();
+        //the page image no longer matches what its version says
+        void invalidatePage(uint32_t page);
+        //everything but memory as one block of bytes
+        static uint32_t getComponentSize();
+        void writeComponents(uint8_t* out);
+        void readComponents(const uint8_t* in);
+    private:
+        std::vector<uint8_t> pages;
+        uint64_t versions[Memory::PAGE_COUNT];
+        uint32_t pagesCopied;
+        uint64_t copiedPages[(Memory::PAGE_COUNT + 63) / 64];
+};
+/*
+* BEGIN SAVE STATE METHODS
+*/
+inline SaveState::SaveState() : pages(Memory::PAGE_COUNT * Memory::PAGE_SIZE){
+    //0 is never handed out as a version so the first capture takes everything
+    memset(versions, 0, sizeof(versions));
+    halted = false;
+    memset(&prefetch, 0, sizeof(prefetch));
+    pagesCopied = 0;
+    memset(copiedPages, 0, sizeof(copiedPages));
+}
+inline void SaveState::captureMemory(Memory* memory){
+    const uint64_t* current = memory->getPageVersions();
+    pagesCopied = 0;
+    memset(copiedPages, 0, sizeof(copiedPages));
+    for (uint32_t page = 0; page < Memory::PAGE_COUNT; page++){
+        if (current[page] == versions[page]){
+            continue;
+        }
+        uint32_t length;
+        const uint8_t* data = memory->getPage(page, &length);
+        memcpy(&pages[page * Memory::PAGE_SIZE], data, length);
+        versions[page] = current[page];
+        copiedPages[page >> 6] |= 1ull << (page & 63);
+        pagesCopied++;
+    }
+}
+inline void SaveState::restoreMemory(Memory* memory){
+    const uint64_t* current = memory->getPageVersions();
+    pagesCopied = 0;
+    for (uint32_t page = 0; page < Memory::PAGE_COUNT; page++){
+        if (current[page] == versions[page]){
+            continue;
+        }
+        memory->restorePage(page, &pages[page * Memory::PAGE_SIZE], versions[page]);
+        pagesCopied++;
+    }
+}
+inline uint32_t SaveState::getPagesCopied(){
+    return pagesCopied;
+}
+inline const uint64_t* SaveState::getCopiedPages(){
+    return copiedPages;
+}
+inline uint8_t* SaveState::getPageImage(){
+    return pages.data();
+}
+inline void SaveState::invalidatePage(uint32_t page){
+    versions[page] = 0;
+}
+inline uint32_t SaveState::getComponentSize(){
+    return sizeof(RegisterFile) + sizeof(Scheduler::State) + sizeof(Interrupts::State) + sizeof(Timers::State) +
+        sizeof(DMA::State) + sizeof(PPU::State) + sizeof(APU::State) + sizeof(Memory::Prefetch) + sizeof(bool);
+}
+inline void SaveState::writeComponents(uint8_t* out){
+    //field by field, the same order readComponents takes them back in
+    memcpy(out, &registers, sizeof(registers));
+    out += sizeof(registers);
+    memcpy(out, &scheduler, sizeof(scheduler));
+    out += sizeof(scheduler);
+    memcpy(out, &interrupts, sizeof(interrupts));
+    out += sizeof(interrupts);
+    memcpy(out, &timers, sizeof(timers));
+    out += sizeof(timers);
+    memcpy(out, &dma, sizeof(dma));
+    out += sizeof(dma);
+    memcpy(out, &ppu, sizeof(ppu));
+    out += sizeof(ppu);
+    memcpy(out, &apu, sizeof(apu));
+    out += sizeof(apu);
+    memcpy(out, &prefetch, sizeof(prefetch));
+    out += sizeof(prefetch);
+    memcpy(out, &halted, sizeof(halted));
+}
+inline void SaveState::readComponents(const uint8_t* in){
+    memcpy(&registers, in, sizeof(registers));
+    in += sizeof(registers);
+    memcpy(&scheduler, in, sizeof(scheduler));
+    in += sizeof(scheduler);
+    memcpy(&interrupts, in, sizeof(interrupts));
+    in += sizeof(interrupts);
+    memcpy(&timers, in, sizeof(timers));
+    in += sizeof(timers);
+    memcpy(&dma, in, sizeof(dma));
+    in += sizeof(dma);
+    memcpy(&ppu, in, sizeof(ppu));
+    in += sizeof(ppu);
+    memcpy(&apu, in, sizeof(apu));
+    in += sizeof(apu);
+    memcpy(&prefetch, in, sizeof(prefetch));
+    in += sizeof(prefetch);
+    memcpy(&halted, in, sizeof(halted));
+}
+#endif
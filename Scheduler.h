@@ -0,0 +1,217 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+#include <stdint.h>
+
+//Called when an event fires, late is how many cycles past its target the event ran
+typedef void (* EventFunc)(void* context, uint64_t late);
+
+/*
+* SCHEDULER:
+*   The single timeline every piece of hardware hangs off of. Instead of each
+*   component being ticked after every instruction, a component works out the
+*   absolute cycle its next interesting thing happens on and schedules it here.
+*   The CPU then runs straight line until the earliest event and dispatches it.
+*   Layout:
+*       events    one fixed slot per eventType (cycle, handler, context)
+*       heap      binary min heap of slot numbers ordered by cycle
+*       heapIndex where each slot currently sits in the heap, -1 if idle
+*   Since every event type owns exactly one slot the heap can never hold more
+*   than EVENT_COUNT entries, so nothing is ever allocated. schedule, cancel and
+*   reschedule are a single sift, O(log n). Ties fire in eventType order so runs
+*   are deterministic.
+*/
+class Scheduler {
+    public:
+        enum eventType {TIMER0, TIMER1, TIMER2, TIMER3, DMA0, DMA1, DMA2, DMA3,
+            HBLANK, HDRAW, AUDIO, IRQ, DEBUG, PROFILE, EVENT_COUNT};
+        Scheduler();
+        void reset();
+        void setHandler(eventType type, EventFunc func, void* context);
+        //schedule uses an absolute cycle, scheduleIn is relative to now
+        //both reschedule the event if it is already pending
+        void schedule(eventType type, uint64_t cycle);
+        void scheduleIn(eventType type, uint64_t delay);
+        void cancel(eventType type);
+        bool isScheduled(eventType type);
+        uint64_t getEventCycle(eventType type);
+        uint64_t getCycles();
+        void addCycles(uint64_t count);
+        void setCycles(uint64_t count);
+        //UINT64_MAX when nothing is pending
+        uint64_t getNextEventCycle();
+        //fires every event whose cycle has been reached, in order
+        void dispatch();
+        //the timeline without the handlers, for save states
+        struct State {
+            uint64_t cycles;
+            uint64_t eventCycles[EVENT_COUNT];
+            uint8_t heap[EVENT_COUNT];
+            int8_t heapIndex[EVENT_COUNT];
+            uint8_t size;
+        };
+        void saveState(State* state);
+        void loadState(const State* state);
+    private:
+        struct Event {
+            uint64_t cycle;
+            EventFunc func;
+            void* context;
+        };
+        Event events[EVENT_COUNT];
+        uint8_t heap[EVENT_COUNT];
+        int8_t heapIndex[EVENT_COUNT];
+        uint8_t size;
+        uint64_t cycles;
+        bool earlier(uint8_t a, uint8_t b);
+        void place(uint8_t position, uint8_t slot);
+        void siftUp(uint8_t position);
+        void siftDown(uint8_t position);
+        void remove(uint8_t position);
+};
+/*
+* BEGIN SCHEDULER METHODS
+*/
+inline Scheduler::Scheduler(){
+    for (int i = 0; i < EVENT_COUNT; i++){
+        events[i].func = 0;
+        events[i].context = 0;
+    }
+    reset();
+}
+inline void Scheduler::reset(){
+    //handlers stay registered, only the timeline is cleared
+    for (int i = 0; i < EVENT_COUNT; i++){
+        events[i].cycle = 0;
+        heapIndex[i] = -1;
+    }
+    size = 0;
+    cycles = 0;
+}
+inline void Scheduler::setHandler(eventType type, EventFunc func, void* context){
+    events[type].func = func;
+    events[type].context = context;
+}
+inline bool Scheduler::earlier(uint8_t a, uint8_t b){
+    if (events[a].cycle != events[b].cycle){
+        return events[a].cycle < events[b].cycle;
+    }
+    return a < b;
+}
+inline void Scheduler::place(uint8_t position, uint8_t slot){
+    heap[position] = slot;
+    heapIndex[slot] = position;
+}
+inline void Scheduler::siftUp(uint8_t position){
+    uint8_t slot = heap[position];
+    while (position){
+        uint8_t parent = (position - 1) >> 1;
+        if (!earlier(slot, heap[parent])){
+            break;
+        }
+        place(position, heap[parent]);
+        position = parent;
+    }
+    place(position, slot);
+}
+inline void Scheduler::siftDown(uint8_t position){
+    uint8_t slot = heap[position];
+    while (true){
+        uint8_t child = position * 2 + 1;
+        if (child >= size){
+            break;
+        }
+        if (child + 1 < size && earlier(heap[child + 1], heap[child])){
+            child++;
+        }
+        if (!earlier(heap[child], slot)){
+            break;
+        }
+        place(position, heap[child]);
+        position = child;
+    }
+    place(position, slot);
+}
+inline void Scheduler::remove(uint8_t position){
+    uint8_t slot = heap[position];
+    heapIndex[slot] = -1;
+    size--;
+    if (position == size){
+        return;
+    }
+    //move the last entry into the hole and let it settle either way
+    uint8_t moved = heap[size];
+    place(position, moved);
+    siftUp(position);
+    siftDown(heapIndex[moved]);
+}
+inline void Scheduler::schedule(eventType type, uint64_t cycle){
+    events[type].cycle = cycle;
+    if (heapIndex[type] < 0){
+        place(size, type);
+        size++;
+        siftUp(size - 1);
+        return;
+    }
+    siftUp(heapIndex[type]);
+    siftDown(heapIndex[type]);
+}
+inline void Scheduler::scheduleIn(eventType type, uint64_t delay){
+    schedule(type, cycles + delay);
+}
+inline void Scheduler::cancel(eventType type){
+    if (heapIndex[type] < 0){
+        return;
+    }
+    remove(heapIndex[type]);
+}
+inline bool Scheduler::isScheduled(eventType type){
+    return heapIndex[type] >= 0;
+}
+inline uint64_t Scheduler::getEventCycle(eventType type){
+    return events[type].cycle;
+}
+inline uint64_t Scheduler::getCycles(){
+    return cycles;
+}
+inline void Scheduler::addCycles(uint64_t count){
+    cycles += count;
+}
+inline void Scheduler::setCycles(uint64_t count){
+    cycles = count;
+}
+inline uint64_t Scheduler::getNextEventCycle(){
+    if (!size){
+        return UINT64_MAX;
+    }
+    return events[heap[0]].cycle;
+}
+inline void Scheduler::dispatch(){
+    while (size && events[heap[0]].cycle <= cycles){
+        uint8_t slot = heap[0];
+        remove(0);
+        //handler may reschedule its own slot, which is why it is removed first
+        if (events[slot].func){
+            events[slot].func(events[slot].context, cycles - events[slot].cycle);
+        }
+    }
+}
+inline void Scheduler::saveState(State* state){
+    state->cycles = cycles;
+    for (int i = 0; i < EVENT_COUNT; i++){
+        state->eventCycles[i] = events[i].cycle;
+        state->heap[i] = heap[i];
+        state->heapIndex[i] = heapIndex[i];
+    }
+    state->size = size;
+}
+inline void Scheduler::loadState(const State* state){
+    //handlers stay as they are, they belong to this machine
+    cycles = state->cycles;
+    for (int i = 0; i < EVENT_COUNT; i++){
+        events[i].cycle = state->eventCycles[i];
+        heap[i] = state->heap[i];
+        heapIndex[i] = state->heapIndex[i];
+    }
+    size = state->size;
+}
+#endif
@@ -0,0 +1,106 @@
+#ifndef TILECACHE_H
+#define TILECACHE_H
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "Memory.h"
+
+/*
+* TILE CACHE:
+*   4bpp tiles unpacked to one palette index per byte, 8 rows of 8, so the
+*   renderer reads a row instead of shifting nibbles out of VRAM on every line.
+*   Tiles are numbered by 32 byte VRAM offset (3072 of them, OBJ tiles from
+*   0x800). Memory sets a bit per tile on every VRAM write, getTile() unpacks a
+*   tile again only if its bit is set and clears it, so a tile is unpacked once
+*   per rewrite instead of once per line it shows up on.
+*   8bpp tiles are already a byte per pixel and are read straight from VRAM.
+*   getTiles() brings a whole range up to date at once and hands out the table,
+*   for the sprite path that gathers 8 pixels from anywhere in it at a time.
+*/
+class TileCache {
+    public:
+        enum {TILE_COUNT = Memory::VRAM_SIZE / 32};
+        TileCache(Memory* memory);
+        //64 palette indices (0 -> 15) for the tile at VRAM offset tile * 32
+        const uint8_t* getTile(uint32_t tile);
+        //unpacks every dirty tile in first -> first + count (multiples of 64) and returns
+        //the table, TILE_COUNT rows of 64; reads from it are not counted as hits
+        const uint8_t* getTiles(uint32_t first, uint32_t count);
+        uint64_t getHits();
+        uint64_t getMisses();
+        //hits / lookups, 0 before the first lookup
+        double getHitRate();
+        void resetStats();
+    private:
+        Memory* memory;
+        uint8_t tiles[TILE_COUNT][64];
+        uint64_t hits;
+        uint64_t misses;
+        void unpack(uint32_t tile);
+};
+/*
+* BEGIN TILE CACHE METHODS
+*/
+inline TileCache::TileCache(Memory* memory){
+    this->memory = memory;
+    resetStats();
+}
+inline const uint8_t* TileCache::getTile(uint32_t tile){
+    uint64_t* dirty = memory->getVramDirty();
+    uint64_t bit = 1ull << (tile & 63);
+    if (dirty[tile >> 6] & bit){
+        dirty[tile >> 6] &= ~bit;
+        unpack(tile);
+        misses++;
+    } else {
+        hits++;
+    }
+    return tiles[tile];
+}
+inline const uint8_t* TileCache::getTiles(uint32_t first, uint32_t count){
+    uint64_t* dirty = memory->getVramDirty();
+    for (uint32_t word = first >> 6; word < (first + count) >> 6; word++){
+        while (dirty[word]){
+            unpack(word * 64 + __builtin_ctzll(dirty[word]));
+            dirty[word] &= dirty[word] - 1;
+            misses++;
+        }
+    }
+    return tiles[0];
+}
+inline void TileCache::unpack(uint32_t tile){
+    const uint8_t* data = memory->getVram() + tile * 32;
+    uint8_t* out = tiles[tile];
+#ifdef __SSE2__
+    //low nibble is the left pixel: split both nibbles out and interleave them back
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    for (int i = 0; i < 32; i += 16){
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i low = _mm_and_si128(bytes, nibble);
+        __m128i high = _mm_and_si128(_mm_srli_epi16(bytes, 4), nibble);
+        _mm_storeu_si128((__m128i*)(out + i * 2), _mm_unpacklo_epi8(low, high));
+        _mm_storeu_si128((__m128i*)(out + i * 2 + 16), _mm_unpackhi_epi8(low, high));
+    }
+#else
+    for (int i = 0; i < 32; i++){
+        out[i * 2] = data[i] & 0xF;
+        out[i * 2 + 1] = data[i] >> 4;
+    }
+#endif
+}
+inline uint64_t TileCache::getHits(){
+    return hits;
+}
+inline uint64_t TileCache::getMisses(){
+    return misses;
+}
+inline double TileCache::getHitRate(){
+    uint64_t lookups = hits + misses;
+    return lookups ? (double)hits / lookups : 0;
+}
+inline void TileCache::resetStats(){
+    hits = 0;
+    misses = 0;
+}
+#endif
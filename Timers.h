@@ -0,0 +1,225 @@
+#ifndef TIMERS_H
+#define TIMERS_H
+#include <stdint.h>
+#include <string.h>
+#include "Scheduler.h"
+#include "Interrupts.h"
+#include "Memory.h"
+
+//Called on every timer overflow with the timer and the cycle it overflowed on
+typedef void (* OverflowFunc)(void* context, uint8_t index, uint64_t cycle);
+
+/*
+* HARDWARE TIMERS TM0 -> TM3:
+*   registers (per timer, 4 bytes apart starting at 0x4000100):
+*       CNT_L  read: current counter  write: reload value
+*       CNT_H  bits 0 -> 1 prescaler (1, 64, 256, 1024 cycles per tick)
+*              bit  2      count-up, tick on the previous timer's overflow
+*              bit  6      IRQ on overflow
+*              bit  7      enable
+*   Nothing here runs per cycle. A running timer only remembers the cycle and
+*   counter it was (re)started from, the current counter is worked out on read:
+*       counter = startCounter + ((now - startCycle) >> prescalerShift)
+*   and its overflow is a single TIMERx event on the scheduler. When that fires
+*   the timer rebases on the reload value, schedules the next overflow and ticks
+*   the next timer if it is in count-up mode. Count-up timers never schedule
+*   anything, they only move when the previous timer overflows.
+*   One overflow handler can listen in (the APU, which clocks its sound FIFOs
+*   off TM0/TM1).
+*/
+class Timers {
+    public:
+        enum controlBits {COUNT_UP = 1 << 2, IRQ_ENABLE = 1 << 6, ENABLE = 1 << 7};
+        Timers(Scheduler* scheduler, Interrupts* interrupts);
+        void reset();
+        uint16_t readCounter(uint8_t index);
+        uint16_t readControl(uint8_t index);
+        void writeReload(uint8_t index, uint16_t value);
+        void writeControl(uint8_t index, uint16_t value);
+        //number of overflows so far, used by things that count overflows (sound FIFOs)
+        uint64_t getOverflowCount(uint8_t index);
+        void setOverflowHandler(OverflowFunc func, void* context);
+        void mapRegisters(Memory* memory);
+    private:
+        struct Timer {
+            Timers* owner;
+            uint8_t index;
+            uint16_t reload;
+            uint16_t control;
+            uint8_t shift;
+            uint16_t startCounter;
+            uint64_t startCycle;
+            uint64_t overflows;
+        };
+        Timer timers[4];
+        Scheduler* scheduler;
+        Interrupts* interrupts;
+        OverflowFunc overflowFunc;
+        void* overflowContext;
+        bool isScheduledTimer(uint8_t index);
+        uint16_t currentCounter(uint8_t index);
+        void start(uint8_t index, uint16_t counter, uint64_t cycle);
+        void overflow(uint8_t index, uint64_t cycle);
+        void tickCascade(uint8_t index, uint64_t cycle);
+        static void overflowEvent(void* context, uint64_t late);
+        static uint16_t ioRead(void* context, uint32_t address);
+        static void ioWrite(void* context, uint32_t address, uint16_t value);
+    public:
+        //the four timers for save states, the overflow events live in the scheduler's state
+        struct State {
+            Timer timers[4];
+        };
+        void saveState(State* state);
+        void loadState(const State* state);
+};
+/*
+* BEGIN TIMERS METHODS
+*/
+inline Timers::Timers(Scheduler* scheduler, Interrupts* interrupts){
+    this->scheduler = scheduler;
+    this->interrupts = interrupts;
+    this->overflowFunc = 0;
+    this->overflowContext = 0;
+    for (uint8_t i = 0; i < 4; i++){
+        timers[i].owner = this;
+        timers[i].index = i;
+        scheduler->setHandler((Scheduler::eventType)(Scheduler::TIMER0 + i), &Timers::overflowEvent, &timers[i]);
+    }
+    reset();
+}
+inline void Timers::reset(){
+    for (uint8_t i = 0; i < 4; i++){
+        timers[i].reload = 0;
+        timers[i].control = 0;
+        timers[i].shift = 0;
+        timers[i].startCounter = 0;
+        timers[i].startCycle = 0;
+        timers[i].overflows = 0;
+        scheduler->cancel((Scheduler::eventType)(Scheduler::TIMER0 + i));
+    }
+}
+inline bool Timers::isScheduledTimer(uint8_t index){
+    //TM0 has no previous timer so its count-up bit is ignored
+    uint16_t control = timers[index].control;
+    return (control & ENABLE) && (index == 0 || !(control & COUNT_UP));
+}
+inline uint16_t Timers::currentCounter(uint8_t index){
+    Timer* timer = &timers[index];
+    if (!isScheduledTimer(index)){
+        return timer->startCounter;
+    }
+    uint64_t ticks = (scheduler->getCycles() - timer->startCycle) >> timer->shift;
+    uint64_t value = timer->startCounter + ticks;
+    if (value > 0xFFFF){
+        //only reachable if read between the overflow cycle and its dispatch
+        uint32_t period = 0x10000 - timer->reload;
+        value = timer->reload + (value - 0x10000) % period;
+    }
+    return (uint16_t)value;
+}
+inline void Timers::start(uint8_t index, uint16_t counter, uint64_t cycle){
+    Timer* timer = &timers[index];
+    timer->startCounter = counter;
+    timer->startCycle = cycle;
+    Scheduler::eventType event = (Scheduler::eventType)(Scheduler::TIMER0 + index);
+    if (!isScheduledTimer(index)){
+        scheduler->cancel(event);
+        return;
+    }
+    uint64_t ticksToOverflow = 0x10000 - counter;
+    scheduler->schedule(event, cycle + (ticksToOverflow << timer->shift));
+}
+inline uint16_t Timers::readCounter(uint8_t index){
+    return currentCounter(index);
+}
+inline uint16_t Timers::readControl(uint8_t index){
+    return timers[index].control;
+}
+inline void Timers::writeReload(uint8_t index, uint16_t value){
+    //only takes effect on the next start or overflow
+    timers[index].reload = value;
+}
+inline void Timers::writeControl(uint8_t index, uint16_t value){
+    static const uint8_t shifts[4] = {0, 6, 8, 10};
+    Timer* timer = &timers[index];
+    value &= 0xC7;
+    uint16_t counter = currentCounter(index);
+    bool wasEnabled = timer->control & ENABLE;
+    timer->control = value;
+    timer->shift = shifts[value & 0b11];
+    if ((value & ENABLE) && !wasEnabled){
+        counter = timer->reload;
+    }
+    //latch the counter and rebase, this also covers stopping and prescaler changes
+    start(index, counter, scheduler->getCycles());
+}
+inline uint64_t Timers::getOverflowCount(uint8_t index){
+    return timers[index].overflows;
+}
+inline void Timers::setOverflowHandler(OverflowFunc func, void* context){
+    this->overflowFunc = func;
+    this->overflowContext = context;
+}
+inline void Timers::overflow(uint8_t index, uint64_t cycle){
+    Timer* timer = &timers[index];
+    timer->overflows++;
+    if (overflowFunc){
+        overflowFunc(overflowContext, index, cycle);
+    }
+    if (timer->control & IRQ_ENABLE){
+        interrupts->raise(Interrupts::TIMER0 << index);
+    }
+    start(index, timer->reload, cycle);
+    if (index < 3){
+        tickCascade(index + 1, cycle);
+    }
+}
+inline void Timers::tickCascade(uint8_t index, uint64_t cycle){
+    Timer* timer = &timers[index];
+    if (!(timer->control & ENABLE) || !(timer->control & COUNT_UP)){
+        return;
+    }
+    if (timer->startCounter == 0xFFFF){
+        overflow(index, cycle);
+        return;
+    }
+    timer->startCounter++;
+}
+inline void Timers::overflowEvent(void* context, uint64_t late){
+    Timer* timer = (Timer*)context;
+    Timers* self = timer->owner;
+    self->overflow(timer->index, self->scheduler->getCycles() - late);
+}
+inline void Timers::mapRegisters(Memory* memory){
+    for (uint32_t address = 0x4000100; address < 0x4000110; address += 2){
+        memory->setIOHandler(address, &Timers::ioRead, &Timers::ioWrite, this);
+    }
+}
+inline uint16_t Timers::ioRead(void* context, uint32_t address){
+    Timers* self = (Timers*)context;
+    uint8_t index = ((address - 0x4000100) >> 2) & 0b11;
+    if (address & 2){
+        return self->readControl(index);
+    }
+    return self->readCounter(index);
+}
+inline void Timers::ioWrite(void* context, uint32_t address, uint16_t value){
+    Timers* self = (Timers*)context;
+    uint8_t index = ((address - 0x4000100) >> 2) & 0b11;
+    if (address & 2){
+        self->writeControl(index, value);
+        return;
+    }
+    self->writeReload(index, value);
+}
+inline void Timers::saveState(State* state){
+    memcpy(state->timers, timers, sizeof(timers));
+}
+inline void Timers::loadState(const State* state){
+    memcpy(timers, state->timers, sizeof(timers));
+    //the state may come from another machine
+    for (uint8_t i = 0; i < 4; i++){
+        timers[i].owner = this;
+    }
+}
+#endif
@@ -0,0 +1,551 @@
+#ifndef TRACE_H
+#define TRACE_H
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <deque>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+* EXECUTION TRACE:
+*   Every step the CPU executes, in a file compact enough to hold millions of
+*   them. A step is the instruction's address and opcode, the registers it
+*   left changed and the stores since the step before (DMA and other hardware
+*   included). Registers are r0 -> r14 with the CPSR in slot 15, r15 is the
+*   address.
+*   On disk, little endian:
+*       "GBATRACE"  magic
+*       uint32      version (1)
+*       uint32      steps per chunk
+*       chunks      back to back
+*       index       uint64 file offset, uint64 first step, per chunk
+*       uint64      index offset
+*       uint64      chunk count
+*       uint64      step count
+*       "GBATEND\0" magic
+*   A chunk is uint32 steps, uint32 bytes of records, the 16 registers as they
+*   were before its first step (so it decodes on its own) and then a record per
+*   step, each a flags byte
+*       THUMB       the opcode is 2 bytes, otherwise 4
+*       JUMP        zigzag varint, address - (last address + last opcode size)
+*       REGISTERS   varint mask, then a zigzag varint delta per register in it
+*       WRITES      varint count, then per store a zigzag varint address delta
+*                   from the end of the store before, a width byte, a varint value
+*   followed by the opcode. Straight line code with nothing changed is 3 or 5
+*   bytes a step. Stores after the last step are not in the file.
+*   TraceWriter fills a chunk at a time and hands full ones to a thread of its
+*   own that does the file writes, waiting only when that thread is
+*   MAX_QUEUED chunks behind. TraceReader maps the file and decodes from the
+*   start of the chunk holding a step, and from where it stopped when reading
+*   in order. Encoding is deterministic, so two traces that are equal up to a
+*   chunk have equal bytes up to there and findDivergence compares whole chunks
+*   with memcmp, decoding only the first chunk that differs.
+*/
+struct TraceWrite {
+    uint32_t address;
+    uint32_t value;
+    uint8_t width;
+};
+struct TraceStep {
+    enum {REGISTERS = 16, CPSR = 15};
+    uint64_t index;
+    uint32_t address;
+    uint32_t opcode;
+    bool thumb;
+    uint32_t registers[REGISTERS];
+    //registers this step changed, bit per slot
+    uint32_t changed;
+    std::vector<TraceWrite> writes;
+    bool operator==(const TraceStep& other) const;
+};
+class TraceWriter {
+    public:
+        enum {VERSION = 1, CHUNK_STEPS = 4096, MAX_QUEUED = 64};
+        TraceWriter();
+        ~TraceWriter();
+        bool open(const char* path);
+        //one step: address, opcode and the registers after it, slot 15 is the CPSR
+        void step(uint32_t address, uint32_t opcode, bool thumb, const uint32_t* registers);
+        //a store, it goes into the next step's record
+        void write(uint32_t address, uint8_t width, uint32_t value);
+        //the last chunk, the index and the footer, false if anything failed to write
+        bool close();
+        uint64_t getStepCount();
+        uint64_t getBytesWritten();
+        //a Memory WatchFunc that passes stores to write
+        static void writeHook(void* context, uint32_t address, uint8_t width, bool write, uint32_t value);
+    private:
+        std::ofstream file;
+        bool opened;
+        //kept longer than the bytes in use so records are written through a pointer
+        std::vector<uint8_t> chunk;
+        uint32_t chunkUsed;
+        uint32_t chunkSteps;
+        uint64_t steps;
+        uint64_t bytes;
+        std::vector<uint64_t> index;
+        uint32_t registers[TraceStep::REGISTERS];
+        uint32_t nextAddress;
+        std::vector<TraceWrite> writes;
+        //writer thread side
+        std::thread thread;
+        std::mutex lock;
+        std::condition_variable queued;
+        std::condition_variable taken;
+        std::deque<std::vector<uint8_t> > queue;
+        std::vector<std::vector<uint8_t> > spare;
+        bool closing;
+        bool failed;
+        void startChunk();
+        void finishChunk();
+        void work();
+        //room for length more bytes after the ones in use
+        uint8_t* reserve(uint32_t length);
+        static uint8_t* putVarint(uint8_t* out, uint32_t value);
+        static void putBytes(std::vector<uint8_t>* out, uint64_t value, uint32_t count);
+};
+class TraceReader {
+    public:
+        TraceReader();
+        ~TraceReader();
+        //false if the file is missing, not a trace or was never closed
+        bool open(const char* path);
+        void close();
+        uint64_t getStepCount();
+        //false past the end, reading in order continues from the last step
+        bool getStep(uint64_t index, TraceStep* step);
+        //first step the traces disagree on, the shorter length when one is the start of the other,
+        //UINT64_MAX when they are the same
+        static uint64_t findDivergence(TraceReader* a, TraceReader* b);
+    private:
+        const uint8_t* data;
+        uint64_t size;
+        uint32_t chunkSteps;
+        uint64_t chunkCount;
+        uint64_t stepCount;
+        const uint8_t* index;
+        //decode position: the chunk, the next step and where its record starts
+        uint64_t chunk;
+        uint64_t next;
+        const uint8_t* position;
+        const uint8_t* chunkEnd;
+        uint32_t registers[TraceStep::REGISTERS];
+        uint32_t nextAddress;
+        const uint8_t* getChunk(uint64_t chunk, uint32_t* steps, uint32_t* bytes);
+        void seekChunk(uint64_t chunk);
+        static uint32_t getVarint(const uint8_t** in);
+        static uint64_t getBytes(const uint8_t* in, uint32_t count);
+};
+/*
+* BEGIN TRACE METHODS
+*/
+enum traceFlags {TRACE_THUMB = 1, TRACE_JUMP = 2, TRACE_REGISTERS = 4, TRACE_WRITES = 8};
+inline uint32_t traceZigzag(int32_t value){
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+inline int32_t traceUnzigzag(uint32_t value){
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+inline bool TraceStep::operator==(const TraceStep& other) const{
+    if (address != other.address || opcode != other.opcode || thumb != other.thumb || writes.size() != other.writes.size() ||
+        memcmp(registers, other.registers, sizeof(registers))){
+        return false;
+    }
+    for (uint32_t i = 0; i < writes.size(); i++){
+        if (writes[i].address != other.writes[i].address || writes[i].value != other.writes[i].value ||
+            writes[i].width != other.writes[i].width){
+            return false;
+        }
+    }
+    return true;
+}
+inline TraceWriter::TraceWriter(){
+    opened = false;
+    closing = false;
+    failed = false;
+    chunkUsed = 0;
+    chunkSteps = 0;
+    steps = 0;
+    bytes = 0;
+    nextAddress = 0;
+    memset(registers, 0, sizeof(registers));
+}
+inline TraceWriter::~TraceWriter(){
+    close();
+}
+inline bool TraceWriter::open(const char* path){
+    close();
+    file.open(path, std::ios::binary | std::ios::trunc);
+    if (!file){
+        return false;
+    }
+    opened = true;
+    closing = false;
+    failed = false;
+    steps = 0;
+    index.clear();
+    writes.clear();
+    memset(registers, 0, sizeof(registers));
+    std::vector<uint8_t> header(8);
+    memcpy(&header[0], "GBATRACE", 8);
+    putBytes(&header, VERSION, 4);
+    putBytes(&header, CHUNK_STEPS, 4);
+    file.write((const char*)header.data(), header.size());
+    bytes = header.size();
+    thread = std::thread(&TraceWriter::work, this);
+    startChunk();
+    return true;
+}
+inline uint8_t* TraceWriter::putVarint(uint8_t* out, uint32_t value){
+    while (value >= 0x80){
+        *out++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (uint8_t)value;
+    return out;
+}
+inline void TraceWriter::putBytes(std::vector<uint8_t>* out, uint64_t value, uint32_t count){
+    for (uint32_t i = 0; i < count; i++){
+        out->push_back((uint8_t)(value >> (i * 8)));
+    }
+}
+inline uint8_t* TraceWriter::reserve(uint32_t length){
+    if (chunk.size() < chunkUsed + length){
+        chunk.resize((chunkUsed + length) * 2);
+    }
+    return &chunk[chunkUsed];
+}
+inline void TraceWriter::startChunk(){
+    chunkSteps = 0;
+    //step and byte counts are filled in by finishChunk
+    uint8_t* out = reserve(8 + TraceStep::REGISTERS * 4);
+    memset(out, 0, 8);
+    memcpy(out + 8, registers, sizeof(registers));
+    chunkUsed = 8 + TraceStep::REGISTERS * 4;
+    //nothing to be sequential to, the first record carries its address whole
+    nextAddress = 0;
+}
+inline void TraceWriter::step(uint32_t address, uint32_t opcode, bool thumb, const uint32_t* registers){
+    if (!opened){
+        return;
+    }
+    //flags, address, mask, registers and opcode at their longest, then the stores
+    uint8_t* start = reserve(1 + 5 + 5 + TraceStep::REGISTERS * 5 + 4 + 5 + writes.size() * 11);
+    uint8_t* out = start + 1;
+    uint8_t flags = thumb ? TRACE_THUMB : 0;
+    if (address != nextAddress){
+        flags |= TRACE_JUMP;
+        out = putVarint(out, traceZigzag((int32_t)(address - nextAddress)));
+    }
+    uint32_t changed = 0;
+    for (uint32_t i = 0; i < TraceStep::REGISTERS; i++){
+        changed |= (uint32_t)(registers[i] != this->registers[i]) << i;
+    }
+    if (changed){
+        flags |= TRACE_REGISTERS;
+        out = putVarint(out, changed);
+        for (uint32_t i = 0; i < TraceStep::REGISTERS; i++){
+            if (changed & (1 << i)){
+                out = putVarint(out, traceZigzag((int32_t)(registers[i] - this->registers[i])));
+                this->registers[i] = registers[i];
+            }
+        }
+    }
+    if (!writes.empty()){
+        flags |= TRACE_WRITES;
+        out = putVarint(out, writes.size());
+        uint32_t last = 0;
+        for (uint32_t i = 0; i < writes.size(); i++){
+            out = putVarint(out, traceZigzag((int32_t)(writes[i].address - last)));
+            *out++ = writes[i].width;
+            out = putVarint(out, writes[i].value);
+            last = writes[i].address + writes[i].width;
+        }
+        writes.clear();
+    }
+    *start = flags;
+    uint32_t width = thumb ? 2 : 4;
+    //little endian hosts only, like the save states
+    memcpy(out, &opcode, width);
+    chunkUsed = out + width - &chunk[0];
+    nextAddress = address + width;
+    steps++;
+    if (++chunkSteps == CHUNK_STEPS){
+        finishChunk();
+        startChunk();
+    }
+}
+inline void TraceWriter::write(uint32_t address, uint8_t width, uint32_t value){
+    if (opened){
+        writes.push_back({address, value, width});
+    }
+}
+inline void TraceWriter::writeHook(void* context, uint32_t address, uint8_t width, bool write, uint32_t value){
+    if (write){
+        ((TraceWriter*)context)->write(address, width, value);
+    }
+}
+inline void TraceWriter::finishChunk(){
+    chunk.resize(chunkUsed);
+    uint32_t length = chunkUsed - 8;
+    for (uint32_t i = 0; i < 4; i++){
+        chunk[i] = (uint8_t)(chunkSteps >> (i * 8));
+        chunk[4 + i] = (uint8_t)(length >> (i * 8));
+    }
+    index.push_back(bytes);
+    index.push_back(steps - chunkSteps);
+    bytes += chunkUsed;
+    chunkUsed = 0;
+    std::unique_lock<std::mutex> guard(lock);
+    taken.wait(guard, [this]{ return queue.size() < MAX_QUEUED; });
+    queue.push_back(std::vector<uint8_t>());
+    queue.back().swap(chunk);
+    //reuse a buffer the writer is done with so a chunk never grows from nothing
+    if (!spare.empty()){
+        chunk.swap(spare.back());
+        spare.pop_back();
+    }
+    queued.notify_one();
+}
+inline void TraceWriter::work(){
+    std::unique_lock<std::mutex> guard(lock);
+    while (true){
+        queued.wait(guard, [this]{ return closing || !queue.empty(); });
+        if (queue.empty()){
+            return;
+        }
+        std::vector<uint8_t> data;
+        data.swap(queue.front());
+        queue.pop_front();
+        taken.notify_one();
+        guard.unlock();
+        file.write((const char*)data.data(), data.size());
+        bool good = (bool)file;
+        guard.lock();
+        failed |= !good;
+        spare.push_back(std::vector<uint8_t>());
+        spare.back().swap(data);
+    }
+}
+inline bool TraceWriter::close(){
+    if (!opened){
+        return false;
+    }
+    if (chunkSteps){
+        finishChunk();
+    }
+    chunk.clear();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        closing = true;
+    }
+    queued.notify_one();
+    thread.join();
+    std::vector<uint8_t> footer;
+    for (uint32_t i = 0; i < index.size(); i++){
+        putBytes(&footer, index[i], 8);
+    }
+    putBytes(&footer, bytes, 8);
+    putBytes(&footer, index.size() / 2, 8);
+    putBytes(&footer, steps, 8);
+    footer.insert(footer.end(), "GBATEND", "GBATEND" + 8);
+    file.write((const char*)footer.data(), footer.size());
+    bytes += footer.size();
+    file.close();
+    opened = false;
+    queue.clear();
+    spare.clear();
+    return !failed && !file.fail();
+}
+inline uint64_t TraceWriter::getStepCount(){
+    return steps;
+}
+inline uint64_t TraceWriter::getBytesWritten(){
+    return bytes + chunkUsed;
+}
+inline TraceReader::TraceReader(){
+    data = 0;
+    size = 0;
+    close();
+}
+inline TraceReader::~TraceReader(){
+    close();
+}
+inline void TraceReader::close(){
+    if (data){
+        munmap((void*)data, size);
+    }
+    data = 0;
+    size = 0;
+    chunkSteps = 0;
+    chunkCount = 0;
+    stepCount = 0;
+    index = 0;
+    chunk = UINT64_MAX;
+    next = 0;
+    position = 0;
+    chunkEnd = 0;
+}
+inline uint64_t TraceReader::getBytes(const uint8_t* in, uint32_t count){
+    uint64_t value = 0;
+    for (uint32_t i = 0; i < count; i++){
+        value |= (uint64_t)in[i] << (i * 8);
+    }
+    return value;
+}
+inline uint32_t TraceReader::getVarint(const uint8_t** in){
+    uint32_t value = 0;
+    for (uint32_t shift = 0; ; shift += 7){
+        uint8_t byte = *(*in)++;
+        value |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)){
+            return value;
+        }
+    }
+}
+inline bool TraceReader::open(const char* path){
+    close();
+    int descriptor = ::open(path, O_RDONLY);
+    if (descriptor < 0){
+        return false;
+    }
+    struct stat info;
+    const uint32_t header = 16;
+    const uint32_t footer = 32;
+    if (fstat(descriptor, &info) || info.st_size < header + footer){
+        ::close(descriptor);
+        return false;
+    }
+    void* mapped = mmap(0, info.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    ::close(descriptor);
+    if (mapped == MAP_FAILED){
+        return false;
+    }
+    data = (const uint8_t*)mapped;
+    size = info.st_size;
+    const uint8_t* end = data + size - footer;
+    uint64_t indexOffset = getBytes(end, 8);
+    chunkCount = getBytes(end + 8, 8);
+    stepCount = getBytes(end + 16, 8);
+    chunkSteps = getBytes(data + 12, 4);
+    if (memcmp(data, "GBATRACE", 8) || getBytes(data + 8, 4) != TraceWriter::VERSION || memcmp(end + 24, "GBATEND", 8) ||
+        indexOffset < header || indexOffset + chunkCount * 16 != size - footer){
+        close();
+        return false;
+    }
+    index = data + indexOffset;
+    return true;
+}
+inline uint64_t TraceReader::getStepCount(){
+    return stepCount;
+}
+inline const uint8_t* TraceReader::getChunk(uint64_t chunk, uint32_t* steps, uint32_t* bytes){
+    const uint8_t* start = data + getBytes(index + chunk * 16, 8);
+    *steps = getBytes(start, 4);
+    *bytes = getBytes(start + 4, 4);
+    return start + 8;
+}
+inline void TraceReader::seekChunk(uint64_t chunk){
+    uint32_t steps;
+    uint32_t bytes;
+    const uint8_t* start = getChunk(chunk, &steps, &bytes);
+    for (uint32_t i = 0; i < TraceStep::REGISTERS; i++){
+        registers[i] = getBytes(start + i * 4, 4);
+    }
+    this->chunk = chunk;
+    this->next = getBytes(index + chunk * 16 + 8, 8);
+    this->position = start + TraceStep::REGISTERS * 4;
+    this->chunkEnd = start + bytes;
+    this->nextAddress = 0;
+}
+inline bool TraceReader::getStep(uint64_t index, TraceStep* step){
+    if (index >= stepCount){
+        return false;
+    }
+    //every chunk but the last holds chunkSteps steps
+    uint64_t wanted = index / chunkSteps;
+    if (wanted != chunk || index < next){
+        seekChunk(wanted);
+    }
+    while (position < chunkEnd){
+        uint8_t flags = *position++;
+        step->thumb = flags & TRACE_THUMB;
+        step->address = nextAddress;
+        if (flags & TRACE_JUMP){
+            step->address += traceUnzigzag(getVarint(&position));
+        }
+        step->changed = 0;
+        if (flags & TRACE_REGISTERS){
+            step->changed = getVarint(&position);
+            for (uint32_t i = 0; i < TraceStep::REGISTERS; i++){
+                if (step->changed & (1 << i)){
+                    registers[i] += traceUnzigzag(getVarint(&position));
+                }
+            }
+        }
+        step->writes.clear();
+        if (flags & TRACE_WRITES){
+            uint32_t count = getVarint(&position);
+            uint32_t last = 0;
+            for (uint32_t i = 0; i < count; i++){
+                TraceWrite write;
+                write.address = last + traceUnzigzag(getVarint(&position));
+                write.width = *position++;
+                write.value = getVarint(&position);
+                last = write.address + write.width;
+                step->writes.push_back(write);
+            }
+        }
+        uint32_t width = step->thumb ? 2 : 4;
+        step->opcode = getBytes(position, width);
+        position += width;
+        nextAddress = step->address + width;
+        memcpy(step->registers, registers, sizeof(registers));
+        step->index = next++;
+        if (step->index == index){
+            return true;
+        }
+    }
+    return false;
+}
+inline uint64_t TraceReader::findDivergence(TraceReader* a, TraceReader* b){
+    uint64_t chunks = a->chunkCount < b->chunkCount ? a->chunkCount : b->chunkCount;
+    uint64_t first = 0;
+    if (a->chunkSteps == b->chunkSteps){
+        for (; first < chunks; first++){
+            uint32_t stepsA;
+            uint32_t stepsB;
+            uint32_t bytesA;
+            uint32_t bytesB;
+            const uint8_t* chunkA = a->getChunk(first, &stepsA, &bytesA);
+            const uint8_t* chunkB = b->getChunk(first, &stepsB, &bytesB);
+            if (stepsA != stepsB || bytesA != bytesB || memcmp(chunkA, chunkB, bytesA)){
+                break;
+            }
+        }
+    } else {
+        //differently chunked files only compare step by step
+        chunks = 0;
+    }
+    //chunks before the first that differs are full and equal
+    uint64_t start = first * a->chunkSteps;
+    uint64_t shorter = a->stepCount < b->stepCount ? a->stepCount : b->stepCount;
+    TraceStep stepA;
+    TraceStep stepB;
+    for (uint64_t i = start; i < shorter; i++){
+        a->getStep(i, &stepA);
+        b->getStep(i, &stepB);
+        if (!(stepA == stepB)){
+            return i;
+        }
+    }
+    return a->stepCount == b->stepCount ? UINT64_MAX : shorter;
+}
+#endif
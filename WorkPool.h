@@ -0,0 +1,171 @@
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//A unit of work, worker is the index of the thread running it
+typedef void (* TaskFunc)(void* context, uint32_t worker);
+
+/*
+* WORK POOL:
+*   A fixed set of worker threads, each with its own deque of tasks. A worker
+*   takes from the back of its own deque (newest first, still warm in cache)
+*   and only when that is empty steals from the front of someone else's, going
+*   round the others starting from its right hand neighbour. Work submitted from
+*   outside is dealt out round robin, work submitted by a task lands on the
+*   deque of the worker running it, so a task that splits itself up keeps the
+*   pieces local until somebody runs dry.
+*   Tasks here are coarse (a whole emulator instance), so every deque has its
+*   own mutex rather than being lock free; the lock is only ever contended when
+*   a thief and the owner meet. Idle workers sleep on a condition variable
+*   instead of spinning, which matters when there are more workers than cores.
+*/
+class WorkPool {
+    public:
+        //0 workers means one per hardware thread
+        WorkPool(uint32_t workers);
+        ~WorkPool();
+        void submit(TaskFunc func, void* context);
+        //block until every task submitted so far has finished
+        void wait();
+        uint32_t getWorkerCount();
+        //tasks run by a worker other than the one whose deque they were on
+        uint64_t getSteals();
+    private:
+        struct Task {
+            TaskFunc func;
+            void* context;
+        };
+        struct alignas(64) Queue {
+            std::mutex lock;
+            std::deque<Task> tasks;
+        };
+        std::vector<Queue*> queues;
+        std::vector<std::thread> threads;
+        //tasks submitted and not finished yet
+        std::atomic<uint64_t> pending;
+        std::atomic<uint64_t> steals;
+        std::atomic<uint32_t> nextQueue;
+        bool stopping;
+        //bumped on every submit so a worker going to sleep can tell it missed one
+        uint64_t generation;
+        std::mutex sleepLock;
+        std::condition_variable wake;
+        std::condition_variable finished;
+        //the pool and worker index of the current thread, for submits from inside a task
+        static inline thread_local WorkPool* currentPool = 0;
+        static inline thread_local uint32_t currentWorker = 0;
+        bool take(uint32_t worker, Task* task);
+        void work(uint32_t worker);
+};
+/*
+* BEGIN WORK POOL METHODS
+*/
+inline WorkPool::WorkPool(uint32_t workers){
+    if (!workers){
+        workers = std::thread::hardware_concurrency();
+        workers = workers ? workers : 1;
+    }
+    pending.store(0);
+    steals.store(0);
+    nextQueue.store(0);
+    stopping = false;
+    generation = 0;
+    for (uint32_t i = 0; i < workers; i++){
+        queues.push_back(new Queue());
+    }
+    for (uint32_t i = 0; i < workers; i++){
+        threads.push_back(std::thread(&WorkPool::work, this, i));
+    }
+}
+inline WorkPool::~WorkPool(){
+    wait();
+    {
+        std::lock_guard<std::mutex> guard(sleepLock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (uint32_t i = 0; i < threads.size(); i++){
+        threads[i].join();
+    }
+    for (uint32_t i = 0; i < queues.size(); i++){
+        delete queues[i];
+    }
+}
+inline void WorkPool::submit(TaskFunc func, void* context){
+    uint32_t index = currentPool == this ? currentWorker : nextQueue.fetch_add(1) % queues.size();
+    pending.fetch_add(1);
+    {
+        std::lock_guard<std::mutex> guard(queues[index]->lock);
+        queues[index]->tasks.push_back({func, context});
+    }
+    {
+        std::lock_guard<std::mutex> guard(sleepLock);
+        generation++;
+    }
+    wake.notify_all();
+}
+inline void WorkPool::wait(){
+    std::unique_lock<std::mutex> guard(sleepLock);
+    finished.wait(guard, [this]{ return pending.load() == 0; });
+}
+inline uint32_t WorkPool::getWorkerCount(){
+    return queues.size();
+}
+inline uint64_t WorkPool::getSteals(){
+    return steals.load();
+}
+inline bool WorkPool::take(uint32_t worker, Task* task){
+    {
+        Queue* own = queues[worker];
+        std::lock_guard<std::mutex> guard(own->lock);
+        if (!own->tasks.empty()){
+            *task = own->tasks.back();
+            own->tasks.pop_back();
+            return true;
+        }
+    }
+    for (uint32_t i = 1; i < queues.size(); i++){
+        Queue* victim = queues[(worker + i) % queues.size()];
+        std::lock_guard<std::mutex> guard(victim->lock);
+        if (!victim->tasks.empty()){
+            *task = victim->tasks.front();
+            victim->tasks.pop_front();
+            steals.fetch_add(1);
+            return true;
+        }
+    }
+    return false;
+}
+inline void WorkPool::work(uint32_t worker){
+    currentPool = this;
+    currentWorker = worker;
+    while (true){
+        uint64_t seen;
+        {
+            std::lock_guard<std::mutex> guard(sleepLock);
+            seen = generation;
+        }
+        Task task;
+        if (take(worker, &task)){
+            task.func(task.context, worker);
+            if (pending.fetch_sub(1) == 1){
+                std::lock_guard<std::mutex> guard(sleepLock);
+                finished.notify_all();
+            }
+            continue;
+        }
+        //nothing anywhere: sleep until a submit that came after the look
+        std::unique_lock<std::mutex> guard(sleepLock);
+        wake.wait(guard, [this, seen]{ return stopping || generation != seen; });
+        if (stopping){
+            return;
+        }
+    }
+}
+#endif